@@ -0,0 +1,46 @@
+#ifndef GEMM_TUNING_H
+#define GEMM_TUNING_H
+#include <stdbool.h>
+
+#include "tensor_gemm.h"
+
+/**
+ * In-memory table of tuned GEMM configurations behind tensor_gemm_tune and the tuning file.
+ * Lookups only see entries recorded for the CPU model this process runs on
+ */
+
+/**
+ * @param config Receives the configuration tuned for exactly this shape, untouched if there is none
+ * @return true if one was found
+ */
+bool gemm_tuning_find(TensorGemmConfig* config, int m, int n, int k, int batch);
+
+/**
+ * A configuration tuned for one product with a given weight
+ */
+typedef struct {
+    int m;
+    int batch;
+    TensorGemmConfig config;
+} GemmTunedShape;
+
+/**
+ * Copy the configurations tuned on this CPU model for every product with an [K, N] weight
+ * @param shapes Receives a malloc'ed array, NULL if there are none
+ * @param count Receives the length of shapes
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_NO_MEMORY otherwise
+ */
+TensorError gemm_tuning_collect(GemmTunedShape** shapes, int* count, int n, int k);
+
+/**
+ * Record the configuration of a shape for the current CPU model, replacing any previous one
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_NO_MEMORY otherwise
+ */
+TensorError gemm_tuning_store(const TensorGemmConfig* config, int m, int n, int k, int batch, double ms);
+
+/**
+ * @return false if the configuration is out of range, as read from a corrupt file
+ */
+bool gemm_tuning_valid(const TensorGemmConfig* config);
+
+#endif //GEMM_TUNING_H
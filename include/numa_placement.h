@@ -0,0 +1,41 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+#include <stddef.h>
+
+/**
+ * Grain of the parallel_for loops that first touch a new buffer, such as tensor fills. Partitioned placement
+ * splits a buffer into the chunks those loops use, so each page is bound to the node of the worker touching it
+ */
+#define NUMA_PARTITION_GRAIN 16384
+
+/**
+ * @return 1 if built with libnuma and the kernel supports NUMA, 0 otherwise
+ */
+int numa_placement_available(void);
+
+/**
+ * @return Number of NUMA nodes, 1 when NUMA support is unavailable
+ */
+int numa_placement_node_count(void);
+
+/**
+ * Node that parallel_for worker `worker` out of `num_workers` is pinned to.
+ * Workers are assigned to nodes in contiguous blocks, matching the chunk order of parallel_for
+ */
+int numa_placement_node_of_worker(int worker, int num_workers);
+
+/**
+ * Restrict the calling thread to the CPUs of a node
+ * @return 0 on success, -1 otherwise
+ */
+int numa_placement_pin_current_thread(int node);
+
+/**
+ * Allocate a float buffer placed according to the calling thread's NUMA policy, aligned to at least
+ * a 64 byte cache line. The buffer is released with free()
+ * @param count Number of floats
+ * @return The buffer, or NULL on failure
+ */
+float* numa_placement_alloc(size_t count);
+
+#endif //NUMA_PLACEMENT_H
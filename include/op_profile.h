@@ -0,0 +1,32 @@
+#ifndef OP_PROFILE_H
+#define OP_PROFILE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tensor_profile.h"
+
+/**
+ * Attribution of a public op call to the tensor_profile.h totals. Public ops wrap their work as
+ *     const ProfileScope scope = profile_begin("tensor_add");
+ *     return profile_end(&scope, element_wise_operation(...));
+ */
+typedef struct {
+    const char* op;                             //< NULL when the call is not recorded
+    bool nested;                                //< Taken a level of the calling thread's op depth
+    double start_ms;
+    uint64_t counters[TENSOR_COUNTER_COUNT];
+} ProfileScope;
+
+ProfileScope profile_begin(const char* op);
+
+/**
+ * @return err, unchanged
+ */
+TensorError profile_end(const ProfileScope* scope, TensorError err);
+
+/**
+ * Open the calling thread's counters if profiling is enabled and it has none yet. Called by parallel_for workers
+ */
+void profile_attach_thread(void);
+
+#endif //OP_PROFILE_H
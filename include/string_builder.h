@@ -1,14 +1,28 @@
 #ifndef STRING_BUILDER_H
 #define STRING_BUILDER_H
+#include <stdbool.h>
+#include <stddef.h>
 
+/**
+ * Growable string, either on the heap or in a fixed buffer owned by the caller.
+ * A fixed buffer is never grown: appends that do not fit are truncated, always NUL terminated, and len
+ * keeps counting the full length, like the return value of snprintf
+ */
 typedef struct {
     char* buff;
-    size_t len;
+    size_t len;     //< Length of everything appended, including what was truncated
     size_t cap;
+    bool fixed;     //< buff belongs to the caller
+    bool failed;    //< A heap buffer could not grow, so its contents are truncated
 } StringBuilder;
 
 void init_sb(StringBuilder* sb);
+void init_sb_fixed(StringBuilder* sb, char* buffer, size_t size);
 void sb_append(StringBuilder* sb, const char* string);
+
+/**
+ * Frees a heap buffer, not the builder itself, which usually lives on the stack
+ */
 void sb_free(StringBuilder* sb);
 
-#endif //STRING_BUILDER_H
\ No newline at end of file
+#endif //STRING_BUILDER_H
@@ -1,6 +1,8 @@
 #ifndef TENSOR_H
 #define TENSOR_H
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 /**
  * Tensor error enum for different initialization or operation errors
  */
@@ -12,6 +14,8 @@ typedef enum {
     TENSOR_ERROR_NEGATIVE_DIM,
     TENSOR_ERROR_CANNOT_BROADCAST,
     TENSOR_ERROR_CANNOT_EXPAND,
+    TENSOR_ERROR_UNSUPPORTED,
+    TENSOR_ERROR_IO,
     TENSOR_ERROR_COUNT,
 }TensorError;
 
@@ -26,6 +30,38 @@ typedef struct {
     float* data;  //< Pointer to an array of floats
 } Tensor;
 
+/**
+ * Placement policy for tensor data on NUMA systems
+ */
+typedef enum {
+    TENSOR_NUMA_DEFAULT,     //< Leave placement to the OS (first touch)
+    TENSOR_NUMA_INTERLEAVE,  //< Interleave pages across all nodes
+    TENSOR_NUMA_BIND,        //< Place all pages on a single node
+    TENSOR_NUMA_PARTITIONED, //< Place each parallel chunk on the node of the worker thread that processes it
+} TensorNumaPolicy;
+
+/**
+ * Memory layout of a 4D image tensor
+ */
+typedef enum {
+    TENSOR_LAYOUT_NCHW, //< [batch, channels, height, width]
+    TENSOR_LAYOUT_NHWC, //< [batch, height, width, channels]
+} TensorLayout;
+
+/**
+ * Parameters for a 2D convolution
+ */
+typedef struct {
+    int stride_h;       //< Vertical stride (>= 1)
+    int stride_w;       //< Horizontal stride (>= 1)
+    int pad_h;          //< Zero padding added to the top and bottom
+    int pad_w;          //< Zero padding added to the left and right
+    int dilation_h;     //< Vertical spacing between kernel taps (>= 1)
+    int dilation_w;     //< Horizontal spacing between kernel taps (>= 1)
+    int groups;         //< Number of channel groups, must divide both input and output channels
+    TensorLayout layout;//< Layout of the input and output tensors
+} TensorConv2dParams;
+
 //TENSOR
 
 /**
@@ -75,8 +111,35 @@ TensorError tensor_ones(Tensor* out,const int* shape,int ndim);
  */
 TensorError tensor_fill(Tensor* out, float num, const int* shape,int ndim);
 
+/**
+ * Allocate a new tensor of uniformly distributed values from the Philox4x32-10 counter-based generator.
+ * Element i depends only on seed and i, so the result is bit-identical for any number of threads
+ * @param out Tensor pointer to allocate the new tensor at
+ * @param low Inclusive lower bound
+ * @param high Exclusive upper bound
+ * @param seed Generator key
+ * @param shape Array of length ndim specifying the size of each dimension
+ * @param ndim Number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_rand_uniform(Tensor* out, float low, float high, uint64_t seed, const int* shape, int ndim);
+
+/**
+ * Allocate a new tensor of normally distributed values, from the same generator as tensor_rand_uniform
+ * through the Box-Muller transform. Bit-identical for any number of threads
+ * @param out Tensor pointer to allocate the new tensor at
+ * @param mean Mean of the distribution
+ * @param std Standard deviation of the distribution, at least 0
+ * @param seed Generator key
+ * @param shape Array of length ndim specifying the size of each dimension
+ * @param ndim Number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_rand_normal(Tensor* out, float mean, float std, uint64_t seed, const int* shape, int ndim);
+
 /**
  * Free ALL memory associated with the tensor (data, shape, strides)
+ * The Tensor struct itself is owned by the caller and is not freed.
  * After calling, the tensor should NOT be used again
  * @param tensor Tensor to be freed
  */
@@ -84,6 +147,7 @@ void tensor_free(Tensor* tensor);
 
 /**
  * Free just the tensor's metadata (shape,strides) and not the underlying shared data buffer.
+ * The Tensor struct itself is owned by the caller and is not freed.
  * After calling, the tensor should NOT be used again
  * @param tensor Tensor to be freed
  */
@@ -120,29 +184,124 @@ TensorError tensor_promote_to_col(Tensor* out, const Tensor* in);
 /**
  * Creates a string representing the tensor's data and shape
  * @param tensor Tensor to create a string from
- * @return String representing the tensor
+ * @return Heap string representing the tensor, to be released with free(), or NULL when out of memory
  */
-const char* tensor_to_string(const Tensor* tensor);
+char* tensor_to_string(const Tensor* tensor);
 
 /**
  * Creates a string representing the tensor's metadata (shape, strides, ndim)
  * @param tensor Tensor to create a string from
- * @return String representing the tensor's metadata
+ * @return Heap string representing the tensor's metadata, to be released with free(), or NULL when out of memory
+ */
+char* tensor_metadata_to_string(const Tensor* tensor);
+
+/**
+ * Writes the string tensor_to_string would create into a caller-supplied buffer, without allocating.
+ * Safe to call from any number of threads at once
+ * @param buffer Destination, always NUL terminated when size > 0
+ * @param size Size of buffer in bytes
+ * @param tensor Tensor to create a string from
+ * @return Length of the full string excluding the terminator, like snprintf: the output was truncated if it is >= size
  */
-const char* tensor_metadata_to_string(const Tensor* tensor);
+size_t tensor_to_string_buffer(char* buffer, size_t size, const Tensor* tensor);
+
+/**
+ * Writes the string tensor_metadata_to_string would create into a caller-supplied buffer, without allocating.
+ * Safe to call from any number of threads at once
+ * @param buffer Destination, always NUL terminated when size > 0
+ * @param size Size of buffer in bytes
+ * @param tensor Tensor to create a string from
+ * @return Length of the full string excluding the terminator, like snprintf: the output was truncated if it is >= size
+ */
+size_t tensor_metadata_to_string_buffer(char* buffer, size_t size, const Tensor* tensor);
 
 /**
  * Creates a string from the TensorError enum
  * @param error Error code
- * @return String representing the error code
+ * @return Static string representing the error code, "TENSOR_ERROR_UNKNOWN" for values outside the enum
  */
 const char* tensor_error_to_string(TensorError error);
 
+#define TENSOR_ERROR_CONTEXT_MAX_DIMS 8
+
+/**
+ * Details of a failed call, owned by the caller so that every thread can keep its own.
+ * Filled by tensor_error_record; shapes beyond TENSOR_ERROR_CONTEXT_MAX_DIMS dimensions are cut short
+ */
+typedef struct {
+    TensorError error;
+    const char* op;                                      //< Name of the failing call, not copied
+    int operands;                                        //< Number of operand shapes recorded, at most 2
+    int ndim[2];
+    int shape[2][TENSOR_ERROR_CONTEXT_MAX_DIMS];
+} TensorErrorContext;
+
+/**
+ * Records a failed call and the shapes of its operands in ctx, leaving ctx untouched on success, so that
+ * a sequence of calls keeps the last failure. Does not allocate, e.g.
+ * tensor_error_record(&ctx, tensor_mat_mul(&out, &a, &b), "tensor_mat_mul", &a, &b)
+ *
+ * @param ctx Caller-owned context
+ * @param error Result of the call
+ * @param op Name of the call, must outlive ctx (a string literal)
+ * @param a First operand, or NULL
+ * @param b Second operand, or NULL
+ * @return error, unchanged
+ */
+TensorError tensor_error_record(TensorErrorContext* ctx, TensorError error, const char* op, const Tensor* a,
+                                const Tensor* b);
+
+/**
+ * Formats a recorded error as "op: TENSOR_ERROR_..., operand shapes [..] and [..]" without allocating
+ * @param buffer Destination, always NUL terminated when size > 0
+ * @param size Size of buffer in bytes
+ * @param ctx Context filled by tensor_error_record
+ * @return Length of the full string excluding the terminator, like snprintf
+ */
+size_t tensor_error_context_to_string(char* buffer, size_t size, const TensorErrorContext* ctx);
+
+// TENSOR_THREADING
+
+/**
+ * Set the number of worker threads used to split a single op.
+ * Takes effect on the next parallel op, the existing workers are stopped
+ * @param num_threads Number of threads, or <= 0 to use one per online CPU
+ */
+void tensor_set_num_threads(int num_threads);
+
+/**
+ * @return The number of worker threads used to split a single op
+ */
+int tensor_get_num_threads(void);
+
+/**
+ * @return The number of NUMA nodes, 1 when NUMA support is unavailable
+ */
+int tensor_numa_node_count(void);
+
+/**
+ * Set where data allocated by the calling thread is placed. The policy is per thread
+ * and applies to every tensor allocated afterwards, including op results
+ * @param policy Placement policy
+ * @param node Target node for TENSOR_NUMA_BIND, ignored otherwise
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_UNSUPPORTED when built without libnuma
+ * or running on a kernel without NUMA support, error code otherwise
+ */
+TensorError tensor_set_numa_policy(TensorNumaPolicy policy, int node);
+
+/**
+ * Set the size above which fills and copies into new tensors use non-temporal stores that bypass the cache
+ * @param bytes Threshold in bytes, or 0 to use the size of the last level cache
+ */
+void tensor_set_streaming_threshold(size_t bytes);
+
 // TENSOR_OP
 
 /**
  * Matrix multiplication between two tensors, broadcasting if possible
- * Uses the last two dimensions as the matrix dimensions, all other dimensions are treated as batches
+ * Uses the last two dimensions as the matrix dimensions, all other dimensions are treated as batches.
+ * With a 2D right operand and at least 8 rows in all, b is packed for the blocked GEMM of tensor_mat_mul_packed
+ * on every call, using any configuration tuned for the shape with tensor_gemm_tune
  *
  * @param out Tensor pointer to allocate the resulting tensor at
  * @param a Left tensor
@@ -191,5 +350,180 @@ TensorError tensor_mul(Tensor* out, const Tensor* a, const Tensor* b);
  */
 TensorError tensor_div(Tensor* out, const Tensor* a, const Tensor* b);
 
+// TENSOR_CONV
+
+/**
+ * 2D convolution computed directly over the strided input, without building an im2col buffer.
+ * Weights are repacked internally into output-channel blocks so each input value is reused across a block of channels
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, uses the same layout as the input
+ * @param input 4D input tensor in params->layout
+ * @param weight 4D weight tensor with shape [out_channels, in_channels / groups, kernel_h, kernel_w]
+ * @param bias 1D tensor of length out_channels, or NULL for no bias
+ * @param params Stride, padding, dilation, groups and layout of the convolution
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_conv2d(Tensor* out, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                          const TensorConv2dParams* params);
+
+// TENSOR_INDEX
+
+/**
+ * Index tensors hold element positions as integral float values, exact for positions below 2^24.
+ * Every index is checked against the size of the indexed axis before any data is touched
+ */
+
+/**
+ * Gather values along an axis: out[i][j][k] = in[index[i][j][k]][j][k] for axis 0, and likewise for other axes
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like index
+ * @param in Tensor to read from
+ * @param axis Axis the index selects along
+ * @param index Tensor with as many dimensions as in, no larger than in along every other axis
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_INVALID_ARGUMENT for an index out of range, error code otherwise
+ */
+TensorError tensor_gather(Tensor* out, const Tensor* in, int axis, const Tensor* index);
+
+/**
+ * Accumulate values along an axis in place: target[index[i][j][k]][j][k] += src[i][j][k] for axis 0,
+ * and likewise for other axes. Repeated indices accumulate in order of their position along the axis,
+ * so the result does not depend on the number of threads
+ *
+ * @param target Tensor to add into. Must not broadcast (stride 0) along any dimension larger than 1
+ * @param axis Axis the index selects along
+ * @param index Tensor with as many dimensions as src, no larger than src along every axis
+ * and no larger than target along every axis but `axis`
+ * @param src Values to add
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_INVALID_ARGUMENT for an index out of range, error code otherwise
+ */
+TensorError tensor_scatter_add(Tensor* target, int axis, const Tensor* index, const Tensor* src);
+
+/**
+ * Select whole slices along an axis, e.g. embedding rows for axis 0
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in with shape[axis] = index length
+ * @param in Tensor to read from
+ * @param axis Axis to select along
+ * @param index 1D tensor of positions along axis
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_INVALID_ARGUMENT for an index out of range, error code otherwise
+ */
+TensorError tensor_index_select(Tensor* out, const Tensor* in, int axis, const Tensor* index);
+
+// TENSOR_SORT
+
+/**
+ * Sorting ops order values totally: NaN compares greater than every other value, -0.0 before +0.0,
+ * and equal values keep the order of their positions, so results never depend on the number of threads.
+ * Positions are returned as integral float values like the indices of the TENSOR_INDEX ops
+ */
+
+/**
+ * Inclusive prefix sum along an axis. Axes longer than a fixed block are scanned block by block
+ * in parallel, with the same blocking for every thread count
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to scan
+ * @param axis Axis to scan along
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_cumsum(Tensor* out, const Tensor* in, int axis);
+
+/**
+ * Sort values along an axis
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to sort
+ * @param axis Axis to sort along
+ * @param descending Sort from largest to smallest instead
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_sort(Tensor* out, const Tensor* in, int axis, bool descending);
+
+/**
+ * Positions along an axis that would sort it, stable for equal values
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to sort
+ * @param axis Axis to sort along
+ * @param descending Sort from largest to smallest instead
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_argsort(Tensor* out, const Tensor* in, int axis, bool descending);
+
+/**
+ * The k largest (or smallest) values along an axis and their positions, in sorted order.
+ * Only the selected values are ever sorted
+ *
+ * @param values Tensor pointer to allocate the values at, shaped like in with shape[axis] = k
+ * @param indices Tensor pointer to allocate the positions at, or NULL to skip them
+ * @param in Tensor to select from
+ * @param axis Axis to select along
+ * @param k Number of values to select, at most in->shape[axis]
+ * @param largest Select the largest values, in descending order, instead of the smallest in ascending order
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_topk(Tensor* values, Tensor* indices, const Tensor* in, int axis, int k, bool largest);
+
+// TENSOR_NORM
+
+/**
+ * Layer normalization over the last dimension: out = (x - mean) / sqrt(var + eps) * weight + bias,
+ * with the mean and biased variance of each row. Statistics and the affine transform are computed
+ * together while the row is in cache, one row per thread at a time
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to normalize, any strides
+ * @param weight Per element scale of shape [D], or NULL for 1
+ * @param bias Per element shift of shape [D], or NULL for 0
+ * @param eps Added to the variance
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_layer_norm(Tensor* out, const Tensor* in, const Tensor* weight, const Tensor* bias, float eps);
+
+/**
+ * RMS normalization over the last dimension: out = x / sqrt(mean(x^2) + eps) * weight
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to normalize, any strides
+ * @param weight Per element scale of shape [D], or NULL for 1
+ * @param eps Added to the mean square
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_rms_norm(Tensor* out, const Tensor* in, const Tensor* weight, float eps);
+
+/**
+ * Inference-mode batch normalization with running statistics:
+ * out = (x - mean[c]) / sqrt(var[c] + eps) * weight[c] + bias[c], folded into one multiply-add per element
+ *
+ * @param out Tensor pointer to allocate the resulting tensor at, shaped like in
+ * @param in Tensor to normalize, any strides. The channel axis is 1 for TENSOR_LAYOUT_NCHW and the last for TENSOR_LAYOUT_NHWC
+ * @param mean Running mean of shape [C]
+ * @param var Running variance of shape [C]
+ * @param weight Per channel scale of shape [C], or NULL for 1
+ * @param bias Per channel shift of shape [C], or NULL for 0
+ * @param eps Added to the variance
+ * @param layout Position of the channel axis
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_batch_norm(Tensor* out, const Tensor* in, const Tensor* mean, const Tensor* var, const Tensor* weight,
+                              const Tensor* bias, float eps, TensorLayout layout);
+
+// TENSOR_ATTENTION
+
+/**
+ * Scaled dot-product attention, softmax(q @ k^T / sqrt(D) + mask) @ v, computed tile by tile over the keys
+ * with an online softmax so the [Lq, Lk] score matrix is never materialized. Batch dimensions broadcast
+ * like tensor_mat_mul, and batches and query blocks are split across threads. Rows whose keys are all
+ * masked with -inf produce zeros
+ *
+ * @param out Tensor pointer to allocate the resulting tensor of shape [..., Lq, Dv] at
+ * @param q Queries of shape [..., Lq, D], any strides
+ * @param k Keys of shape [..., Lk, D], any strides
+ * @param v Values of shape [..., Lk, Dv], any strides
+ * @param mask Additive mask broadcastable to [..., Lq, Lk], such as -inf above the diagonal for causal attention, or NULL
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_attention(Tensor* out, const Tensor* q, const Tensor* k, const Tensor* v, const Tensor* mask);
+
 #endif //TENSOR_H
 
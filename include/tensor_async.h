@@ -0,0 +1,114 @@
+#ifndef TENSOR_ASYNC_H
+#define TENSOR_ASYNC_H
+#include <stdbool.h>
+
+#include "tensor.h"
+
+/**
+ * Opaque queue owning a set of worker threads that execute submitted tensor ops
+ */
+typedef struct TensorQueue TensorQueue;
+
+/**
+ * Opaque handle to the result of a submitted op
+ */
+typedef struct TensorFuture TensorFuture;
+
+/**
+ * Generic task run by a queue worker
+ */
+typedef TensorError (*TensorTaskFn)(void* arg);
+
+/**
+ * Signature shared by the binary tensor ops (tensor_add, tensor_mat_mul, ...)
+ */
+typedef TensorError (*TensorBinaryOp)(Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Create a queue and start its worker threads
+ * @param out Pointer that receives the new queue
+ * @param num_threads Number of worker threads, or <= 0 to use one per online CPU
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_queue_create(TensorQueue** out, int num_threads);
+
+/**
+ * Create a queue whose workers are pinned to the CPUs of one NUMA node.
+ * Tensors allocated by ops running on the queue are placed on the same node
+ * @param out Pointer that receives the new queue
+ * @param num_threads Number of worker threads, or <= 0 to use one per online CPU
+ * @param node NUMA node to pin the workers to
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_UNSUPPORTED without NUMA support, error code otherwise
+ */
+TensorError tensor_queue_create_on_node(TensorQueue** out, int num_threads, int node);
+
+/**
+ * Wait for every submitted op to finish, then stop the workers and free the queue.
+ * Every future obtained from the queue must be released before it is destroyed
+ * @param queue Queue to destroy
+ */
+void tensor_queue_destroy(TensorQueue* queue);
+
+/**
+ * Block until every op submitted so far has finished
+ * @param queue Queue to wait on
+ * @return TENSOR_ERROR_NONE if every op succeeded, otherwise the first error reported since the last call
+ */
+TensorError tensor_queue_wait_all(TensorQueue* queue);
+
+/**
+ * Submit a generic task. Dependencies are tracked per Tensor handle and per buffer: the task runs after the last
+ * pending writer of each tensor in reads, and after the last writer and all pending readers of each tensor in writes,
+ * where an access also conflicts with accesses through other handles, such as views, whose elements overlap its own.
+ * A tensor in writes that the task allocates must have NULL data. If a dependency fails, the task is not run and its
+ * future reports the dependency's error
+ *
+ * @param out Pointer that receives the future, or NULL to not keep a handle
+ * @param queue Queue to submit to
+ * @param fn Task to run
+ * @param arg Argument passed to fn
+ * @param reads Tensors the task reads
+ * @param num_reads Length of reads
+ * @param writes Tensors the task writes or allocates
+ * @param num_writes Length of writes
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_submit(TensorFuture** out, TensorQueue* queue, TensorTaskFn fn, void* arg,
+                          const Tensor* const* reads, int num_reads, Tensor* const* writes, int num_writes);
+
+/**
+ * Submit a binary tensor op such as tensor_add or tensor_mat_mul. out_tensor must not be read
+ * by the caller until the returned future has completed
+ *
+ * @param out Pointer that receives the future, or NULL to not keep a handle
+ * @param queue Queue to submit to
+ * @param op Op to run
+ * @param out_tensor Tensor pointer the op allocates its result at
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_submit_binary(TensorFuture** out, TensorQueue* queue, TensorBinaryOp op,
+                                 Tensor* out_tensor, const Tensor* a, const Tensor* b);
+
+/**
+ * Block until the op behind the future has finished
+ * @param future Future to wait on
+ * @return The error code returned by the op
+ */
+TensorError tensor_future_wait(TensorFuture* future);
+
+/**
+ * Check whether the op behind the future has finished, without blocking
+ * @param future Future to check
+ * @return true if finished
+ */
+bool tensor_future_is_ready(TensorFuture* future);
+
+/**
+ * Release the caller's handle to a future. The op itself still runs to completion
+ * @param future Future to release
+ */
+void tensor_future_release(TensorFuture* future);
+
+#endif //TENSOR_ASYNC_H
@@ -0,0 +1,131 @@
+#ifndef TENSOR_GEMM_H
+#define TENSOR_GEMM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tensor.h"
+
+/**
+ * Opaque right operand of a matrix multiplication, repacked once for the blocked GEMM kernels.
+ *
+ * The [K, N] matrix is split into K blocks sized for the L2 cache, and each block into column panels
+ * as wide as the kernel's register tile, stored contiguously, 64 byte aligned and zero padded at the
+ * edge. Packing costs about as much as a multiply with a handful of rows, so weights that are reused
+ * across calls should be packed once. The packed copy does not reference the source tensor
+ */
+typedef struct TensorPackedWeights TensorPackedWeights;
+
+/**
+ * Pack a 2D weight matrix
+ * @param out Pointer that receives the packed weights
+ * @param weight Matrix of shape [K, N], any strides
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_pack_weights(TensorPackedWeights** out, const Tensor* weight);
+
+/**
+ * Free packed weights
+ * @param packed Packed weights to destroy
+ */
+void tensor_packed_weights_destroy(TensorPackedWeights* packed);
+
+/**
+ * @param packed Packed weights
+ * @return Size of the packed copy in bytes, including padding
+ */
+size_t tensor_packed_weights_bytes(const TensorPackedWeights* packed);
+
+/**
+ * Matrix multiplication with a packed right operand, a @ weight for the weight passed to tensor_pack_weights.
+ * Leading dimensions of a are batches that all share the weight, and a 1D a acts as a row vector [1, K].
+ * tensor_mat_mul runs the same kernels when it packs a 2D right operand itself. Otherwise products are
+ * accumulated in the same order as tensor_mat_mul, but fused multiply-adds are used where the CPU has them,
+ * so results may differ from it in the last bits
+ *
+ * @param out Tensor pointer to allocate the resulting tensor of shape [..., M, N] at
+ * @param a Left tensor of shape [..., M, K], any strides
+ * @param weight Packed [K, N] weights
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_mat_mul_packed(Tensor* out, const Tensor* a, const TensorPackedWeights* weight);
+
+/**
+ * Register-tile kernels of the blocked GEMM
+ */
+typedef enum {
+    TENSOR_GEMM_KERNEL_AUTO,        //< The widest one the CPU supports
+    TENSOR_GEMM_KERNEL_GENERIC,     //< Portable C, 4 x 16 tiles
+    TENSOR_GEMM_KERNEL_AVX2,        //< AVX2 and FMA, 6 x 16 tiles
+    TENSOR_GEMM_KERNEL_AVX512,      //< AVX-512, 12 x 16 tiles
+    TENSOR_GEMM_KERNEL_COUNT,
+} TensorGemmKernel;
+
+/**
+ * Blocking and threading of one tensor_mat_mul_packed shape. The output is split into work units of
+ * unit_rows rows by unit_panels 16-column panels, and the units into `threads` even contiguous ranges.
+ * kc is the K block the weights are packed with, so it only applies to weights packed after it was tuned.
+ * A weight has a single K block for every product, so tensor_pack_weights uses the kc of the shape tuned for
+ * it with the most rows (M * batch), ties going to the smaller batch
+ */
+typedef struct {
+    int kc;                     //< Rows of the weight per packed block
+    int unit_rows;              //< Output rows per work unit, at most TENSOR_GEMM_MAX_UNIT_ROWS
+    int unit_panels;            //< Column panels per work unit
+    TensorGemmKernel kernel;
+    int threads;                //< Workers to split the units across, 0 for all of them
+} TensorGemmConfig;
+
+#define TENSOR_GEMM_MAX_UNIT_ROWS 96
+
+/**
+ * Tuned configurations, keyed by CPU model and (M, N, K, batch), are copied into the packed weights by
+ * tensor_pack_weights, so tensor_mat_mul_packed looks them up without locking and only sees shapes tuned
+ * before the weight was packed; tensor_mat_mul looks them up on every call it packs for. Shapes that were
+ * not tuned use built-in defaults. The first lookup loads the file named by the TENSOR_GEMM_TUNING_FILE
+ * environment variable, if it is set.
+ *
+ * Benchmark candidate kernels, K blocks, work unit sizes and thread counts for one shape, a coordinate
+ * search starting from the defaults, and record the fastest configuration for the current CPU. Each
+ * candidate is timed over 3 to 10 runs, a few hundred multiplications of the shape in all
+ * @param best Receives the fastest configuration, may be NULL
+ * @param m Rows of each left matrix
+ * @param n Columns of the weight
+ * @param k Shared dimension
+ * @param batch Number of left matrices multiplied by the same weight
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_gemm_tune(TensorGemmConfig* best, int m, int n, int k, int batch);
+
+/**
+ * @param config Receives the configuration tensor_mat_mul_packed uses for this shape
+ * @return true if it was tuned on this CPU model, false if it is the default
+ */
+bool tensor_gemm_find_config(TensorGemmConfig* config, int m, int n, int k, int batch);
+
+/**
+ * Merge the configurations in a tuning file into the ones in memory, replacing those of the same
+ * CPU model and shape. Entries of other CPU models are kept, so that tensor_gemm_tuning_save writes
+ * them back and one file can serve a mixed fleet
+ * @param path Tuning file written by tensor_gemm_tuning_save
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_IO if the file cannot be read or is malformed
+ */
+TensorError tensor_gemm_tuning_load(const char* path);
+
+/**
+ * Write every configuration in memory to a tuning file, one line per CPU model and shape
+ * @param path File to create or replace
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_IO if the file cannot be written
+ */
+TensorError tensor_gemm_tuning_save(const char* path);
+
+/**
+ * Forget every configuration in memory
+ */
+void tensor_gemm_tuning_clear(void);
+
+/**
+ * @return Model name of the CPU that tuning files are keyed by
+ */
+const char* tensor_gemm_cpu_model(void);
+
+#endif //TENSOR_GEMM_H
@@ -0,0 +1,103 @@
+#ifndef TENSOR_KERNELS_H
+#define TENSOR_KERNELS_H
+#include <stddef.h>
+
+#include "tensor.h"
+
+/**
+ * Op entry points split into shape inference and computation, for callers that manage output storage
+ * themselves. The *_output_shape functions validate the operands and compute the output shape without
+ * allocating, the *_into functions compute the op into a contiguous output that already has that shape
+ */
+
+#define TENSOR_KERNEL_MAX_DIMS 32
+
+typedef enum {
+    ELEMENTWISE_ADD,
+    ELEMENTWISE_SUB,
+    ELEMENTWISE_MUL,
+    ELEMENTWISE_DIV,
+} ElementwiseOp;
+
+/**
+ * @param shape Receives the broadcast shape, at least TENSOR_KERNEL_MAX_DIMS long
+ * @param ndim Receives the number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError elementwise_output_shape(int* shape, int* ndim, const Tensor* a, const Tensor* b);
+
+void elementwise_into(const Tensor* out, const Tensor* a, const Tensor* b, ElementwiseOp op);
+
+/**
+ * @param shape Receives the output shape, at least TENSOR_KERNEL_MAX_DIMS long
+ * @param ndim Receives the number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError mat_mul_output_shape(int* shape, int* ndim, const Tensor* a, const Tensor* b);
+
+/**
+ * @return Number of floats of scratch memory mat_mul_into needs, 0 for products it computes without packing b
+ */
+size_t mat_mul_scratch_length(const Tensor* a, const Tensor* b);
+
+/**
+ * @param scratch 64 byte aligned buffer of mat_mul_scratch_length floats, overwritten, may be NULL if that is 0
+ */
+void mat_mul_into(const Tensor* out, const Tensor* a, const Tensor* b, float* scratch);
+
+/**
+ * @param shape Receives the 4D output shape
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError conv2d_output_shape(int* shape, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                                const TensorConv2dParams* params);
+
+/**
+ * @return Number of floats of scratch memory conv2d_into needs for this weight
+ */
+size_t conv2d_scratch_length(const Tensor* weight, const TensorConv2dParams* params);
+
+/**
+ * @param scratch Buffer of conv2d_scratch_length floats, overwritten
+ */
+void conv2d_into(const Tensor* out, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                 const TensorConv2dParams* params, float* scratch);
+
+/**
+ * Width of a GEMM register tile, and of a column panel of a packed right operand
+ */
+#define GEMM_NR 16
+#define GEMM_MR_MAX 12     //< Rows of the tallest kernel's tile
+
+/**
+ * Computes the first `rows` (at most MR) rows of a tile:
+ * c[r][j] (+)= sum over p < kc of a[r][p * a_stride] * b[p * GEMM_NR + j].
+ * When accumulate is 0 the tile is overwritten instead of added to
+ */
+typedef void (*GemmKernelFn)(int rows, int kc, const float* const* a, int a_stride, const float* b,
+                             float* c, int ldc, int accumulate);
+
+typedef struct {
+    GemmKernelFn fn;
+    int mr;
+} GemmKernel;
+
+/**
+ * @return The widest register-tile kernel the CPU supports and the number of rows it computes at once
+ */
+GemmKernel gemm_kernel(void);
+
+/**
+ * @return Number of floats a [K, N] weight takes once packed for the GEMM kernels
+ */
+size_t gemm_packed_length(int k, int n);
+
+/**
+ * Computes a @ weight like tensor_mat_mul_packed, packing the 2D weight into scratch first with the
+ * configuration tuned for this shape
+ * @param out Contiguous output of shape [..., M, N]
+ * @param scratch 64 byte aligned buffer of gemm_packed_length(K, N) floats, overwritten
+ */
+void gemm_mat_mul_into(const Tensor* out, const Tensor* a, const Tensor* weight, float* scratch);
+
+#endif //TENSOR_KERNELS_H
@@ -0,0 +1,140 @@
+#ifndef TENSOR_PLAN_H
+#define TENSOR_PLAN_H
+#include <stddef.h>
+
+#include "tensor.h"
+
+/**
+ * Opaque, precompiled sequence of tensor ops with fixed shapes.
+ *
+ * Ops are recorded once through the tensor_plan_* wrappers, which only compute the shape of each result.
+ * tensor_plan_compile then works out how long every result and scratch buffer lives and places them all
+ * in one preallocated slab, letting buffers whose lifetimes do not overlap share memory.
+ * tensor_plan_execute replays the ops into the slab without allocating.
+ *
+ * Results recorded on a plan are owned by it: their data points into the slab and is only meaningful
+ * after an execute, and intermediates are overwritten by later ops of the same execute unless marked
+ * with tensor_plan_mark_output. Tensors not produced by the plan (inputs, weights) are read in place
+ * on every execute, so their contents may change between executes but their shapes must not.
+ */
+typedef struct TensorPlan TensorPlan;
+
+/**
+ * Create an empty plan
+ * @param out Pointer that receives the new plan
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_create(TensorPlan** out);
+
+/**
+ * Free the slab, the metadata of every recorded result and the plan itself
+ * @param plan Plan to destroy
+ */
+void tensor_plan_destroy(TensorPlan* plan);
+
+/**
+ * Record tensor_add on the plan
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_add(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_sub on the plan
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_sub(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_mul on the plan
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_mul(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_div on the plan
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_div(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_mat_mul on the plan
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_mat_mul(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_conv2d on the plan. The packed weight scratch buffer is placed in the slab too
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the result, owned by the plan
+ * @param input 4D input in params->layout
+ * @param weight Weights shaped [C_out, C_in / groups, KH, KW]
+ * @param bias Per output channel bias of shape [C_out], or NULL
+ * @param params Convolution parameters, copied
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_conv2d(TensorPlan* plan, Tensor* out, const Tensor* input, const Tensor* weight,
+                               const Tensor* bias, const TensorConv2dParams* params);
+
+/**
+ * Record tensor_expand on the plan. The view shares the memory of in, so it keeps in alive as long as it is read
+ * @param plan Plan to record on
+ * @param out Tensor pointer that receives the view, owned by the plan
+ * @param in Original tensor pointer
+ * @param new_shape Array of length new_ndim specifying the new size of each dimension
+ * @param new_ndim New number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_expand(TensorPlan* plan, Tensor* out, const Tensor* in, const int* new_shape, int new_ndim);
+
+/**
+ * Keep a recorded result valid after tensor_plan_execute returns, instead of sharing its memory
+ * with results recorded after its last use
+ * @param plan Plan the tensor was recorded on
+ * @param tensor Result to keep
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_mark_output(TensorPlan* plan, const Tensor* tensor);
+
+/**
+ * Assign every recorded result a place in the slab and allocate it, and start the thread pool.
+ * No ops can be recorded afterwards
+ * @param plan Plan to compile
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_plan_compile(TensorPlan* plan);
+
+/**
+ * Run every recorded op in order. Allocates nothing itself, and the pool threads were started by
+ * tensor_plan_compile, unless tensor_set_num_threads has stopped them since
+ * @param plan Compiled plan
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_INVALID_ARGUMENT if the plan is not compiled
+ */
+TensorError tensor_plan_execute(const TensorPlan* plan);
+
+/**
+ * @param plan Compiled plan
+ * @return Size of the slab in bytes
+ */
+size_t tensor_plan_slab_bytes(const TensorPlan* plan);
+
+#endif //TENSOR_PLAN_H
@@ -0,0 +1,75 @@
+#ifndef TENSOR_PROFILE_H
+#define TENSOR_PROFILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensor.h"
+
+/**
+ * Opt-in per-op profiling. While enabled, every call to a public compute op (tensor_mat_mul, tensor_add,
+ * tensor_conv2d, ...) adds its wall time and the Linux hardware counters below to that op's totals. Ops run by
+ * tensor_plan_execute are recorded per op under the name that recorded them (tensor_plan_add, ...), and the
+ * gradient updates of a tape's backward pass under tensor_tape_accumulate_grad.
+ * Counters are read from the calling thread and from every parallel_for worker, so threaded ops are
+ * counted in full. Only the outermost op is attributed when ops call each other, and ops running
+ * concurrently from several threads share the pool workers' counts between them.
+ *
+ * Counters come from perf_event_open and count user space only. A counter the kernel or the CPU does not
+ * provide, as in many virtual machines or with kernel.perf_event_paranoid > 2, stays 0 and is left out of
+ * tensor_profile_counters_available; wall time is recorded either way. Off by default: a disabled profiler
+ * costs each op one atomic load
+ */
+typedef enum {
+    TENSOR_COUNTER_CYCLES,
+    TENSOR_COUNTER_INSTRUCTIONS,
+    TENSOR_COUNTER_L1D_MISSES,        //< L1 data cache read misses
+    TENSOR_COUNTER_LLC_MISSES,        //< Last level cache misses
+    TENSOR_COUNTER_BRANCH_MISSES,
+    TENSOR_COUNTER_COUNT,
+} TensorCounter;
+
+/**
+ * Totals of one op since profiling was enabled or last reset
+ */
+typedef struct {
+    const char* op;                             //< Name of the public function, a static string
+    uint64_t calls;
+    double ms;                                  //< Wall time summed over calls
+    uint64_t counters[TENSOR_COUNTER_COUNT];    //< Summed over the calling thread and the pool workers
+} TensorProfileEntry;
+
+/**
+ * Start or stop recording. Enabling opens the counters of the calling thread and tells which are available
+ * @param enable true to start recording, false to stop. Totals are kept until tensor_profile_reset
+ */
+void tensor_profile_enable(bool enable);
+
+/**
+ * @return Bit mask of the counters that could be opened, bit i for TensorCounter i
+ */
+unsigned tensor_profile_counters_available(void);
+
+/**
+ * Clear every op's totals
+ */
+void tensor_profile_reset(void);
+
+/**
+ * Copy the totals of every op recorded so far, in order of first call
+ * @param entries Destination array
+ * @param capacity Length of entries
+ * @return Number of ops recorded, which may exceed capacity
+ */
+int tensor_profile_snapshot(TensorProfileEntry* entries, int capacity);
+
+/**
+ * Format the totals as a table, one op per line, with instructions per cycle and misses per thousand
+ * instructions, without allocating
+ * @param buffer Destination, always NUL terminated when size > 0
+ * @param size Size of buffer in bytes
+ * @return Length of the full table excluding the terminator, like snprintf
+ */
+size_t tensor_profile_report(char* buffer, size_t size);
+
+#endif //TENSOR_PROFILE_H
@@ -0,0 +1,125 @@
+#ifndef TENSOR_STREAM_H
+#define TENSOR_STREAM_H
+#include <stddef.h>
+
+#include "tensor.h"
+
+/**
+ * Out-of-core tensors: row-major float32 data in a file, in native byte order, starting at a byte
+ * offset. Only the shape is kept in memory, so a file tensor can be far larger than RAM. The outer
+ * dimension counts rows, everything after it makes up one row.
+ *
+ * Streaming ops process the rows in fixed chunks. A dedicated I/O thread reads the chunks ahead of the
+ * computation with pread, hinting the kernel to prefetch the next one, and writes results behind it, so
+ * with depth buffers per operand the disk and the CPU are busy at the same time. Each chunk is
+ * computed by the thread pool like any in-memory op
+ */
+typedef struct TensorFile TensorFile;
+
+/**
+ * Open an existing file as a read-only tensor
+ * @param out Pointer that receives the file tensor
+ * @param path File to open
+ * @param shape Shape of the tensor stored in it, at least one dimension
+ * @param ndim Number of dimensions
+ * @param offset Byte offset of the first element, e.g. to skip a header
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_IO if the file cannot be opened or is too short
+ */
+TensorError tensor_file_open(TensorFile** out, const char* path, const int* shape, int ndim, size_t offset);
+
+/**
+ * Create or truncate a file sized for a tensor, readable and writable
+ * @param out Pointer that receives the file tensor
+ * @param path File to create
+ * @param shape Shape of the tensor, at least one dimension
+ * @param ndim Number of dimensions
+ * @return TENSOR_ERROR_NONE on success, TENSOR_ERROR_IO if the file cannot be created
+ */
+TensorError tensor_file_create(TensorFile** out, const char* path, const int* shape, int ndim);
+
+/**
+ * Close the file. Data written to it stays in the file
+ * @param file File tensor to close
+ */
+void tensor_file_close(TensorFile* file);
+
+/**
+ * Read a range of rows into memory
+ * @param out Tensor pointer to allocate the rows at, shaped [rows, ...]
+ * @param file File tensor to read
+ * @param row0 First row
+ * @param rows Number of rows
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_file_read_rows(Tensor* out, const TensorFile* file, int row0, int rows);
+
+/**
+ * Write a range of rows from memory
+ * @param file File tensor created by tensor_file_create
+ * @param row0 First row to overwrite
+ * @param in Rows of shape [rows, ...] matching the file's row shape, any strides
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_file_write_rows(TensorFile* file, int row0, const Tensor* in);
+
+/**
+ * Chunking of a streaming op. A NULL params uses the defaults, 1 MiB chunks, small enough
+ * for the buffers in flight to stay in cache, and double buffering
+ */
+typedef struct {
+    size_t chunk_bytes;     //< Bytes of one chunk of one operand, rounded down to whole rows, at least one
+    int depth;              //< Chunks in flight per operand, 2 to 8: one computed while the others are read or written
+} TensorStreamParams;
+
+typedef enum {
+    TENSOR_STREAM_ADD,
+    TENSOR_STREAM_SUB,
+    TENSOR_STREAM_MUL,
+    TENSOR_STREAM_DIV,
+} TensorStreamOp;
+
+typedef enum {
+    TENSOR_STREAM_SUM,
+    TENSOR_STREAM_MEAN,
+    TENSOR_STREAM_MIN,
+    TENSOR_STREAM_MAX,
+} TensorStreamReduction;
+
+/**
+ * Element-wise op between two file tensors of the same shape, out = a op b. out may be a itself
+ * @param out File tensor of the same shape, created by tensor_file_create
+ * @param a Left file tensor
+ * @param b Right file tensor
+ * @param op Operation
+ * @param params Chunking, or NULL for the defaults
+ * @return TENSOR_ERROR_NONE on success, error code otherwise. out is partly written after an I/O error
+ */
+TensorError tensor_stream_binary(TensorFile* out, const TensorFile* a, const TensorFile* b, TensorStreamOp op,
+                                 const TensorStreamParams* params);
+
+/**
+ * Element-wise op between a file tensor and an in-memory tensor, out = a op b, with b broadcast to the
+ * shape of a. A b that spans the outer axis is sliced along with the chunks of a
+ * @param out File tensor shaped like a, created by tensor_file_create
+ * @param a File tensor
+ * @param b In-memory tensor broadcastable to the shape of a, any strides
+ * @param op Operation
+ * @param params Chunking, or NULL for the defaults
+ * @return TENSOR_ERROR_NONE on success, error code otherwise. out is partly written after an I/O error
+ */
+TensorError tensor_stream_binary_tensor(TensorFile* out, const TensorFile* a, const Tensor* b, TensorStreamOp op,
+                                        const TensorStreamParams* params);
+
+/**
+ * Reduce a file tensor over its outer axis, accumulating in double precision in row order so results
+ * do not depend on the chunk size or the thread count
+ * @param out Tensor pointer to allocate the result at, shaped like one row, or [1] for a 1D file tensor
+ * @param in File tensor with at least one row for TENSOR_STREAM_MEAN, MIN and MAX
+ * @param reduction Reduction
+ * @param params Chunking, or NULL for the defaults
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_stream_reduce(Tensor* out, const TensorFile* in, TensorStreamReduction reduction,
+                                 const TensorStreamParams* params);
+
+#endif //TENSOR_STREAM_H
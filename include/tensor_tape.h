@@ -0,0 +1,161 @@
+#ifndef TENSOR_TAPE_H
+#define TENSOR_TAPE_H
+
+#include "tensor.h"
+
+/**
+ * Opaque gradient tape recording tensor ops for reverse-mode differentiation.
+ *
+ * Ops recorded through the tensor_tape_* wrappers allocate their result at the caller's Tensor pointer
+ * as usual, but the tape owns that result: during tensor_tape_backward each one is freed as soon as
+ * the last backward step that reads it has run. Call tensor_tape_retain to keep one alive.
+ * Tensors that were not produced by the tape (inputs, weights) are never freed by it.
+ *
+ * Gradients are stored per Tensor handle in a compact shape: dimensions the tensor broadcasts
+ * (stride 0, e.g. from tensor_expand) have size 1, so a gradient matches the storage the tensor reads from.
+ */
+typedef struct TensorTape TensorTape;
+
+/**
+ * Backward step of a recorded op. It receives the gradient of the op's result and must add the
+ * gradient of each input through tensor_tape_accumulate_grad
+ */
+typedef TensorError (*TensorBackwardFn)(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                        const Tensor* const* inputs, int num_inputs, void* ctx);
+
+/**
+ * Create an empty tape
+ * @param out Pointer that receives the new tape
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_create(TensorTape** out);
+
+/**
+ * Free every remaining tape-owned result, every gradient and the tape itself
+ * @param tape Tape to destroy
+ */
+void tensor_tape_destroy(TensorTape* tape);
+
+/**
+ * Forget all recorded ops and gradients, freeing remaining tape-owned results.
+ * Gradient buffers are kept for reuse by the next recording of the same shapes
+ * @param tape Tape to reset
+ */
+void tensor_tape_reset(TensorTape* tape);
+
+/**
+ * Record tensor_add on the tape
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the resulting tensor at, owned by the tape
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_add(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_sub on the tape
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the resulting tensor at, owned by the tape
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_sub(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_mul on the tape
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the resulting tensor at, owned by the tape
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_mul(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_div on the tape
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the resulting tensor at, owned by the tape
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_div(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_mat_mul on the tape
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the resulting tensor at, owned by the tape
+ * @param a Left tensor
+ * @param b Right tensor
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_mat_mul(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b);
+
+/**
+ * Record tensor_expand on the tape. The backward step sums the gradient over the broadcast dimensions
+ * @param tape Tape to record on
+ * @param out Tensor pointer to allocate the view at, owned by the tape
+ * @param in Original tensor pointer
+ * @param new_shape Array of length new_ndim specifying the new size of each dimension
+ * @param new_ndim New number of dimensions
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_expand(TensorTape* tape, Tensor* out, const Tensor* in, const int* new_shape, int new_ndim);
+
+/**
+ * Record a custom op whose result the caller already computed into out
+ * @param tape Tape to record on
+ * @param out Result of the op, owned by the tape from now on
+ * @param out_is_view Whether out shares its data with another tensor, so only its metadata is freed
+ * @param inputs Tensors the op differentiates with respect to
+ * @param num_inputs Length of inputs (at most 4)
+ * @param saved Tensors the backward step reads, kept alive until it has run
+ * @param num_saved Length of saved (at most 4)
+ * @param backward Backward step
+ * @param ctx Argument passed to backward
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_record(TensorTape* tape, Tensor* out, bool out_is_view,
+                               const Tensor* const* inputs, int num_inputs,
+                               const Tensor* const* saved, int num_saved,
+                               TensorBackwardFn backward, void* ctx);
+
+/**
+ * Add scale * grad to the gradient of input, summing over the dimensions input broadcasts.
+ * Meant to be called from a TensorBackwardFn
+ * @param tape Tape the input was recorded on
+ * @param input Tensor to accumulate the gradient of
+ * @param grad Gradient with a shape input broadcasts to
+ * @param scale Factor applied to grad
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_accumulate_grad(TensorTape* tape, const Tensor* input, const Tensor* grad, float scale);
+
+/**
+ * Keep a tape-owned result and its gradient alive through tensor_tape_backward
+ * @param tape Tape the tensor was recorded on
+ * @param tensor Result to keep
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_retain(TensorTape* tape, const Tensor* tensor);
+
+/**
+ * Run every recorded backward step in reverse order. A tape can be backpropagated once,
+ * call tensor_tape_reset before recording the next step
+ * @param tape Tape to backpropagate
+ * @param root Tensor to differentiate
+ * @param seed Gradient of root, or NULL to use ones
+ * @return TENSOR_ERROR_NONE on success, error code otherwise
+ */
+TensorError tensor_tape_backward(TensorTape* tape, const Tensor* root, const Tensor* seed);
+
+/**
+ * @param tape Tape to read from
+ * @param tensor Input, or retained result, to read the gradient of
+ * @return The gradient, or NULL if tensor does not influence the root. Owned by the tape
+ */
+const Tensor* tensor_tape_grad(const TensorTape* tape, const Tensor* tensor);
+
+#endif //TENSOR_TAPE_H
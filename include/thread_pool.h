@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/**
+ * Body of a parallel loop, called once per chunk with the half open range [begin, end)
+ */
+typedef void (*ParallelRangeFn)(void* ctx, int begin, int end);
+
+/**
+ * Split [0, length) into one contiguous chunk per pool thread and run fn on each chunk.
+ * Chunk i always runs on worker i, so memory placed with parallel_chunk_range stays local to it.
+ * Runs inline when the range is smaller than two grains, when called from inside a parallel region,
+ * or when another thread already owns the pool
+ * @param length Number of iterations
+ * @param grain Minimum iterations per chunk
+ * @param fn Loop body
+ * @param ctx Argument passed to fn
+ */
+void parallel_for(int length, int grain, ParallelRangeFn fn, void* ctx);
+
+/**
+ * Start the pool's threads now rather than on the first parallel_for that needs them, so later loops do not
+ * allocate. tensor_set_num_threads stops them again
+ */
+void parallel_start(void);
+
+/**
+ * @return The number of threads parallel_for splits work across
+ */
+int parallel_num_threads(void);
+
+/**
+ * @return The number of chunks parallel_for splits [0, length) into with this grain when it gets the pool,
+ *         1 when it runs inline
+ */
+int parallel_chunk_count(int length, int grain);
+
+/**
+ * Bounds of chunk `chunk` when [0, length) is split into `chunks` even pieces
+ */
+void parallel_chunk_range(int length, int chunk, int chunks, int* begin, int* end);
+
+#endif //THREAD_POOL_H
@@ -0,0 +1,299 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm_tuning.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TUNING_HAS_CPUID 1
+#include <cpuid.h>
+#endif
+
+#define TUNING_MODEL_MAX 128
+#define TUNING_LINE_MAX 512
+#define TUNING_MAX_KC 4096
+#define TUNING_FILE_HEADER "# tensor gemm tuning v1"
+
+/**
+ * The tuning file is plain text, one tab-separated entry per line:
+ *     cpu model, m, n, k, batch, kc, unit_rows, unit_panels, kernel name, threads, ms
+ * Kernels are stored by name so the file stays valid if TensorGemmKernel is reordered
+ */
+typedef struct {
+    char cpu[TUNING_MODEL_MAX];
+    int m;
+    int n;
+    int k;
+    int batch;
+    TensorGemmConfig config;
+    double ms;                  //< Time of the winning configuration when it was tuned
+} TuningEntry;
+
+static const char* const kernel_names[TENSOR_GEMM_KERNEL_COUNT] = {
+    [TENSOR_GEMM_KERNEL_AUTO] = "auto",
+    [TENSOR_GEMM_KERNEL_GENERIC] = "generic",
+    [TENSOR_GEMM_KERNEL_AVX2] = "avx2",
+    [TENSOR_GEMM_KERNEL_AVX512] = "avx512",
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_once_t once;
+    char cpu[TUNING_MODEL_MAX];
+    TuningEntry* entries;
+    int count;
+    int capacity;
+} tuning = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+// Collapses tabs, newlines and runs of spaces so the model is one field of a tuning file line
+static void normalize_model(char* model) {
+    char* dst = model;
+    for (const char* src = model; *src; src++) {
+        const char c = *src == '\t' || *src == '\n' || *src == '\r' ? ' ' : *src;
+        if (c == ' ' && (dst == model || dst[-1] == ' ')) continue;
+        *dst++ = c;
+    }
+    while (dst > model && dst[-1] == ' ') dst--;
+    *dst = '\0';
+}
+
+static void read_cpu_model(char* model) {
+    model[0] = '\0';
+
+#ifdef TUNING_HAS_CPUID
+    unsigned int regs[12];
+    if (__get_cpuid_max(0x80000000u, NULL) >= 0x80000004u) {
+        for (unsigned int i = 0; i < 3; i++) {
+            __get_cpuid(0x80000002u + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+        }
+        memcpy(model, regs, sizeof regs);
+        model[sizeof regs] = '\0';
+    }
+#endif
+
+    if (model[0] == '\0') {
+        FILE* file = fopen("/proc/cpuinfo", "r");
+        char line[TUNING_LINE_MAX];
+        while (file && fgets(line, sizeof line, file)) {
+            const char* colon = strchr(line, ':');
+            if (colon && strncmp(line, "model name", 10) == 0) {
+                snprintf(model, TUNING_MODEL_MAX, "%s", colon + 1);
+                break;
+            }
+        }
+        if (file) fclose(file);
+    }
+
+    normalize_model(model);
+    if (model[0] == '\0') snprintf(model, TUNING_MODEL_MAX, "unknown");
+}
+
+static void tuning_init(void) {
+    read_cpu_model(tuning.cpu);
+
+    const char* path = getenv("TENSOR_GEMM_TUNING_FILE");
+    if (path) tensor_gemm_tuning_load(path);
+}
+
+const char* tensor_gemm_cpu_model(void) {
+    pthread_once(&tuning.once, tuning_init);
+    return tuning.cpu;
+}
+
+bool gemm_tuning_valid(const TensorGemmConfig* config) {
+    return config->kc >= 1 && config->kc <= TUNING_MAX_KC
+        && config->unit_rows >= 1 && config->unit_rows <= TENSOR_GEMM_MAX_UNIT_ROWS
+        && config->unit_panels >= 1
+        && config->kernel >= 0 && config->kernel < TENSOR_GEMM_KERNEL_COUNT
+        && config->threads >= 0;
+}
+
+// Caller must hold tuning.lock
+static TuningEntry* find_entry(const char* cpu, const int m, const int n, const int k, const int batch) {
+    for (int i = 0; i < tuning.count; i++) {
+        TuningEntry* e = &tuning.entries[i];
+        if (e->m == m && e->n == n && e->k == k && e->batch == batch && strcmp(e->cpu, cpu) == 0) return e;
+    }
+    return NULL;
+}
+
+// Caller must hold tuning.lock
+static TensorError insert_entry(const TuningEntry* entry) {
+    TuningEntry* existing = find_entry(entry->cpu, entry->m, entry->n, entry->k, entry->batch);
+    if (existing) {
+        *existing = *entry;
+        return TENSOR_ERROR_NONE;
+    }
+
+    if (tuning.count == tuning.capacity) {
+        const int capacity = tuning.capacity ? 2 * tuning.capacity : 16;
+        TuningEntry* entries = realloc(tuning.entries, (size_t) capacity * sizeof *entries);
+        if (entries == NULL) return TENSOR_ERROR_NO_MEMORY;
+        tuning.entries = entries;
+        tuning.capacity = capacity;
+    }
+    tuning.entries[tuning.count++] = *entry;
+    return TENSOR_ERROR_NONE;
+}
+
+bool gemm_tuning_find(TensorGemmConfig* config, const int m, const int n, const int k, const int batch) {
+    const char* cpu = tensor_gemm_cpu_model();
+
+    pthread_mutex_lock(&tuning.lock);
+    const TuningEntry* entry = find_entry(cpu, m, n, k, batch);
+    if (entry) *config = entry->config;
+    pthread_mutex_unlock(&tuning.lock);
+
+    return entry != NULL;
+}
+
+TensorError gemm_tuning_collect(GemmTunedShape** shapes, int* count, const int n, const int k) {
+    const char* cpu = tensor_gemm_cpu_model();
+    *shapes = NULL;
+    *count = 0;
+
+    pthread_mutex_lock(&tuning.lock);
+    int matches = 0;
+    for (int i = 0; i < tuning.count; i++) {
+        const TuningEntry* e = &tuning.entries[i];
+        matches += e->n == n && e->k == k && strcmp(e->cpu, cpu) == 0;
+    }
+
+    GemmTunedShape* copy = matches ? malloc((size_t) matches * sizeof *copy) : NULL;
+    for (int i = 0; copy && i < tuning.count; i++) {
+        const TuningEntry* e = &tuning.entries[i];
+        if (e->n == n && e->k == k && strcmp(e->cpu, cpu) == 0) copy[(*count)++] = (GemmTunedShape) {e->m, e->batch, e->config};
+    }
+    pthread_mutex_unlock(&tuning.lock);
+
+    if (matches && copy == NULL) return TENSOR_ERROR_NO_MEMORY;
+    *shapes = copy;
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError gemm_tuning_store(const TensorGemmConfig* config, const int m, const int n, const int k, const int batch,
+                              const double ms) {
+    TuningEntry entry = {.m = m, .n = n, .k = k, .batch = batch, .config = *config, .ms = ms};
+    snprintf(entry.cpu, sizeof entry.cpu, "%s", tensor_gemm_cpu_model());
+
+    pthread_mutex_lock(&tuning.lock);
+    const TensorError err = insert_entry(&entry);
+    pthread_mutex_unlock(&tuning.lock);
+    return err;
+}
+
+// Splits a line in place at its tabs, returns the number of fields
+static int split_fields(char* line, char** fields, const int max_fields) {
+    int count = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char* field = line; field && count < max_fields; count++) {
+        fields[count] = field;
+        field = strchr(field, '\t');
+        if (field) *field++ = '\0';
+    }
+    return count;
+}
+
+static bool parse_entry(char* line, TuningEntry* entry) {
+    char* fields[12];
+    if (split_fields(line, fields, 12) != 11 || fields[0][0] == '\0') return false;
+
+    snprintf(entry->cpu, sizeof entry->cpu, "%s", fields[0]);
+    int values[8];
+    const int positions[8] = {1, 2, 3, 4, 5, 6, 7, 9};
+    for (int i = 0; i < 8; i++) {
+        char* end;
+        const long value = strtol(fields[positions[i]], &end, 10);
+        if (end == fields[positions[i]] || *end != '\0' || value < 0 || value > 1L << 30) return false;
+        values[i] = (int) value;
+    }
+
+    int kernel = 0;
+    while (kernel < TENSOR_GEMM_KERNEL_COUNT && strcmp(fields[8], kernel_names[kernel]) != 0) kernel++;
+
+    char* end;
+    entry->ms = strtod(fields[10], &end);
+    if (end == fields[10] || *end != '\0') return false;
+
+    entry->m = values[0];
+    entry->n = values[1];
+    entry->k = values[2];
+    entry->batch = values[3];
+    entry->config = (TensorGemmConfig) {
+        .kc = values[4],
+        .unit_rows = values[5],
+        .unit_panels = values[6],
+        .kernel = (TensorGemmKernel) kernel,
+        .threads = values[7],
+    };
+    return kernel < TENSOR_GEMM_KERNEL_COUNT && gemm_tuning_valid(&entry->config);
+}
+
+TensorError tensor_gemm_tuning_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return TENSOR_ERROR_IO;
+
+    // Parse the whole file first so a malformed one changes nothing
+    TuningEntry* parsed = NULL;
+    int count = 0, capacity = 0;
+    TensorError err = TENSOR_ERROR_NONE;
+    char line[TUNING_LINE_MAX];
+    while (err == TENSOR_ERROR_NONE && fgets(line, sizeof line, file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            TuningEntry* grown = realloc(parsed, (size_t) capacity * sizeof *grown);
+            if (grown == NULL) {
+                err = TENSOR_ERROR_NO_MEMORY;
+                break;
+            }
+            parsed = grown;
+        }
+        if (!parse_entry(line, &parsed[count++])) err = TENSOR_ERROR_IO;
+    }
+    if (ferror(file)) err = TENSOR_ERROR_IO;
+    fclose(file);
+
+    pthread_mutex_lock(&tuning.lock);
+    for (int i = 0; i < count && err == TENSOR_ERROR_NONE; i++) err = insert_entry(&parsed[i]);
+    pthread_mutex_unlock(&tuning.lock);
+
+    free(parsed);
+    return err;
+}
+
+TensorError tensor_gemm_tuning_save(const char* path) {
+    pthread_once(&tuning.once, tuning_init);
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return TENSOR_ERROR_IO;
+
+    fprintf(file, "%s\n", TUNING_FILE_HEADER);
+    pthread_mutex_lock(&tuning.lock);
+    for (int i = 0; i < tuning.count; i++) {
+        const TuningEntry* e = &tuning.entries[i];
+        fprintf(file, "%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s\t%d\t%.4f\n", e->cpu, e->m, e->n, e->k, e->batch,
+                e->config.kc, e->config.unit_rows, e->config.unit_panels, kernel_names[e->config.kernel],
+                e->config.threads, e->ms);
+    }
+    pthread_mutex_unlock(&tuning.lock);
+
+    const bool failed = ferror(file) != 0;
+    return fclose(file) != 0 || failed ? TENSOR_ERROR_IO : TENSOR_ERROR_NONE;
+}
+
+void tensor_gemm_tuning_clear(void) {
+    pthread_once(&tuning.once, tuning_init);
+
+    pthread_mutex_lock(&tuning.lock);
+    free(tuning.entries);
+    tuning.entries = NULL;
+    tuning.count = 0;
+    tuning.capacity = 0;
+    pthread_mutex_unlock(&tuning.lock);
+}
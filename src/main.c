@@ -15,14 +15,19 @@ int main(void) {
 
     TensorError err = tensor_from_data(&a, data_a, shape_a, ndim_a);
     printf("A init error: %s\n", tensor_error_to_string(err));
-    printf("A\n %s", tensor_metadata_to_string(&a));
-    printf("%s\n", tensor_to_string(&a));
+    char buffer[1024];
+    tensor_metadata_to_string_buffer(buffer, sizeof buffer, &a);
+    printf("A\n %s", buffer);
+    tensor_to_string_buffer(buffer, sizeof buffer, &a);
+    printf("%s\n", buffer);
 
 
     err = tensor_expand(&out, &a, (int[]){3,6}, 2);
     printf("Out error: %s\n", tensor_error_to_string(err));
-    printf("Out\n %s", tensor_metadata_to_string(&out));
-    printf("%s\n", tensor_to_string(&out));
+    tensor_metadata_to_string_buffer(buffer, sizeof buffer, &out);
+    printf("Out\n %s", buffer);
+    tensor_to_string_buffer(buffer, sizeof buffer, &out);
+    printf("%s\n", buffer);
 
     printf("Press enter to exit...");
     getchar();
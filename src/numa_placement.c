@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef TENSOR_HAS_NUMA
+#include <numa.h>
+#endif
+
+#include "numa_placement.h"
+#include "tensor.h"
+#include "thread_pool.h"
+
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+#define HUGE_PAGE_THRESHOLD ((size_t) 8 << 20)
+#define CACHE_LINE_SIZE 64
+
+static _Thread_local TensorNumaPolicy current_policy = TENSOR_NUMA_DEFAULT;
+static _Thread_local int current_node = 0;
+
+int numa_placement_available(void) {
+#ifdef TENSOR_HAS_NUMA
+    return numa_available() >= 0;
+#else
+    return 0;
+#endif
+}
+
+int numa_placement_node_count(void) {
+#ifdef TENSOR_HAS_NUMA
+    if (numa_available() < 0) return 1;
+    return numa_max_node() + 1;
+#else
+    return 1;
+#endif
+}
+
+int numa_placement_node_of_worker(const int worker, const int num_workers) {
+    return (int) ((long long) worker * numa_placement_node_count() / num_workers);
+}
+
+int numa_placement_pin_current_thread(const int node) {
+#ifdef TENSOR_HAS_NUMA
+    if (numa_available() < 0) return -1;
+    return numa_run_on_node(node) == 0 ? 0 : -1;
+#else
+    (void) node;
+    return -1;
+#endif
+}
+
+#ifdef TENSOR_HAS_NUMA
+/**
+ * Bind each chunk a NUMA_PARTITION_GRAIN parallel_for gives the buffer to the node of the worker that processes it.
+ * Chunk boundaries are rounded down to pages, so a page shared by two chunks goes to the later one. A buffer such a
+ * loop runs inline is left to first touch by the calling thread
+ */
+static void numa_bind_partitioned(char* buffer, const size_t count, const size_t bytes, const size_t page) {
+    const int chunks = parallel_chunk_count((int) count, NUMA_PARTITION_GRAIN);
+    if (chunks < 2) return;
+
+    const int workers = parallel_num_threads();
+    for (int c = 0; c < chunks; c++) {
+        int begin, end;
+        parallel_chunk_range((int) count, c, chunks, &begin, &end);
+
+        const size_t byte_begin = begin * sizeof(float) / page * page;
+        const size_t byte_end = c == chunks - 1 ? bytes : end * sizeof(float) / page * page;
+        if (byte_end <= byte_begin) continue;
+
+        numa_tonode_memory(&buffer[byte_begin], byte_end - byte_begin, numa_placement_node_of_worker(c, workers));
+    }
+}
+#endif
+
+/**
+ * Buffers of at least HUGE_PAGE_THRESHOLD bytes are aligned to huge pages and advised to use them where
+ * transparent huge pages are opt-in. Filling a fresh buffer is dominated by page faults, and a 2 MiB
+ * page takes one fault where 4 KiB pages take 512. Smaller buffers start on a cache line
+ */
+static float* placement_alloc_default(const size_t count) {
+    const size_t bytes = count * sizeof(float);
+    void* buffer;
+#ifdef MADV_HUGEPAGE
+    if (bytes >= HUGE_PAGE_THRESHOLD) {
+        if (posix_memalign(&buffer, HUGE_PAGE_SIZE, bytes) != 0) return NULL;
+        madvise(buffer, (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+        return buffer;
+    }
+#endif
+    if (posix_memalign(&buffer, CACHE_LINE_SIZE, bytes ? bytes : sizeof(float)) != 0) return NULL;
+    return buffer;
+}
+
+float* numa_placement_alloc(const size_t count) {
+#ifdef TENSOR_HAS_NUMA
+    if (current_policy == TENSOR_NUMA_DEFAULT || numa_available() < 0) {
+        return placement_alloc_default(count);
+    }
+
+    // Policies apply per page, so the buffer must own whole pages that have not been touched yet
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t bytes = (count * sizeof(float) + page - 1) / page * page;
+
+    void* buffer;
+    if (posix_memalign(&buffer, page, bytes ? bytes : page) != 0) return NULL;
+    if (bytes == 0) return buffer;
+
+    switch (current_policy) {
+        case TENSOR_NUMA_INTERLEAVE:
+            numa_interleave_memory(buffer, bytes, numa_all_nodes_ptr);
+            break;
+        case TENSOR_NUMA_BIND:
+            numa_tonode_memory(buffer, bytes, current_node);
+            break;
+        case TENSOR_NUMA_PARTITIONED:
+            numa_bind_partitioned(buffer, count, bytes, page);
+            break;
+        default:
+            break;
+    }
+
+    return buffer;
+#else
+    return placement_alloc_default(count);
+#endif
+}
+
+int tensor_numa_node_count(void) {
+    return numa_placement_node_count();
+}
+
+TensorError tensor_set_numa_policy(const TensorNumaPolicy policy, const int node) {
+    if (policy == TENSOR_NUMA_DEFAULT) {
+        current_policy = policy;
+        return TENSOR_ERROR_NONE;
+    }
+
+#ifdef TENSOR_HAS_NUMA
+    if (numa_available() < 0) return TENSOR_ERROR_UNSUPPORTED;
+    if (policy == TENSOR_NUMA_BIND && (node < 0 || node >= numa_placement_node_count())) {
+        return TENSOR_ERROR_INVALID_ARGUMENT;
+    }
+
+    current_policy = policy;
+    current_node = node;
+    return TENSOR_ERROR_NONE;
+#else
+    (void) node;
+    return TENSOR_ERROR_UNSUPPORTED;
+#endif
+}
@@ -4,38 +4,59 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define SB_INITIAL_CAP 128
+
 void init_sb(StringBuilder* sb) {
-    sb->buff = malloc(128);
-    sb->cap = 128;
+    sb->buff = malloc(SB_INITIAL_CAP);
+    sb->cap = sb->buff ? SB_INITIAL_CAP : 0;
     sb->len = 0;
-    sb->buff[0] = '\0';
+    sb->fixed = false;
+    sb->failed = sb->buff == NULL;
+    if (sb->buff) sb->buff[0] = '\0';
 }
 
-void sb_append(StringBuilder* sb, const char* string) {
-    const size_t string_len = strlen(string);
-    if (sb->len + string_len < sb->cap) {
-        memcpy(&sb->buff[sb->len], string, string_len);
-        sb->len += string_len;
-        sb->buff[sb->len] = '\0';
-    }else {
-        size_t new_cap = sb->cap;
-        while (sb->len + string_len + 1 > new_cap) {
-            new_cap *= 2;
-        }
-        char* new_buff = realloc(sb->buff, new_cap);
-
-        sb->buff = new_buff;
-        sb->cap *= new_cap;
-
-        memcpy(&sb->buff[sb->len], string, string_len);
-        sb->len += string_len;
-        sb->buff[sb->len] = '\0';
+void init_sb_fixed(StringBuilder* sb, char* buffer, const size_t size) {
+    sb->buff = buffer;
+    sb->cap = size;
+    sb->len = 0;
+    sb->fixed = true;
+    sb->failed = false;
+    if (size > 0) buffer[0] = '\0';
+}
+
+static void sb_grow(StringBuilder* sb, const size_t needed) {
+    size_t new_cap = sb->cap;
+    while (needed > new_cap) {
+        new_cap *= 2;
+    }
 
+    char* new_buff = realloc(sb->buff, new_cap);
+    if (new_buff == NULL) {
+        sb->failed = true;
+        return;
     }
+
+    sb->buff = new_buff;
+    sb->cap = new_cap;
 }
 
+void sb_append(StringBuilder* sb, const char* string) {
+    const size_t string_len = strlen(string);
+    if (!sb->fixed && !sb->failed && sb->len + string_len + 1 > sb->cap) sb_grow(sb, sb->len + string_len + 1);
+
+    // Copy whatever still fits in front of the terminator
+    if (sb->len < sb->cap) {
+        const size_t room = sb->cap - sb->len - 1;
+        const size_t n = string_len < room ? string_len : room;
+        memcpy(&sb->buff[sb->len], string, n);
+        sb->buff[sb->len + n] = '\0';
+    }
+    sb->len += string_len;
+}
 
 void sb_free(StringBuilder* sb) {
-    free(sb->buff);
-    free(sb);
-};
\ No newline at end of file
+    if (!sb->fixed) free(sb->buff);
+    sb->buff = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
@@ -1,11 +1,24 @@
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "tensor.h"
 
 #include <stdio.h>
 
+#include "numa_placement.h"
 #include "string_builder.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define STREAM_HAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define FILL_GRAIN NUMA_PARTITION_GRAIN
+#define STREAM_DEFAULT_THRESHOLD (8u << 20)
 
 static const char* TensorErrorStrings[] = {
     [TENSOR_ERROR_NONE] = "TENSOR_ERROR_NONE",
@@ -14,7 +27,9 @@ static const char* TensorErrorStrings[] = {
     [TENSOR_ERROR_INPUT_DIM_MISMATCH] = "TENSOR_ERROR_INPUT_DIM_MISMATCH",
     [TENSOR_ERROR_NEGATIVE_DIM] = "TENSOR_ERROR_NEGATIVE_DIM",
     [TENSOR_ERROR_CANNOT_BROADCAST] = "TENSOR_ERROR_CANNOT_BROADCAST",
-    [TENSOR_ERROR_CANNOT_EXPAND] = "TENSOR_ERROR_CANNOT_EXPAND"
+    [TENSOR_ERROR_CANNOT_EXPAND] = "TENSOR_ERROR_CANNOT_EXPAND",
+    [TENSOR_ERROR_UNSUPPORTED] = "TENSOR_ERROR_UNSUPPORTED",
+    [TENSOR_ERROR_IO] = "TENSOR_ERROR_IO"
 };
 
 static int tensor_flat_length(const int* shape, int ndim) {
@@ -27,7 +42,7 @@ static int tensor_flat_length(const int* shape, int ndim) {
 }
 
 static int tensor_alloc_data(Tensor* out, const int flat_length) {
-    out->data = malloc(flat_length * sizeof *out->data);
+    out->data = numa_placement_alloc(flat_length);
     return out->data ? 0 : -1;
 }
 
@@ -37,17 +52,20 @@ static int tensor_alloc_metadata(Tensor* out, const int ndim) {
     );
 
     if (metadata == NULL) {
-        return TENSOR_ERROR_NO_MEMORY;
+        out->shape = NULL;
+        out->strides = NULL;
+        return -1;
     }
 
     out->shape = (int*) metadata;
     out->strides = (int*) &metadata[ndim * sizeof *out->shape];
-    return out->data ? 0 : -1;
+    return 0;
 }
 
 static int tensor_alloc(Tensor* out, const int* shape, const int ndim) {
     const int flat_length = tensor_flat_length(shape, ndim);
 
+    out->shape = NULL;
     if (tensor_alloc_data(out,flat_length) < 0) return -1;
 
     if (tensor_alloc_metadata(out,ndim) < 0) return -1;
@@ -67,6 +85,155 @@ static int tensor_alloc_view(Tensor* out, const Tensor* in, const int ndim) {
     return 0;
 }
 
+/**
+ * Fills and copies larger than the last level cache bypass it with non-temporal stores: the data would
+ * be evicted before it is read again anyway, and going through the cache would first evict the working
+ * set of every other thread sharing it and read each destination line before overwriting it
+ */
+static _Atomic size_t streaming_threshold = 0;
+
+// The last level cache size, looked up on first use and whenever the threshold is reset to 0
+static size_t streaming_threshold_bytes(void) {
+    size_t threshold = atomic_load_explicit(&streaming_threshold, memory_order_relaxed);
+    if (threshold > 0) return threshold;
+
+    threshold = STREAM_DEFAULT_THRESHOLD;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    const long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc > 0) threshold = (size_t) llc;
+#endif
+    atomic_store_explicit(&streaming_threshold, threshold, memory_order_relaxed);
+    return threshold;
+}
+
+typedef void (*FillKernelFn)(float* data, float value, int n);
+typedef void (*CopyKernelFn)(float* dst, const float* src, int n);
+
+static void fill_cached(float* data, const float value, const int n) {
+    for (int i = 0; i < n; i++) {
+        data[i] = value;
+    }
+}
+
+static void copy_cached(float* dst, const float* src, const int n) {
+    memcpy(dst, src, n * sizeof *dst);
+}
+
+#ifdef STREAM_HAS_X86_KERNELS
+// Scalar stores up to the first aligned address, then streaming stores. The fence orders them before
+// the worker reports its chunk done, since non-temporal stores are weakly ordered
+static void fill_stream_sse(float* data, const float value, const int n) {
+    int i = 0;
+    for (; i < n && ((uintptr_t) &data[i] & 15); i++) data[i] = value;
+
+    const __m128 v = _mm_set1_ps(value);
+    for (; i + 16 <= n; i += 16) {
+        _mm_stream_ps(&data[i], v);
+        _mm_stream_ps(&data[i + 4], v);
+        _mm_stream_ps(&data[i + 8], v);
+        _mm_stream_ps(&data[i + 12], v);
+    }
+    for (; i < n; i++) data[i] = value;
+    _mm_sfence();
+}
+
+__attribute__((target("avx")))
+static void fill_stream_avx(float* data, const float value, const int n) {
+    int i = 0;
+    for (; i < n && ((uintptr_t) &data[i] & 31); i++) data[i] = value;
+
+    const __m256 v = _mm256_set1_ps(value);
+    for (; i + 32 <= n; i += 32) {
+        _mm256_stream_ps(&data[i], v);
+        _mm256_stream_ps(&data[i + 8], v);
+        _mm256_stream_ps(&data[i + 16], v);
+        _mm256_stream_ps(&data[i + 24], v);
+    }
+    for (; i < n; i++) data[i] = value;
+    _mm_sfence();
+}
+
+static void copy_stream_sse(float* dst, const float* src, const int n) {
+    int i = 0;
+    for (; i < n && ((uintptr_t) &dst[i] & 15); i++) dst[i] = src[i];
+
+    for (; i + 16 <= n; i += 16) {
+        _mm_prefetch((const char*) &src[i + 256], _MM_HINT_NTA);
+        _mm_stream_ps(&dst[i], _mm_loadu_ps(&src[i]));
+        _mm_stream_ps(&dst[i + 4], _mm_loadu_ps(&src[i + 4]));
+        _mm_stream_ps(&dst[i + 8], _mm_loadu_ps(&src[i + 8]));
+        _mm_stream_ps(&dst[i + 12], _mm_loadu_ps(&src[i + 12]));
+    }
+    for (; i < n; i++) dst[i] = src[i];
+    _mm_sfence();
+}
+
+__attribute__((target("avx")))
+static void copy_stream_avx(float* dst, const float* src, const int n) {
+    int i = 0;
+    for (; i < n && ((uintptr_t) &dst[i] & 31); i++) dst[i] = src[i];
+
+    for (; i + 32 <= n; i += 32) {
+        _mm_prefetch((const char*) &src[i + 256], _MM_HINT_NTA);
+        _mm256_stream_ps(&dst[i], _mm256_loadu_ps(&src[i]));
+        _mm256_stream_ps(&dst[i + 8], _mm256_loadu_ps(&src[i + 8]));
+        _mm256_stream_ps(&dst[i + 16], _mm256_loadu_ps(&src[i + 16]));
+        _mm256_stream_ps(&dst[i + 24], _mm256_loadu_ps(&src[i + 24]));
+    }
+    for (; i < n; i++) dst[i] = src[i];
+    _mm_sfence();
+}
+#endif
+
+static FillKernelFn fill_kernel(const int length) {
+#ifdef STREAM_HAS_X86_KERNELS
+    if ((size_t) length * sizeof(float) >= streaming_threshold_bytes()) {
+        return __builtin_cpu_supports("avx") ? fill_stream_avx : fill_stream_sse;
+    }
+#endif
+    (void) length;
+    return fill_cached;
+}
+
+static CopyKernelFn copy_kernel(const int length) {
+#ifdef STREAM_HAS_X86_KERNELS
+    if ((size_t) length * sizeof(float) >= streaming_threshold_bytes()) {
+        return __builtin_cpu_supports("avx") ? copy_stream_avx : copy_stream_sse;
+    }
+#endif
+    (void) length;
+    return copy_cached;
+}
+
+typedef struct {
+    float* data;
+    const float* src;
+    float value;
+    FillKernelFn fill;
+    CopyKernelFn copy;
+} FillContext;
+
+static void fill_range(void* ctx, const int begin, const int end) {
+    const FillContext* fill = ctx;
+    fill->fill(&fill->data[begin], fill->value, end - begin);
+}
+
+static void copy_range(void* ctx, const int begin, const int end) {
+    const FillContext* copy = ctx;
+    copy->copy(&copy->data[begin], &copy->src[begin], end - begin);
+}
+
+// Filling in parallel also makes each worker the first to touch its chunk, keeping pages local to it
+static void tensor_fill_data(const Tensor* out, const float value) {
+    FillContext fill = {out->data, NULL, value, fill_kernel(out->length), NULL};
+    parallel_for(out->length, FILL_GRAIN, fill_range, &fill);
+}
+
+static void tensor_copy_data(const Tensor* out, const float* src) {
+    FillContext copy = {out->data, src, 0.0f, NULL, copy_kernel(out->length)};
+    parallel_for(out->length, FILL_GRAIN, copy_range, &copy);
+}
+
 static void tensor_calculate_strides(const Tensor* out) {
     out->strides[out->ndim - 1] = 1;
     for (int i = out->ndim - 2; i >= 0; i--) {
@@ -153,8 +320,8 @@ TensorError tensor_from_data(Tensor* out, const float* data, const int* shape,co
         return TENSOR_ERROR_NO_MEMORY;
     }
     memcpy(out->shape, shape, ndim * sizeof *out->shape);
-    memcpy(out->data, data, out->length * sizeof *out->data);
     tensor_calculate_strides(out);
+    tensor_copy_data(out, data);
     return TENSOR_ERROR_NONE;
 }
 
@@ -165,9 +332,7 @@ TensorError tensor_zeros(Tensor* out, const int* shape, const int ndim) {
     }
     memcpy(out->shape, shape, ndim * sizeof *out->shape);
     tensor_calculate_strides(out);
-    for (int i = 0; i < out->length; i++) {
-        out->data[i] = 0.0f;
-    }
+    tensor_fill_data(out, 0.0f);
     return TENSOR_ERROR_NONE;
 }
 
@@ -178,9 +343,7 @@ TensorError tensor_ones(Tensor* out, const int* shape, const int ndim) {
     }
     memcpy(out->shape, shape, ndim * sizeof *out->shape);
     tensor_calculate_strides(out);
-    for (int i = 0; i < out->length; i++) {
-        out->data[i] = 1.0f;
-    }
+    tensor_fill_data(out, 1.0f);
     return TENSOR_ERROR_NONE;
 }
 
@@ -191,21 +354,26 @@ TensorError tensor_fill(Tensor* out, const float num, const int* shape,int ndim)
     }
     memcpy(out->shape, shape, ndim * sizeof *out->shape);
     tensor_calculate_strides(out);
-    for (int i = 0; i < out->length; i++) {
-        out->data[i] = num;
-    }
+    tensor_fill_data(out, num);
     return TENSOR_ERROR_NONE;
 }
 
+void tensor_set_streaming_threshold(const size_t bytes) {
+    atomic_store_explicit(&streaming_threshold, bytes, memory_order_relaxed);
+}
+
 void tensor_free(Tensor* tensor) {
     free(tensor->data);
     free(tensor->shape);
-    free(tensor);
+    tensor->data = NULL;
+    tensor->shape = NULL;
+    tensor->strides = NULL;
 };
 
 void tensor_view_free(Tensor* tensor) {
     free(tensor->shape);
-    free(tensor);
+    tensor->shape = NULL;
+    tensor->strides = NULL;
 }
 
 float tensor_get(const Tensor* tensor, const int* idx) {
@@ -270,51 +438,128 @@ TensorError tensor_promote_to_col(Tensor* out, const Tensor* in) {
     return TENSOR_ERROR_NONE;
 }
 
-const char* tensor_to_string(const Tensor* tensor) {
-    StringBuilder sb;
-    init_sb(&sb);
-    build_string_2(&sb,tensor, 0, 0,0);
-    return sb.buff;
-}
-
-const char* tensor_metadata_to_string(const Tensor* tensor) {
-    StringBuilder sb;
-    init_sb(&sb);
-
-    sb_append(&sb, "----------- METADATA -----------\n");
+static void build_metadata_string(StringBuilder* sb, const Tensor* tensor) {
+    sb_append(sb, "----------- METADATA -----------\n");
     char ndim_buff[21];
     snprintf(ndim_buff, sizeof(ndim_buff),"%d",tensor->ndim);
 
-    sb_append(&sb, "ndim: ");
-    sb_append(&sb, ndim_buff);
-    sb_append(&sb, "\nShape: [");
+    sb_append(sb, "ndim: ");
+    sb_append(sb, ndim_buff);
+    sb_append(sb, "\nShape: [");
 
     for (int i = 0; i < tensor->ndim; i++) {
         char shape_buff[21];
         snprintf(shape_buff, sizeof(shape_buff),"%d",tensor->shape[i]);
 
-        sb_append(&sb, shape_buff);
+        sb_append(sb, shape_buff);
         if (i < tensor->ndim - 1) {
-            sb_append(&sb, ", ");
+            sb_append(sb, ", ");
         }
     }
 
-    sb_append(&sb, "]\nStrides: [");
+    sb_append(sb, "]\nStrides: [");
 
     for (int i = 0; i < tensor->ndim; i++) {
         char stride_buff[21];
         snprintf(stride_buff, sizeof(stride_buff),"%d",tensor->strides[i]);
-        sb_append(&sb, stride_buff);
+        sb_append(sb, stride_buff);
         if (i < tensor->ndim - 1) {
-            sb_append(&sb, ", ");
+            sb_append(sb, ", ");
         }
     }
-    sb_append(&sb, "]\n");
-    sb_append(&sb, "--------------------------------\n");
+    sb_append(sb, "]\n");
+    sb_append(sb, "--------------------------------\n");
+}
 
-    return sb.buff;
+// The builder's heap buffer handed to the caller, or NULL if it could not grow
+static char* sb_release(StringBuilder* sb) {
+    if (sb->failed) {
+        sb_free(sb);
+        return NULL;
+    }
+    return sb->buff;
 }
 
-const char* tensor_error_to_string(const TensorError error){return TensorErrorStrings[error];}
+char* tensor_to_string(const Tensor* tensor) {
+    StringBuilder sb;
+    init_sb(&sb);
+    build_string_2(&sb,tensor, 0, 0,0);
+    return sb_release(&sb);
+}
+
+char* tensor_metadata_to_string(const Tensor* tensor) {
+    StringBuilder sb;
+    init_sb(&sb);
+    build_metadata_string(&sb, tensor);
+    return sb_release(&sb);
+}
+
+size_t tensor_to_string_buffer(char* buffer, const size_t size, const Tensor* tensor) {
+    StringBuilder sb;
+    init_sb_fixed(&sb, buffer, size);
+    build_string_2(&sb,tensor, 0, 0,0);
+    return sb.len;
+}
+
+size_t tensor_metadata_to_string_buffer(char* buffer, const size_t size, const Tensor* tensor) {
+    StringBuilder sb;
+    init_sb_fixed(&sb, buffer, size);
+    build_metadata_string(&sb, tensor);
+    return sb.len;
+}
+
+const char* tensor_error_to_string(const TensorError error) {
+    if ((unsigned) error >= TENSOR_ERROR_COUNT) return "TENSOR_ERROR_UNKNOWN";
+    return TensorErrorStrings[error];
+}
+
+TensorError tensor_error_record(TensorErrorContext* ctx, const TensorError error, const char* op, const Tensor* a,
+                                const Tensor* b) {
+    if (error == TENSOR_ERROR_NONE) return error;
+
+    ctx->error = error;
+    ctx->op = op;
+    ctx->operands = 0;
+
+    // NULL operands are skipped, the others are recorded in order
+    const Tensor* operands[] = {a, b};
+    for (int i = 0; i < 2; i++) {
+        if (operands[i] == NULL) continue;
+        const int slot = ctx->operands++;
+        const int ndim = operands[i]->ndim;
+        ctx->ndim[slot] = ndim;
+        for (int d = 0; d < ndim && d < TENSOR_ERROR_CONTEXT_MAX_DIMS; d++) ctx->shape[slot][d] = operands[i]->shape[d];
+    }
+
+    return error;
+}
+
+size_t tensor_error_context_to_string(char* buffer, const size_t size, const TensorErrorContext* ctx) {
+    StringBuilder sb;
+    init_sb_fixed(&sb, buffer, size);
+
+    if (ctx->op) {
+        sb_append(&sb, ctx->op);
+        sb_append(&sb, ": ");
+    }
+    sb_append(&sb, tensor_error_to_string(ctx->error));
+
+    for (int i = 0; i < ctx->operands; i++) {
+        sb_append(&sb, i == 0 ? ", operand shapes [" : " and [");
+        for (int d = 0; d < ctx->ndim[i]; d++) {
+            if (d == TENSOR_ERROR_CONTEXT_MAX_DIMS) {
+                sb_append(&sb, ", ...");
+                break;
+            }
+
+            char dim_buff[21];
+            snprintf(dim_buff, sizeof(dim_buff), d == 0 ? "%d" : ", %d", ctx->shape[i][d]);
+            sb_append(&sb, dim_buff);
+        }
+        sb_append(&sb, "]");
+    }
+
+    return sb.len;
+}
 
 
@@ -0,0 +1,466 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tensor_async.h"
+#include "numa_placement.h"
+
+struct TensorFuture {
+    TensorQueue* queue;
+    TensorTaskFn fn;
+    void* arg;
+
+    // Arguments of tensor_submit_binary, kept inline so the wrapper needs no extra allocation
+    TensorBinaryOp binary_op;
+    Tensor* binary_out;
+    const Tensor* binary_a;
+    const Tensor* binary_b;
+
+    TensorError result;
+    TensorError dependency_error;
+    bool done;
+
+    int pending_dependencies;
+    TensorFuture** dependents;
+    int num_dependents;
+    int dependents_cap;
+
+    int refcount;
+    TensorFuture* next_ready;
+};
+
+/**
+ * Last writer and readers-since-last-write of one Tensor handle, and the elements the handle was last seen
+ * to span. Accesses through different handles are ordered when those spans overlap, so views and copied
+ * structs that share a buffer are ordered like the handle they alias.
+ * Only ever references unfinished futures, finished ones are purged on completion.
+ * If the last writer failed, its error is kept so later readers fail instead of reading an unwritten tensor
+ */
+typedef struct AccessRecord {
+    const Tensor* tensor;
+    const float* begin;     //< [begin, end) spans the elements of the handle's buffer, empty if not known
+    const float* end;
+    TensorFuture* writer;
+    TensorError writer_error;
+    TensorFuture** readers;
+    int num_readers;
+    int readers_cap;
+    struct AccessRecord* next;
+} AccessRecord;
+
+struct TensorQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+
+    pthread_t* threads;
+    int num_threads;
+    int node;     //< NUMA node the workers are pinned to, -1 for no pinning
+    bool shutdown;
+
+    TensorFuture* ready_head;
+    TensorFuture* ready_tail;
+    int in_flight;
+
+    AccessRecord* records;
+    TensorError first_error;
+};
+
+static int grow_array(void** array, int* cap, const int needed, const size_t elem_size) {
+    if (needed <= *cap) return 0;
+    const int new_cap = *cap ? *cap * 2 : 4;
+    void* grown = realloc(*array, new_cap * elem_size);
+    if (grown == NULL) return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static void future_release_locked(TensorFuture* future) {
+    if (--future->refcount > 0) return;
+    free(future->dependents);
+    free(future);
+}
+
+static void queue_push_ready(TensorQueue* queue, TensorFuture* future) {
+    future->next_ready = NULL;
+    if (queue->ready_tail) queue->ready_tail->next_ready = future;
+    else queue->ready_head = future;
+    queue->ready_tail = future;
+    pthread_cond_signal(&queue->work_available);
+}
+
+static AccessRecord* queue_find_record(TensorQueue* queue, const Tensor* tensor) {
+    for (AccessRecord* rec = queue->records; rec; rec = rec->next) {
+        if (rec->tensor == tensor) return rec;
+    }
+
+    AccessRecord* rec = calloc(1, sizeof *rec);
+    if (rec == NULL) return NULL;
+    rec->tensor = tensor;
+    rec->next = queue->records;
+    queue->records = rec;
+    return rec;
+}
+
+/**
+ * Elements a tensor reads from, or an empty span when its fields cannot be trusted: a pending writer may be
+ * filling them in, or the tensor has no buffer yet because the task allocates it
+ */
+static void access_span(const AccessRecord* rec, const Tensor* tensor, const bool allocated,
+                        const float** begin, const float** end) {
+    *begin = *end = NULL;
+    if (!allocated || rec->writer != NULL || rec->writer_error != TENSOR_ERROR_NONE || tensor->data == NULL) return;
+
+    ptrdiff_t low = 0, high = 0;
+    for (int d = 0; d < tensor->ndim; d++) {
+        if (tensor->shape[d] == 0) return;
+        const ptrdiff_t reach = (ptrdiff_t) (tensor->shape[d] - 1) * tensor->strides[d];
+        if (reach < 0) low += reach;
+        else high += reach;
+    }
+    *begin = tensor->data + low;
+    *end = tensor->data + high + 1;
+}
+
+static bool record_conflicts(const AccessRecord* rec, const Tensor* tensor, const float* begin, const float* end) {
+    if (rec->tensor == tensor) return true;
+    return begin < end && rec->begin < rec->end && begin < rec->end && rec->begin < end;
+}
+
+static void queue_purge_records(TensorQueue* queue, const TensorFuture* finished) {
+    AccessRecord** link = &queue->records;
+    while (*link) {
+        AccessRecord* rec = *link;
+        if (rec->writer == finished) {
+            rec->writer = NULL;
+            rec->writer_error = finished->result;
+        }
+
+        int kept = 0;
+        for (int i = 0; i < rec->num_readers; i++) {
+            if (rec->readers[i] != finished) rec->readers[kept++] = rec->readers[i];
+        }
+        rec->num_readers = kept;
+
+        if (rec->writer == NULL && rec->num_readers == 0 && rec->writer_error == TENSOR_ERROR_NONE) {
+            *link = rec->next;
+            free(rec->readers);
+            free(rec);
+        }else {
+            link = &rec->next;
+        }
+    }
+}
+
+static int future_depend_on(TensorFuture* future, TensorFuture* dependency) {
+    if (dependency == NULL || dependency == future) return 0;
+
+    for (int i = 0; i < dependency->num_dependents; i++) {
+        if (dependency->dependents[i] == future) return 0;
+    }
+
+    if (grow_array((void**) &dependency->dependents, &dependency->dependents_cap,
+                   dependency->num_dependents + 1, sizeof *dependency->dependents) < 0) return -1;
+
+    dependency->dependents[dependency->num_dependents++] = future;
+    future->pending_dependencies++;
+    return 0;
+}
+
+static int record_add_reader(AccessRecord* rec, TensorFuture* future) {
+    if (grow_array((void**) &rec->readers, &rec->readers_cap,
+                   rec->num_readers + 1, sizeof *rec->readers) < 0) return -1;
+    rec->readers[rec->num_readers++] = future;
+    return 0;
+}
+
+static void future_complete_locked(TensorQueue* queue, TensorFuture* future, const TensorError result) {
+    future->result = result;
+    future->done = true;
+
+    if (result != TENSOR_ERROR_NONE && queue->first_error == TENSOR_ERROR_NONE) {
+        queue->first_error = result;
+    }
+
+    queue_purge_records(queue, future);
+
+    for (int i = 0; i < future->num_dependents; i++) {
+        TensorFuture* dependent = future->dependents[i];
+        if (result != TENSOR_ERROR_NONE && dependent->dependency_error == TENSOR_ERROR_NONE) {
+            dependent->dependency_error = result;
+        }
+        if (--dependent->pending_dependencies == 0) queue_push_ready(queue, dependent);
+    }
+    future->num_dependents = 0;
+
+    queue->in_flight--;
+    pthread_cond_broadcast(&queue->work_done);
+
+    // Drop the scheduler's reference
+    future_release_locked(future);
+}
+
+static void* queue_worker(void* arg) {
+    TensorQueue* queue = arg;
+
+    // Results allocated by ops on a pinned queue land on the same node as the workers
+    if (queue->node >= 0) {
+        numa_placement_pin_current_thread(queue->node);
+        tensor_set_numa_policy(TENSOR_NUMA_BIND, queue->node);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        while (queue->ready_head == NULL && !queue->shutdown) {
+            pthread_cond_wait(&queue->work_available, &queue->lock);
+        }
+        if (queue->ready_head == NULL) break;
+
+        TensorFuture* future = queue->ready_head;
+        queue->ready_head = future->next_ready;
+        if (queue->ready_head == NULL) queue->ready_tail = NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        const TensorError result = future->dependency_error != TENSOR_ERROR_NONE
+                                 ? future->dependency_error
+                                 : future->fn(future->arg);
+
+        pthread_mutex_lock(&queue->lock);
+        future_complete_locked(queue, future, result);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+static TensorError run_binary(void* arg) {
+    const TensorFuture* future = arg;
+    return future->binary_op(future->binary_out, future->binary_a, future->binary_b);
+}
+
+static TensorError queue_create(TensorQueue** out, int num_threads, const int node) {
+    if (num_threads <= 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (int) cpus : 1;
+    }
+
+    TensorQueue* queue = calloc(1, sizeof *queue);
+    if (queue == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    queue->threads = malloc(num_threads * sizeof *queue->threads);
+    if (queue->threads == NULL) {
+        free(queue);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    queue->node = node;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work_available, NULL);
+    pthread_cond_init(&queue->work_done, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&queue->threads[i], NULL, queue_worker, queue) != 0) {
+            queue->num_threads = i;
+            tensor_queue_destroy(queue);
+            return TENSOR_ERROR_NO_MEMORY;
+        }
+    }
+    queue->num_threads = num_threads;
+
+    *out = queue;
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_queue_create(TensorQueue** out, const int num_threads) {
+    return queue_create(out, num_threads, -1);
+}
+
+TensorError tensor_queue_create_on_node(TensorQueue** out, const int num_threads, const int node) {
+    if (!numa_placement_available()) return TENSOR_ERROR_UNSUPPORTED;
+    if (node < 0 || node >= numa_placement_node_count()) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    return queue_create(out, num_threads, node);
+}
+
+void tensor_queue_destroy(TensorQueue* queue) {
+    tensor_queue_wait_all(queue);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = true;
+    pthread_cond_broadcast(&queue->work_available);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (int i = 0; i < queue->num_threads; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+
+    // Only records holding the error of a failed writer can remain once the queue is idle
+    while (queue->records) {
+        AccessRecord* rec = queue->records;
+        queue->records = rec->next;
+        free(rec->readers);
+        free(rec);
+    }
+
+    pthread_cond_destroy(&queue->work_done);
+    pthread_cond_destroy(&queue->work_available);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->threads);
+    free(queue);
+}
+
+TensorError tensor_queue_wait_all(TensorQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->in_flight > 0) {
+        pthread_cond_wait(&queue->work_done, &queue->lock);
+    }
+    const TensorError err = queue->first_error;
+    queue->first_error = TENSOR_ERROR_NONE;
+    pthread_mutex_unlock(&queue->lock);
+
+    return err;
+}
+
+static TensorFuture* future_create(TensorQueue* queue, const TensorTaskFn fn, void* arg, const bool keep_handle) {
+    TensorFuture* future = calloc(1, sizeof *future);
+    if (future == NULL) return NULL;
+
+    future->queue = queue;
+    future->fn = fn;
+    future->arg = arg;
+    future->refcount = keep_handle ? 2 : 1;
+    return future;
+}
+
+static TensorError queue_schedule(TensorQueue* queue, TensorFuture* future,
+                                  const Tensor* const* reads, const int num_reads,
+                                  Tensor* const* writes, const int num_writes, const bool writes_allocate) {
+    pthread_mutex_lock(&queue->lock);
+
+    // Count the submission itself as a dependency so nothing can start it until the graph is wired
+    future->pending_dependencies = 1;
+
+    int failed = 0;
+    for (int i = 0; i < num_reads && !failed; i++) {
+        AccessRecord* own = queue_find_record(queue, reads[i]);
+        if (own == NULL) {
+            failed = 1;
+            break;
+        }
+
+        const float* begin;
+        const float* end;
+        access_span(own, reads[i], true, &begin, &end);
+        for (const AccessRecord* rec = queue->records; rec && !failed; rec = rec->next) {
+            if (!record_conflicts(rec, reads[i], begin, end)) continue;
+            failed = future_depend_on(future, rec->writer) < 0;
+
+            if (rec->writer_error != TENSOR_ERROR_NONE && future->dependency_error == TENSOR_ERROR_NONE) {
+                future->dependency_error = rec->writer_error;
+            }
+        }
+
+        if (!failed) failed = record_add_reader(own, future) < 0;
+        if (begin < end) {
+            own->begin = begin;
+            own->end = end;
+        }
+    }
+
+    for (int i = 0; i < num_writes && !failed; i++) {
+        AccessRecord* own = queue_find_record(queue, writes[i]);
+        if (own == NULL) {
+            failed = 1;
+            break;
+        }
+
+        const float* begin;
+        const float* end;
+        access_span(own, writes[i], !writes_allocate, &begin, &end);
+        for (const AccessRecord* rec = queue->records; rec && !failed; rec = rec->next) {
+            if (!record_conflicts(rec, writes[i], begin, end)) continue;
+            failed = future_depend_on(future, rec->writer) < 0;
+            for (int r = 0; r < rec->num_readers && !failed; r++) {
+                failed = future_depend_on(future, rec->readers[r]) < 0;
+            }
+        }
+
+        own->writer = future;
+        own->writer_error = TENSOR_ERROR_NONE;
+        own->num_readers = 0;
+        if (begin < end) {
+            own->begin = begin;
+            own->end = end;
+        }
+    }
+
+    // The graph may already reference the future, so a failed submission still completes through the scheduler
+    if (failed) future->dependency_error = TENSOR_ERROR_NO_MEMORY;
+
+    queue->in_flight++;
+    if (--future->pending_dependencies == 0) queue_push_ready(queue, future);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return failed ? TENSOR_ERROR_NO_MEMORY : TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_submit(TensorFuture** out, TensorQueue* queue, const TensorTaskFn fn, void* arg,
+                          const Tensor* const* reads, const int num_reads, Tensor* const* writes, const int num_writes) {
+    TensorFuture* future = future_create(queue, fn, arg, out != NULL);
+    if (future == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    if (out) *out = future;
+    return queue_schedule(queue, future, reads, num_reads, writes, num_writes, false);
+}
+
+TensorError tensor_submit_binary(TensorFuture** out, TensorQueue* queue, const TensorBinaryOp op,
+                                 Tensor* out_tensor, const Tensor* a, const Tensor* b) {
+    TensorFuture* future = future_create(queue, run_binary, NULL, out != NULL);
+    if (future == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    future->arg = future;
+    future->binary_op = op;
+    future->binary_out = out_tensor;
+    future->binary_a = a;
+    future->binary_b = b;
+
+    const Tensor* reads[] = {a, b};
+    Tensor* writes[] = {out_tensor};
+
+    if (out) *out = future;
+    return queue_schedule(queue, future, reads, 2, writes, 1, true);
+}
+
+TensorError tensor_future_wait(TensorFuture* future) {
+    TensorQueue* queue = future->queue;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!future->done) {
+        pthread_cond_wait(&queue->work_done, &queue->lock);
+    }
+    const TensorError err = future->result;
+    pthread_mutex_unlock(&queue->lock);
+
+    return err;
+}
+
+bool tensor_future_is_ready(TensorFuture* future) {
+    TensorQueue* queue = future->queue;
+
+    pthread_mutex_lock(&queue->lock);
+    const bool done = future->done;
+    pthread_mutex_unlock(&queue->lock);
+
+    return done;
+}
+
+void tensor_future_release(TensorFuture* future) {
+    TensorQueue* queue = future->queue;
+
+    pthread_mutex_lock(&queue->lock);
+    future_release_locked(future);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,365 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+#define MIN(a,b)((a) < (b) ? (a) : (b))
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ATTENTION_HAS_X86_KERNELS 1
+#endif
+
+#define ATTENTION_BLOCK_Q 64        //< Query rows per work unit, sharing every packed key tile
+#define ATTENTION_BLOCK_K 64        //< Keys per tile of the online softmax, a multiple of GEMM_NR
+#define ATTENTION_ALIGNMENT 64
+#define ATTENTION_LANES 16
+#define ATTENTION_EXP_MIN_BITS 0xC2AE0000u  //< -87.0f: exp flushes to 0 from here down, keeping 2^n a normal float
+
+/**
+ * Queries are split into blocks of ATTENTION_BLOCK_Q rows and every block walks the keys one tile at a
+ * time. The tile of K is packed transposed and the matching tile of V as is, both in the column panels
+ * of tensor_gemm.c, so the block's scores and its update of the output are two small products run
+ * through the same register-tile kernels as the packed GEMM.
+ *
+ * Each row keeps the running maximum m and normalizer l of the online softmax. A tile with a larger
+ * maximum rescales the accumulated output and normalizer by exp(m_old - m_new) before its own
+ * probabilities are added, so only one tile of scores per row ever exists and the output is divided
+ * by l once at the end. Rows do not depend on each other, so results do not depend on the thread count.
+ */
+typedef struct {
+    const float* data;
+    int batch_strides[TENSOR_KERNEL_MAX_DIMS];
+    int row_stride;
+    int col_stride;
+} AttentionOperand;
+
+typedef struct {
+    AttentionOperand q;
+    AttentionOperand k;
+    AttentionOperand v;
+    AttentionOperand mask;
+    int has_mask;
+
+    int batch_ndim;
+    const int* batch_shape;
+    int lq;
+    int lk;
+    int d;
+    int dv;
+    float scale;
+
+    GemmKernel kernel;
+    int v_panels;
+    int q_blocks;
+    int units;
+    int chunks;
+    size_t scratch_length;
+    float* scratch;
+    float* out;
+} AttentionJob;
+
+/**
+ * exp(x) for x <= 0 as a branch-free polynomial that vectorizes, within a few ulp of expf. Arguments at or
+ * below -87, -inf included, flush to 0. The clamp and the flush work on the float bits, where
+ * more negative means larger: float selects are not if-converted, and GCC merges two selects on one
+ * condition back into a branch, so the flush tests the clamped bits instead of repeating the comparison
+ */
+static inline __attribute__((always_inline)) float attention_exp(const float x) {
+    uint32_t x_bits;
+    memcpy(&x_bits, &x, sizeof x_bits);
+    x_bits = x_bits < ATTENTION_EXP_MIN_BITS ? x_bits : ATTENTION_EXP_MIN_BITS;
+    float clamped;
+    memcpy(&clamped, &x_bits, sizeof clamped);
+
+    const float n = (clamped * 1.44269504f + 12582912.0f) - 12582912.0f;
+    const float f = clamped - n * 0.693145751953125f - n * 1.42860677e-6f;
+
+    float p = 1.98412698e-4f;
+    p = p * f + 1.38888889e-3f;
+    p = p * f + 8.33333333e-3f;
+    p = p * f + 4.16666667e-2f;
+    p = p * f + 1.66666667e-1f;
+    p = p * f + 0.5f;
+    p = p * f + 1.0f;
+    p = p * f + 1.0f;
+
+    const int32_t exponent = ((int32_t) n + 127) << 23;
+    float scale;
+    memcpy(&scale, &exponent, sizeof scale);
+
+    const float result = p * scale;
+    uint32_t bits;
+    memcpy(&bits, &result, sizeof bits);
+    bits &= -(uint32_t) (x_bits != ATTENTION_EXP_MIN_BITS);
+    float flushed;
+    memcpy(&flushed, &bits, sizeof flushed);
+    return flushed;
+}
+
+static int batch_offset(const AttentionOperand* op, const int* batch_shape, const int batch_ndim, int batch) {
+    int offset = 0;
+    for (int dim = batch_ndim - 1; dim >= 0; dim--) {
+        offset += batch % batch_shape[dim] * op->batch_strides[dim];
+        batch /= batch_shape[dim];
+    }
+    return offset;
+}
+
+// Runs rows x (panels * GEMM_NR) of a product through the GEMM kernel, MR rows at a time
+static void attention_product(const AttentionJob* job, const int rows, const int kc, const float* a, const int lda,
+                              const float* b, const int panels, float* c, const int ldc, const int accumulate) {
+    const int mr = job->kernel.mr;
+    for (int r = 0; r < rows; r += mr) {
+        const int height = MIN(mr, rows - r);
+        const float* a_tile[GEMM_MR_MAX];
+        for (int i = 0; i < height; i++) a_tile[i] = &a[(r + i) * lda];
+
+        for (int jp = 0; jp < panels; jp++) {
+            job->kernel.fn(height, kc, a_tile, 1, &b[(size_t) jp * kc * GEMM_NR], &c[r * ldc + jp * GEMM_NR], ldc,
+                           accumulate);
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+void attention_unit(const AttentionJob* job, const int unit, float* scratch) {
+    enum { BQ = ATTENTION_BLOCK_Q, BK = ATTENTION_BLOCK_K, K_PANELS = ATTENTION_BLOCK_K / GEMM_NR };
+    const int d = job->d;
+    const int dv = job->dv;
+    const int v_panels = job->v_panels;
+    const int ld_acc = v_panels * GEMM_NR;
+    const int batch = unit / job->q_blocks;
+    const int q0 = unit % job->q_blocks * BQ;
+    const int rows = MIN(BQ, job->lq - q0);
+
+    float* restrict kt = scratch;
+    float* restrict vt = &kt[(size_t) d * BK];
+    float* restrict qs = &vt[(size_t) BK * ld_acc];
+    float* restrict scores = &qs[(size_t) BQ * d];
+    float* restrict acc = &scores[BQ * BK];
+    float* restrict m = &acc[(size_t) BQ * ld_acc];
+    float* restrict l = &m[BQ];
+
+    const float* q = &job->q.data[batch_offset(&job->q, job->batch_shape, job->batch_ndim, batch)];
+    const float* k = &job->k.data[batch_offset(&job->k, job->batch_shape, job->batch_ndim, batch)];
+    const float* v = &job->v.data[batch_offset(&job->v, job->batch_shape, job->batch_ndim, batch)];
+    const float* mask = job->has_mask
+        ? &job->mask.data[batch_offset(&job->mask, job->batch_shape, job->batch_ndim, batch)]
+        : NULL;
+
+    for (int i = 0; i < rows; i++) {
+        const float* q_row = &q[(q0 + i) * job->q.row_stride];
+        for (int c = 0; c < d; c++) qs[i * d + c] = q_row[c * job->q.col_stride] * job->scale;
+        for (int e = 0; e < ld_acc; e++) acc[i * ld_acc + e] = 0.0f;
+        m[i] = -INFINITY;
+        l[i] = 0.0f;
+    }
+
+    for (int k0 = 0; k0 < job->lk; k0 += BK) {
+        const int kn = MIN(BK, job->lk - k0);
+
+        // K^T in column panels of the tile's keys, V in column panels of its values, both zero padded
+        for (int j = 0; j < BK; j++) {
+            float* panel = &kt[j / GEMM_NR * d * GEMM_NR + j % GEMM_NR];
+            if (j >= kn) {
+                for (int c = 0; c < d; c++) panel[c * GEMM_NR] = 0.0f;
+                continue;
+            }
+            const float* k_row = &k[(k0 + j) * job->k.row_stride];
+            for (int c = 0; c < d; c++) panel[c * GEMM_NR] = k_row[c * job->k.col_stride];
+        }
+        for (int jp = 0; jp < v_panels; jp++) {
+            const int width = MIN(GEMM_NR, dv - jp * GEMM_NR);
+            for (int j = 0; j < kn; j++) {
+                const float* v_row = &v[(k0 + j) * job->v.row_stride + jp * GEMM_NR * job->v.col_stride];
+                float* restrict dst = &vt[((size_t) jp * kn + j) * GEMM_NR];
+                for (int e = 0; e < width; e++) dst[e] = v_row[e * job->v.col_stride];
+                for (int e = width; e < GEMM_NR; e++) dst[e] = 0.0f;
+            }
+        }
+
+        attention_product(job, rows, d, qs, d, kt, K_PANELS, scores, BK, 0);
+
+        for (int i = 0; i < rows; i++) {
+            float* restrict s = &scores[i * BK];
+            if (mask) {
+                const float* mask_row = &mask[(q0 + i) * job->mask.row_stride + k0 * job->mask.col_stride];
+                for (int j = 0; j < kn; j++) s[j] += mask_row[j * job->mask.col_stride];
+            }
+            for (int j = kn; j < BK; j++) s[j] = -INFINITY;
+
+            float lanes[ATTENTION_LANES];
+            for (int j = 0; j < ATTENTION_LANES; j++) lanes[j] = s[j];
+            for (int j0 = ATTENTION_LANES; j0 < BK; j0 += ATTENTION_LANES) {
+                for (int j = 0; j < ATTENTION_LANES; j++) lanes[j] = s[j0 + j] > lanes[j] ? s[j0 + j] : lanes[j];
+            }
+            float m_new = m[i];
+            for (int j = 0; j < ATTENTION_LANES; j++) m_new = lanes[j] > m_new ? lanes[j] : m_new;
+
+            // Every key so far is masked out for this row: its probabilities are 0 and nothing is rescaled
+            if (m_new == -INFINITY) {
+                for (int j = 0; j < BK; j++) s[j] = 0.0f;
+                continue;
+            }
+
+            for (int j = 0; j < ATTENTION_LANES; j++) lanes[j] = 0.0f;
+            for (int j0 = 0; j0 < BK; j0 += ATTENTION_LANES) {
+                for (int j = 0; j < ATTENTION_LANES; j++) {
+                    const float p = attention_exp(s[j0 + j] - m_new);
+                    s[j0 + j] = p;
+                    lanes[j] += p;
+                }
+            }
+            float sum = 0.0f;
+            for (int j = 0; j < ATTENTION_LANES; j++) sum += lanes[j];
+
+            const float alpha = attention_exp(m[i] - m_new);
+            float* restrict acc_row = &acc[i * ld_acc];
+            for (int e = 0; e < ld_acc; e++) acc_row[e] *= alpha;
+            l[i] = l[i] * alpha + sum;
+            m[i] = m_new;
+        }
+
+        attention_product(job, rows, kn, scores, BK, vt, v_panels, acc, ld_acc, 1);
+    }
+
+    for (int i = 0; i < rows; i++) {
+        float* restrict out = &job->out[((size_t) batch * job->lq + q0 + i) * dv];
+        const float inv = l[i] > 0.0f ? 1.0f / l[i] : 0.0f;
+        for (int e = 0; e < dv; e++) out[e] = acc[i * ld_acc + e] * inv;
+    }
+}
+
+static inline __attribute__((always_inline))
+void attention_chunks(const AttentionJob* job, const int begin, const int end) {
+    for (int chunk = begin; chunk < end; chunk++) {
+        int first, last;
+        parallel_chunk_range(job->units, chunk, job->chunks, &first, &last);
+        float* scratch = &job->scratch[(size_t) chunk * job->scratch_length];
+        for (int unit = first; unit < last; unit++) attention_unit(job, unit, scratch);
+    }
+}
+
+static void attention_range_default(void* ctx, const int begin, const int end) {
+    attention_chunks(ctx, begin, end);
+}
+
+#ifdef ATTENTION_HAS_X86_KERNELS
+__attribute__((target("avx2,fma")))
+static void attention_range_avx2(void* ctx, const int begin, const int end) {
+    attention_chunks(ctx, begin, end);
+}
+#endif
+
+// Folds the batch dimensions of t, all but its last two, into the right-aligned broadcast batch shape
+static int broadcast_batch(int* shape, int* ndim, const Tensor* t) {
+    const int t_ndim = MAX(0, t->ndim - 2);
+    for (int i = 1; i <= t_ndim; i++) {
+        const int dim = t->shape[t_ndim - i];
+        int* slot = &shape[TENSOR_KERNEL_MAX_DIMS - i];
+        if (*slot != dim && *slot != 1 && dim != 1) return -1;
+        if (dim != 1) *slot = dim;
+    }
+    *ndim = MAX(*ndim, t_ndim);
+    return 0;
+}
+
+static void operand_init(AttentionOperand* op, const Tensor* t, const int batch_ndim) {
+    const int t_ndim = MAX(0, t->ndim - 2);
+    for (int i = 0; i < batch_ndim; i++) {
+        const int dim = i - (batch_ndim - t_ndim);
+        op->batch_strides[i] = dim < 0 || t->shape[dim] == 1 ? 0 : t->strides[dim];
+    }
+    op->data = t->data;
+    op->row_stride = t->ndim < 2 || t->shape[t->ndim - 2] == 1 ? 0 : t->strides[t->ndim - 2];
+    op->col_stride = t->shape[t->ndim - 1] == 1 ? 0 : t->strides[t->ndim - 1];
+}
+
+static TensorError attention(Tensor* out, const Tensor* q, const Tensor* k, const Tensor* v, const Tensor* mask) {
+    if (q->ndim < 2 || k->ndim < 2 || v->ndim < 2) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (mask && mask->ndim < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const int lq = q->shape[q->ndim - 2];
+    const int d = q->shape[q->ndim - 1];
+    const int lk = k->shape[k->ndim - 2];
+    const int dv = v->shape[v->ndim - 1];
+    if (k->shape[k->ndim - 1] != d || v->shape[v->ndim - 2] != lk) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    int batch[TENSOR_KERNEL_MAX_DIMS];
+    int batch_ndim = 0;
+    for (int i = 0; i < TENSOR_KERNEL_MAX_DIMS; i++) batch[i] = 1;
+
+    const Tensor* operands[] = {q, k, v, mask};
+    for (int i = 0; i < 4 && operands[i]; i++) {
+        if (operands[i]->ndim > TENSOR_KERNEL_MAX_DIMS - 2) return TENSOR_ERROR_INVALID_ARGUMENT;
+        if (broadcast_batch(batch, &batch_ndim, operands[i]) < 0) return TENSOR_ERROR_CANNOT_BROADCAST;
+    }
+    if (mask) {
+        const int mask_k = mask->shape[mask->ndim - 1];
+        const int mask_q = mask->ndim < 2 ? 1 : mask->shape[mask->ndim - 2];
+        if ((mask_k != lk && mask_k != 1) || (mask_q != lq && mask_q != 1)) return TENSOR_ERROR_CANNOT_BROADCAST;
+    }
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(shape, &batch[TENSOR_KERNEL_MAX_DIMS - batch_ndim], batch_ndim * sizeof *shape);
+    shape[batch_ndim] = lq;
+    shape[batch_ndim + 1] = dv;
+
+    TensorError err = tensor_empty(out, shape, batch_ndim + 2);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out->length == 0) return TENSOR_ERROR_NONE;
+
+    AttentionJob job = {
+        .has_mask = mask != NULL,
+        .batch_ndim = batch_ndim,
+        .batch_shape = shape,
+        .lq = lq,
+        .lk = lk,
+        .d = d,
+        .dv = dv,
+        .scale = d > 0 ? 1.0f / sqrtf((float) d) : 1.0f,
+        .q_blocks = (lq + ATTENTION_BLOCK_Q - 1) / ATTENTION_BLOCK_Q,
+        .out = out->data,
+    };
+    operand_init(&job.q, q, batch_ndim);
+    operand_init(&job.k, k, batch_ndim);
+    operand_init(&job.v, v, batch_ndim);
+    if (mask) operand_init(&job.mask, mask, batch_ndim);
+
+    job.kernel = gemm_kernel();
+    job.v_panels = (dv + GEMM_NR - 1) / GEMM_NR;
+    job.units = out->length / (lq * dv) * job.q_blocks;
+    job.chunks = MIN(job.units, parallel_num_threads());
+
+    // Packed K and V tiles, the scaled query block, its scores and accumulators, m and l, per chunk.
+    // Every region is a multiple of GEMM_NR floats, so the panels stay aligned for the kernels
+    const int ld_acc = job.v_panels * GEMM_NR;
+    job.scratch_length = (size_t) d * ATTENTION_BLOCK_K + (size_t) ATTENTION_BLOCK_K * ld_acc
+                       + (size_t) ATTENTION_BLOCK_Q * (d + ATTENTION_BLOCK_K + ld_acc + 2);
+    void* scratch;
+    if (posix_memalign(&scratch, ATTENTION_ALIGNMENT, job.scratch_length * job.chunks * sizeof(float)) != 0) {
+        tensor_free(out);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+    job.scratch = scratch;
+
+    ParallelRangeFn range = attention_range_default;
+#ifdef ATTENTION_HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) range = attention_range_avx2;
+#endif
+    parallel_for(job.chunks, 1, range, &job);
+
+    free(job.scratch);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_attention(Tensor* out, const Tensor* q, const Tensor* k, const Tensor* v, const Tensor* mask) {
+    const ProfileScope scope = profile_begin("tensor_attention");
+    return profile_end(&scope, attention(out, q, k, v, mask));
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "tensor_kernels.h"
+
+#define OC_BLOCK 8
+#define OW_TILE 8
+
+/**
+ * Strides of the four logical axes (batch, channel, height, width) of a 4D tensor,
+ * resolved from its layout so that one kernel serves both NCHW and NHWC
+ */
+typedef struct {
+    int n;
+    int c;
+    int h;
+    int w;
+} AxisStrides;
+
+static AxisStrides conv_axis_strides(const Tensor* tensor, const TensorLayout layout) {
+    AxisStrides s;
+    s.n = tensor->strides[0];
+    if (layout == TENSOR_LAYOUT_NHWC) {
+        s.h = tensor->strides[1];
+        s.w = tensor->strides[2];
+        s.c = tensor->strides[3];
+    }else {
+        s.c = tensor->strides[1];
+        s.h = tensor->strides[2];
+        s.w = tensor->strides[3];
+    }
+    return s;
+}
+
+/**
+ * Packs OIHW weights into an output-channel blocked layout [G][OB][Cin_g][KH][KW][OC_BLOCK].
+ * The innermost OC_BLOCK lane is contiguous so the kernel can broadcast one input value
+ * against a whole block of output channels. Channels past the end of a group are zero padded.
+ */
+static void conv_pack_weights(float* packed, const Tensor* weight, const int groups, const int cout_g,
+                              const int blocks_per_group) {
+    const int cin_g = weight->shape[1];
+    const int kh = weight->shape[2];
+    const int kw = weight->shape[3];
+    const int block_size = cin_g * kh * kw * OC_BLOCK;
+
+    memset(packed, 0, (size_t) groups * blocks_per_group * block_size * sizeof *packed);
+
+    for (int g = 0; g < groups; g++) {
+        for (int oc = 0; oc < cout_g; oc++) {
+            const int w_oc = g * cout_g + oc;
+            float* dst = &packed[(g * blocks_per_group + oc / OC_BLOCK) * block_size + oc % OC_BLOCK];
+
+            for (int ic = 0; ic < cin_g; ic++) {
+                for (int y = 0; y < kh; y++) {
+                    for (int x = 0; x < kw; x++) {
+                        const int src = w_oc * weight->strides[0] + ic * weight->strides[1]
+                                      + y * weight->strides[2] + x * weight->strides[3];
+                        dst[((ic * kh + y) * kw + x) * OC_BLOCK] = weight->data[src];
+                    }
+                }
+            }
+        }
+    }
+}
+
+TensorError conv2d_output_shape(int* shape, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                                const TensorConv2dParams* params) {
+    if (input->ndim != 4 || weight->ndim != 4) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (params->stride_h < 1 || params->stride_w < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (params->dilation_h < 1 || params->dilation_w < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (params->pad_h < 0 || params->pad_w < 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (params->groups < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const int nhwc = params->layout == TENSOR_LAYOUT_NHWC;
+
+    const int batch = input->shape[0];
+    const int c_in = nhwc ? input->shape[3] : input->shape[1];
+    const int h_in = nhwc ? input->shape[1] : input->shape[2];
+    const int w_in = nhwc ? input->shape[2] : input->shape[3];
+
+    const int c_out = weight->shape[0];
+    const int groups = params->groups;
+
+    if (c_in % groups != 0 || c_out % groups != 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (c_in / groups != weight->shape[1]) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    if (bias && (bias->ndim != 1 || bias->shape[0] != c_out)) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    // The padded input must hold one full dilated window, checked before dividing since C division truncates toward zero
+    const int h_span = h_in + 2 * params->pad_h - params->dilation_h * (weight->shape[2] - 1) - 1;
+    const int w_span = w_in + 2 * params->pad_w - params->dilation_w * (weight->shape[3] - 1) - 1;
+    if (h_span < 0 || w_span < 0) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    const int h_out = h_span / params->stride_h + 1;
+    const int w_out = w_span / params->stride_w + 1;
+
+    shape[0] = batch;
+    shape[1] = nhwc ? h_out : c_out;
+    shape[2] = nhwc ? w_out : h_out;
+    shape[3] = nhwc ? c_out : w_out;
+
+    return TENSOR_ERROR_NONE;
+}
+
+size_t conv2d_scratch_length(const Tensor* weight, const TensorConv2dParams* params) {
+    const int cout_g = weight->shape[0] / params->groups;
+    const int blocks_per_group = (cout_g + OC_BLOCK - 1) / OC_BLOCK;
+    return (size_t) params->groups * blocks_per_group * weight->shape[1] * weight->shape[2] * weight->shape[3] * OC_BLOCK;
+}
+
+void conv2d_into(const Tensor* out, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                 const TensorConv2dParams* params, float* scratch) {
+    const TensorLayout layout = params->layout;
+    const int nhwc = layout == TENSOR_LAYOUT_NHWC;
+
+    const int batch = input->shape[0];
+    const int h_in = nhwc ? input->shape[1] : input->shape[2];
+    const int w_in = nhwc ? input->shape[2] : input->shape[3];
+    const int h_out = nhwc ? out->shape[1] : out->shape[2];
+    const int w_out = nhwc ? out->shape[2] : out->shape[3];
+
+    const int c_out = weight->shape[0];
+    const int cin_g = weight->shape[1];
+    const int k_h = weight->shape[2];
+    const int k_w = weight->shape[3];
+    const int groups = params->groups;
+
+    const int sh = params->stride_h;
+    const int sw = params->stride_w;
+    const int ph = params->pad_h;
+    const int pw = params->pad_w;
+    const int dh = params->dilation_h;
+    const int dw = params->dilation_w;
+
+    const int cout_g = c_out / groups;
+    const int blocks_per_group = (cout_g + OC_BLOCK - 1) / OC_BLOCK;
+    const int block_size = cin_g * k_h * k_w * OC_BLOCK;
+
+    float* packed = scratch;
+    conv_pack_weights(packed, weight, groups, cout_g, blocks_per_group);
+
+    const AxisStrides is = conv_axis_strides(input, layout);
+    const AxisStrides os = conv_axis_strides(out, layout);
+
+    for (int n = 0; n < batch; n++) {
+        for (int g = 0; g < groups; g++) {
+            for (int ob = 0; ob < blocks_per_group; ob++) {
+                const float* w_block = &packed[(g * blocks_per_group + ob) * block_size];
+                const int oc_base = g * cout_g + ob * OC_BLOCK;
+                const int oc_count = cout_g - ob * OC_BLOCK < OC_BLOCK ? cout_g - ob * OC_BLOCK : OC_BLOCK;
+
+                float bias_block[OC_BLOCK] = {0};
+                if (bias) {
+                    for (int o = 0; o < oc_count; o++) {
+                        bias_block[o] = bias->data[(oc_base + o) * bias->strides[0]];
+                    }
+                }
+
+                for (int oh = 0; oh < h_out; oh++) {
+                    for (int ow0 = 0; ow0 < w_out; ow0 += OW_TILE) {
+                        const int tile = w_out - ow0 < OW_TILE ? w_out - ow0 : OW_TILE;
+                        float acc[OW_TILE][OC_BLOCK];
+
+                        for (int t = 0; t < tile; t++) {
+                            memcpy(acc[t], bias_block, sizeof bias_block);
+                        }
+
+                        for (int ic = 0; ic < cin_g; ic++) {
+                            const float* in_c = &input->data[n * is.n + (g * cin_g + ic) * is.c];
+
+                            for (int y = 0; y < k_h; y++) {
+                                const int ih = oh * sh - ph + y * dh;
+                                if (ih < 0 || ih >= h_in) continue;
+                                const float* in_row = &in_c[ih * is.h];
+
+                                for (int x = 0; x < k_w; x++) {
+                                    const float* w_vec = &w_block[((ic * k_h + y) * k_w + x) * OC_BLOCK];
+
+                                    for (int t = 0; t < tile; t++) {
+                                        const int iw = (ow0 + t) * sw - pw + x * dw;
+                                        if (iw < 0 || iw >= w_in) continue;
+                                        const float value = in_row[iw * is.w];
+
+                                        for (int o = 0; o < OC_BLOCK; o++) {
+                                            acc[t][o] += value * w_vec[o];
+                                        }
+                                    }
+                                }
+                            }
+                        }
+
+                        for (int t = 0; t < tile; t++) {
+                            float* out_px = &out->data[n * os.n + oh * os.h + (ow0 + t) * os.w];
+                            for (int o = 0; o < oc_count; o++) {
+                                out_px[(oc_base + o) * os.c] = acc[t][o];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static TensorError conv2d(Tensor* out, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                          const TensorConv2dParams* params) {
+    int shape[4];
+
+    TensorError err = conv2d_output_shape(shape, input, weight, bias, params);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    float* scratch = malloc(conv2d_scratch_length(weight, params) * sizeof *scratch);
+    if (scratch == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    err = tensor_empty(out, shape, 4);
+    if (err == TENSOR_ERROR_NONE) conv2d_into(out, input, weight, bias, params, scratch);
+
+    free(scratch);
+    return err;
+}
+
+TensorError tensor_conv2d(Tensor* out, const Tensor* input, const Tensor* weight, const Tensor* bias,
+                          const TensorConv2dParams* params) {
+    const ProfileScope scope = profile_begin("tensor_conv2d");
+    return profile_end(&scope, conv2d(out, input, weight, bias, params));
+}
@@ -0,0 +1,616 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+#define MIN(a,b)((a) < (b) ? (a) : (b))
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gemm_tuning.h"
+#include "op_profile.h"
+#include "tensor_gemm.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEMM_HAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Blocked GEMM in the style of BLIS: C is computed in MR x GEMM_NR register tiles, each a sum of
+ * rank-1 updates over one K block at a time. The B panel of a tile (GEMM_KC x GEMM_NR) stays in L1,
+ * the MR rows of A it is multiplied with stay in L2 across the panels of a work unit.
+ *
+ * A is read in place through per-row pointers, so batched and strided left operands need no copy.
+ * The panel width is the same for every kernel, which keeps the packed layout independent of the
+ * kernel picked at run time; only the number of rows per tile differs.
+ *
+ * The constants below are the defaults; tensor_gemm_tune replaces them per shape (see gemm_tuning.h).
+ */
+#define GEMM_KC 256
+#define GEMM_UNIT_ROWS 48      //< Multiple of every kernel's MR
+#define GEMM_UNIT_PANELS 8
+#define GEMM_ALIGNMENT 64
+
+struct TensorPackedWeights {
+    int k;
+    int n;
+    int kc;
+    int panels;
+    float* data;    //< [K / kc][panels][kc][GEMM_NR], a K block starts at k0 * panels * GEMM_NR
+    GemmTunedShape* tuned;  //< Configurations tuned for this weight when it was packed, read without locking
+    int num_tuned;
+};
+
+#define GEMM_GENERIC_MR 4
+
+static void gemm_kernel_generic(const int rows, const int kc, const float* const* a, const int a_stride,
+                                const float* b, float* c, const int ldc, const int accumulate) {
+    float acc[GEMM_GENERIC_MR][GEMM_NR];
+    for (int r = 0; r < rows; r++) {
+        for (int j = 0; j < GEMM_NR; j++) acc[r][j] = accumulate ? c[r * ldc + j] : 0.0f;
+    }
+
+    for (int p = 0; p < kc; p++) {
+        const float* b_row = &b[p * GEMM_NR];
+        for (int r = 0; r < rows; r++) {
+            const float x = a[r][p * a_stride];
+            for (int j = 0; j < GEMM_NR; j++) acc[r][j] += x * b_row[j];
+        }
+    }
+
+    for (int r = 0; r < rows; r++) {
+        for (int j = 0; j < GEMM_NR; j++) c[r * ldc + j] = acc[r][j];
+    }
+}
+
+#ifdef GEMM_HAS_X86_KERNELS
+/**
+ * The x86 tiles are written once for a compile-time row count and instantiated for every count up to
+ * MR, so a short edge (or a single-row product) keeps its accumulators in registers without computing
+ * discarded rows
+ */
+__attribute__((target("avx2,fma"))) static inline __attribute__((always_inline))
+void gemm_tile_avx2(const int rows, const int kc, const float* const* a, const int a_stride, const float* b,
+                    float* c, const int ldc, const int accumulate) {
+    __m256 acc[6][2];
+    for (int r = 0; r < rows; r++) {
+        acc[r][0] = accumulate ? _mm256_loadu_ps(&c[r * ldc]) : _mm256_setzero_ps();
+        acc[r][1] = accumulate ? _mm256_loadu_ps(&c[r * ldc + 8]) : _mm256_setzero_ps();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        const __m256 b0 = _mm256_load_ps(&b[p * GEMM_NR]);
+        const __m256 b1 = _mm256_load_ps(&b[p * GEMM_NR + 8]);
+        for (int r = 0; r < rows; r++) {
+            const __m256 x = _mm256_broadcast_ss(&a[r][p * a_stride]);
+            acc[r][0] = _mm256_fmadd_ps(x, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(x, b1, acc[r][1]);
+        }
+    }
+
+    for (int r = 0; r < rows; r++) {
+        _mm256_storeu_ps(&c[r * ldc], acc[r][0]);
+        _mm256_storeu_ps(&c[r * ldc + 8], acc[r][1]);
+    }
+}
+
+// 6 rows x 2 vectors: 12 accumulators, 2 B vectors and the broadcast fill 15 of the 16 registers
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(const int rows, const int kc, const float* const* a, const int a_stride,
+                             const float* b, float* c, const int ldc, const int accumulate) {
+    switch (rows) {
+        case 1: gemm_tile_avx2(1, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 2: gemm_tile_avx2(2, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 3: gemm_tile_avx2(3, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 4: gemm_tile_avx2(4, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 5: gemm_tile_avx2(5, kc, a, a_stride, b, c, ldc, accumulate); break;
+        default: gemm_tile_avx2(6, kc, a, a_stride, b, c, ldc, accumulate); break;
+    }
+}
+
+__attribute__((target("avx512f"))) static inline __attribute__((always_inline))
+void gemm_tile_avx512(const int rows, const int kc, const float* const* a, const int a_stride, const float* b,
+                      float* c, const int ldc, const int accumulate) {
+    __m512 acc[12];
+    for (int r = 0; r < rows; r++) acc[r] = accumulate ? _mm512_loadu_ps(&c[r * ldc]) : _mm512_setzero_ps();
+
+    for (int p = 0; p < kc; p++) {
+        const __m512 b0 = _mm512_load_ps(&b[p * GEMM_NR]);
+        for (int r = 0; r < rows; r++) {
+            acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a[r][p * a_stride]), b0, acc[r]);
+        }
+    }
+
+    for (int r = 0; r < rows; r++) _mm512_storeu_ps(&c[r * ldc], acc[r]);
+}
+
+// 12 rows x 1 vector: 12 of the 32 registers hold accumulators, enough independent FMAs to hide their latency
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(const int rows, const int kc, const float* const* a, const int a_stride,
+                               const float* b, float* c, const int ldc, const int accumulate) {
+    switch (rows) {
+        case 1: gemm_tile_avx512(1, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 2: gemm_tile_avx512(2, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 3: gemm_tile_avx512(3, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 4: gemm_tile_avx512(4, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 5: gemm_tile_avx512(5, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 6: gemm_tile_avx512(6, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 7: gemm_tile_avx512(7, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 8: gemm_tile_avx512(8, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 9: gemm_tile_avx512(9, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 10: gemm_tile_avx512(10, kc, a, a_stride, b, c, ldc, accumulate); break;
+        case 11: gemm_tile_avx512(11, kc, a, a_stride, b, c, ldc, accumulate); break;
+        default: gemm_tile_avx512(12, kc, a, a_stride, b, c, ldc, accumulate); break;
+    }
+}
+#endif
+
+// Fails for kernels the CPU or the build lacks
+static bool gemm_kernel_variant(const TensorGemmKernel variant, GemmKernel* kernel) {
+    switch (variant) {
+        case TENSOR_GEMM_KERNEL_GENERIC:
+            *kernel = (GemmKernel) {gemm_kernel_generic, GEMM_GENERIC_MR};
+            return true;
+#ifdef GEMM_HAS_X86_KERNELS
+        case TENSOR_GEMM_KERNEL_AVX2:
+            *kernel = (GemmKernel) {gemm_kernel_avx2, 6};
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case TENSOR_GEMM_KERNEL_AVX512:
+            *kernel = (GemmKernel) {gemm_kernel_avx512, 12};
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+GemmKernel gemm_kernel(void) {
+    GemmKernel kernel;
+    if (gemm_kernel_variant(TENSOR_GEMM_KERNEL_AVX512, &kernel)) return kernel;
+    if (gemm_kernel_variant(TENSOR_GEMM_KERNEL_AVX2, &kernel)) return kernel;
+    gemm_kernel_variant(TENSOR_GEMM_KERNEL_GENERIC, &kernel);
+    return kernel;
+}
+
+static TensorGemmConfig gemm_default_config(void) {
+    return (TensorGemmConfig) {
+        .kc = GEMM_KC,
+        .unit_rows = GEMM_UNIT_ROWS,
+        .unit_panels = GEMM_UNIT_PANELS,
+        .kernel = TENSOR_GEMM_KERNEL_AUTO,
+        .threads = 0,
+    };
+}
+
+bool tensor_gemm_find_config(TensorGemmConfig* config, const int m, const int n, const int k, const int batch) {
+    *config = gemm_default_config();
+    return gemm_tuning_find(config, m, n, k, batch);
+}
+
+// Fills packed->data, sized for the weight by pack_weights_blocked or gemm_mat_mul_into, with packed->kc blocks
+static void pack_blocks(const TensorPackedWeights* packed, const Tensor* weight) {
+    const int k = packed->k;
+    const int n = packed->n;
+    const int panels = packed->panels;
+    const int kc_block = packed->kc;
+
+    const int row_stride = weight->strides[0];
+    const int col_stride = weight->strides[1];
+    for (int k0 = 0; k0 < k; k0 += kc_block) {
+        const int kc = MIN(kc_block, k - k0);
+        float* block = &packed->data[(size_t) k0 * panels * GEMM_NR];
+
+        for (int jp = 0; jp < panels; jp++) {
+            float* panel = &block[(size_t) jp * kc * GEMM_NR];
+            const int j0 = jp * GEMM_NR;
+            const int width = MIN(GEMM_NR, n - j0);
+
+            for (int p = 0; p < kc; p++) {
+                const float* src = &weight->data[(k0 + p) * row_stride + j0 * col_stride];
+                float* dst = &panel[p * GEMM_NR];
+                for (int j = 0; j < width; j++) dst[j] = src[j * col_stride];
+                for (int j = width; j < GEMM_NR; j++) dst[j] = 0.0f;
+            }
+        }
+    }
+}
+
+size_t gemm_packed_length(const int k, const int n) {
+    return (size_t) k * ((n + GEMM_NR - 1) / GEMM_NR) * GEMM_NR;
+}
+
+static TensorError pack_weights_blocked(TensorPackedWeights** out, const Tensor* weight, const int kc_block) {
+    *out = NULL;
+    if (weight->ndim != 2) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const int k = weight->shape[0];
+    const int n = weight->shape[1];
+    const size_t length = gemm_packed_length(k, n);
+
+    TensorPackedWeights* packed = malloc(sizeof *packed);
+    if (packed == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    void* data = NULL;
+    if (posix_memalign(&data, GEMM_ALIGNMENT, MAX(length, 1) * sizeof(float)) != 0) {
+        free(packed);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+    *packed = (TensorPackedWeights) {k, n, kc_block, (n + GEMM_NR - 1) / GEMM_NR, data, NULL, 0};
+    pack_blocks(packed, weight);
+
+    *out = packed;
+    return TENSOR_ERROR_NONE;
+}
+
+/**
+ * The tuned product with the most rows (M * batch), ties going to the smaller batch, so the choice does not
+ * depend on the order shapes were tuned or loaded in. It is the one that spends the longest in the K loop
+ */
+static const GemmTunedShape* packing_shape(const GemmTunedShape* tuned, const int num_tuned) {
+    const GemmTunedShape* best = NULL;
+    for (int i = 0; i < num_tuned; i++) {
+        const long long rows = (long long) tuned[i].m * tuned[i].batch;
+        const long long best_rows = best ? (long long) best->m * best->batch : -1;
+        if (rows > best_rows || (rows == best_rows && tuned[i].batch < best->batch)) best = &tuned[i];
+    }
+    return best;
+}
+
+/**
+ * Packs with the K block of packing_shape, which tensor_mat_mul_packed cannot change later, and keeps a copy
+ * of the configurations tuned for the weight so multiplications never take the tuning table's lock
+ */
+static TensorError pack_weights(TensorPackedWeights** out, const Tensor* weight) {
+    *out = NULL;
+    if (weight->ndim != 2) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    GemmTunedShape* tuned;
+    int num_tuned;
+    TensorError err = gemm_tuning_collect(&tuned, &num_tuned, weight->shape[1], weight->shape[0]);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const GemmTunedShape* shape = packing_shape(tuned, num_tuned);
+    err = pack_weights_blocked(out, weight, shape ? shape->config.kc : GEMM_KC);
+    if (err != TENSOR_ERROR_NONE) {
+        free(tuned);
+        return err;
+    }
+    (*out)->tuned = tuned;
+    (*out)->num_tuned = num_tuned;
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_pack_weights(TensorPackedWeights** out, const Tensor* weight) {
+    const ProfileScope scope = profile_begin("tensor_pack_weights");
+    return profile_end(&scope, pack_weights(out, weight));
+}
+
+void tensor_packed_weights_destroy(TensorPackedWeights* packed) {
+    if (packed == NULL) return;
+    free(packed->tuned);
+    free(packed->data);
+    free(packed);
+}
+
+size_t tensor_packed_weights_bytes(const TensorPackedWeights* packed) {
+    return gemm_packed_length(packed->k, packed->n) * sizeof(float);
+}
+
+typedef struct {
+    const TensorPackedWeights* b;
+    GemmKernel kernel;
+
+    int rows;
+    int m;
+    int batch_ndim;
+    const int* batch_shape;
+    const int* a_batch_strides;
+    int a_row_stride;
+    int a_col_stride;
+    const float* a;
+
+    float* out;
+    int unit_rows;
+    int unit_panels;
+    int panel_groups;
+} GemmJob;
+
+/**
+ * One unit is up to unit_rows output rows by unit_panels panels. Every element is accumulated over K
+ * in the same order whichever unit computes it, so results depend on the kernel and the K block but
+ * not on the unit size or the thread count
+ */
+static void gemm_unit(const GemmJob* job, const int unit) {
+    const TensorPackedWeights* b = job->b;
+    const int mr = job->kernel.mr;
+    const int n = b->n;
+
+    const int row0 = unit / job->panel_groups * job->unit_rows;
+    const int rows = MIN(job->unit_rows, job->rows - row0);
+    const int panel0 = unit % job->panel_groups * job->unit_panels;
+    const int panels = MIN(job->unit_panels, b->panels - panel0);
+
+    const float* a_rows[TENSOR_GEMM_MAX_UNIT_ROWS];
+    for (int r = 0; r < rows; r++) {
+        const int row = row0 + r;
+        int tmp = row / job->m;
+        int offset = row % job->m * job->a_row_stride;
+        for (int d = job->batch_ndim - 1; d >= 0; d--) {
+            offset += tmp % job->batch_shape[d] * job->a_batch_strides[d];
+            tmp /= job->batch_shape[d];
+        }
+        a_rows[r] = &job->a[offset];
+    }
+
+    for (int k0 = 0; k0 < b->k; k0 += b->kc) {
+        const int kc = MIN(b->kc, b->k - k0);
+        const float* block = &b->data[(size_t) k0 * b->panels * GEMM_NR];
+        const int accumulate = k0 > 0;
+
+        for (int jp = panel0; jp < panel0 + panels; jp++) {
+            const float* panel = &block[(size_t) jp * kc * GEMM_NR];
+            const int j0 = jp * GEMM_NR;
+            const int width = MIN(GEMM_NR, n - j0);
+
+            for (int r = 0; r < rows; r += mr) {
+                const int height = MIN(mr, rows - r);
+                const float* a_tile[GEMM_MR_MAX];
+                for (int i = 0; i < height; i++) a_tile[i] = &a_rows[r + i][k0 * job->a_col_stride];
+
+                float* c = &job->out[(size_t) (row0 + r) * n + j0];
+                if (width == GEMM_NR) {
+                    job->kernel.fn(height, kc, a_tile, job->a_col_stride, panel, c, n, accumulate);
+                    continue;
+                }
+
+                // The last panel of a row goes through a full-width buffer
+                float tile[GEMM_MR_MAX * GEMM_NR];
+                if (accumulate) {
+                    for (int i = 0; i < height; i++) memcpy(&tile[i * GEMM_NR], &c[(size_t) i * n], width * sizeof *c);
+                }
+                job->kernel.fn(height, kc, a_tile, job->a_col_stride, panel, tile, GEMM_NR, accumulate);
+                for (int i = 0; i < height; i++) memcpy(&c[(size_t) i * n], &tile[i * GEMM_NR], width * sizeof *c);
+            }
+        }
+    }
+}
+
+static void gemm_range(void* ctx, const int begin, const int end) {
+    const GemmJob* job = ctx;
+    for (int unit = begin; unit < end; unit++) gemm_unit(job, unit);
+}
+
+// Computes a @ weight into out, already shaped [..., M, N] by mat_mul_packed
+static void gemm_into(const Tensor* out, const Tensor* a, const TensorPackedWeights* weight,
+                      const TensorGemmConfig* config) {
+    const int batch_ndim = out->ndim - 2;
+    const int rows = out->length / MAX(1, weight->n);
+    if (out->length == 0) return;
+    if (weight->k == 0) {
+        memset(out->data, 0, (size_t) out->length * sizeof *out->data);
+        return;
+    }
+
+    int a_batch_strides[TENSOR_KERNEL_MAX_DIMS];
+    for (int d = 0; d < batch_ndim; d++) a_batch_strides[d] = a->shape[d] == 1 ? 0 : a->strides[d];
+
+    GemmKernel kernel;
+    if (!gemm_kernel_variant(config->kernel, &kernel)) kernel = gemm_kernel();
+
+    const GemmJob job = {
+        .b = weight,
+        .kernel = kernel,
+        .rows = rows,
+        .m = out->shape[batch_ndim],
+        .batch_ndim = batch_ndim,
+        .batch_shape = out->shape,
+        .a_batch_strides = a_batch_strides,
+        .a_row_stride = a->ndim == 1 ? 0 : a->strides[a->ndim - 2],
+        .a_col_stride = a->strides[a->ndim - 1],
+        .a = a->data,
+        .out = out->data,
+        .unit_rows = config->unit_rows,
+        .unit_panels = config->unit_panels,
+        .panel_groups = (weight->panels + config->unit_panels - 1) / config->unit_panels,
+    };
+
+    // A thread count becomes the grain that splits the units into that many chunks
+    const int units = (rows + config->unit_rows - 1) / config->unit_rows * job.panel_groups;
+    const int grain = config->threads > 0 ? (units + config->threads - 1) / config->threads : 1;
+    parallel_for(units, grain, gemm_range, (void*) &job);
+}
+
+static TensorError mat_mul_packed(Tensor* out, const Tensor* a, const TensorPackedWeights* weight) {
+    if (a->ndim < 1 || a->ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (a->shape[a->ndim - 1] != weight->k) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    // Same output shape as tensor_mat_mul with a 2D right operand
+    const int batch_ndim = MAX(0, a->ndim - 2);
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(shape, a->shape, batch_ndim * sizeof *shape);
+    shape[batch_ndim] = a->ndim == 1 ? 1 : a->shape[a->ndim - 2];
+    shape[batch_ndim + 1] = weight->n;
+
+    const TensorError err = tensor_empty(out, shape, batch_ndim + 2);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const int m = shape[batch_ndim];
+    const int batch = m ? out->length / MAX(1, weight->n) / m : 1;
+    TensorGemmConfig config = gemm_default_config();
+    for (int i = 0; i < weight->num_tuned; i++) {
+        if (weight->tuned[i].m == m && weight->tuned[i].batch == batch) config = weight->tuned[i].config;
+    }
+    gemm_into(out, a, weight, &config);
+    return TENSOR_ERROR_NONE;
+}
+
+void gemm_mat_mul_into(const Tensor* out, const Tensor* a, const Tensor* weight, float* scratch) {
+    const int k = weight->shape[0];
+    const int n = weight->shape[1];
+    const int m = out->shape[out->ndim - 2];
+    const int batch = m ? out->length / MAX(1, n) / m : 1;
+
+    // Packed for this one product, so always with the K block tuned for it
+    TensorGemmConfig config;
+    tensor_gemm_find_config(&config, m, n, k, batch);
+    const TensorPackedWeights packed = {k, n, config.kc, (n + GEMM_NR - 1) / GEMM_NR, scratch, NULL, 0};
+    pack_blocks(&packed, weight);
+    gemm_into(out, a, &packed, &config);
+}
+
+TensorError tensor_mat_mul_packed(Tensor* out, const Tensor* a, const TensorPackedWeights* weight) {
+    const ProfileScope scope = profile_begin("tensor_mat_mul_packed");
+    return profile_end(&scope, mat_mul_packed(out, a, weight));
+}
+
+#define GEMM_TUNE_MIN_MS 20.0          //< Candidates are rerun until they have been timed this long
+#define GEMM_TUNE_MIN_REPEATS 3
+#define GEMM_TUNE_MAX_REPEATS 10
+
+/**
+ * Operands of the shape being tuned. The weight is repacked whenever a candidate changes the K block
+ */
+typedef struct {
+    Tensor a;
+    Tensor weight;
+    Tensor out;
+    TensorPackedWeights* packed;
+    int rows;
+    int panels;
+} GemmBench;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Fastest of the timed runs that follow one warm-up run
+static TensorError bench_config(GemmBench* bench, const TensorGemmConfig* config, double* ms) {
+    if (bench->packed == NULL || bench->packed->kc != config->kc) {
+        tensor_packed_weights_destroy(bench->packed);
+        const TensorError err = pack_weights_blocked(&bench->packed, &bench->weight, config->kc);
+        if (err != TENSOR_ERROR_NONE) return err;
+    }
+
+    gemm_into(&bench->out, &bench->a, bench->packed, config);
+    double best = 0.0, total = 0.0;
+    for (int r = 0; r < GEMM_TUNE_MAX_REPEATS && (r < GEMM_TUNE_MIN_REPEATS || total < GEMM_TUNE_MIN_MS); r++) {
+        const double start = now_ms();
+        gemm_into(&bench->out, &bench->a, bench->packed, config);
+        const double elapsed = now_ms() - start;
+        best = r == 0 || elapsed < best ? elapsed : best;
+        total += elapsed;
+    }
+
+    *ms = best;
+    return TENSOR_ERROR_NONE;
+}
+
+static TensorError try_config(GemmBench* bench, const TensorGemmConfig* candidate, TensorGemmConfig* best,
+                              double* best_ms) {
+    double ms;
+    const TensorError err = bench_config(bench, candidate, &ms);
+    if (err == TENSOR_ERROR_NONE && ms < *best_ms) {
+        *best = *candidate;
+        *best_ms = ms;
+    }
+    return err;
+}
+
+// Candidate values are tried in increasing order, and once one covers the whole extent the larger ones are the same
+static bool covers(const int previous, const int extent) {
+    return previous > 0 && previous >= extent;
+}
+
+/**
+ * One pass of coordinate search: the kernel first, since the unit rows should be a multiple of its MR,
+ * then the K block, the unit rows, the unit panels and the thread count, each keeping the best so far
+ */
+static TensorError tune_search(GemmBench* bench, TensorGemmConfig* best, double* best_ms, const int k) {
+    TensorError err = TENSOR_ERROR_NONE;
+    TensorGemmConfig candidate;
+
+    for (int v = TENSOR_GEMM_KERNEL_GENERIC; v < TENSOR_GEMM_KERNEL_COUNT && err == TENSOR_ERROR_NONE; v++) {
+        GemmKernel kernel;
+        if (v == (int) best->kernel || !gemm_kernel_variant((TensorGemmKernel) v, &kernel)) continue;
+        candidate = *best;
+        candidate.kernel = (TensorGemmKernel) v;
+        err = try_config(bench, &candidate, best, best_ms);
+    }
+
+    static const int kc_values[] = {64, 128, 192, 256, 384, 512, 768};
+    for (int i = 0; i < 7 && err == TENSOR_ERROR_NONE && !covers(i ? kc_values[i - 1] : 0, k); i++) {
+        if (kc_values[i] == best->kc) continue;
+        candidate = *best;
+        candidate.kc = kc_values[i];
+        err = try_config(bench, &candidate, best, best_ms);
+    }
+
+    GemmKernel kernel;
+    if (!gemm_kernel_variant(best->kernel, &kernel)) kernel = gemm_kernel();
+    for (int rows = kernel.mr; rows <= TENSOR_GEMM_MAX_UNIT_ROWS && err == TENSOR_ERROR_NONE; rows *= 2) {
+        if (covers(rows / 2, bench->rows)) break;
+        if (rows == best->unit_rows) continue;
+        candidate = *best;
+        candidate.unit_rows = rows;
+        err = try_config(bench, &candidate, best, best_ms);
+    }
+
+    for (int panels = 1; panels <= 32 && err == TENSOR_ERROR_NONE && !covers(panels / 2, bench->panels); panels *= 2) {
+        if (panels == best->unit_panels) continue;
+        candidate = *best;
+        candidate.unit_panels = panels;
+        err = try_config(bench, &candidate, best, best_ms);
+    }
+
+    const int max_threads = parallel_num_threads();
+    const int units = (bench->rows + best->unit_rows - 1) / best->unit_rows
+                    * ((bench->panels + best->unit_panels - 1) / best->unit_panels);
+    for (int threads = 1; err == TENSOR_ERROR_NONE && !covers(threads / 2, units); threads *= 2) {
+        candidate = *best;
+        candidate.threads = threads >= max_threads ? 0 : threads;
+        if (candidate.threads != best->threads) err = try_config(bench, &candidate, best, best_ms);
+        if (threads >= max_threads) break;
+    }
+
+    return err;
+}
+
+TensorError tensor_gemm_tune(TensorGemmConfig* best, const int m, const int n, const int k, const int batch) {
+    if (m < 1 || n < 1 || k < 1 || batch < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if ((long long) m * batch > INT_MAX / MAX(k, n)) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    GemmBench bench = {.rows = m * batch, .panels = (n + GEMM_NR - 1) / GEMM_NR};
+    TensorError err = tensor_empty(&bench.a, batch > 1 ? (int[]){batch, m, k} : (int[]){m, k}, batch > 1 ? 3 : 2);
+    if (err == TENSOR_ERROR_NONE) err = tensor_empty(&bench.weight, (int[]){k, n}, 2);
+    if (err == TENSOR_ERROR_NONE) {
+        err = tensor_empty(&bench.out, batch > 1 ? (int[]){batch, m, n} : (int[]){m, n}, batch > 1 ? 3 : 2);
+    }
+
+    if (err == TENSOR_ERROR_NONE) {
+        // Any finite values do, the kernels take the same time for all of them
+        for (int i = 0; i < bench.a.length; i++) bench.a.data[i] = (float) (i % 17 - 8) * 0.0625f;
+        for (int i = 0; i < bench.weight.length; i++) bench.weight.data[i] = (float) (i % 13 - 6) * 0.125f;
+
+        // Start from the defaults with the kernel gemm_kernel would pick
+        TensorGemmConfig config = gemm_default_config();
+        GemmKernel kernel;
+        config.kernel = TENSOR_GEMM_KERNEL_AVX512;
+        while (config.kernel > TENSOR_GEMM_KERNEL_GENERIC && !gemm_kernel_variant(config.kernel, &kernel)) config.kernel--;
+
+        double ms;
+        err = bench_config(&bench, &config, &ms);
+        if (err == TENSOR_ERROR_NONE) err = tune_search(&bench, &config, &ms, k);
+        if (err == TENSOR_ERROR_NONE) err = gemm_tuning_store(&config, m, n, k, batch, ms);
+        if (err == TENSOR_ERROR_NONE && best) *best = config;
+    }
+
+    tensor_packed_weights_destroy(bench.packed);
+    tensor_free(&bench.a);
+    tensor_free(&bench.weight);
+    tensor_free(&bench.out);
+    return err;
+}
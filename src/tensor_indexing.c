@@ -0,0 +1,400 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+#define MIN(a,b)((a) < (b) ? (a) : (b))
+
+#include <limits.h>
+#include <string.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define INDEX_HAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define INDEX_GRAIN 16384
+#define SCATTER_BLOCK 256
+
+/**
+ * Gathers one output row: out[j] = base[index[j] * axis_stride + j * step], for j in [0, n).
+ * step is the input stride of the row dimension, or 0 when the row runs along the indexed axis itself
+ */
+typedef void (*GatherRowFn)(float* out, const float* base, const float* index, int index_stride,
+                            int n, int axis_stride, int step);
+
+static void gather_row_scalar(float* out, const float* base, const float* index, const int index_stride,
+                              const int n, const int axis_stride, const int step) {
+    for (int j = 0; j < n; j++) {
+        out[j] = base[(int) index[j * index_stride] * axis_stride + j * step];
+    }
+}
+
+#ifdef INDEX_HAS_X86_KERNELS
+__attribute__((target("avx2")))
+static void gather_row_avx2(float* out, const float* base, const float* index, const int index_stride,
+                            const int n, const int axis_stride, const int step) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i index_lanes = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(index_stride));
+    const __m256i step_lanes = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step));
+    const __m256i scale = _mm256_set1_epi32(axis_stride);
+
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        const __m256 positions = index_stride == 1
+            ? _mm256_loadu_ps(&index[j])
+            : _mm256_i32gather_ps(&index[j * index_stride], index_lanes, 4);
+
+        __m256i offsets = _mm256_mullo_epi32(_mm256_cvttps_epi32(positions), scale);
+        offsets = _mm256_add_epi32(offsets, _mm256_add_epi32(step_lanes, _mm256_set1_epi32(j * step)));
+        _mm256_storeu_ps(&out[j], _mm256_i32gather_ps(base, offsets, 4));
+    }
+
+    gather_row_scalar(&out[j], &base[j * step], &index[j * index_stride], index_stride, n - j, axis_stride, step);
+}
+
+__attribute__((target("avx512f")))
+static void gather_row_avx512(float* out, const float* base, const float* index, const int index_stride,
+                              const int n, const int axis_stride, const int step) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i index_lanes = _mm512_mullo_epi32(lanes, _mm512_set1_epi32(index_stride));
+    const __m512i step_lanes = _mm512_mullo_epi32(lanes, _mm512_set1_epi32(step));
+    const __m512i scale = _mm512_set1_epi32(axis_stride);
+
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        const __m512 positions = index_stride == 1
+            ? _mm512_loadu_ps(&index[j])
+            : _mm512_i32gather_ps(index_lanes, &index[j * index_stride], 4);
+
+        __m512i offsets = _mm512_mullo_epi32(_mm512_cvttps_epi32(positions), scale);
+        offsets = _mm512_add_epi32(offsets, _mm512_add_epi32(step_lanes, _mm512_set1_epi32(j * step)));
+        _mm512_storeu_ps(&out[j], _mm512_i32gather_ps(offsets, base, 4));
+    }
+
+    gather_row_scalar(&out[j], &base[j * step], &index[j * index_stride], index_stride, n - j, axis_stride, step);
+}
+#endif
+
+static GatherRowFn gather_row_kernel(void) {
+#ifdef INDEX_HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx512f")) return gather_row_avx512;
+    if (__builtin_cpu_supports("avx2")) return gather_row_avx2;
+#endif
+    return gather_row_scalar;
+}
+
+static int unravel_offset(int flat, const int* shape, const int ndim, const int* strides) {
+    int offset = 0;
+    for (int d = ndim - 1; d >= 0; d--) {
+        offset += flat % shape[d] * strides[d];
+        flat /= shape[d];
+    }
+    return offset;
+}
+
+// Every element of index must be a position in [0, limit)
+static int index_in_range(const Tensor* index, const int limit) {
+    if (index->length == 0) return 1;
+
+    const int last = index->ndim - 1;
+    const int row_length = index->shape[last];
+    const int rows = index->length / row_length;
+
+    for (int row = 0; row < rows; row++) {
+        const float* values = &index->data[unravel_offset(row, index->shape, last, index->strides)];
+        for (int j = 0; j < row_length; j++) {
+            const float value = values[j * index->strides[last]];
+            if (!(value >= 0.0f && value < (float) limit)) return 0;
+        }
+    }
+    return 1;
+}
+
+typedef struct {
+    GatherRowFn gather_row;
+    const Tensor* out;
+    const Tensor* in;
+    const Tensor* index;
+    const int* in_strides;      //< Input strides with the indexed axis zeroed, the index supplies that offset
+    int axis_stride;
+    int step;
+} GatherJob;
+
+static void gather_range(void* ctx, const int begin, const int end) {
+    const GatherJob* job = ctx;
+    const Tensor* out = job->out;
+    const int last = out->ndim - 1;
+    const int n = out->shape[last];
+
+    for (int row = begin; row < end; row++) {
+        const int in_offset = unravel_offset(row, out->shape, last, job->in_strides);
+        const int index_offset = unravel_offset(row, out->shape, last, job->index->strides);
+
+        job->gather_row(&out->data[(size_t) row * n], &job->in->data[in_offset], &job->index->data[index_offset],
+                        job->index->strides[last], n, job->axis_stride, job->step);
+    }
+}
+
+static TensorError gather(Tensor* out, const Tensor* in, const int axis, const Tensor* index) {
+    if (axis < 0 || axis >= in->ndim || in->ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (index->ndim != in->ndim) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    for (int d = 0; d < in->ndim; d++) {
+        if (d != axis && index->shape[d] > in->shape[d]) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    }
+    if (!index_in_range(index, in->shape[axis])) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const TensorError err = tensor_empty(out, index->shape, index->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out->length == 0) return TENSOR_ERROR_NONE;
+
+    const int last = in->ndim - 1;
+    int in_strides[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(in_strides, in->strides, in->ndim * sizeof *in_strides);
+    in_strides[axis] = 0;
+
+    GatherJob job = {
+        .gather_row = gather_row_kernel(),
+        .out = out,
+        .in = in,
+        .index = index,
+        .in_strides = in_strides,
+        .axis_stride = in->strides[axis],
+        .step = axis == last ? 0 : in->strides[last],
+    };
+
+    const int n = out->shape[last];
+    parallel_for(out->length / n, MAX(1, INDEX_GRAIN / n), gather_range, &job);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_gather(Tensor* out, const Tensor* in, const int axis, const Tensor* index) {
+    const ProfileScope scope = profile_begin("tensor_gather");
+    return profile_end(&scope, gather(out, in, axis, index));
+}
+
+typedef struct {
+    GatherRowFn gather_row;
+    const Tensor* out;
+    const Tensor* in;
+    const Tensor* index;
+    int axis;
+    int count;          //< Length of index
+    int inner;          //< Elements per selected slice
+    int inner_contiguous;
+} IndexSelectJob;
+
+// Selection along the last axis, one gathered row per combination of the leading dimensions
+static void index_select_rows(void* ctx, const int begin, const int end) {
+    const IndexSelectJob* job = ctx;
+    const Tensor* in = job->in;
+    const int last = in->ndim - 1;
+
+    for (int row = begin; row < end; row++) {
+        const int in_offset = unravel_offset(row, in->shape, last, in->strides);
+        job->gather_row(&job->out->data[(size_t) row * job->count], &in->data[in_offset], job->index->data,
+                        job->index->strides[0], job->count, in->strides[last], 0);
+    }
+}
+
+// Selection along an outer axis, one copied slice per (leading position, index entry) pair
+static void index_select_slices(void* ctx, const int begin, const int end) {
+    const IndexSelectJob* job = ctx;
+    const Tensor* in = job->in;
+    const int axis = job->axis;
+    const int last = in->ndim - 1;
+    const int row_length = in->shape[last];
+    const int inner_dims = last - axis - 1;
+
+    for (int unit = begin; unit < end; unit++) {
+        const int outer = unit / job->count;
+        const int position = (int) job->index->data[unit % job->count * job->index->strides[0]];
+        const float* src = &in->data[unravel_offset(outer, in->shape, axis, in->strides) + position * in->strides[axis]];
+        float* dst = &job->out->data[(size_t) unit * job->inner];
+
+        if (job->inner_contiguous) {
+            memcpy(dst, src, job->inner * sizeof *dst);
+            continue;
+        }
+
+        for (int row = 0; row < job->inner / row_length; row++) {
+            const float* src_row = &src[unravel_offset(row, &in->shape[axis + 1], inner_dims, &in->strides[axis + 1])];
+            for (int j = 0; j < row_length; j++) {
+                dst[row * row_length + j] = src_row[j * in->strides[last]];
+            }
+        }
+    }
+}
+
+static TensorError index_select(Tensor* out, const Tensor* in, const int axis, const Tensor* index) {
+    if (axis < 0 || axis >= in->ndim || in->ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (index->ndim != 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (!index_in_range(index, in->shape[axis])) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(shape, in->shape, in->ndim * sizeof *shape);
+    shape[axis] = index->shape[0];
+
+    const TensorError err = tensor_empty(out, shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out->length == 0) return TENSOR_ERROR_NONE;
+
+    IndexSelectJob job = {
+        .gather_row = gather_row_kernel(),
+        .out = out,
+        .in = in,
+        .index = index,
+        .axis = axis,
+        .count = index->shape[0],
+        .inner = 1,
+        .inner_contiguous = 1,
+    };
+
+    for (int d = in->ndim - 1; d > axis; d--) {
+        if (in->shape[d] != 1 && in->strides[d] != job.inner) job.inner_contiguous = 0;
+        job.inner *= in->shape[d];
+    }
+
+    if (axis == in->ndim - 1) {
+        const int rows = out->length / job.count;
+        parallel_for(rows, MAX(1, INDEX_GRAIN / job.count), index_select_rows, &job);
+    }else {
+        const int units = out->length / job.inner;
+        parallel_for(units, MAX(1, INDEX_GRAIN / job.inner), index_select_slices, &job);
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_index_select(Tensor* out, const Tensor* in, const int axis, const Tensor* index) {
+    const ProfileScope scope = profile_begin("tensor_index_select");
+    return profile_end(&scope, index_select(out, in, axis, index));
+}
+
+/**
+ * Scatter-add decomposed into fibers: every position of the index shape except the indexed axis.
+ * All updates of one fiber land in the same target fiber, so splitting the work by fiber
+ * (or, when there are too few fibers, by target position along the axis) needs no atomics
+ */
+typedef struct {
+    Tensor* target;
+    const Tensor* index;
+    const Tensor* src;
+    int fiber_ndim;                             //< Fiber dimensions before the last one
+    int fiber_shape[TENSOR_KERNEL_MAX_DIMS];
+    int target_strides[TENSOR_KERNEL_MAX_DIMS];
+    int index_strides[TENSOR_KERNEL_MAX_DIMS];
+    int src_strides[TENSOR_KERNEL_MAX_DIMS];
+    int row_length;                             //< Length of the last fiber dimension
+    int row_target_stride;
+    int row_index_stride;
+    int row_src_stride;
+    int blocks_per_row;
+    int units;                                  //< Rows times blocks per row
+    int axis_length;
+    int axis_target_stride;
+    int axis_index_stride;
+    int axis_src_stride;
+} ScatterJob;
+
+// Adds every update of one block of fibers whose target position along the axis lies in [lo, hi)
+static void scatter_block(const ScatterJob* job, const int unit, const int lo, const int hi) {
+    const int row = unit / job->blocks_per_row;
+    const int j_begin = unit % job->blocks_per_row * SCATTER_BLOCK;
+    const int j_end = MIN(job->row_length, j_begin + SCATTER_BLOCK);
+
+    float* target = &job->target->data[unravel_offset(row, job->fiber_shape, job->fiber_ndim, job->target_strides)];
+    const float* index = &job->index->data[unravel_offset(row, job->fiber_shape, job->fiber_ndim, job->index_strides)];
+    const float* src = &job->src->data[unravel_offset(row, job->fiber_shape, job->fiber_ndim, job->src_strides)];
+
+    for (int i = 0; i < job->axis_length; i++) {
+        const float* index_row = &index[i * job->axis_index_stride];
+        const float* src_row = &src[i * job->axis_src_stride];
+
+        for (int j = j_begin; j < j_end; j++) {
+            const int position = (int) index_row[j * job->row_index_stride];
+            if (position < lo || position >= hi) continue;
+            target[position * job->axis_target_stride + j * job->row_target_stride] += src_row[j * job->row_src_stride];
+        }
+    }
+}
+
+static void scatter_by_fiber(void* ctx, const int begin, const int end) {
+    const ScatterJob* job = ctx;
+    for (int unit = begin; unit < end; unit++) {
+        scatter_block(job, unit, 0, INT_MAX);
+    }
+}
+
+static void scatter_by_position(void* ctx, const int begin, const int end) {
+    const ScatterJob* job = ctx;
+    for (int unit = 0; unit < job->units; unit++) {
+        scatter_block(job, unit, begin, end);
+    }
+}
+
+static TensorError scatter_add(Tensor* target, const int axis, const Tensor* index, const Tensor* src) {
+    const int ndim = target->ndim;
+    if (axis < 0 || axis >= ndim || ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (index->ndim != ndim || src->ndim != ndim) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    for (int d = 0; d < ndim; d++) {
+        if (index->shape[d] > src->shape[d]) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+        if (d != axis && index->shape[d] > target->shape[d]) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+        if (target->shape[d] > 1 && target->strides[d] == 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    }
+    if (!index_in_range(index, target->shape[axis])) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (index->length == 0) return TENSOR_ERROR_NONE;
+
+    ScatterJob job = {
+        .target = target,
+        .index = index,
+        .src = src,
+        .row_length = 1,
+        .axis_length = index->shape[axis],
+        .axis_target_stride = target->strides[axis],
+        .axis_index_stride = index->strides[axis],
+        .axis_src_stride = src->strides[axis],
+    };
+
+    // Fiber dimensions are every dimension but the axis, the last of them becomes the row
+    for (int d = 0; d < ndim; d++) {
+        if (d == axis) continue;
+        job.fiber_shape[job.fiber_ndim] = index->shape[d];
+        job.target_strides[job.fiber_ndim] = target->strides[d];
+        job.index_strides[job.fiber_ndim] = index->strides[d];
+        job.src_strides[job.fiber_ndim] = src->strides[d];
+        job.fiber_ndim++;
+    }
+    if (job.fiber_ndim > 0) {
+        job.fiber_ndim--;
+        job.row_length = job.fiber_shape[job.fiber_ndim];
+        job.row_target_stride = job.target_strides[job.fiber_ndim];
+        job.row_index_stride = job.index_strides[job.fiber_ndim];
+        job.row_src_stride = job.src_strides[job.fiber_ndim];
+    }
+
+    job.blocks_per_row = (job.row_length + SCATTER_BLOCK - 1) / SCATTER_BLOCK;
+    const int rows = index->length / (job.axis_length * job.row_length);
+    const int units = rows * job.blocks_per_row;
+    job.units = units;
+    const int work_per_unit = job.axis_length * MIN(job.row_length, SCATTER_BLOCK);
+    const int threads = parallel_num_threads();
+
+    if (units >= 2 * threads || target->shape[axis] < 2 * threads) {
+        parallel_for(units, MAX(1, INDEX_GRAIN / work_per_unit), scatter_by_fiber, &job);
+    }else {
+        // Few long fibers, e.g. a histogram: every thread scans all updates but owns a range of target positions
+        const int positions = target->shape[axis];
+        const int grain = index->length < INDEX_GRAIN ? positions : MAX(1, positions / threads);
+        parallel_for(positions, grain, scatter_by_position, &job);
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_scatter_add(Tensor* target, const int axis, const Tensor* index, const Tensor* src) {
+    const ProfileScope scope = profile_begin("tensor_scatter_add");
+    return profile_end(&scope, scatter_add(target, axis, index, src));
+}
@@ -0,0 +1,260 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NORM_HAS_X86_KERNELS 1
+#endif
+
+#define NORM_GRAIN 16384
+#define NORM_LANES 16
+
+/**
+ * Every kernel works on one row of the last dimension at a time. A strided row is first gathered into
+ * its output row, which is contiguous, and normalized in place there, so each element of in is read
+ * from memory once however many passes the statistics take over the cached row.
+ *
+ * Reductions keep NORM_LANES independent partial sums that are combined in a fixed order, which lets
+ * the compiler vectorize them without reassociating and keeps results independent of the thread count.
+ */
+typedef enum {
+    NORM_LAYER,
+    NORM_RMS,
+    NORM_BATCH,
+} NormKind;
+
+typedef struct {
+    NormKind kind;
+    const Tensor* in;
+    float* out;
+    int d;
+    float eps;
+
+    const float* scale;         //< [d] weight, or the folded batchnorm scale per channel
+    const float* shift;         //< [d] bias, or the folded batchnorm shift per channel
+    int channel_last;           //< Batchnorm: the channel axis is the row itself
+    int channel_inner;          //< Batchnorm: rows per channel step when it is not
+    int channels;
+} NormJob;
+
+static inline __attribute__((always_inline)) float row_sum(const float* x, const int d) {
+    float acc[NORM_LANES] = {0};
+    int i = 0;
+    for (; i + NORM_LANES <= d; i += NORM_LANES) {
+        for (int j = 0; j < NORM_LANES; j++) acc[j] += x[i + j];
+    }
+
+    float sum = 0.0f;
+    for (; i < d; i++) sum += x[i];
+    for (int j = 0; j < NORM_LANES; j++) sum += acc[j];
+    return sum;
+}
+
+static inline __attribute__((always_inline)) float row_centered_squares(const float* x, const int d, const float mean) {
+    float acc[NORM_LANES] = {0};
+    int i = 0;
+    for (; i + NORM_LANES <= d; i += NORM_LANES) {
+        for (int j = 0; j < NORM_LANES; j++) {
+            const float v = x[i + j] - mean;
+            acc[j] += v * v;
+        }
+    }
+
+    float sum = 0.0f;
+    for (; i < d; i++) sum += (x[i] - mean) * (x[i] - mean);
+    for (int j = 0; j < NORM_LANES; j++) sum += acc[j];
+    return sum;
+}
+
+static inline __attribute__((always_inline))
+void layer_norm_row(float* out, const float* x, const NormJob* job) {
+    const int d = job->d;
+    const float mean = row_sum(x, d) / (float) d;
+    const float rstd = 1.0f / sqrtf(row_centered_squares(x, d, mean) / (float) d + job->eps);
+
+    const float* restrict scale = job->scale;
+    const float* restrict shift = job->shift;
+    for (int i = 0; i < d; i++) out[i] = (x[i] - mean) * rstd * scale[i] + shift[i];
+}
+
+static inline __attribute__((always_inline))
+void rms_norm_row(float* out, const float* x, const NormJob* job) {
+    const int d = job->d;
+    const float rstd = 1.0f / sqrtf(row_centered_squares(x, d, 0.0f) / (float) d + job->eps);
+
+    const float* restrict scale = job->scale;
+    for (int i = 0; i < d; i++) out[i] = x[i] * rstd * scale[i];
+}
+
+static inline __attribute__((always_inline))
+void batch_norm_row(float* out, const float* x, const NormJob* job, const int row) {
+    const int d = job->d;
+    if (job->channel_last) {
+        const float* restrict scale = job->scale;
+        const float* restrict shift = job->shift;
+        for (int i = 0; i < d; i++) out[i] = x[i] * scale[i] + shift[i];
+        return;
+    }
+
+    const int c = row / job->channel_inner % job->channels;
+    const float scale = job->scale[c];
+    const float shift = job->shift[c];
+    for (int i = 0; i < d; i++) out[i] = x[i] * scale + shift;
+}
+
+static inline __attribute__((always_inline))
+void norm_rows(const NormJob* job, const int begin, const int end) {
+    const Tensor* in = job->in;
+    const int d = job->d;
+    const int stride = in->strides[in->ndim - 1];
+
+    for (int row = begin; row < end; row++) {
+        int offset = 0;
+        int tmp = row;
+        for (int dim = in->ndim - 2; dim >= 0; dim--) {
+            offset += tmp % in->shape[dim] * in->strides[dim];
+            tmp /= in->shape[dim];
+        }
+
+        float* out = &job->out[(size_t) row * d];
+        const float* x = &in->data[offset];
+        if (stride != 1) {
+            for (int i = 0; i < d; i++) out[i] = x[i * stride];
+            x = out;
+        }
+
+        switch (job->kind) {
+            case NORM_LAYER: layer_norm_row(out, x, job); break;
+            case NORM_RMS: rms_norm_row(out, x, job); break;
+            case NORM_BATCH: batch_norm_row(out, x, job, row); break;
+        }
+    }
+}
+
+static void norm_range_default(void* ctx, const int begin, const int end) {
+    norm_rows(ctx, begin, end);
+}
+
+#ifdef NORM_HAS_X86_KERNELS
+__attribute__((target("avx2")))
+static void norm_range_avx2(void* ctx, const int begin, const int end) {
+    norm_rows(ctx, begin, end);
+}
+#endif
+
+static void norm_run(const Tensor* out, NormJob* job) {
+    ParallelRangeFn range = norm_range_default;
+#ifdef NORM_HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) range = norm_range_avx2;
+#endif
+
+    job->out = out->data;
+    parallel_for(out->length / job->d, MAX(1, NORM_GRAIN / job->d), range, job);
+}
+
+static int is_vector_of(const Tensor* t, const int length) {
+    return t == NULL || (t->ndim == 1 && t->shape[0] == length);
+}
+
+// Contiguous copy of an optional 1D parameter, or `fallback` everywhere when it is NULL
+static void copy_parameter(float* dst, const Tensor* t, const int length, const float fallback) {
+    for (int i = 0; i < length; i++) dst[i] = t ? t->data[i * t->strides[0]] : fallback;
+}
+
+static TensorError affine_norm(Tensor* out, const Tensor* in, const Tensor* weight, const Tensor* bias,
+                               const float eps, const NormKind kind) {
+    if (in->ndim < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
+    const int d = in->shape[in->ndim - 1];
+    if (!is_vector_of(weight, d) || !is_vector_of(bias, d)) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    float* params = malloc(2 * (size_t) MAX(d, 1) * sizeof *params);
+    if (params == NULL) return TENSOR_ERROR_NO_MEMORY;
+    copy_parameter(params, weight, d, 1.0f);
+    copy_parameter(&params[d], bias, d, 0.0f);
+
+    const TensorError err = tensor_empty(out, in->shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) {
+        free(params);
+        return err;
+    }
+
+    if (out->length > 0) {
+        NormJob job = {.kind = kind, .in = in, .d = d, .eps = eps, .scale = params, .shift = &params[d]};
+        norm_run(out, &job);
+    }
+
+    free(params);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_layer_norm(Tensor* out, const Tensor* in, const Tensor* weight, const Tensor* bias, const float eps) {
+    const ProfileScope scope = profile_begin("tensor_layer_norm");
+    return profile_end(&scope, affine_norm(out, in, weight, bias, eps, NORM_LAYER));
+}
+
+TensorError tensor_rms_norm(Tensor* out, const Tensor* in, const Tensor* weight, const float eps) {
+    const ProfileScope scope = profile_begin("tensor_rms_norm");
+    return profile_end(&scope, affine_norm(out, in, weight, NULL, eps, NORM_RMS));
+}
+
+static TensorError batch_norm(Tensor* out, const Tensor* in, const Tensor* mean, const Tensor* var, const Tensor* weight,
+                              const Tensor* bias, const float eps, const TensorLayout layout) {
+    if (in->ndim < (layout == TENSOR_LAYOUT_NCHW ? 2 : 1)) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (mean == NULL || var == NULL) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const int axis = layout == TENSOR_LAYOUT_NCHW ? 1 : in->ndim - 1;
+    const int channels = in->shape[axis];
+    if (!is_vector_of(mean, channels) || !is_vector_of(var, channels)) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    if (!is_vector_of(weight, channels) || !is_vector_of(bias, channels)) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    // Fold the statistics and the affine transform into one scale and shift per channel
+    float* params = malloc(2 * (size_t) MAX(channels, 1) * sizeof *params);
+    if (params == NULL) return TENSOR_ERROR_NO_MEMORY;
+    float* scale = params;
+    float* shift = &params[channels];
+    copy_parameter(scale, weight, channels, 1.0f);
+    copy_parameter(shift, bias, channels, 0.0f);
+    for (int c = 0; c < channels; c++) {
+        const float rstd = 1.0f / sqrtf(var->data[c * var->strides[0]] + eps);
+        scale[c] *= rstd;
+        shift[c] -= mean->data[c * mean->strides[0]] * scale[c];
+    }
+
+    const TensorError err = tensor_empty(out, in->shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) {
+        free(params);
+        return err;
+    }
+
+    if (out->length > 0) {
+        int inner = 1;
+        for (int dim = axis + 1; dim < in->ndim - 1; dim++) inner *= in->shape[dim];
+
+        NormJob job = {
+            .kind = NORM_BATCH,
+            .in = in,
+            .d = in->shape[in->ndim - 1],
+            .eps = eps,
+            .scale = scale,
+            .shift = shift,
+            .channel_last = axis == in->ndim - 1,
+            .channel_inner = inner,
+            .channels = channels,
+        };
+        norm_run(out, &job);
+    }
+
+    free(params);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_batch_norm(Tensor* out, const Tensor* in, const Tensor* mean, const Tensor* var, const Tensor* weight,
+                              const Tensor* bias, const float eps, const TensorLayout layout) {
+    const ProfileScope scope = profile_begin("tensor_batch_norm");
+    return profile_end(&scope, batch_norm(out, in, mean, var, weight, bias, eps, layout));
+}
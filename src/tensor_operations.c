@@ -3,123 +3,459 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "op_profile.h"
 #include "tensor.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+#define ELEMENTWISE_GRAIN 16384
+#define MAT_MUL_GRAIN_FLOPS 32768
+#define MAT_MUL_PACK_MIN_ROWS 8            //< Rows that amortize packing a 2D right operand for the blocked GEMM
+#define MAT_MUL_ALIGNMENT 64
+
+/**
+ * Loops for one elementwise op, specialized by operand layout.
+ * Each kernel inlines the op so the compiler can vectorize it, instead of calling through a function pointer per element
+ */
+typedef struct {
+    void (*contiguous)(float* restrict out, const float* restrict a, const float* restrict b, int n);
+    void (*scalar_a)(float* restrict out, float x, const float* restrict b, int n);
+    void (*scalar_b)(float* restrict out, const float* restrict a, float y, int n);
+    void (*strided)(float* restrict out, const float* a, int stride_a, const float* b, int stride_b, int n);
+} ElementwiseKernels;
+
+#define DEFINE_ELEMENTWISE_KERNELS(name, expr)                                                             \
+    static void name##_contiguous(float* restrict out, const float* restrict a,                            \
+                                  const float* restrict b, const int n) {                                  \
+        for (int i = 0; i < n; i++) {const float x = a[i]; const float y = b[i]; out[i] = (expr);}         \
+    }                                                                                                      \
+    static void name##_scalar_a(float* restrict out, const float x, const float* restrict b, const int n) { \
+        for (int i = 0; i < n; i++) {const float y = b[i]; out[i] = (expr);}                               \
+    }                                                                                                      \
+    static void name##_scalar_b(float* restrict out, const float* restrict a, const float y, const int n) { \
+        for (int i = 0; i < n; i++) {const float x = a[i]; out[i] = (expr);}                               \
+    }                                                                                                      \
+    static void name##_strided(float* restrict out, const float* a, const int stride_a,                    \
+                               const float* b, const int stride_b, const int n) {                          \
+        for (int i = 0; i < n; i++) {const float x = a[i * stride_a]; const float y = b[i * stride_b]; out[i] = (expr);} \
+    }                                                                                                      \
+    static const ElementwiseKernels name##_kernels = {                                                     \
+        name##_contiguous, name##_scalar_a, name##_scalar_b, name##_strided                                \
+    };
+
+DEFINE_ELEMENTWISE_KERNELS(add, x + y)
+DEFINE_ELEMENTWISE_KERNELS(sub, x - y)
+DEFINE_ELEMENTWISE_KERNELS(mul, x * y)
+DEFINE_ELEMENTWISE_KERNELS(div, x / y)
+
+/**
+ * Operand layouts after dimension coalescing, decided once per call
+ */
+typedef enum {
+    ELEMENTWISE_CONTIGUOUS,      //< Both operands contiguous with the output shape
+    ELEMENTWISE_SCALAR_A,        //< a is a single broadcast value, b is contiguous
+    ELEMENTWISE_SCALAR_B,        //< b is a single broadcast value, a is contiguous
+    ELEMENTWISE_ROW_BROADCAST,   //< Both operands are contiguous along each row; outer dimensions may broadcast
+    ELEMENTWISE_COL_BROADCAST,   //< One operand is constant along each row, the other is contiguous
+    ELEMENTWISE_GENERIC,         //< Anything else, rows are walked with per-operand strides
+} ElementwiseLayout;
+
+/**
+ * Broadcast problem with size 1 dimensions dropped and mergeable dimensions collapsed
+ */
+typedef struct {
+    int ndim;
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int strides_a[TENSOR_KERNEL_MAX_DIMS];
+    int strides_b[TENSOR_KERNEL_MAX_DIMS];
+} ElementwiseShape;
+
+typedef struct {
+    const ElementwiseKernels* kernels;
+    ElementwiseLayout layout;
+    const ElementwiseShape* dims;
+    float* out;
+    const float* a;
+    const float* b;
+} ElementwiseJob;
+
+static int broadcast_shape(int* out_shape, const int* a_shape, const int a_ndim, const int* b_shape, const int b_ndim) {
+    const int ndim = MAX(a_ndim, b_ndim);
+
+    for (int i = 0; i < ndim; i++) {
+        const int a_dim = i < ndim - a_ndim ? 1 : a_shape[i - (ndim - a_ndim)];
+        const int b_dim = i < ndim - b_ndim ? 1 : b_shape[i - (ndim - b_ndim)];
+
+        if (a_dim != b_dim && a_dim != 1 && b_dim != 1) return -1;
+        out_shape[i] = a_dim != 1 ? a_dim : b_dim;
+    }
 
+    return 0;
+}
 
-TensorError elementwise_broadcast(Tensor* out, const Tensor* a, const Tensor* b) {
-    const int max_ndim = MAX(a->ndim, b->ndim);
-    const int min_ndim = MIN(a->ndim, b->ndim);
-    const int diff = max_ndim - min_ndim;
+// Strides of `in` when broadcast to out_shape, 0 along new or repeated dimensions
+static void broadcast_strides(int* strides, const Tensor* in, const int* out_shape, const int ndim) {
+    const int diff = ndim - in->ndim;
 
+    for (int i = 0; i < ndim; i++) {
+        if (i < diff || (in->shape[i - diff] == 1 && out_shape[i] != 1)) {
+            strides[i] = 0;
+        }else {
+            strides[i] = in->strides[i - diff];
+        }
+    }
+}
 
-    int shape[max_ndim];
+static void elementwise_coalesce(ElementwiseShape* dims, const int* shape, const int* sa, const int* sb, const int ndim) {
+    dims->ndim = 0;
 
-    for (int i = 0; i < diff; i++) {
+    for (int i = 0; i < ndim; i++) {
+        if (shape[i] == 1) continue;
 
-    }
+        const int last = dims->ndim - 1;
+        if (last >= 0
+            && dims->strides_a[last] == sa[i] * shape[i]
+            && dims->strides_b[last] == sb[i] * shape[i]) {
+            dims->shape[last] *= shape[i];
+            dims->strides_a[last] = sa[i];
+            dims->strides_b[last] = sb[i];
+            continue;
+        }
 
+        dims->shape[dims->ndim] = shape[i];
+        dims->strides_a[dims->ndim] = sa[i];
+        dims->strides_b[dims->ndim] = sb[i];
+        dims->ndim++;
+    }
 
-    return TENSOR_ERROR_NONE;
+    if (dims->ndim == 0) {
+        dims->ndim = 1;
+        dims->shape[0] = 1;
+        dims->strides_a[0] = 0;
+        dims->strides_b[0] = 0;
+    }
 }
 
-TensorError matrix_broadcast(Tensor* out, Tensor* a, Tensor* b) {
-    if (a->ndim != b->ndim) return TENSOR_ERROR_CANNOT_BROADCAST;
-    int out_shape[a->ndim];
+static ElementwiseLayout elementwise_classify(const ElementwiseShape* dims) {
+    const int last = dims->ndim - 1;
+    const int sa = dims->strides_a[last];
+    const int sb = dims->strides_b[last];
 
-    for (int i = 0; i < a->ndim - 2; i++) {
-        if (a->shape[i] != b->shape[i] && a->shape[i] != 1 && b->shape[i] != 1){
-            return TENSOR_ERROR_CANNOT_BROADCAST;
-        }
-        out_shape[i] = a->shape[i] != 1 ? a->shape[i] : b->shape[i];
+    if (dims->ndim == 1) {
+        if (sa == 1 && sb == 1) return ELEMENTWISE_CONTIGUOUS;
+        if (sa == 0 && sb == 1) return ELEMENTWISE_SCALAR_A;
+        if (sa == 1 && sb == 0) return ELEMENTWISE_SCALAR_B;
+        return ELEMENTWISE_GENERIC;
     }
 
-    out_shape[a->ndim - 2] = a->shape[a->ndim - 2];
-    out_shape[a->ndim - 1] = b->shape[b->ndim - 1];
+    if (sa == 1 && sb == 1) return ELEMENTWISE_ROW_BROADCAST;
+    if ((sa == 1 && sb == 0) || (sa == 0 && sb == 1)) return ELEMENTWISE_COL_BROADCAST;
+    return ELEMENTWISE_GENERIC;
+}
+
+static void elementwise_flat_range(void* ctx, const int begin, const int end) {
+    const ElementwiseJob* job = ctx;
+    const int n = end - begin;
+
+    switch (job->layout) {
+        case ELEMENTWISE_CONTIGUOUS:
+            job->kernels->contiguous(&job->out[begin], &job->a[begin], &job->b[begin], n);
+            break;
+        case ELEMENTWISE_SCALAR_A:
+            job->kernels->scalar_a(&job->out[begin], job->a[0], &job->b[begin], n);
+            break;
+        case ELEMENTWISE_SCALAR_B:
+            job->kernels->scalar_b(&job->out[begin], &job->a[begin], job->b[0], n);
+            break;
+        default:
+            job->kernels->strided(&job->out[begin],
+                                  &job->a[begin * job->dims->strides_a[0]], job->dims->strides_a[0],
+                                  &job->b[begin * job->dims->strides_b[0]], job->dims->strides_b[0], n);
+            break;
+    }
+}
 
-    const TensorError err = tensor_init(out,NULL,out_shape, a->ndim);
+static void elementwise_row_range(void* ctx, const int begin, const int end) {
+    const ElementwiseJob* job = ctx;
+    const ElementwiseShape* dims = job->dims;
+    const int last = dims->ndim - 1;
+    const int row_length = dims->shape[last];
 
-    if (err != TENSOR_ERROR_NONE) return err;
+    for (int row = begin; row < end; row++) {
+        int offset_a = 0;
+        int offset_b = 0;
+        int tmp = row;
 
-    out_shape[a->ndim - 1] = a->shape[a->ndim - 1];
-    out_shape[a->ndim - 2] = a->shape[a->ndim - 2];
-    tensor_broadcast_to(a,out->shape,out->ndim, true);
+        for (int dim = last - 1; dim >= 0; dim--) {
+            const int d_idx = tmp % dims->shape[dim];
+            tmp /= dims->shape[dim];
 
-    out_shape[a->ndim - 1] = b->shape[b->ndim - 1];
-    out_shape[a->ndim - 2] = b->shape[b->ndim - 2];
-    tensor_broadcast_to(b, out->shape, out->ndim,true);
+            offset_a += d_idx * dims->strides_a[dim];
+            offset_b += d_idx * dims->strides_b[dim];
+        }
 
-    return TENSOR_ERROR_NONE;
+        float* out = &job->out[(size_t) row * row_length];
+        const float* a = &job->a[offset_a];
+        const float* b = &job->b[offset_b];
+
+        switch (job->layout) {
+            case ELEMENTWISE_ROW_BROADCAST:
+                job->kernels->contiguous(out, a, b, row_length);
+                break;
+            case ELEMENTWISE_COL_BROADCAST:
+                if (dims->strides_a[last] == 0) job->kernels->scalar_a(out, a[0], b, row_length);
+                else job->kernels->scalar_b(out, a, b[0], row_length);
+                break;
+            default:
+                job->kernels->strided(out, a, dims->strides_a[last], b, dims->strides_b[last], row_length);
+                break;
+        }
+    }
 }
 
-TensorError element_wise_operation(Tensor* out, const Tensor* a, const Tensor* b, float (*op)(float,float)) {
-    Tensor a_copy;
-    Tensor b_copy;
+static const ElementwiseKernels* const elementwise_kernels[] = {
+    [ELEMENTWISE_ADD] = &add_kernels,
+    [ELEMENTWISE_SUB] = &sub_kernels,
+    [ELEMENTWISE_MUL] = &mul_kernels,
+    [ELEMENTWISE_DIV] = &div_kernels,
+};
 
-    const Tensor* max_tensor = a->ndim < b->ndim ? b : a;
-    const Tensor* min_tensor = a->ndim < b->ndim ? a : b;
+TensorError elementwise_output_shape(int* shape, int* ndim, const Tensor* a, const Tensor* b) {
+    const int max_ndim = MAX(a->ndim, b->ndim);
+    if (max_ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
 
-    tensor_shallow_copy(&a_copy,max_tensor,max_tensor->ndim);
-    tensor_shallow_copy(&b_copy,min_tensor,max_tensor->ndim);
+    if (broadcast_shape(shape, a->shape, a->ndim, b->shape, b->ndim) < 0) return TENSOR_ERROR_CANNOT_BROADCAST;
 
-    const TensorError err = elementwise_broadcast(out, &a_copy,&b_copy);
+    *ndim = max_ndim;
+    return TENSOR_ERROR_NONE;
+}
 
+void elementwise_into(const Tensor* out, const Tensor* a, const Tensor* b, const ElementwiseOp op) {
+    int strides_a[TENSOR_KERNEL_MAX_DIMS];
+    int strides_b[TENSOR_KERNEL_MAX_DIMS];
+    ElementwiseShape dims;
+    if (out->length == 0) return;
+
+    broadcast_strides(strides_a, a, out->shape, out->ndim);
+    broadcast_strides(strides_b, b, out->shape, out->ndim);
+    elementwise_coalesce(&dims, out->shape, strides_a, strides_b, out->ndim);
+
+    ElementwiseJob job = {elementwise_kernels[op], elementwise_classify(&dims), &dims, out->data, a->data, b->data};
+
+    if (dims.ndim == 1) {
+        parallel_for(dims.shape[0], ELEMENTWISE_GRAIN, elementwise_flat_range, &job);
+    }else {
+        const int row_length = dims.shape[dims.ndim - 1];
+        int rows = 1;
+        for (int d = 0; d < dims.ndim - 1; d++) rows *= dims.shape[d];
+        parallel_for(rows, MAX(1, ELEMENTWISE_GRAIN / row_length), elementwise_row_range, &job);
+    }
+}
+
+static TensorError element_wise_operation(Tensor* out, const Tensor* a, const Tensor* b, const ElementwiseOp op) {
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int ndim;
+
+    TensorError err = elementwise_output_shape(shape, &ndim, a, b);
     if (err != TENSOR_ERROR_NONE) return err;
 
-    int total = 1;
-    for (int d = 0; d < out->ndim; d++) total *= out->shape[d];
+    err = tensor_empty(out, shape, ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    elementwise_into(out, a, b, op);
+    return TENSOR_ERROR_NONE;
+}
 
-    for (int idx = 0; idx < total; idx++) {
+/**
+ * Batched matrix product with every operand described by explicit shape and strides,
+ * so 1D promotion and batch broadcasting never need views
+ */
+typedef struct {
+    int ndim;
+    int m;
+    int n;
+    int k;
+    const int* batch_shape;
+    const int* a_batch_strides;
+    const int* b_batch_strides;
+    int a_row_stride;
+    int a_col_stride;
+    int b_row_stride;
+    int b_col_stride;
+    const float* a;
+    const float* b;
+    float* out;
+} MatMulJob;
+
+// Strides of each operand along the right-aligned batch dimensions of the output, 0 where it broadcasts
+static void matrix_batch_strides(int* a_batch_strides, int* b_batch_strides, const Tensor* a, const Tensor* b,
+                                 const int batch_ndim) {
+    const int a_batch_ndim = MAX(0, a->ndim - 2);
+    const int b_batch_ndim = MAX(0, b->ndim - 2);
+
+    for (int i = 0; i < batch_ndim; i++) {
+        const int a_dim = i - (batch_ndim - a_batch_ndim);
+        const int b_dim = i - (batch_ndim - b_batch_ndim);
+
+        a_batch_strides[i] = a_dim < 0 || a->shape[a_dim] == 1 ? 0 : a->strides[a_dim];
+        b_batch_strides[i] = b_dim < 0 || b->shape[b_dim] == 1 ? 0 : b->strides[b_dim];
+    }
+}
+
+static void mat_mul_row_range(void* ctx, const int begin, const int end) {
+    const MatMulJob* job = ctx;
+
+    for (int row = begin; row < end; row++) {
+        const int i = row % job->m;
         int offset_a = 0;
         int offset_b = 0;
-        int tmp = idx;
+        int tmp = row / job->m;
 
-        for (int dim = 0; dim < out->ndim; dim++) {
-            const int d_idx = tmp / out->strides[dim];
-            tmp %= out->strides[dim];
+        for (int dim = job->ndim - 1; dim >= 0; dim--) {
+            const int d_idx = tmp % job->batch_shape[dim];
+            tmp /= job->batch_shape[dim];
 
-            offset_a += d_idx * a_copy.strides[dim];
-            offset_b += d_idx * b_copy.strides[dim];
+            offset_a += d_idx * job->a_batch_strides[dim];
+            offset_b += d_idx * job->b_batch_strides[dim];
         }
 
-        out->data[idx] = op(a_copy.data[offset_a], b_copy.data[offset_b]);
-    }
+        float* restrict c = &job->out[(size_t) row * job->n];
+        const float* a_row = &job->a[offset_a + i * job->a_row_stride];
+        const float* b = &job->b[offset_b];
 
-    return TENSOR_ERROR_NONE;
+        for (int j = 0; j < job->n; j++) c[j] = 0.0f;
+
+        for (int p = 0; p < job->k; p++) {
+            const float x = a_row[p * job->a_col_stride];
+            const float* restrict b_row = &b[p * job->b_row_stride];
+
+            if (job->b_col_stride == 1) {
+                for (int j = 0; j < job->n; j++) c[j] += x * b_row[j];
+            }else {
+                for (int j = 0; j < job->n; j++) c[j] += x * b_row[j * job->b_col_stride];
+            }
+        }
+    }
 }
 
-TensorError tensor_mat_mul(Tensor* out, const Tensor* a, const Tensor* b) {
-    Tensor a_copy;
-    Tensor b_copy;
+TensorError mat_mul_output_shape(int* shape, int* ndim, const Tensor* a, const Tensor* b) {
+    if (a->ndim < 1 || b->ndim < 1) return TENSOR_ERROR_INVALID_ARGUMENT;
 
-    const int total_dims = MAX(2,MAX(a->ndim,b->ndim));
+    // A 1D left operand acts as a row vector [1,K], a 1D right operand as a column vector [K,1]
+    const int m = a->ndim == 1 ? 1 : a->shape[a->ndim - 2];
+    const int a_k = a->shape[a->ndim - 1];
+    const int b_k = b->ndim == 1 ? b->shape[0] : b->shape[b->ndim - 2];
+    const int n = b->ndim == 1 ? 1 : b->shape[b->ndim - 1];
+
+    if (a_k != b_k) {return TENSOR_ERROR_INPUT_DIM_MISMATCH;}
 
-    tensor_shallow_copy(&a_copy,a,total_dims);
-    tensor_shallow_copy(&b_copy,b,total_dims);
+    const int a_batch_ndim = MAX(0, a->ndim - 2);
+    const int b_batch_ndim = MAX(0, b->ndim - 2);
+    const int batch_ndim = MAX(a_batch_ndim, b_batch_ndim);
+    if (batch_ndim + 2 > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
 
-    if (b->ndim == 1) {
-        tensor_promote_to_col(&b_copy);
+    if (broadcast_shape(shape, a->shape, a_batch_ndim, b->shape, b_batch_ndim) < 0) {
+        return TENSOR_ERROR_CANNOT_BROADCAST;
     }
 
-    const int a_k = a_copy.shape[a_copy.ndim - 1];
-    const int b_k = b_copy.shape[b_copy.ndim - 2];
+    shape[batch_ndim] = m;
+    shape[batch_ndim + 1] = n;
+    *ndim = batch_ndim + 2;
 
-    if (a_k != b_k) {return TENSOR_ERROR_INPUT_DIM_MISMATCH;}
+    return TENSOR_ERROR_NONE;
+}
 
-    const TensorError err = matrix_broadcast(out, &a_copy, &b_copy);
+/**
+ * Products with a 2D right operand and enough rows go through the blocked GEMM, which packs b for each call
+ * and so picks up configurations tuned for the shape; everything else runs the row loop below
+ */
+size_t mat_mul_scratch_length(const Tensor* a, const Tensor* b) {
+    if (b->ndim != 2) return 0;
+    int rows = 1;
+    for (int d = 0; d < a->ndim - 1; d++) rows *= a->shape[d];
+    return rows < MAT_MUL_PACK_MIN_ROWS ? 0 : gemm_packed_length(b->shape[0], b->shape[1]);
+}
 
+void mat_mul_into(const Tensor* out, const Tensor* a, const Tensor* b, float* scratch) {
+    if (mat_mul_scratch_length(a, b)) {
+        gemm_mat_mul_into(out, a, b, scratch);
+        return;
+    }
+
+    const int batch_ndim = out->ndim - 2;
+    const int m = out->shape[batch_ndim];
+    const int n = out->shape[batch_ndim + 1];
+    const int k = a->shape[a->ndim - 1];
+
+    int a_batch_strides[TENSOR_KERNEL_MAX_DIMS];
+    int b_batch_strides[TENSOR_KERNEL_MAX_DIMS];
+    matrix_batch_strides(a_batch_strides, b_batch_strides, a, b, batch_ndim);
+
+    const MatMulJob job = {
+        .ndim = batch_ndim,
+        .m = m,
+        .n = n,
+        .k = k,
+        .batch_shape = out->shape,
+        .a_batch_strides = a_batch_strides,
+        .b_batch_strides = b_batch_strides,
+        .a_row_stride = a->ndim == 1 ? 0 : a->strides[a->ndim - 2],
+        .a_col_stride = a->strides[a->ndim - 1],
+        .b_row_stride = b->ndim == 1 ? b->strides[0] : b->strides[b->ndim - 2],
+        .b_col_stride = b->ndim == 1 ? 0 : b->strides[b->ndim - 1],
+        .a = a->data,
+        .b = b->data,
+        .out = out->data,
+    };
+
+    const int rows = out->length / MAX(1, n);
+    parallel_for(rows, MAX(1, MAT_MUL_GRAIN_FLOPS / MAX(1, n * k)), mat_mul_row_range, (void*) &job);
+}
+
+static TensorError mat_mul(Tensor* out, const Tensor* a, const Tensor* b) {
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int ndim;
+
+    TensorError err = mat_mul_output_shape(shape, &ndim, a, b);
     if (err != TENSOR_ERROR_NONE) return err;
 
+    void* scratch = NULL;
+    const size_t scratch_length = mat_mul_scratch_length(a, b);
+    if (scratch_length && posix_memalign(&scratch, MAT_MUL_ALIGNMENT, scratch_length * sizeof(float)) != 0) {
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    err = tensor_empty(out, shape, ndim);
+    if (err == TENSOR_ERROR_NONE) mat_mul_into(out, a, b, scratch);
+
+    free(scratch);
+    return err;
+}
+
+TensorError tensor_mat_mul(Tensor* out, const Tensor* a, const Tensor* b) {
+    const ProfileScope scope = profile_begin("tensor_mat_mul");
+    return profile_end(&scope, mat_mul(out, a, b));
+}
 
+TensorError tensor_add(Tensor* out, const Tensor* a, const Tensor* b) {
+    const ProfileScope scope = profile_begin("tensor_add");
+    return profile_end(&scope, element_wise_operation(out,a,b,ELEMENTWISE_ADD));
 }
-float add_op(const float x, const float y) {return x + y;}
-float sub_op(const float x, const float y) {return x - y;}
-float mul_op(const float x, const float y) {return x * y;}
-float div_op(const float x, const float y) {return x / y;}
 
-TensorError tensor_add(Tensor* out, const Tensor* a, const Tensor* b) {return element_wise_operation(out,a,b,add_op);}
-TensorError tensor_sub(Tensor* out, const Tensor* a, const Tensor* b) {return element_wise_operation(out,a,b,sub_op);}
-TensorError tensor_mul(Tensor* out, const Tensor* a, const Tensor* b) {return element_wise_operation(out,a,b,mul_op);}
-TensorError tensor_div(Tensor* out, const Tensor* a, const Tensor* b) {return element_wise_operation(out,a,b,div_op);}
+TensorError tensor_sub(Tensor* out, const Tensor* a, const Tensor* b) {
+    const ProfileScope scope = profile_begin("tensor_sub");
+    return profile_end(&scope, element_wise_operation(out,a,b,ELEMENTWISE_SUB));
+}
+
+TensorError tensor_mul(Tensor* out, const Tensor* a, const Tensor* b) {
+    const ProfileScope scope = profile_begin("tensor_mul");
+    return profile_end(&scope, element_wise_operation(out,a,b,ELEMENTWISE_MUL));
+}
 
+TensorError tensor_div(Tensor* out, const Tensor* a, const Tensor* b) {
+    const ProfileScope scope = profile_begin("tensor_div");
+    return profile_end(&scope, element_wise_operation(out,a,b,ELEMENTWISE_DIV));
+}
@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tensor_plan.h"
+
+#include "numa_placement.h"
+#include "op_profile.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+// Slab offsets are rounded to a cache line and the slab starts on one, so no two buffers share one
+#define PLAN_ALIGNMENT 16
+
+/**
+ * A region of the slab. first and last are the indices of the ops that write it first and read it last,
+ * so two buffers may share memory when those intervals do not intersect
+ */
+typedef struct {
+    size_t length;
+    int first;
+    int last;
+    bool output;
+    size_t offset;
+} PlanBuffer;
+
+/**
+ * A Tensor handle produced by the plan. Views share the buffer of the tensor they were made from,
+ * buffer is -1 for views of tensors the plan does not own
+ */
+typedef struct {
+    Tensor* tensor;
+    int buffer;
+    bool is_view;
+} PlanResult;
+
+typedef enum {
+    PLAN_OP_ELEMENTWISE,
+    PLAN_OP_MAT_MUL,
+    PLAN_OP_CONV2D,
+} PlanOpKind;
+
+typedef struct {
+    PlanOpKind kind;
+    ElementwiseOp elementwise;
+    Tensor* out;
+    const Tensor* a;
+    const Tensor* b;
+    const Tensor* bias;
+    TensorConv2dParams params;
+    int scratch;        //< Buffer index of the op's scratch memory, -1 if it needs none
+} PlanOp;
+
+struct TensorPlan {
+    PlanOp* ops;
+    int num_ops;
+    int ops_cap;
+
+    PlanResult* results;
+    int num_results;
+    int results_cap;
+
+    PlanBuffer* buffers;
+    int num_buffers;
+    int buffers_cap;
+
+    bool compiled;
+    float* slab;
+    size_t slab_length;
+};
+
+static int grow_array(void** array, int* cap, const int needed, const size_t elem_size) {
+    if (needed <= *cap) return 0;
+    const int new_cap = *cap ? *cap * 2 : 8;
+    void* grown = realloc(*array, new_cap * elem_size);
+    if (grown == NULL) return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static PlanResult* plan_find(const TensorPlan* plan, const Tensor* tensor) {
+    for (int i = 0; i < plan->num_results; i++) {
+        if (plan->results[i].tensor == tensor) return &plan->results[i];
+    }
+    return NULL;
+}
+
+static int plan_add_buffer(TensorPlan* plan, const size_t length, const int op) {
+    if (grow_array((void**) &plan->buffers, &plan->buffers_cap, plan->num_buffers + 1, sizeof *plan->buffers) < 0) {
+        return -1;
+    }
+    plan->buffers[plan->num_buffers] = (PlanBuffer) {length, op, op, false, 0};
+    return plan->num_buffers++;
+}
+
+// Extend the lifetime of whatever buffer `tensor` reads from up to op
+static void plan_use(const TensorPlan* plan, const Tensor* tensor, const int op) {
+    if (tensor == NULL) return;
+    const PlanResult* result = plan_find(plan, tensor);
+    if (result == NULL || result->buffer < 0) return;
+
+    PlanBuffer* buffer = &plan->buffers[result->buffer];
+    if (buffer->last < op) buffer->last = op;
+}
+
+static TensorError plan_check_out(const TensorPlan* plan, const Tensor* out, const Tensor* a, const Tensor* b) {
+    if (plan->compiled) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (out == a || out == b || plan_find(plan, out)) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return TENSOR_ERROR_NONE;
+}
+
+/**
+ * Record an op producing a contiguous result of the given shape. The result gets its metadata now,
+ * its data once the plan is compiled
+ */
+static TensorError plan_record(TensorPlan* plan, const PlanOp* op, const int* shape, const int ndim,
+                               const size_t scratch_length) {
+    if (grow_array((void**) &plan->ops, &plan->ops_cap, plan->num_ops + 1, sizeof *plan->ops) < 0) {
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+    if (grow_array((void**) &plan->results, &plan->results_cap, plan->num_results + 1, sizeof *plan->results) < 0) {
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    int* metadata = malloc(2 * ndim * sizeof *metadata);
+    if (metadata == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    const int index = plan->num_ops;
+    int length = 1;
+    for (int i = 0; i < ndim; i++) length *= shape[i];
+
+    const int buffer = plan_add_buffer(plan, length, index);
+    const int scratch = scratch_length ? plan_add_buffer(plan, scratch_length, index) : -1;
+    if (buffer < 0 || (scratch_length && scratch < 0)) {
+        if (buffer >= 0) plan->num_buffers = buffer;
+        free(metadata);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    Tensor* out = op->out;
+    out->ndim = ndim;
+    out->length = length;
+    out->shape = metadata;
+    out->strides = &metadata[ndim];
+    out->data = NULL;
+    memcpy(out->shape, shape, ndim * sizeof *shape);
+    for (int i = ndim - 1, stride = 1; i >= 0; i--) {
+        out->strides[i] = stride;
+        stride *= shape[i];
+    }
+
+    plan_use(plan, op->a, index);
+    plan_use(plan, op->b, index);
+    plan_use(plan, op->bias, index);
+
+    plan->ops[index] = *op;
+    plan->ops[index].scratch = scratch;
+    plan->num_ops++;
+    plan->results[plan->num_results++] = (PlanResult) {out, buffer, false};
+
+    return TENSOR_ERROR_NONE;
+}
+
+static TensorError plan_elementwise(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b, const ElementwiseOp kind) {
+    TensorError err = plan_check_out(plan, out, a, b);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int ndim;
+    err = elementwise_output_shape(shape, &ndim, a, b);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const PlanOp op = {.kind = PLAN_OP_ELEMENTWISE, .elementwise = kind, .out = out, .a = a, .b = b};
+    return plan_record(plan, &op, shape, ndim, 0);
+}
+
+TensorError tensor_plan_create(TensorPlan** out) {
+    TensorPlan* plan = calloc(1, sizeof *plan);
+    if (plan == NULL) return TENSOR_ERROR_NO_MEMORY;
+    *out = plan;
+    return TENSOR_ERROR_NONE;
+}
+
+void tensor_plan_destroy(TensorPlan* plan) {
+    if (plan == NULL) return;
+
+    for (int i = 0; i < plan->num_results; i++) {
+        Tensor* tensor = plan->results[i].tensor;
+        tensor_view_free(tensor);
+        tensor->data = NULL;
+    }
+
+    free(plan->slab);
+    free(plan->ops);
+    free(plan->results);
+    free(plan->buffers);
+    free(plan);
+}
+
+TensorError tensor_plan_add(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b) {
+    return plan_elementwise(plan, out, a, b, ELEMENTWISE_ADD);
+}
+
+TensorError tensor_plan_sub(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b) {
+    return plan_elementwise(plan, out, a, b, ELEMENTWISE_SUB);
+}
+
+TensorError tensor_plan_mul(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b) {
+    return plan_elementwise(plan, out, a, b, ELEMENTWISE_MUL);
+}
+
+TensorError tensor_plan_div(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b) {
+    return plan_elementwise(plan, out, a, b, ELEMENTWISE_DIV);
+}
+
+TensorError tensor_plan_mat_mul(TensorPlan* plan, Tensor* out, const Tensor* a, const Tensor* b) {
+    TensorError err = plan_check_out(plan, out, a, b);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int ndim;
+    err = mat_mul_output_shape(shape, &ndim, a, b);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const PlanOp op = {.kind = PLAN_OP_MAT_MUL, .out = out, .a = a, .b = b};
+    return plan_record(plan, &op, shape, ndim, mat_mul_scratch_length(a, b));
+}
+
+TensorError tensor_plan_conv2d(TensorPlan* plan, Tensor* out, const Tensor* input, const Tensor* weight,
+                               const Tensor* bias, const TensorConv2dParams* params) {
+    TensorError err = plan_check_out(plan, out, input, weight);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out == bias) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    int shape[4];
+    err = conv2d_output_shape(shape, input, weight, bias, params);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const PlanOp op = {.kind = PLAN_OP_CONV2D, .out = out, .a = input, .b = weight, .bias = bias, .params = *params};
+    return plan_record(plan, &op, shape, 4, conv2d_scratch_length(weight, params));
+}
+
+TensorError tensor_plan_expand(TensorPlan* plan, Tensor* out, const Tensor* in, const int* new_shape, const int new_ndim) {
+    TensorError err = plan_check_out(plan, out, in, NULL);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    if (grow_array((void**) &plan->results, &plan->results_cap, plan->num_results + 1, sizeof *plan->results) < 0) {
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    err = tensor_expand(out, in, new_shape, new_ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const PlanResult* base = plan_find(plan, in);
+    plan->results[plan->num_results++] = (PlanResult) {out, base ? base->buffer : -1, true};
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_plan_mark_output(TensorPlan* plan, const Tensor* tensor) {
+    const PlanResult* result = plan_find(plan, tensor);
+    if (result == NULL || plan->compiled) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    if (result->buffer >= 0) plan->buffers[result->buffer].output = true;
+    return TENSOR_ERROR_NONE;
+}
+
+static size_t plan_aligned(const size_t length) {
+    return (length + PLAN_ALIGNMENT - 1) / PLAN_ALIGNMENT * PLAN_ALIGNMENT;
+}
+
+static int compare_by_size(const void* lhs, const void* rhs) {
+    const PlanBuffer* a = *(PlanBuffer* const*) lhs;
+    const PlanBuffer* b = *(PlanBuffer* const*) rhs;
+    if (a->length != b->length) return a->length < b->length ? 1 : -1;
+    return a->first - b->first;
+}
+
+static int compare_by_offset(const void* lhs, const void* rhs) {
+    const PlanBuffer* a = *(PlanBuffer* const*) lhs;
+    const PlanBuffer* b = *(PlanBuffer* const*) rhs;
+    return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+/**
+ * Greedy interval coloring by size: buffers are placed largest first, each in the smallest gap left
+ * between already placed buffers whose lifetimes intersect its own, or after all of them.
+ * Placing large buffers first keeps small ones from fragmenting the slab
+ */
+static TensorError plan_assign_offsets(TensorPlan* plan) {
+    const int n = plan->num_buffers;
+    PlanBuffer** order = malloc(2 * (n ? n : 1) * sizeof *order);
+    if (order == NULL) return TENSOR_ERROR_NO_MEMORY;
+    PlanBuffer** live = &order[n];
+
+    for (int i = 0; i < n; i++) {
+        PlanBuffer* buffer = &plan->buffers[i];
+        if (buffer->output) buffer->last = plan->num_ops;
+        order[i] = buffer;
+    }
+    qsort(order, n, sizeof *order, compare_by_size);
+
+    plan->slab_length = 0;
+    for (int i = 0; i < n; i++) {
+        PlanBuffer* buffer = order[i];
+        const size_t length = plan_aligned(buffer->length);
+
+        int num_live = 0;
+        for (int j = 0; j < i; j++) {
+            if (order[j]->first <= buffer->last && buffer->first <= order[j]->last) live[num_live++] = order[j];
+        }
+        qsort(live, num_live, sizeof *live, compare_by_offset);
+
+        size_t best_offset = 0;
+        size_t best_gap = (size_t) -1;
+        size_t end = 0;
+        for (int j = 0; j < num_live; j++) {
+            if (live[j]->offset >= end + length && live[j]->offset - end < best_gap) {
+                best_gap = live[j]->offset - end;
+                best_offset = end;
+            }
+            const size_t live_end = live[j]->offset + plan_aligned(live[j]->length);
+            if (live_end > end) end = live_end;
+        }
+
+        buffer->offset = best_gap != (size_t) -1 ? best_offset : end;
+        if (buffer->offset + length > plan->slab_length) plan->slab_length = buffer->offset + length;
+    }
+
+    free(order);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_plan_compile(TensorPlan* plan) {
+    if (plan->compiled) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    TensorError err = plan_assign_offsets(plan);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    plan->slab = numa_placement_alloc(plan->slab_length ? plan->slab_length : 1);
+    if (plan->slab == NULL) return TENSOR_ERROR_NO_MEMORY;
+
+    // Every result, views included, starts at the beginning of its buffer
+    for (int i = 0; i < plan->num_results; i++) {
+        const PlanResult* result = &plan->results[i];
+        if (result->buffer >= 0) result->tensor->data = &plan->slab[plan->buffers[result->buffer].offset];
+    }
+
+    parallel_start();
+    plan->compiled = true;
+    return TENSOR_ERROR_NONE;
+}
+
+// Planned ops are profiled under the name of the call that recorded them
+static const char* plan_op_name(const PlanOp* op) {
+    static const char* const elementwise_names[] = {
+        [ELEMENTWISE_ADD] = "tensor_plan_add",
+        [ELEMENTWISE_SUB] = "tensor_plan_sub",
+        [ELEMENTWISE_MUL] = "tensor_plan_mul",
+        [ELEMENTWISE_DIV] = "tensor_plan_div",
+    };
+
+    switch (op->kind) {
+        case PLAN_OP_ELEMENTWISE: return elementwise_names[op->elementwise];
+        case PLAN_OP_MAT_MUL: return "tensor_plan_mat_mul";
+        default: return "tensor_plan_conv2d";
+    }
+}
+
+TensorError tensor_plan_execute(const TensorPlan* plan) {
+    if (!plan->compiled) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    for (int i = 0; i < plan->num_ops; i++) {
+        const PlanOp* op = &plan->ops[i];
+        const ProfileScope scope = profile_begin(plan_op_name(op));
+
+        switch (op->kind) {
+            case PLAN_OP_ELEMENTWISE:
+                elementwise_into(op->out, op->a, op->b, op->elementwise);
+                break;
+            case PLAN_OP_MAT_MUL:
+                mat_mul_into(op->out, op->a, op->b,
+                             op->scratch < 0 ? NULL : &plan->slab[plan->buffers[op->scratch].offset]);
+                break;
+            case PLAN_OP_CONV2D:
+                conv2d_into(op->out, op->a, op->b, op->bias, &op->params,
+                            &plan->slab[plan->buffers[op->scratch].offset]);
+                break;
+        }
+        profile_end(&scope, TENSOR_ERROR_NONE);
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+size_t tensor_plan_slab_bytes(const TensorPlan* plan) {
+    return plan->slab_length * sizeof *plan->slab;
+}
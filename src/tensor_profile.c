@@ -0,0 +1,267 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "op_profile.h"
+#include "string_builder.h"
+
+#if defined(__linux__)
+#define PROFILE_HAS_PERF_EVENTS 1
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#define PROFILE_MAX_THREADS 256
+#define PROFILE_MAX_OPS 64
+
+/**
+ * Every thread that runs ops, callers and parallel_for workers alike, opens one counter group the first
+ * time it does so while profiling is enabled, counting that thread only. A call's counts are the change
+ * in the sum over all groups between its start and end. When a thread exits its final counts move to
+ * `retired`, so the sum never goes backwards and its slot can be reused
+ */
+typedef struct {
+    bool in_use;
+    int leader;                             //< Group leader fd, -1 when no counter could be opened
+    int members;
+    int fds[TENSOR_COUNTER_COUNT];
+    TensorCounter order[TENSOR_COUNTER_COUNT];  //< Counter of each value in a group read
+} ThreadCounters;
+
+static struct {
+    atomic_bool enabled;
+    pthread_mutex_t lock;
+    pthread_once_t key_once;
+    pthread_key_t key;                      //< Slot + 1 of the thread's counters, released at thread exit
+
+    ThreadCounters threads[PROFILE_MAX_THREADS];
+    uint64_t retired[TENSOR_COUNTER_COUNT];
+    unsigned available;
+
+    TensorProfileEntry ops[PROFILE_MAX_OPS];
+    int op_count;
+} profile = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .key_once = PTHREAD_ONCE_INIT,
+};
+
+static _Thread_local int thread_slot = -1;  //< -1 before the first attach, -2 when every slot was taken
+static _Thread_local int op_depth = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+#ifdef PROFILE_HAS_PERF_EVENTS
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} profile_events[TENSOR_COUNTER_COUNT] = {
+    [TENSOR_COUNTER_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [TENSOR_COUNTER_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [TENSOR_COUNTER_L1D_MISSES] = {
+        PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+    },
+    [TENSOR_COUNTER_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [TENSOR_COUNTER_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#endif
+
+// Opens what it can of one group on the calling thread; counters the CPU lacks are skipped
+static void counters_open(ThreadCounters* t) {
+    t->leader = -1;
+    t->members = 0;
+
+#ifdef PROFILE_HAS_PERF_EVENTS
+    for (int c = 0; c < TENSOR_COUNTER_COUNT; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = profile_events[c].type;
+        attr.config = profile_events[c].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, t->leader, 0);
+        if (fd < 0) continue;
+
+        if (t->leader < 0) t->leader = fd;
+        t->fds[t->members] = fd;
+        t->order[t->members++] = (TensorCounter) c;
+    }
+#endif
+}
+
+static void counters_close(ThreadCounters* t) {
+    // Members first, the leader last
+    for (int i = t->members - 1; i >= 0; i--) close(t->fds[i]);
+    t->leader = -1;
+    t->members = 0;
+}
+
+// Adds the group's counts to totals, scaled up if the kernel had to multiplex it with other events
+static void counters_read(const ThreadCounters* t, uint64_t* totals) {
+    if (t->leader < 0) return;
+
+    uint64_t values[3 + TENSOR_COUNTER_COUNT];
+    const ssize_t expected = (ssize_t) ((3 + t->members) * sizeof *values);
+    if (read(t->leader, values, sizeof values) < expected) return;
+
+    const uint64_t enabled = values[1];
+    const uint64_t running = values[2];
+    for (int i = 0; i < t->members; i++) {
+        uint64_t value = values[3 + i];
+        if (running > 0 && running < enabled) value = (uint64_t) ((double) value * enabled / running);
+        totals[t->order[i]] += value;
+    }
+}
+
+// Caller must hold profile.lock
+static void counters_sum(uint64_t* totals) {
+    memcpy(totals, profile.retired, sizeof profile.retired);
+    for (int i = 0; i < PROFILE_MAX_THREADS; i++) {
+        if (profile.threads[i].in_use) counters_read(&profile.threads[i], totals);
+    }
+}
+
+static void thread_exit(void* arg) {
+    ThreadCounters* t = &profile.threads[(intptr_t) arg - 1];
+
+    pthread_mutex_lock(&profile.lock);
+    counters_read(t, profile.retired);
+    counters_close(t);
+    t->in_use = false;
+    pthread_mutex_unlock(&profile.lock);
+}
+
+static void create_key(void) {
+    pthread_key_create(&profile.key, thread_exit);
+}
+
+void profile_attach_thread(void) {
+    if (thread_slot != -1 || !atomic_load_explicit(&profile.enabled, memory_order_relaxed)) return;
+    pthread_once(&profile.key_once, create_key);
+
+    pthread_mutex_lock(&profile.lock);
+    thread_slot = -2;
+    for (int i = 0; i < PROFILE_MAX_THREADS; i++) {
+        ThreadCounters* t = &profile.threads[i];
+        if (t->in_use) continue;
+
+        counters_open(t);
+        for (int m = 0; m < t->members; m++) profile.available |= 1u << t->order[m];
+        t->in_use = true;
+        thread_slot = i;
+        pthread_setspecific(profile.key, (void*) (intptr_t) (i + 1));
+        break;
+    }
+    pthread_mutex_unlock(&profile.lock);
+}
+
+ProfileScope profile_begin(const char* op) {
+    ProfileScope scope = {0};
+    if (!atomic_load_explicit(&profile.enabled, memory_order_relaxed)) return scope;
+
+    scope.nested = true;
+    if (op_depth++ > 0) return scope;
+
+    profile_attach_thread();
+    scope.op = op;
+    pthread_mutex_lock(&profile.lock);
+    counters_sum(scope.counters);
+    pthread_mutex_unlock(&profile.lock);
+    scope.start_ms = now_ms();
+    return scope;
+}
+
+TensorError profile_end(const ProfileScope* scope, const TensorError err) {
+    if (scope->nested) op_depth--;
+    if (scope->op == NULL) return err;
+
+    const double ms = now_ms() - scope->start_ms;
+    uint64_t totals[TENSOR_COUNTER_COUNT];
+
+    pthread_mutex_lock(&profile.lock);
+    counters_sum(totals);
+
+    int i = 0;
+    while (i < profile.op_count && strcmp(profile.ops[i].op, scope->op) != 0) i++;
+    if (i == profile.op_count && profile.op_count < PROFILE_MAX_OPS) {
+        profile.ops[profile.op_count++] = (TensorProfileEntry) {.op = scope->op};
+    }
+
+    if (i < profile.op_count) {
+        TensorProfileEntry* entry = &profile.ops[i];
+        entry->calls++;
+        entry->ms += ms;
+        for (int c = 0; c < TENSOR_COUNTER_COUNT; c++) entry->counters[c] += totals[c] - scope->counters[c];
+    }
+    pthread_mutex_unlock(&profile.lock);
+
+    return err;
+}
+
+void tensor_profile_enable(const bool enable) {
+    atomic_store_explicit(&profile.enabled, enable, memory_order_relaxed);
+    profile_attach_thread();
+}
+
+unsigned tensor_profile_counters_available(void) {
+    pthread_mutex_lock(&profile.lock);
+    const unsigned available = profile.available;
+    pthread_mutex_unlock(&profile.lock);
+    return available;
+}
+
+void tensor_profile_reset(void) {
+    pthread_mutex_lock(&profile.lock);
+    profile.op_count = 0;
+    pthread_mutex_unlock(&profile.lock);
+}
+
+int tensor_profile_snapshot(TensorProfileEntry* entries, const int capacity) {
+    pthread_mutex_lock(&profile.lock);
+    const int count = profile.op_count;
+    memcpy(entries, profile.ops, (count < capacity ? count : capacity) * sizeof *entries);
+    pthread_mutex_unlock(&profile.lock);
+    return count;
+}
+
+// Events per thousand instructions, or 0 without an instruction count
+static double per_kilo_instruction(const TensorProfileEntry* entry, const TensorCounter counter) {
+    const uint64_t instructions = entry->counters[TENSOR_COUNTER_INSTRUCTIONS];
+    return instructions ? 1e3 * (double) entry->counters[counter] / (double) instructions : 0.0;
+}
+
+size_t tensor_profile_report(char* buffer, const size_t size) {
+    TensorProfileEntry entries[PROFILE_MAX_OPS];
+    const int count = tensor_profile_snapshot(entries, PROFILE_MAX_OPS);
+
+    StringBuilder sb;
+    init_sb_fixed(&sb, buffer, size);
+    sb_append(&sb, "op calls ms cycles instructions ipc l1d_mpki llc_mpki branch_mpki\n");
+
+    for (int i = 0; i < count && i < PROFILE_MAX_OPS; i++) {
+        const TensorProfileEntry* e = &entries[i];
+        const uint64_t cycles = e->counters[TENSOR_COUNTER_CYCLES];
+
+        char line[256];
+        snprintf(line, sizeof line, "%s %llu %.3f %llu %llu %.2f %.2f %.2f %.2f\n", e->op,
+                 (unsigned long long) e->calls, e->ms, (unsigned long long) cycles,
+                 (unsigned long long) e->counters[TENSOR_COUNTER_INSTRUCTIONS],
+                 cycles ? (double) e->counters[TENSOR_COUNTER_INSTRUCTIONS] / (double) cycles : 0.0,
+                 per_kilo_instruction(e, TENSOR_COUNTER_L1D_MISSES), per_kilo_instruction(e, TENSOR_COUNTER_LLC_MISSES),
+                 per_kilo_instruction(e, TENSOR_COUNTER_BRANCH_MISSES));
+        sb_append(&sb, line);
+    }
+
+    return sb.len;
+}
@@ -0,0 +1,225 @@
+#include <string.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RANDOM_HAS_X86_KERNELS 1
+#endif
+
+/**
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+ * Block b is the encryption of the counter {b, 0, 0, 0} under the key {seed lo, seed hi}, so any
+ * element can be produced without generating the ones before it.
+ *
+ * Elements are generated in batches of RANDOM_BATCH_BLOCKS blocks. Word w of block i in a batch
+ * becomes element w * RANDOM_BATCH_BLOCKS + i of that batch, which keeps every step of a batch a
+ * plain loop over contiguous arrays that the compiler vectorizes. Batches are the unit of work for
+ * the threads, so how they are split never changes a value.
+ */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+#define RANDOM_BATCH_BLOCKS 64
+#define RANDOM_BATCH (4 * RANDOM_BATCH_BLOCKS)
+#define RANDOM_GRAIN 64
+
+#define RANDOM_LN2 0.693147180559945f
+#define RANDOM_HALF_PI 1.57079632679490f
+
+typedef struct {
+    uint32_t key[2];
+    int normal;
+    float offset;   //< low for uniform, mean for normal
+    float scale;    //< high - low for uniform, std for normal
+    float top;      //< largest uniform value below high
+} RandomJob;
+
+typedef void (*RandomBatchFn)(float* out, const RandomJob* job, uint32_t first_block);
+
+static inline __attribute__((always_inline))
+void philox_batch(uint32_t x[4][RANDOM_BATCH_BLOCKS], const uint32_t* key, const uint32_t first_block) {
+    for (int i = 0; i < RANDOM_BATCH_BLOCKS; i++) {
+        x[0][i] = first_block + (uint32_t) i;
+        x[1][i] = 0;
+        x[2][i] = 0;
+        x[3][i] = 0;
+    }
+
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        for (int i = 0; i < RANDOM_BATCH_BLOCKS; i++) {
+            const uint64_t p0 = (uint64_t) PHILOX_M0 * x[0][i];
+            const uint64_t p1 = (uint64_t) PHILOX_M1 * x[2][i];
+            const uint32_t c1 = x[1][i], c3 = x[3][i];
+            x[0][i] = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+            x[1][i] = (uint32_t) p1;
+            x[2][i] = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+            x[3][i] = (uint32_t) p0;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+static inline __attribute__((always_inline)) uint32_t float_bits(const float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    return bits;
+}
+
+static inline __attribute__((always_inline)) float bits_float(const uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+// Natural log of u in (0, 1): exponent plus the atanh series of the mantissa centred on 1
+static inline __attribute__((always_inline)) float random_log(const float u) {
+    const uint32_t bits = float_bits(u);
+    int exponent = (int) (bits >> 23) - 127;
+    const uint32_t mantissa = (bits & 0x7FFFFFu) | 0x3F800000u;
+    const uint32_t high = mantissa > 0x3FB504F3u;   //< above sqrt(2): halve it into [sqrt(2)/2, 1)
+    const float m = bits_float(mantissa - (high << 23));
+    exponent += (int) high;
+
+    const float t = (m - 1.0f) / (m + 1.0f);
+    const float t2 = t * t;
+    const float series = 2.0f + t2 * (0.666666667f + t2 * (0.4f + t2 * (0.285714286f + t2 * 0.222222222f)));
+    return (float) exponent * RANDOM_LN2 + t * series;
+}
+
+// sqrt(s) for s > 0 as s / sqrt(s), refining the bit-level reciprocal square root estimate
+static inline __attribute__((always_inline)) float random_sqrt(const float s) {
+    const float half = 0.5f * s;
+    float y = bits_float(0x5F3759DFu - (float_bits(s) >> 1));
+    y = y * (1.5f - half * y * y);
+    y = y * (1.5f - half * y * y);
+    y = y * (1.5f - half * y * y);
+    return s * y;
+}
+
+static inline __attribute__((always_inline))
+void random_batch(float* out, const RandomJob* job, const uint32_t first_block) {
+    uint32_t x[4][RANDOM_BATCH_BLOCKS];
+    philox_batch(x, job->key, first_block);
+
+    if (!job->normal) {
+        for (int w = 0; w < 4; w++) {
+            float* dst = &out[w * RANDOM_BATCH_BLOCKS];
+            for (int i = 0; i < RANDOM_BATCH_BLOCKS; i++) {
+                const float u = (float) (x[w][i] >> 8) * 0x1p-24f;
+                const float v = job->offset + job->scale * u;
+                dst[i] = v < job->top ? v : job->top;
+            }
+        }
+        return;
+    }
+
+    // Box-Muller on word pairs (0, 1) and (2, 3): the first sets the radius, the second the angle.
+    // The top two bits of the angle word pick a quadrant and the rest an offset in [-pi/4, pi/4)
+    for (int w = 0; w < 4; w += 2) {
+        float* dst_cos = &out[w * RANDOM_BATCH_BLOCKS];
+        float* dst_sin = &out[(w + 1) * RANDOM_BATCH_BLOCKS];
+        for (int i = 0; i < RANDOM_BATCH_BLOCKS; i++) {
+            const float u = ((float) (x[w][i] >> 9) + 0.5f) * 0x1p-23f;
+            const float radius = job->scale * random_sqrt(-2.0f * random_log(u));
+
+            const uint32_t angle = x[w + 1][i];
+            const uint32_t quadrant = angle >> 30;
+            const float phi = ((float) ((angle >> 8) & 0x3FFFFFu) * 0x1p-22f - 0.5f) * RANDOM_HALF_PI;
+            const float phi2 = phi * phi;
+            const float s = phi * (1.0f - phi2 * (0.166666667f - phi2 * (0.00833333333f - phi2 * 0.000198412698f)));
+            const float c = 1.0f - phi2 * (0.5f - phi2 * (0.0416666667f - phi2 * (0.00138888889f - phi2 * 0.0000248015873f)));
+
+            const uint32_t swap = quadrant & 1;
+            const uint32_t cos_sign = ((quadrant + 1) & 2) << 30;
+            const uint32_t sin_sign = (quadrant & 2) << 30;
+            const float cos_value = bits_float(float_bits(swap ? s : c) ^ cos_sign);
+            const float sin_value = bits_float(float_bits(swap ? c : s) ^ sin_sign);
+            dst_cos[i] = job->offset + radius * cos_value;
+            dst_sin[i] = job->offset + radius * sin_value;
+        }
+    }
+}
+
+// Both variants vectorize the same loops without contracting to FMA, so their results are bit-identical
+static void random_batch_default(float* out, const RandomJob* job, const uint32_t first_block) {
+    random_batch(out, job, first_block);
+}
+
+#ifdef RANDOM_HAS_X86_KERNELS
+__attribute__((target("avx2")))
+static void random_batch_avx2(float* out, const RandomJob* job, const uint32_t first_block) {
+    random_batch(out, job, first_block);
+}
+#endif
+
+static RandomBatchFn random_batch_kernel(void) {
+#ifdef RANDOM_HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) return random_batch_avx2;
+#endif
+    return random_batch_default;
+}
+
+typedef struct {
+    float* data;
+    int length;
+    RandomJob job;
+    RandomBatchFn kernel;
+} RandomContext;
+
+static void random_range(void* ctx, const int begin, const int end) {
+    const RandomContext* random = ctx;
+    for (int batch = begin; batch < end; batch++) {
+        const int offset = batch * RANDOM_BATCH;
+        const uint32_t first_block = (uint32_t) batch * RANDOM_BATCH_BLOCKS;
+        if (random->length - offset >= RANDOM_BATCH) {
+            random->kernel(&random->data[offset], &random->job, first_block);
+        }else {
+            float tail[RANDOM_BATCH];
+            random->kernel(tail, &random->job, first_block);
+            memcpy(&random->data[offset], tail, (random->length - offset) * sizeof *tail);
+        }
+    }
+}
+
+// Largest float strictly below a finite value
+static float float_below(const float value) {
+    if (value == 0.0f) return -bits_float(1);
+    const uint32_t bits = float_bits(value);
+    return bits_float(value > 0.0f ? bits - 1 : bits + 1);
+}
+
+static TensorError random_generate(Tensor* out, const RandomJob* job, const int* shape, const int ndim) {
+    const TensorError err = tensor_empty(out, shape, ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    RandomContext random = {out->data, out->length, *job, random_batch_kernel()};
+    const int batches = (out->length + RANDOM_BATCH - 1) / RANDOM_BATCH;
+    parallel_for(batches, RANDOM_GRAIN, random_range, &random);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_rand_uniform(Tensor* out, const float low, const float high, const uint64_t seed,
+                                const int* shape, const int ndim) {
+    const float span = high - low;
+    if (!(low < high) || span - span != 0.0f) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const RandomJob job = {{(uint32_t) seed, (uint32_t) (seed >> 32)}, 0, low, span, float_below(high)};
+    const ProfileScope scope = profile_begin("tensor_rand_uniform");
+    return profile_end(&scope, random_generate(out, &job, shape, ndim));
+}
+
+TensorError tensor_rand_normal(Tensor* out, const float mean, const float std, const uint64_t seed,
+                               const int* shape, const int ndim) {
+    if (!(std >= 0.0f) || std - std != 0.0f || mean - mean != 0.0f) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const RandomJob job = {{(uint32_t) seed, (uint32_t) (seed >> 32)}, 1, mean, std, 0.0f};
+    const ProfileScope scope = profile_begin("tensor_rand_normal");
+    return profile_end(&scope, random_generate(out, &job, shape, ndim));
+}
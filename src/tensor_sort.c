@@ -0,0 +1,751 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+#define MIN(a,b)((a) < (b) ? (a) : (b))
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "op_profile.h"
+#include "tensor.h"
+#include "tensor_kernels.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SORT_HAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define SORT_GRAIN 16384
+#define SORT_PARALLEL_MIN 65536     //< Lanes at least this long are split across threads when there are few of them
+#define CUMSUM_BLOCK 65536          //< Scan block size for long axes, fixed so results do not depend on the thread count
+#define CUMSUM_INNER_BLOCK 1024
+
+/**
+ * Every value is sorted as a 64-bit key: the float mapped to an order-preserving int32 in the high half,
+ * its position in the low half. Keys are unique, so comparing keys alone is a total, stable order,
+ * and any split of the work across threads produces the same result
+ */
+typedef int64_t SortKey;
+
+static SortKey sort_key(const float value, const int position, const bool descending) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    if (isnan(value)) bits = 0x7FC00000u;
+
+    // Flip the magnitude of negative floats so that signed integer order matches float order
+    int32_t ordered = (int32_t) bits;
+    ordered ^= (int32_t) ((uint32_t) (ordered >> 31) >> 1);
+    if (descending) ordered = ~ordered;
+
+    return (SortKey) ((uint64_t) (uint32_t) ordered << 32 | (uint32_t) position);
+}
+
+static float sort_key_value(const SortKey key, const bool descending) {
+    int32_t ordered = (int32_t) (uint32_t) ((uint64_t) key >> 32);
+    if (descending) ordered = ~ordered;
+    ordered ^= (int32_t) ((uint32_t) (ordered >> 31) >> 1);
+
+    float value;
+    memcpy(&value, &ordered, sizeof value);
+    return value;
+}
+
+static int sort_key_position(const SortKey key) {
+    return (int) (uint32_t) key;
+}
+
+/**
+ * Sorts every group of 4 consecutive keys, producing the initial runs of the merge sort
+ */
+typedef void (*SortRunsFn)(SortKey* keys, int n);
+
+static void compare_exchange(SortKey* a, SortKey* b) {
+    const SortKey x = *a;
+    const SortKey y = *b;
+    *a = x < y ? x : y;
+    *b = x < y ? y : x;
+}
+
+static void sort_runs_scalar(SortKey* keys, const int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        compare_exchange(&keys[i], &keys[i + 1]);
+        compare_exchange(&keys[i + 2], &keys[i + 3]);
+        compare_exchange(&keys[i], &keys[i + 2]);
+        compare_exchange(&keys[i + 1], &keys[i + 3]);
+        compare_exchange(&keys[i + 1], &keys[i + 2]);
+    }
+    for (int j = i + 1; j < n; j++) {
+        for (int p = j; p > i && keys[p - 1] > keys[p]; p--) compare_exchange(&keys[p - 1], &keys[p]);
+    }
+}
+
+#ifdef SORT_HAS_X86_KERNELS
+#define SORT_CE_AVX2(a, b)                                      \
+    do {                                                        \
+        const __m256i gt_ = _mm256_cmpgt_epi64(a, b);           \
+        const __m256i lo_ = _mm256_blendv_epi8(a, b, gt_);      \
+        b = _mm256_blendv_epi8(b, a, gt_);                      \
+        a = lo_;                                                \
+    } while (0)
+
+/**
+ * In-register sorting network over blocks of 16 keys: four registers are sorted column-wise with a
+ * 4-input network, then the 4x4 block is transposed so that each column becomes a contiguous sorted run
+ */
+__attribute__((target("avx2")))
+static void sort_runs_avx2(SortKey* keys, const int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i r0 = _mm256_loadu_si256((const __m256i*) &keys[i]);
+        __m256i r1 = _mm256_loadu_si256((const __m256i*) &keys[i + 4]);
+        __m256i r2 = _mm256_loadu_si256((const __m256i*) &keys[i + 8]);
+        __m256i r3 = _mm256_loadu_si256((const __m256i*) &keys[i + 12]);
+
+        SORT_CE_AVX2(r0, r1);
+        SORT_CE_AVX2(r2, r3);
+        SORT_CE_AVX2(r0, r2);
+        SORT_CE_AVX2(r1, r3);
+        SORT_CE_AVX2(r1, r2);
+
+        const __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+        const __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+        const __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+        const __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+
+        _mm256_storeu_si256((__m256i*) &keys[i], _mm256_permute2x128_si256(t0, t2, 0x20));
+        _mm256_storeu_si256((__m256i*) &keys[i + 4], _mm256_permute2x128_si256(t1, t3, 0x20));
+        _mm256_storeu_si256((__m256i*) &keys[i + 8], _mm256_permute2x128_si256(t0, t2, 0x31));
+        _mm256_storeu_si256((__m256i*) &keys[i + 12], _mm256_permute2x128_si256(t1, t3, 0x31));
+    }
+
+    sort_runs_scalar(&keys[i], n - i);
+}
+#endif
+
+static SortRunsFn sort_runs_kernel(void) {
+#ifdef SORT_HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) return sort_runs_avx2;
+#endif
+    return sort_runs_scalar;
+}
+
+static void sort_merge(SortKey* restrict out, const SortKey* a, const int na, const SortKey* b, const int nb) {
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        const int take_b = b[j] < a[i];
+        out[k++] = take_b ? b[j] : a[i];
+        j += take_b;
+        i += !take_b;
+    }
+    memcpy(&out[k], &a[i], (na - i) * sizeof *out);
+    memcpy(&out[k + na - i], &b[j], (nb - j) * sizeof *out);
+}
+
+// Bottom-up merge sort of keys, using tmp as the second buffer. The result ends up in keys
+static void sort_keys(SortKey* keys, SortKey* tmp, const int n, const SortRunsFn sort_runs) {
+    sort_runs(keys, n);
+
+    SortKey* src = keys;
+    SortKey* dst = tmp;
+    for (int width = 4; width < n; width *= 2) {
+        for (int start = 0; start < n; start += 2 * width) {
+            const int na = MIN(width, n - start);
+            const int nb = MIN(width, n - start - na);
+            sort_merge(&dst[start], &src[start], na, &src[start + na], nb);
+        }
+        SortKey* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != keys) memcpy(keys, src, n * sizeof *keys);
+}
+
+/**
+ * Number of elements taken from a when the first k outputs of merging a and b are produced (merge path)
+ */
+static int merge_co_rank(const int k, const SortKey* a, const int na, const SortKey* b, const int nb) {
+    int lo = MAX(0, k - nb);
+    int hi = MIN(k, na);
+    while (lo < hi) {
+        const int i = (lo + hi) / 2;
+        if (a[i] < b[k - i - 1]) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+
+typedef struct {
+    SortKey* keys;
+    SortKey* tmp;
+    int n;
+    int chunk_length;
+    int width;
+    int parts;          //< Output partitions per merged pair
+    SortRunsFn sort_runs;
+} LaneSortJob;
+
+static void lane_sort_chunks(void* ctx, const int begin, const int end) {
+    const LaneSortJob* job = ctx;
+    for (int c = begin; c < end; c++) {
+        const int start = c * job->chunk_length;
+        const int length = MIN(job->chunk_length, job->n - start);
+        if (length > 0) sort_keys(&job->keys[start], &job->tmp[start], length, job->sort_runs);
+    }
+}
+
+// Merges pairs of sorted runs of job->width keys from keys into tmp, each pair split into independent parts
+static void lane_merge_parts(void* ctx, const int begin, const int end) {
+    const LaneSortJob* job = ctx;
+    for (int unit = begin; unit < end; unit++) {
+        const int start = unit / job->parts * 2 * job->width;
+        const int part = unit % job->parts;
+        const int na = MIN(job->width, job->n - start);
+        const int nb = MIN(job->width, job->n - start - na);
+        const SortKey* a = &job->keys[start];
+        const SortKey* b = &a[na];
+
+        const int k0 = (int) ((int64_t) (na + nb) * part / job->parts);
+        const int k1 = (int) ((int64_t) (na + nb) * (part + 1) / job->parts);
+        const int i0 = merge_co_rank(k0, a, na, b, nb);
+        const int i1 = merge_co_rank(k1, a, na, b, nb);
+
+        sort_merge(&job->tmp[start + k0], &a[i0], i1 - i0, &b[k0 - i0], k1 - i1 - (k0 - i0));
+    }
+}
+
+// Sorts one long lane with every thread: chunks are sorted in parallel, then merged pairwise along merge paths
+static void sort_keys_parallel(SortKey* keys, SortKey* tmp, const int n, const SortRunsFn sort_runs) {
+    const int threads = parallel_num_threads();
+    LaneSortJob job = {keys, tmp, n, (n + threads - 1) / threads, 0, threads, sort_runs};
+
+    parallel_for(threads, 1, lane_sort_chunks, &job);
+
+    for (job.width = job.chunk_length; job.width < n; job.width *= 2) {
+        const int pairs = (n + 2 * job.width - 1) / (2 * job.width);
+        parallel_for(pairs * job.parts, 1, lane_merge_parts, &job);
+
+        SortKey* swap = job.keys;
+        job.keys = job.tmp;
+        job.tmp = swap;
+    }
+
+    if (job.keys != keys) memcpy(keys, job.keys, n * sizeof *keys);
+}
+
+/**
+ * Geometry shared by the ops that work on whole lanes, the 1D fibers along the axis.
+ * Outputs are contiguous, so their lane strides come from the output shape
+ */
+typedef struct {
+    int lanes;
+    int n;                                          //< Length of the axis in the input
+    int lane_ndim;
+    int lane_shape[TENSOR_KERNEL_MAX_DIMS];
+    int in_strides[TENSOR_KERNEL_MAX_DIMS];
+    int out_strides[TENSOR_KERNEL_MAX_DIMS];
+    int in_axis_stride;
+    int out_axis_stride;
+} LaneLayout;
+
+static void lane_layout(LaneLayout* layout, const Tensor* in, const int axis, const int out_axis_length) {
+    int out_stride = 1;
+    int out_strides[TENSOR_KERNEL_MAX_DIMS];
+    for (int d = in->ndim - 1; d >= 0; d--) {
+        out_strides[d] = out_stride;
+        out_stride *= d == axis ? out_axis_length : in->shape[d];
+    }
+
+    layout->lanes = 1;
+    layout->n = in->shape[axis];
+    layout->lane_ndim = 0;
+    layout->in_axis_stride = in->strides[axis];
+    layout->out_axis_stride = out_strides[axis];
+
+    for (int d = 0; d < in->ndim; d++) {
+        if (d == axis) continue;
+        layout->lane_shape[layout->lane_ndim] = in->shape[d];
+        layout->in_strides[layout->lane_ndim] = in->strides[d];
+        layout->out_strides[layout->lane_ndim] = out_strides[d];
+        layout->lane_ndim++;
+        layout->lanes *= in->shape[d];
+    }
+}
+
+static int lane_offset(int lane, const LaneLayout* layout, const int* strides) {
+    int offset = 0;
+    for (int d = layout->lane_ndim - 1; d >= 0; d--) {
+        offset += lane % layout->lane_shape[d] * strides[d];
+        lane /= layout->lane_shape[d];
+    }
+    return offset;
+}
+
+static TensorError check_axis(const Tensor* in, const int axis) {
+    if (in->ndim < 1 || in->ndim > TENSOR_KERNEL_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (axis < 0 || axis >= in->ndim) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return TENSOR_ERROR_NONE;
+}
+
+typedef struct {
+    LaneLayout layout;
+    const Tensor* in;
+    const Tensor* values;       //< NULL when only positions are wanted
+    const Tensor* indices;      //< NULL when only values are wanted
+    bool descending;
+    SortKey* keys;
+    SortKey* tmp;
+    SortRunsFn sort_runs;
+} SortJob;
+
+static void sort_load_lane(const SortJob* job, SortKey* keys, const int lane) {
+    const float* in = &job->in->data[lane_offset(lane, &job->layout, job->layout.in_strides)];
+    for (int i = 0; i < job->layout.n; i++) {
+        keys[i] = sort_key(in[i * job->layout.in_axis_stride], i, job->descending);
+    }
+}
+
+static void sort_store_lane(const SortJob* job, const SortKey* keys, const int count, const int lane) {
+    const int offset = lane_offset(lane, &job->layout, job->layout.out_strides);
+    const int stride = job->layout.out_axis_stride;
+
+    if (job->values) {
+        float* values = &job->values->data[offset];
+        for (int i = 0; i < count; i++) values[i * stride] = sort_key_value(keys[i], job->descending);
+    }
+    if (job->indices) {
+        float* indices = &job->indices->data[offset];
+        for (int i = 0; i < count; i++) indices[i * stride] = (float) sort_key_position(keys[i]);
+    }
+}
+
+static void sort_lane_range(void* ctx, const int begin, const int end) {
+    const SortJob* job = ctx;
+    const int n = job->layout.n;
+
+    for (int lane = begin; lane < end; lane++) {
+        SortKey* keys = &job->keys[(size_t) lane * n];
+        sort_load_lane(job, keys, lane);
+        sort_keys(keys, &job->tmp[(size_t) lane * n], n, job->sort_runs);
+        sort_store_lane(job, keys, n, lane);
+    }
+}
+
+static TensorError sort_along_axis(Tensor* values, Tensor* indices, const Tensor* in, const int axis, const bool descending) {
+    TensorError err = check_axis(in, axis);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    Tensor* out = values ? values : indices;
+    err = tensor_empty(out, in->shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out->length == 0) return TENSOR_ERROR_NONE;
+
+    SortJob job = {.in = in, .values = values, .indices = indices, .descending = descending, .sort_runs = sort_runs_kernel()};
+    lane_layout(&job.layout, in, axis, in->shape[axis]);
+
+    const int n = job.layout.n;
+    const int long_lanes = job.layout.lanes < parallel_num_threads() && n >= SORT_PARALLEL_MIN;
+
+    // Long lanes are sorted one at a time with every thread, so they only need scratch for one lane
+    const size_t scratch = long_lanes ? (size_t) n : (size_t) job.layout.lanes * n;
+    job.keys = malloc(2 * scratch * sizeof *job.keys);
+    if (job.keys == NULL) {
+        tensor_free(out);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+    job.tmp = &job.keys[scratch];
+
+    if (long_lanes) {
+        for (int lane = 0; lane < job.layout.lanes; lane++) {
+            sort_load_lane(&job, job.keys, lane);
+            sort_keys_parallel(job.keys, job.tmp, n, job.sort_runs);
+            sort_store_lane(&job, job.keys, n, lane);
+        }
+    }else {
+        parallel_for(job.layout.lanes, MAX(1, SORT_GRAIN / n), sort_lane_range, &job);
+    }
+
+    free(job.keys);
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_sort(Tensor* out, const Tensor* in, const int axis, const bool descending) {
+    const ProfileScope scope = profile_begin("tensor_sort");
+    return profile_end(&scope, sort_along_axis(out, NULL, in, axis, descending));
+}
+
+TensorError tensor_argsort(Tensor* out, const Tensor* in, const int axis, const bool descending) {
+    const ProfileScope scope = profile_begin("tensor_argsort");
+    return profile_end(&scope, sort_along_axis(NULL, out, in, axis, descending));
+}
+
+// Max-heap of the k smallest keys seen so far, the root is the key to beat
+static void heap_sift_down(SortKey* heap, const int k, int i) {
+    const SortKey key = heap[i];
+    while (2 * i + 1 < k) {
+        int child = 2 * i + 1;
+        if (child + 1 < k && heap[child + 1] > heap[child]) child++;
+        if (heap[child] <= key) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = key;
+}
+
+/**
+ * Reorders keys so that its first k entries are the k smallest, in no particular order (quickselect)
+ */
+static void select_smallest(SortKey* keys, const int n, const int k) {
+    int lo = 0;
+    int hi = n - 1;
+
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        if (keys[mid] < keys[lo]) compare_exchange(&keys[mid], &keys[lo]);
+        if (keys[hi] < keys[lo]) compare_exchange(&keys[hi], &keys[lo]);
+        if (keys[hi] < keys[mid]) compare_exchange(&keys[hi], &keys[mid]);
+        const SortKey pivot = keys[mid];
+
+        int i = lo;
+        int j = hi;
+        while (i <= j) {
+            while (keys[i] < pivot) i++;
+            while (keys[j] > pivot) j--;
+            if (i <= j) {
+                compare_exchange(&keys[i], &keys[j]);
+                i++;
+                j--;
+            }
+        }
+
+        if (k - 1 <= j) hi = j;
+        else if (k - 1 >= i) lo = i;
+        else break;
+    }
+}
+
+typedef struct {
+    SortJob sort;
+    int k;
+    int chunks;             //< Pieces each lane is split into
+    int chunk_length;
+    SortKey* candidates;    //< k keys per chunk
+} TopkJob;
+
+/**
+ * The k smallest keys of in[begin, end) along a lane, written sorted to out[0, min(k, end - begin)).
+ * Small k streams the lane through a heap, large k selects then sorts; both use 2k scratch keys in out
+ */
+static int topk_range(const TopkJob* job, const float* in, const int begin, const int end, SortKey* out) {
+    const SortJob* sort = &job->sort;
+    const int stride = sort->layout.in_axis_stride;
+    const int n = end - begin;
+    const int k = MIN(job->k, n);
+    SortKey* tmp = &out[k];
+
+    if ((int64_t) k * 8 <= n) {
+        for (int i = 0; i < k; i++) out[i] = sort_key(in[(begin + i) * stride], begin + i, sort->descending);
+        for (int i = k / 2 - 1; i >= 0; i--) heap_sift_down(out, k, i);
+
+        for (int i = begin + k; i < end; i++) {
+            const SortKey key = sort_key(in[i * stride], i, sort->descending);
+            if (key < out[0]) {
+                out[0] = key;
+                heap_sift_down(out, k, 0);
+            }
+        }
+        sort_keys(out, tmp, k, sort->sort_runs);
+        return k;
+    }
+
+    SortKey* keys = malloc(2 * (size_t) n * sizeof *keys);
+    if (keys == NULL) return -1;
+
+    for (int i = 0; i < n; i++) keys[i] = sort_key(in[(begin + i) * stride], begin + i, sort->descending);
+    select_smallest(keys, n, k);
+    sort_keys(keys, &keys[n], k, sort->sort_runs);
+    memcpy(out, keys, k * sizeof *out);
+
+    free(keys);
+    return k;
+}
+
+static void topk_lane_range(void* ctx, const int begin, const int end) {
+    const TopkJob* job = ctx;
+    const SortJob* sort = &job->sort;
+
+    for (int lane = begin; lane < end; lane++) {
+        const float* in = &sort->in->data[lane_offset(lane, &sort->layout, sort->layout.in_strides)];
+        SortKey* keys = &sort->keys[(size_t) lane * 2 * job->k];
+
+        // A failed allocation leaves the lane marked for the caller to detect
+        if (topk_range(job, in, 0, sort->layout.n, keys) < 0) keys[0] = INT64_MIN;
+        else sort_store_lane(sort, keys, job->k, lane);
+    }
+}
+
+// One chunk of a long lane: its own top k, kept as candidates for the final selection
+static void topk_chunk_range(void* ctx, const int begin, const int end) {
+    const TopkJob* job = ctx;
+    const int n = job->sort.layout.n;
+
+    for (int c = begin; c < end; c++) {
+        const int start = c * job->chunk_length;
+        const int stop = MIN(n, start + job->chunk_length);
+        SortKey* candidates = &job->candidates[(size_t) c * 2 * job->k];
+
+        for (int i = 0; i < job->k; i++) candidates[i] = INT64_MAX;
+        if (start < stop && topk_range(job, job->sort.in->data, start, stop, candidates) < 0) {
+            candidates[0] = INT64_MIN;
+        }
+    }
+}
+
+static TensorError topk(Tensor* values, Tensor* indices, const Tensor* in, const int axis, const int k, const bool largest) {
+    TensorError err = check_axis(in, axis);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (k < 0 || k > in->shape[axis]) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(shape, in->shape, in->ndim * sizeof *shape);
+    shape[axis] = k;
+
+    err = tensor_empty(values, shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (indices && (err = tensor_empty(indices, shape, in->ndim)) != TENSOR_ERROR_NONE) {
+        tensor_free(values);
+        return err;
+    }
+    if (values->length == 0) return TENSOR_ERROR_NONE;
+
+    TopkJob job = {
+        .sort = {.in = in, .values = values, .indices = indices, .descending = largest, .sort_runs = sort_runs_kernel()},
+        .k = k,
+    };
+    lane_layout(&job.sort.layout, in, axis, k);
+
+    const int n = job.sort.layout.n;
+    const int threads = parallel_num_threads();
+    const int long_lanes = job.sort.layout.lanes < threads && n >= SORT_PARALLEL_MIN && (int64_t) k * threads * 8 <= n;
+
+    job.chunks = long_lanes ? threads : 1;
+    job.chunk_length = (n + job.chunks - 1) / job.chunks;
+    const size_t scratch = long_lanes ? (size_t) 2 * k * job.chunks : (size_t) 2 * k * job.sort.layout.lanes;
+    job.sort.keys = malloc(scratch * sizeof *job.sort.keys);
+    job.candidates = job.sort.keys;
+    if (job.sort.keys == NULL) err = TENSOR_ERROR_NO_MEMORY;
+
+    if (err == TENSOR_ERROR_NONE && long_lanes) {
+        // Per-chunk winners are merged by sorting the candidates, at most k per chunk
+        SortKey* merged = malloc(2 * (size_t) k * job.chunks * sizeof *merged);
+        if (merged == NULL) err = TENSOR_ERROR_NO_MEMORY;
+
+        for (int lane = 0; lane < job.sort.layout.lanes && err == TENSOR_ERROR_NONE; lane++) {
+            const int offset = lane_offset(lane, &job.sort.layout, job.sort.layout.in_strides);
+            Tensor lane_view = *in;
+            lane_view.data = &in->data[offset];
+            job.sort.in = &lane_view;
+
+            parallel_for(job.chunks, 1, topk_chunk_range, &job);
+
+            for (int c = 0; c < job.chunks; c++) {
+                if (job.candidates[(size_t) c * 2 * k] == INT64_MIN) err = TENSOR_ERROR_NO_MEMORY;
+                memcpy(&merged[(size_t) c * k], &job.candidates[(size_t) c * 2 * k], k * sizeof *merged);
+            }
+            sort_keys(merged, &merged[(size_t) k * job.chunks], k * job.chunks, job.sort.sort_runs);
+
+            job.sort.in = in;
+            sort_store_lane(&job.sort, merged, k, lane);
+        }
+        free(merged);
+    }else if (err == TENSOR_ERROR_NONE) {
+        parallel_for(job.sort.layout.lanes, MAX(1, SORT_GRAIN / n), topk_lane_range, &job);
+        for (int lane = 0; lane < job.sort.layout.lanes; lane++) {
+            if (job.sort.keys[(size_t) lane * 2 * k] == INT64_MIN) err = TENSOR_ERROR_NO_MEMORY;
+        }
+    }
+
+    free(job.sort.keys);
+    if (err != TENSOR_ERROR_NONE) {
+        tensor_free(values);
+        if (indices) tensor_free(indices);
+    }
+    return err;
+}
+
+TensorError tensor_topk(Tensor* values, Tensor* indices, const Tensor* in, const int axis, const int k, const bool largest) {
+    const ProfileScope scope = profile_begin("tensor_topk");
+    return profile_end(&scope, topk(values, indices, in, axis, k, largest));
+}
+
+/**
+ * Inclusive scan of one lane starting from carry
+ * @return The last value written
+ */
+static float scan_lane(float* out, const int out_stride, const float* in, const int in_stride, const int n, float carry) {
+    int i = 0;
+
+#ifdef __SSE2__
+    // In-register scan of 4 values: two shifted adds, then the running total is broadcast to every lane
+    if (out_stride == 1 && in_stride == 1) {
+        __m128 total = _mm_set1_ps(carry);
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_loadu_ps(&in[i]);
+            x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+            x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+            x = _mm_add_ps(x, total);
+            _mm_storeu_ps(&out[i], x);
+            total = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        carry = _mm_cvtss_f32(total);
+    }
+#endif
+
+    for (; i < n; i++) {
+        carry += in[i * in_stride];
+        out[i * out_stride] = carry;
+    }
+    return carry;
+}
+
+typedef struct {
+    LaneLayout layout;
+    const Tensor* in;
+    const Tensor* out;
+    int blocks;             //< Scan blocks per lane
+    float* block_totals;    //< Per (lane, block) totals, replaced by the carry into each block
+    int outer;              //< Row-wise scan: combinations of the dimensions before the axis
+    int outer_ndim;
+    int inner;              //< Row-wise scan: elements per row
+    int inner_blocks;
+} CumsumJob;
+
+static void cumsum_lane_range(void* ctx, const int begin, const int end) {
+    const CumsumJob* job = ctx;
+    const LaneLayout* layout = &job->layout;
+
+    for (int lane = begin; lane < end; lane++) {
+        scan_lane(&job->out->data[lane_offset(lane, layout, layout->out_strides)], layout->out_axis_stride,
+                  &job->in->data[lane_offset(lane, layout, layout->in_strides)], layout->in_axis_stride, layout->n, 0.0f);
+    }
+}
+
+static void cumsum_block_scan(void* ctx, const int begin, const int end) {
+    const CumsumJob* job = ctx;
+    const LaneLayout* layout = &job->layout;
+
+    for (int unit = begin; unit < end; unit++) {
+        const int lane = unit / job->blocks;
+        const int start = unit % job->blocks * CUMSUM_BLOCK;
+        const int length = MIN(CUMSUM_BLOCK, layout->n - start);
+
+        float* out = &job->out->data[lane_offset(lane, layout, layout->out_strides) + start * layout->out_axis_stride];
+        const float* in = &job->in->data[lane_offset(lane, layout, layout->in_strides) + start * layout->in_axis_stride];
+        job->block_totals[unit] = scan_lane(out, layout->out_axis_stride, in, layout->in_axis_stride, length, 0.0f);
+    }
+}
+
+static void cumsum_block_carry(void* ctx, const int begin, const int end) {
+    const CumsumJob* job = ctx;
+    const LaneLayout* layout = &job->layout;
+
+    for (int unit = begin; unit < end; unit++) {
+        const float carry = job->block_totals[unit];
+        if (unit % job->blocks == 0) continue;
+
+        const int lane = unit / job->blocks;
+        const int start = unit % job->blocks * CUMSUM_BLOCK;
+        const int length = MIN(CUMSUM_BLOCK, layout->n - start);
+        float* out = &job->out->data[lane_offset(lane, layout, layout->out_strides) + start * layout->out_axis_stride];
+        for (int i = 0; i < length; i++) out[i * layout->out_axis_stride] += carry;
+    }
+}
+
+// Scan along an outer axis as a running sum of contiguous rows, which vectorizes across the row
+static void cumsum_row_range(void* ctx, const int begin, const int end) {
+    const CumsumJob* job = ctx;
+    const Tensor* in = job->in;
+    const int n = job->layout.n;
+
+    for (int unit = begin; unit < end; unit++) {
+        const int outer = unit / job->inner_blocks;
+        const int start = unit % job->inner_blocks * CUMSUM_INNER_BLOCK;
+        const int length = MIN(CUMSUM_INNER_BLOCK, job->inner - start);
+
+        int in_offset = 0;
+        for (int d = job->outer_ndim - 1, rest = outer; d >= 0; d--) {
+            in_offset += rest % in->shape[d] * in->strides[d];
+            rest /= in->shape[d];
+        }
+
+        const float* src = &in->data[in_offset + start];
+        float* restrict dst = &job->out->data[(size_t) outer * n * job->inner + start];
+        memcpy(dst, src, length * sizeof *dst);
+
+        for (int i = 1; i < n; i++) {
+            const float* restrict row = &src[i * job->layout.in_axis_stride];
+            float* restrict current = &dst[(size_t) i * job->inner];
+            const float* restrict previous = &dst[(size_t) (i - 1) * job->inner];
+            for (int j = 0; j < length; j++) current[j] = previous[j] + row[j];
+        }
+    }
+}
+
+static TensorError cumsum(Tensor* out, const Tensor* in, const int axis) {
+    TensorError err = check_axis(in, axis);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    err = tensor_empty(out, in->shape, in->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+    if (out->length == 0) return TENSOR_ERROR_NONE;
+
+    CumsumJob job = {.in = in, .out = out, .outer = 1, .outer_ndim = axis, .inner = 1};
+    lane_layout(&job.layout, in, axis, in->shape[axis]);
+    const int n = job.layout.n;
+
+    // The dimensions after the axis form one contiguous row when their strides are those of a dense tensor
+    int inner_contiguous = axis < in->ndim - 1;
+    for (int d = in->ndim - 1; d > axis; d--) {
+        if (in->shape[d] != 1 && in->strides[d] != job.inner) inner_contiguous = 0;
+        job.inner *= in->shape[d];
+    }
+    for (int d = 0; d < axis; d++) job.outer *= in->shape[d];
+
+    if (n >= 2 * CUMSUM_BLOCK) {
+        job.blocks = (n + CUMSUM_BLOCK - 1) / CUMSUM_BLOCK;
+        const int units = job.layout.lanes * job.blocks;
+        job.block_totals = malloc(units * sizeof *job.block_totals);
+        if (job.block_totals == NULL) {
+            tensor_free(out);
+            return TENSOR_ERROR_NO_MEMORY;
+        }
+
+        parallel_for(units, 1, cumsum_block_scan, &job);
+        for (int lane = 0; lane < job.layout.lanes; lane++) {
+            float carry = 0.0f;
+            for (int b = 0; b < job.blocks; b++) {
+                const float total = job.block_totals[lane * job.blocks + b];
+                job.block_totals[lane * job.blocks + b] = carry;
+                carry += total;
+            }
+        }
+        parallel_for(units, 1, cumsum_block_carry, &job);
+
+        free(job.block_totals);
+    }else if (inner_contiguous) {
+        job.inner_blocks = (job.inner + CUMSUM_INNER_BLOCK - 1) / CUMSUM_INNER_BLOCK;
+        const int work = n * MIN(job.inner, CUMSUM_INNER_BLOCK);
+        parallel_for(job.outer * job.inner_blocks, MAX(1, SORT_GRAIN / work), cumsum_row_range, &job);
+    }else {
+        parallel_for(job.layout.lanes, MAX(1, SORT_GRAIN / n), cumsum_lane_range, &job);
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_cumsum(Tensor* out, const Tensor* in, const int axis) {
+    const ProfileScope scope = profile_begin("tensor_cumsum");
+    return profile_end(&scope, cumsum(out, in, axis));
+}
@@ -0,0 +1,515 @@
+#define MAX(a,b)((a) > (b) ? (a) : (b))
+#define MIN(a,b)((a) < (b) ? (a) : (b))
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "op_profile.h"
+#include "tensor_kernels.h"
+#include "tensor_stream.h"
+#include "thread_pool.h"
+
+#define STREAM_DEFAULT_CHUNK_BYTES (1u << 20)
+#define STREAM_DEFAULT_DEPTH 2
+#define STREAM_MAX_DEPTH 8
+#define STREAM_MAX_INPUTS 2
+#define STREAM_ALIGNMENT 64
+#define STREAM_REDUCE_GRAIN 16384
+
+struct TensorFile {
+    int fd;
+    bool writable;
+    int ndim;
+    int* shape;
+    int rows;           //< shape[0]
+    int row_length;     //< Elements per row, the product of the other dimensions
+    off_t offset;
+};
+
+static off_t row_offset(const TensorFile* file, const int row) {
+    return file->offset + (off_t) row * file->row_length * (off_t) sizeof(float);
+}
+
+static TensorError read_fully(const int fd, void* buffer, size_t bytes, off_t offset) {
+    char* dst = buffer;
+    while (bytes > 0) {
+        const ssize_t n = pread(fd, dst, bytes, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return TENSOR_ERROR_IO;
+        dst += n;
+        bytes -= (size_t) n;
+        offset += n;
+    }
+    return TENSOR_ERROR_NONE;
+}
+
+static TensorError write_fully(const int fd, const void* buffer, size_t bytes, off_t offset) {
+    const char* src = buffer;
+    while (bytes > 0) {
+        const ssize_t n = pwrite(fd, src, bytes, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return TENSOR_ERROR_IO;
+        src += n;
+        bytes -= (size_t) n;
+        offset += n;
+    }
+    return TENSOR_ERROR_NONE;
+}
+
+// Takes ownership of fd, closing it on failure
+static TensorError file_init(TensorFile** out, const int fd, const bool writable, const int* shape, const int ndim,
+                             const size_t offset) {
+    *out = NULL;
+    TensorError err = ndim < 1 || ndim > TENSOR_KERNEL_MAX_DIMS ? TENSOR_ERROR_INVALID_ARGUMENT : TENSOR_ERROR_NONE;
+    long long row_length = 1;
+    for (int d = 0; d < ndim && err == TENSOR_ERROR_NONE; d++) {
+        if (shape[d] < 0) err = TENSOR_ERROR_NEGATIVE_DIM;
+        if (d > 0) row_length *= shape[d];
+        if (row_length > INT_MAX / (long long) sizeof(float)) err = TENSOR_ERROR_INVALID_ARGUMENT;
+    }
+
+    TensorFile* file = err == TENSOR_ERROR_NONE ? malloc(sizeof *file) : NULL;
+    int* file_shape = file ? malloc(ndim * sizeof *file_shape) : NULL;
+    if (err == TENSOR_ERROR_NONE && file_shape == NULL) err = TENSOR_ERROR_NO_MEMORY;
+    if (err != TENSOR_ERROR_NONE) {
+        free(file);
+        close(fd);
+        return err;
+    }
+
+    memcpy(file_shape, shape, ndim * sizeof *file_shape);
+    *file = (TensorFile) {fd, writable, ndim, file_shape, shape[0], (int) row_length, (off_t) offset};
+    *out = file;
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_file_open(TensorFile** out, const char* path, const int* shape, const int ndim, const size_t offset) {
+    *out = NULL;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return TENSOR_ERROR_IO;
+
+    TensorFile* file;
+    const TensorError err = file_init(&file, fd, false, shape, ndim, offset);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < row_offset(file, file->rows)) {
+        tensor_file_close(file);
+        return TENSOR_ERROR_IO;
+    }
+
+    posix_fadvise(fd, file->offset, row_offset(file, file->rows) - file->offset, POSIX_FADV_SEQUENTIAL);
+    *out = file;
+    return TENSOR_ERROR_NONE;
+}
+
+TensorError tensor_file_create(TensorFile** out, const char* path, const int* shape, const int ndim) {
+    *out = NULL;
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return TENSOR_ERROR_IO;
+
+    TensorFile* file;
+    const TensorError err = file_init(&file, fd, true, shape, ndim, 0);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    if (ftruncate(fd, row_offset(file, file->rows)) != 0) {
+        tensor_file_close(file);
+        return TENSOR_ERROR_IO;
+    }
+
+    *out = file;
+    return TENSOR_ERROR_NONE;
+}
+
+void tensor_file_close(TensorFile* file) {
+    if (file == NULL) return;
+    close(file->fd);
+    free(file->shape);
+    free(file);
+}
+
+TensorError tensor_file_read_rows(Tensor* out, const TensorFile* file, const int row0, const int rows) {
+    if (row0 < 0 || rows < 0 || row0 > file->rows - rows) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if ((long long) rows * file->row_length > INT_MAX) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    memcpy(shape, file->shape, file->ndim * sizeof *shape);
+    shape[0] = rows;
+
+    TensorError err = tensor_empty(out, shape, file->ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    err = read_fully(file->fd, out->data, (size_t) out->length * sizeof *out->data, row_offset(file, row0));
+    if (err != TENSOR_ERROR_NONE) tensor_free(out);
+    return err;
+}
+
+// Copies a tensor of any strides into contiguous row-major order
+static void gather_contiguous(float* dst, const Tensor* in) {
+    int idx[TENSOR_KERNEL_MAX_DIMS] = {0};
+    int offset = 0;
+    for (int i = 0; i < in->length; i++) {
+        dst[i] = in->data[offset];
+        for (int d = in->ndim - 1; d >= 0; d--) {
+            offset += in->strides[d];
+            if (++idx[d] < in->shape[d]) break;
+            offset -= idx[d] * in->strides[d];
+            idx[d] = 0;
+        }
+    }
+}
+
+static bool is_contiguous(const Tensor* t) {
+    int expected = 1;
+    for (int d = t->ndim - 1; d >= 0; d--) {
+        if (t->shape[d] != 1 && t->strides[d] != expected) return false;
+        expected *= t->shape[d];
+    }
+    return true;
+}
+
+TensorError tensor_file_write_rows(TensorFile* file, const int row0, const Tensor* in) {
+    if (!file->writable) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (in->ndim != file->ndim) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    for (int d = 1; d < in->ndim; d++) {
+        if (in->shape[d] != file->shape[d]) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+    }
+    if (row0 < 0 || row0 > file->rows - in->shape[0]) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    const size_t bytes = (size_t) in->length * sizeof *in->data;
+    if (is_contiguous(in)) return write_fully(file->fd, in->data, bytes, row_offset(file, row0));
+
+    float* buffer = malloc(MAX(bytes, 1));
+    if (buffer == NULL) return TENSOR_ERROR_NO_MEMORY;
+    gather_contiguous(buffer, in);
+    const TensorError err = write_fully(file->fd, buffer, bytes, row_offset(file, row0));
+    free(buffer);
+    return err;
+}
+
+/**
+ * Chunk c of every operand lives in slot c % depth. The I/O thread loads chunk c into its slot once
+ * the compute side is done with chunk c - depth and that chunk's output has been written, and the
+ * compute side takes chunk c once it is loaded. `loaded` and `computed` only grow, so each side waits
+ * on the other's counter alone
+ */
+typedef void (*StreamComputeFn)(void* ctx, int row0, int rows, float* const* in, float* out);
+
+typedef struct {
+    const TensorFile* inputs[STREAM_MAX_INPUTS];
+    int num_inputs;
+    TensorFile* output;             //< NULL for reductions
+    StreamComputeFn compute;
+    void* ctx;
+
+    int rows;
+    int chunk_rows;
+    int chunks;
+    int depth;
+    size_t slot_length;             //< Floats per operand per slot
+    float* buffers;                 //< [depth][num_inputs + 1][slot_length]
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int loaded;
+    int computed;
+    TensorError error;
+} StreamPipeline;
+
+static float* slot_buffer(const StreamPipeline* p, const int chunk, const int operand) {
+    return &p->buffers[((size_t) (chunk % p->depth) * (p->num_inputs + 1) + operand) * p->slot_length];
+}
+
+static int chunk_row_count(const StreamPipeline* p, const int chunk) {
+    return MIN(p->chunk_rows, p->rows - chunk * p->chunk_rows);
+}
+
+// Waits until counter exceeds chunk; false once either side has failed
+static bool wait_for(StreamPipeline* p, const int* counter, const int chunk) {
+    pthread_mutex_lock(&p->lock);
+    while (*counter <= chunk && p->error == TENSOR_ERROR_NONE) pthread_cond_wait(&p->changed, &p->lock);
+    const bool ok = p->error == TENSOR_ERROR_NONE;
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+static void advance(StreamPipeline* p, int* counter, const TensorError err) {
+    pthread_mutex_lock(&p->lock);
+    if (err != TENSOR_ERROR_NONE && p->error == TENSOR_ERROR_NONE) p->error = err;
+    if (err == TENSOR_ERROR_NONE) (*counter)++;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static TensorError write_chunk(const StreamPipeline* p, const int chunk) {
+    const TensorFile* out = p->output;
+    const size_t bytes = (size_t) chunk_row_count(p, chunk) * out->row_length * sizeof(float);
+    return write_fully(out->fd, slot_buffer(p, chunk, p->num_inputs), bytes, row_offset(out, chunk * p->chunk_rows));
+}
+
+static void* stream_io(void* arg) {
+    StreamPipeline* p = arg;
+
+    for (int c = 0; c < p->chunks; c++) {
+        // Write behind: the slot's previous chunk leaves while the compute side works on the next one
+        if (c >= p->depth) {
+            if (!wait_for(p, &p->computed, c - p->depth)) return NULL;
+            if (p->output) {
+                const TensorError err = write_chunk(p, c - p->depth);
+                if (err != TENSOR_ERROR_NONE) {
+                    advance(p, &p->loaded, err);
+                    return NULL;
+                }
+            }
+        }
+
+        // Read ahead: the kernel starts fetching chunk c + 1 while this thread blocks on chunk c
+        const int row0 = c * p->chunk_rows;
+        const int rows = chunk_row_count(p, c);
+        TensorError err = TENSOR_ERROR_NONE;
+        for (int i = 0; i < p->num_inputs && err == TENSOR_ERROR_NONE; i++) {
+            const TensorFile* in = p->inputs[i];
+            if (c + 1 < p->chunks) {
+                posix_fadvise(in->fd, row_offset(in, row0 + rows),
+                              row_offset(in, row0 + rows + chunk_row_count(p, c + 1)) - row_offset(in, row0 + rows),
+                              POSIX_FADV_WILLNEED);
+            }
+            err = read_fully(in->fd, slot_buffer(p, c, i), (size_t) rows * in->row_length * sizeof(float),
+                             row_offset(in, row0));
+        }
+        advance(p, &p->loaded, err);
+        if (err != TENSOR_ERROR_NONE) return NULL;
+    }
+
+    for (int c = MAX(0, p->chunks - p->depth); c < p->chunks && p->output; c++) {
+        if (!wait_for(p, &p->computed, c)) return NULL;
+        const TensorError err = write_chunk(p, c);
+        if (err != TENSOR_ERROR_NONE) {
+            advance(p, &p->loaded, err);
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static TensorError stream_run(StreamPipeline* p, const int row_length, const TensorStreamParams* params) {
+    const size_t chunk_bytes = params ? params->chunk_bytes : STREAM_DEFAULT_CHUNK_BYTES;
+    p->depth = params ? params->depth : STREAM_DEFAULT_DEPTH;
+    if (p->depth < 2 || p->depth > STREAM_MAX_DEPTH) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (p->rows == 0 || row_length == 0) return TENSOR_ERROR_NONE;
+
+    const size_t row_bytes = (size_t) row_length * sizeof(float);
+    p->chunk_rows = (int) MIN((size_t) p->rows, MAX(chunk_bytes / row_bytes, 1));
+    p->chunks = (p->rows + p->chunk_rows - 1) / p->chunk_rows;
+    p->slot_length = (size_t) p->chunk_rows * row_length;
+
+    void* buffers = NULL;
+    const size_t bytes = (size_t) p->depth * (p->num_inputs + 1) * p->slot_length * sizeof(float);
+    if (posix_memalign(&buffers, STREAM_ALIGNMENT, bytes) != 0) return TENSOR_ERROR_NO_MEMORY;
+    p->buffers = buffers;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    p->loaded = 0;
+    p->computed = 0;
+    p->error = TENSOR_ERROR_NONE;
+
+    pthread_t io;
+    if (pthread_create(&io, NULL, stream_io, p) != 0) {
+        p->error = TENSOR_ERROR_NO_MEMORY;
+    }else {
+        float* in[STREAM_MAX_INPUTS];
+        for (int c = 0; c < p->chunks && wait_for(p, &p->loaded, c); c++) {
+            for (int i = 0; i < p->num_inputs; i++) in[i] = slot_buffer(p, c, i);
+            p->compute(p->ctx, c * p->chunk_rows, chunk_row_count(p, c), in, slot_buffer(p, c, p->num_inputs));
+            advance(p, &p->computed, TENSOR_ERROR_NONE);
+        }
+        pthread_join(io, NULL);
+    }
+
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    free(p->buffers);
+    return p->error;
+}
+
+static const ElementwiseOp stream_ops[] = {
+    [TENSOR_STREAM_ADD] = ELEMENTWISE_ADD,
+    [TENSOR_STREAM_SUB] = ELEMENTWISE_SUB,
+    [TENSOR_STREAM_MUL] = ELEMENTWISE_MUL,
+    [TENSOR_STREAM_DIV] = ELEMENTWISE_DIV,
+};
+
+/**
+ * Chunks are viewed as contiguous [rows, ...] tensors and handed to the in-memory element-wise kernels
+ */
+typedef struct {
+    ElementwiseOp op;
+    int ndim;
+    int shape[TENSOR_KERNEL_MAX_DIMS];
+    int strides[TENSOR_KERNEL_MAX_DIMS];
+    const Tensor* b;            //< In-memory right operand, NULL when it is the second input
+    bool b_sliced;              //< b spans the outer axis and is cut into the same chunks
+} BinaryStream;
+
+static void binary_chunk(void* ctx, const int row0, const int rows, float* const* in, float* out) {
+    BinaryStream* job = ctx;
+    job->shape[0] = rows;
+    const int length = rows * job->strides[0];
+
+    const Tensor a = {job->ndim, length, job->shape, job->strides, in[0]};
+    const Tensor result = {job->ndim, length, job->shape, job->strides, out};
+    if (job->b == NULL) {
+        const Tensor b = {job->ndim, length, job->shape, job->strides, in[1]};
+        elementwise_into(&result, &a, &b, job->op);
+        return;
+    }
+
+    Tensor b = *job->b;
+    int b_shape[TENSOR_KERNEL_MAX_DIMS];
+    if (job->b_sliced) {
+        memcpy(b_shape, b.shape, b.ndim * sizeof *b_shape);
+        b_shape[0] = rows;
+        b.shape = b_shape;
+        b.data = &b.data[(size_t) row0 * b.strides[0]];
+    }
+    elementwise_into(&result, &a, &b, job->op);
+}
+
+static bool same_shape(const TensorFile* a, const TensorFile* b) {
+    return a->ndim == b->ndim && memcmp(a->shape, b->shape, a->ndim * sizeof *a->shape) == 0;
+}
+
+static TensorError stream_binary(TensorFile* out, const TensorFile* a, const TensorFile* b_file, const Tensor* b,
+                                 const TensorStreamOp op, const TensorStreamParams* params) {
+    if ((unsigned) op > TENSOR_STREAM_DIV || !out->writable) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (!same_shape(out, a) || (b_file && !same_shape(b_file, a))) return TENSOR_ERROR_INPUT_DIM_MISMATCH;
+
+    BinaryStream job = {.op = stream_ops[op], .ndim = a->ndim, .b = b};
+    memcpy(job.shape, a->shape, a->ndim * sizeof *job.shape);
+    int stride = 1;
+    for (int d = a->ndim - 1; d >= 0; d--) {
+        job.strides[d] = stride;
+        stride *= d > 0 ? a->shape[d] : 1;
+    }
+
+    if (b) {
+        // b may broadcast into a, never the other way around
+        int shape[TENSOR_KERNEL_MAX_DIMS];
+        int ndim;
+        const Tensor a_shape = {a->ndim, 0, a->shape, NULL, NULL};
+        const TensorError err = elementwise_output_shape(shape, &ndim, &a_shape, b);
+        if (err != TENSOR_ERROR_NONE) return err;
+        if (ndim != a->ndim || memcmp(shape, a->shape, ndim * sizeof *shape) != 0) return TENSOR_ERROR_CANNOT_BROADCAST;
+        job.b_sliced = b->ndim == a->ndim && b->shape[0] != 1;
+    }
+
+    StreamPipeline pipeline = {
+        .inputs = {a, b_file},
+        .num_inputs = b_file ? 2 : 1,
+        .output = out,
+        .compute = binary_chunk,
+        .ctx = &job,
+        .rows = a->rows,
+    };
+    return stream_run(&pipeline, a->row_length, params);
+}
+
+TensorError tensor_stream_binary(TensorFile* out, const TensorFile* a, const TensorFile* b, const TensorStreamOp op,
+                                 const TensorStreamParams* params) {
+    const ProfileScope scope = profile_begin("tensor_stream_binary");
+    return profile_end(&scope, stream_binary(out, a, b, NULL, op, params));
+}
+
+TensorError tensor_stream_binary_tensor(TensorFile* out, const TensorFile* a, const Tensor* b, const TensorStreamOp op,
+                                        const TensorStreamParams* params) {
+    const ProfileScope scope = profile_begin("tensor_stream_binary_tensor");
+    return profile_end(&scope, stream_binary(out, a, NULL, b, op, params));
+}
+
+/**
+ * One double accumulator per column. The pool splits the columns, and every thread walks the rows of
+ * the chunk in order, so each column is accumulated in file order whatever the chunking
+ */
+typedef struct {
+    TensorStreamReduction reduction;
+    int row_length;
+    double* acc;
+    const float* chunk;
+    int rows;
+} ReduceStream;
+
+static void reduce_columns(void* ctx, const int begin, const int end) {
+    const ReduceStream* job = ctx;
+    double* restrict acc = job->acc;
+
+    for (int r = 0; r < job->rows; r++) {
+        const float* restrict x = &job->chunk[(size_t) r * job->row_length];
+        switch (job->reduction) {
+            case TENSOR_STREAM_SUM:
+            case TENSOR_STREAM_MEAN:
+                for (int j = begin; j < end; j++) acc[j] += x[j];
+                break;
+            case TENSOR_STREAM_MIN:
+                for (int j = begin; j < end; j++) acc[j] = x[j] < acc[j] ? x[j] : acc[j];
+                break;
+            case TENSOR_STREAM_MAX:
+                for (int j = begin; j < end; j++) acc[j] = x[j] > acc[j] ? x[j] : acc[j];
+                break;
+        }
+    }
+}
+
+static void reduce_chunk(void* ctx, const int row0, const int rows, float* const* in, float* out) {
+    (void) row0;
+    (void) out;
+    ReduceStream* job = ctx;
+    job->chunk = in[0];
+    job->rows = rows;
+    parallel_for(job->row_length, MAX(1, STREAM_REDUCE_GRAIN / rows), reduce_columns, job);
+}
+
+static TensorError stream_reduce(Tensor* out, const TensorFile* in, const TensorStreamReduction reduction,
+                                 const TensorStreamParams* params) {
+    if ((unsigned) reduction > TENSOR_STREAM_MAX) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (reduction != TENSOR_STREAM_SUM && in->rows == 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    double* acc = malloc(MAX(in->row_length, 1) * sizeof *acc);
+    if (acc == NULL) return TENSOR_ERROR_NO_MEMORY;
+    const double initial = reduction == TENSOR_STREAM_MIN ? INFINITY : reduction == TENSOR_STREAM_MAX ? -INFINITY : 0.0;
+    for (int j = 0; j < in->row_length; j++) acc[j] = initial;
+
+    ReduceStream job = {.reduction = reduction, .row_length = in->row_length, .acc = acc};
+    StreamPipeline pipeline = {
+        .inputs = {in},
+        .num_inputs = 1,
+        .compute = reduce_chunk,
+        .ctx = &job,
+        .rows = in->rows,
+    };
+    TensorError err = stream_run(&pipeline, in->row_length, params);
+
+    if (err == TENSOR_ERROR_NONE) {
+        err = in->ndim > 1 ? tensor_empty(out, &in->shape[1], in->ndim - 1) : tensor_empty(out, (int[]){1}, 1);
+    }
+    if (err == TENSOR_ERROR_NONE) {
+        const double scale = reduction == TENSOR_STREAM_MEAN ? 1.0 / in->rows : 1.0;
+        for (int j = 0; j < in->row_length; j++) out->data[j] = (float) (acc[j] * scale);
+    }
+
+    free(acc);
+    return err;
+}
+
+TensorError tensor_stream_reduce(Tensor* out, const TensorFile* in, const TensorStreamReduction reduction,
+                                 const TensorStreamParams* params) {
+    const ProfileScope scope = profile_begin("tensor_stream_reduce");
+    return profile_end(&scope, stream_reduce(out, in, reduction, params));
+}
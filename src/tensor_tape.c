@@ -0,0 +1,542 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tensor_tape.h"
+
+#include "op_profile.h"
+
+#define TAPE_MAX_INPUTS 4
+#define TAPE_MAX_DIMS 32
+
+/**
+ * Everything the tape knows about one Tensor handle.
+ * The compact gradient shape is copied at record time, so gradients can still be accumulated
+ * after a tape-owned tensor has been freed
+ */
+typedef struct {
+    const Tensor* key;
+    Tensor* owned;      //< Non-NULL if the tape frees this tensor
+    bool is_view;
+    bool retained;
+    bool freed;
+    int producer;       //< Index of the node that produced the tensor, -1 for inputs
+    int uses;           //< Backward steps that still need the tensor's data
+    int views;          //< Tape-owned views of the tensor's data that are still allocated
+
+    Tensor grad;        //< grad.data is NULL until something is accumulated
+} TapeRecord;
+
+typedef struct {
+    TensorBackwardFn backward;
+    void* ctx;
+    int out;
+    int inputs[TAPE_MAX_INPUTS];
+    int num_inputs;
+    int saved[TAPE_MAX_INPUTS];
+    int num_saved;
+} TapeNode;
+
+typedef struct {
+    float* data;
+    int length;
+} PooledBuffer;
+
+struct TensorTape {
+    TapeRecord* records;
+    int num_records;
+    int records_cap;
+
+    TapeNode* nodes;
+    int num_nodes;
+    int nodes_cap;
+
+    PooledBuffer* pool;
+    int pool_size;
+    int pool_cap;
+};
+
+static int grow_array(void** array, int* cap, const int needed, const size_t elem_size) {
+    if (needed <= *cap) return 0;
+    const int new_cap = *cap ? *cap * 2 : 8;
+    void* grown = realloc(*array, new_cap * elem_size);
+    if (grown == NULL) return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static float* pool_acquire(TensorTape* tape, const int length) {
+    for (int i = 0; i < tape->pool_size; i++) {
+        if (tape->pool[i].length == length) {
+            float* data = tape->pool[i].data;
+            tape->pool[i] = tape->pool[--tape->pool_size];
+            memset(data, 0, length * sizeof *data);
+            return data;
+        }
+    }
+    return calloc(length, sizeof(float));
+}
+
+static void pool_release(TensorTape* tape, float* data, const int length) {
+    if (data == NULL) return;
+    if (grow_array((void**) &tape->pool, &tape->pool_cap, tape->pool_size + 1, sizeof *tape->pool) < 0) {
+        free(data);
+        return;
+    }
+    tape->pool[tape->pool_size++] = (PooledBuffer) {data, length};
+}
+
+static int tape_find(const TensorTape* tape, const Tensor* key) {
+    for (int i = 0; i < tape->num_records; i++) {
+        if (tape->records[i].key == key) return i;
+    }
+    return -1;
+}
+
+static int tape_add_record(TensorTape* tape, const Tensor* tensor) {
+    const int existing = tape_find(tape, tensor);
+    if (existing >= 0) return existing;
+    if (tensor->ndim > TAPE_MAX_DIMS) return -1;
+
+    if (grow_array((void**) &tape->records, &tape->records_cap, tape->num_records + 1, sizeof *tape->records) < 0) {
+        return -1;
+    }
+
+    int* metadata = malloc(2 * tensor->ndim * sizeof *metadata);
+    if (metadata == NULL) return -1;
+
+    TapeRecord* rec = &tape->records[tape->num_records];
+    memset(rec, 0, sizeof *rec);
+    rec->key = tensor;
+    rec->producer = -1;
+
+    // Broadcast dimensions collapse to 1 so the gradient is sized like the storage, not the view
+    rec->grad.ndim = tensor->ndim;
+    rec->grad.shape = metadata;
+    rec->grad.strides = &metadata[tensor->ndim];
+    rec->grad.length = 1;
+    for (int i = tensor->ndim - 1; i >= 0; i--) {
+        rec->grad.shape[i] = tensor->strides[i] == 0 ? 1 : tensor->shape[i];
+        rec->grad.strides[i] = rec->grad.length;
+        rec->grad.length *= rec->grad.shape[i];
+    }
+
+    return tape->num_records++;
+}
+
+static void tape_free_owned(TapeRecord* rec) {
+    if (rec->owned == NULL || rec->freed) return;
+    if (rec->is_view) tensor_view_free(rec->owned);
+    else tensor_free(rec->owned);
+    rec->freed = true;
+}
+
+/**
+ * grad_input += scale * g * mul / div, reduced over every dimension the input broadcasts.
+ * mul and div are optional and broadcast against g, so the built-in backward steps never
+ * materialize a full size temporary for products like g * b
+ */
+static TensorError accumulate(TensorTape* tape, const Tensor* input, const Tensor* g,
+                              const Tensor* mul, const Tensor* div, const float scale) {
+    const int index = tape_find(tape, input);
+    if (index < 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    TapeRecord* rec = &tape->records[index];
+    const int ndim = g->ndim;
+    if (ndim < rec->grad.ndim || ndim > TAPE_MAX_DIMS) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    int target_strides[TAPE_MAX_DIMS];
+    int mul_strides[TAPE_MAX_DIMS];
+    int div_strides[TAPE_MAX_DIMS];
+
+    const int target_diff = ndim - rec->grad.ndim;
+    for (int d = 0; d < ndim; d++) {
+        const int t = d - target_diff;
+        if (t >= 0 && rec->grad.shape[t] != 1 && rec->grad.shape[t] != g->shape[d]) return TENSOR_ERROR_CANNOT_BROADCAST;
+        target_strides[d] = t < 0 || rec->grad.shape[t] == 1 ? 0 : rec->grad.strides[t];
+    }
+
+    const Tensor* factors[2] = {mul, div};
+    int* factor_strides[2] = {mul_strides, div_strides};
+    for (int f = 0; f < 2; f++) {
+        if (factors[f] == NULL) continue;
+        const int diff = ndim - factors[f]->ndim;
+        if (diff < 0) return TENSOR_ERROR_CANNOT_BROADCAST;
+        for (int d = 0; d < ndim; d++) {
+            const int t = d - diff;
+            factor_strides[f][d] = t < 0 || factors[f]->shape[t] == 1 ? 0 : factors[f]->strides[t];
+        }
+    }
+
+    if (rec->grad.data == NULL) {
+        rec->grad.data = pool_acquire(tape, rec->grad.length);
+        if (rec->grad.data == NULL) return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    const int last = ndim - 1;
+    const int row_length = g->shape[last];
+    int rows = 1;
+    for (int d = 0; d < last; d++) rows *= g->shape[d];
+
+    for (int row = 0; row < rows; row++) {
+        int offset_g = 0, offset_t = 0, offset_m = 0, offset_d = 0;
+        int tmp = row;
+        for (int d = last - 1; d >= 0; d--) {
+            const int d_idx = tmp % g->shape[d];
+            tmp /= g->shape[d];
+            offset_g += d_idx * g->strides[d];
+            offset_t += d_idx * target_strides[d];
+            offset_m += d_idx * mul_strides[d];
+            offset_d += d_idx * div_strides[d];
+        }
+
+        float* target = &rec->grad.data[offset_t];
+        const float* g_row = &g->data[offset_g];
+        const int ts = target_strides[last];
+        const int gs = g->strides[last];
+
+        for (int j = 0; j < row_length; j++) {
+            float value = scale * g_row[j * gs];
+            if (mul) value *= mul->data[offset_m + j * mul_strides[last]];
+            if (div) value /= div->data[offset_d + j * div_strides[last]];
+            target[j * ts] += value;
+        }
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+// Every gradient update of the backward pass is profiled, the products of mat_mul_backward under tensor_mat_mul
+static TensorError tape_accumulate(TensorTape* tape, const Tensor* input, const Tensor* g,
+                                   const Tensor* mul, const Tensor* div, const float scale) {
+    const ProfileScope scope = profile_begin("tensor_tape_accumulate_grad");
+    return profile_end(&scope, accumulate(tape, input, g, mul, div, scale));
+}
+
+TensorError tensor_tape_accumulate_grad(TensorTape* tape, const Tensor* input, const Tensor* grad, const float scale) {
+    return tape_accumulate(tape, input, grad, NULL, NULL, scale);
+}
+
+TensorError tensor_tape_create(TensorTape** out) {
+    TensorTape* tape = calloc(1, sizeof *tape);
+    if (tape == NULL) return TENSOR_ERROR_NO_MEMORY;
+    *out = tape;
+    return TENSOR_ERROR_NONE;
+}
+
+void tensor_tape_reset(TensorTape* tape) {
+    for (int i = 0; i < tape->num_records; i++) {
+        TapeRecord* rec = &tape->records[i];
+        tape_free_owned(rec);
+        pool_release(tape, rec->grad.data, rec->grad.length);
+        free(rec->grad.shape);
+    }
+    tape->num_records = 0;
+    tape->num_nodes = 0;
+}
+
+void tensor_tape_destroy(TensorTape* tape) {
+    tensor_tape_reset(tape);
+    for (int i = 0; i < tape->pool_size; i++) {
+        free(tape->pool[i].data);
+    }
+    free(tape->pool);
+    free(tape->records);
+    free(tape->nodes);
+    free(tape);
+}
+
+TensorError tensor_tape_record(TensorTape* tape, Tensor* out, const bool out_is_view,
+                               const Tensor* const* inputs, const int num_inputs,
+                               const Tensor* const* saved, const int num_saved,
+                               const TensorBackwardFn backward, void* ctx) {
+    if (num_inputs > TAPE_MAX_INPUTS || num_saved > TAPE_MAX_INPUTS) return TENSOR_ERROR_INVALID_ARGUMENT;
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    if (grow_array((void**) &tape->nodes, &tape->nodes_cap, tape->num_nodes + 1, sizeof *tape->nodes) < 0) {
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+
+    TapeNode* node = &tape->nodes[tape->num_nodes];
+    node->backward = backward;
+    node->ctx = ctx;
+    node->num_inputs = num_inputs;
+    node->num_saved = num_saved;
+
+    // Records are only counted as used once all of them exist, so a failure drops the new ones and changes nothing
+    const int num_records = tape->num_records;
+    bool added = true;
+    for (int i = 0; i < num_inputs && added; i++) added = (node->inputs[i] = tape_add_record(tape, inputs[i])) >= 0;
+    if (added) added = (node->out = tape_add_record(tape, out)) >= 0;
+    for (int i = 0; i < num_saved && added; i++) added = (node->saved[i] = tape_add_record(tape, saved[i])) >= 0;
+
+    if (!added) {
+        while (tape->num_records > num_records) free(tape->records[--tape->num_records].grad.shape);
+        return TENSOR_ERROR_NO_MEMORY;
+    }
+    for (int i = 0; i < num_saved; i++) tape->records[node->saved[i]].uses++;
+
+    TapeRecord* out_rec = &tape->records[node->out];
+    out_rec->owned = out;
+    out_rec->is_view = out_is_view;
+    out_rec->producer = tape->num_nodes;
+
+    // A view reads the data of its inputs, which must outlive it
+    for (int i = 0; i < num_inputs && out_is_view; i++) tape->records[node->inputs[i]].views++;
+
+    tape->num_nodes++;
+    return TENSOR_ERROR_NONE;
+}
+
+static TensorError add_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    (void) ctx;
+    TensorError err = tape_accumulate(tape, inputs[0], grad_out, NULL, NULL, 1.0f);
+    if (err != TENSOR_ERROR_NONE) return err;
+    return tape_accumulate(tape, inputs[1], grad_out, NULL, NULL, 1.0f);
+}
+
+static TensorError sub_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    (void) ctx;
+    TensorError err = tape_accumulate(tape, inputs[0], grad_out, NULL, NULL, 1.0f);
+    if (err != TENSOR_ERROR_NONE) return err;
+    return tape_accumulate(tape, inputs[1], grad_out, NULL, NULL, -1.0f);
+}
+
+static TensorError mul_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    (void) ctx;
+    TensorError err = tape_accumulate(tape, inputs[0], grad_out, inputs[1], NULL, 1.0f);
+    if (err != TENSOR_ERROR_NONE) return err;
+    return tape_accumulate(tape, inputs[1], grad_out, inputs[0], NULL, 1.0f);
+}
+
+static TensorError div_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) num_inputs;
+    (void) ctx;
+    // d(a/b)/da = 1/b, d(a/b)/db = -(a/b)/b
+    TensorError err = tape_accumulate(tape, inputs[0], grad_out, NULL, inputs[1], 1.0f);
+    if (err != TENSOR_ERROR_NONE) return err;
+    return tape_accumulate(tape, inputs[1], grad_out, out, inputs[1], -1.0f);
+}
+
+static TensorError expand_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                   const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    (void) ctx;
+    return tape_accumulate(tape, inputs[0], grad_out, NULL, NULL, 1.0f);
+}
+
+/**
+ * Describe `in` as a matrix (promoting 1D tensors) and optionally transposed, without copying
+ */
+static Tensor matrix_view(const Tensor* in, int* shape, int* strides, const bool is_left, const bool transpose) {
+    int ndim = in->ndim;
+    memcpy(shape, in->shape, ndim * sizeof *shape);
+    memcpy(strides, in->strides, ndim * sizeof *strides);
+
+    if (ndim == 1) {
+        // Left operands act as [1,K] rows, right operands as [K,1] columns
+        if (is_left) {
+            shape[1] = shape[0]; strides[1] = strides[0];
+            shape[0] = 1; strides[0] = 0;
+        }else {
+            shape[1] = 1; strides[1] = 0;
+        }
+        ndim = 2;
+    }
+
+    if (transpose) {
+        int tmp = shape[ndim - 1]; shape[ndim - 1] = shape[ndim - 2]; shape[ndim - 2] = tmp;
+        tmp = strides[ndim - 1]; strides[ndim - 1] = strides[ndim - 2]; strides[ndim - 2] = tmp;
+    }
+
+    return (Tensor) {ndim, in->length, shape, strides, in->data};
+}
+
+// Drop dimension `dim` (which must have size 1) from a gradient so it lines up with a 1D operand
+static Tensor drop_dim(const Tensor* in, int* shape, int* strides, const int dim) {
+    int ndim = 0;
+    for (int d = 0; d < in->ndim; d++) {
+        if (d == dim) continue;
+        shape[ndim] = in->shape[d];
+        strides[ndim] = in->strides[d];
+        ndim++;
+    }
+    return (Tensor) {ndim, in->length, shape, strides, in->data};
+}
+
+static TensorError mat_mul_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                    const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    (void) ctx;
+    const Tensor* a = inputs[0];
+    const Tensor* b = inputs[1];
+    int shape[2][TAPE_MAX_DIMS], strides[2][TAPE_MAX_DIMS];
+    int drop_shape[TAPE_MAX_DIMS], drop_strides[TAPE_MAX_DIMS];
+
+    // dA = dOut @ B^T
+    const Tensor b_t = matrix_view(b, shape[0], strides[0], false, true);
+    Tensor grad_a;
+    TensorError err = tensor_mat_mul(&grad_a, grad_out, &b_t);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const Tensor grad_a_view = a->ndim == 1 ? drop_dim(&grad_a, drop_shape, drop_strides, grad_a.ndim - 2) : grad_a;
+    err = tape_accumulate(tape, a, &grad_a_view, NULL, NULL, 1.0f);
+    tensor_free(&grad_a);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    // dB = A^T @ dOut
+    const Tensor a_t = matrix_view(a, shape[1], strides[1], true, true);
+    Tensor grad_b;
+    err = tensor_mat_mul(&grad_b, &a_t, grad_out);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const Tensor grad_b_view = b->ndim == 1 ? drop_dim(&grad_b, drop_shape, drop_strides, grad_b.ndim - 1) : grad_b;
+    err = tape_accumulate(tape, b, &grad_b_view, NULL, NULL, 1.0f);
+    tensor_free(&grad_b);
+
+    return err;
+}
+
+static TensorError tape_record_binary(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b,
+                                      const TensorError op_err, const TensorBackwardFn backward,
+                                      const bool save_inputs, const bool save_out) {
+    if (op_err != TENSOR_ERROR_NONE) return op_err;
+
+    const Tensor* inputs[] = {a, b};
+    const Tensor* saved[3];
+    int num_saved = 0;
+    if (save_inputs) {
+        saved[num_saved++] = a;
+        saved[num_saved++] = b;
+    }
+    if (save_out) saved[num_saved++] = out;
+
+    const TensorError err = tensor_tape_record(tape, out, false, inputs, 2, saved, num_saved, backward, NULL);
+    if (err != TENSOR_ERROR_NONE) tensor_free(out);
+    return err;
+}
+
+TensorError tensor_tape_add(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return tape_record_binary(tape, out, a, b, tensor_add(out, a, b), add_backward, false, false);
+}
+
+TensorError tensor_tape_sub(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return tape_record_binary(tape, out, a, b, tensor_sub(out, a, b), sub_backward, false, false);
+}
+
+TensorError tensor_tape_mul(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return tape_record_binary(tape, out, a, b, tensor_mul(out, a, b), mul_backward, true, false);
+}
+
+TensorError tensor_tape_div(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return tape_record_binary(tape, out, a, b, tensor_div(out, a, b), div_backward, true, true);
+}
+
+TensorError tensor_tape_mat_mul(TensorTape* tape, Tensor* out, const Tensor* a, const Tensor* b) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    return tape_record_binary(tape, out, a, b, tensor_mat_mul(out, a, b), mat_mul_backward, true, false);
+}
+
+TensorError tensor_tape_expand(TensorTape* tape, Tensor* out, const Tensor* in, const int* new_shape, const int new_ndim) {
+    if (tape_find(tape, out) >= 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    TensorError err = tensor_expand(out, in, new_shape, new_ndim);
+    if (err != TENSOR_ERROR_NONE) return err;
+
+    const Tensor* inputs[] = {in};
+    err = tensor_tape_record(tape, out, true, inputs, 1, NULL, 0, expand_backward, NULL);
+    if (err != TENSOR_ERROR_NONE) tensor_view_free(out);
+    return err;
+}
+
+TensorError tensor_tape_retain(TensorTape* tape, const Tensor* tensor) {
+    const int index = tape_find(tape, tensor);
+    if (index < 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+    tape->records[index].retained = true;
+    return TENSOR_ERROR_NONE;
+}
+
+/**
+ * Free a tape-owned tensor as soon as no backward step still reads it and no view of its data is left.
+ * Freeing a view may in turn release the tensors it viewed
+ */
+static void tape_release_if_done(TensorTape* tape, const int index) {
+    TapeRecord* rec = &tape->records[index];
+    if (rec->owned == NULL || rec->freed || rec->retained || rec->uses > 0 || rec->views > 0) return;
+    tape_free_owned(rec);
+
+    if (!rec->is_view) return;
+    const TapeNode* producer = &tape->nodes[rec->producer];
+    for (int i = 0; i < producer->num_inputs; i++) {
+        tape->records[producer->inputs[i]].views--;
+        tape_release_if_done(tape, producer->inputs[i]);
+    }
+}
+
+TensorError tensor_tape_backward(TensorTape* tape, const Tensor* root, const Tensor* seed) {
+    const int root_index = tape_find(tape, root);
+    if (root_index < 0) return TENSOR_ERROR_INVALID_ARGUMENT;
+
+    TapeRecord* root_rec = &tape->records[root_index];
+    TensorError err;
+
+    if (seed) {
+        err = tape_accumulate(tape, root, seed, NULL, NULL, 1.0f);
+        if (err != TENSOR_ERROR_NONE) return err;
+    }else {
+        if (root_rec->grad.data == NULL) {
+            root_rec->grad.data = pool_acquire(tape, root_rec->grad.length);
+            if (root_rec->grad.data == NULL) return TENSOR_ERROR_NO_MEMORY;
+        }
+        for (int i = 0; i < root_rec->grad.length; i++) root_rec->grad.data[i] += 1.0f;
+    }
+
+    for (int n = tape->num_nodes - 1; n >= 0; n--) {
+        const TapeNode* node = &tape->nodes[n];
+        TapeRecord* out_rec = &tape->records[node->out];
+
+        if (out_rec->grad.data != NULL) {
+            const Tensor* inputs[TAPE_MAX_INPUTS];
+            for (int i = 0; i < node->num_inputs; i++) inputs[i] = tape->records[node->inputs[i]].key;
+
+            err = node->backward(tape, out_rec->key, &out_rec->grad, inputs, node->num_inputs, node->ctx);
+            if (err != TENSOR_ERROR_NONE) return err;
+
+            // The gradient of an intermediate is dead once it has been propagated to the inputs
+            if (!out_rec->retained) {
+                pool_release(tape, out_rec->grad.data, out_rec->grad.length);
+                out_rec->grad.data = NULL;
+            }
+        }
+
+        for (int i = 0; i < node->num_saved; i++) {
+            tape->records[node->saved[i]].uses--;
+            tape_release_if_done(tape, node->saved[i]);
+        }
+        tape_release_if_done(tape, node->out);
+    }
+
+    return TENSOR_ERROR_NONE;
+}
+
+const Tensor* tensor_tape_grad(const TensorTape* tape, const Tensor* tensor) {
+    const int index = tape_find(tape, tensor);
+    if (index < 0 || tape->records[index].grad.data == NULL) return NULL;
+    return &tape->records[index].grad;
+}
@@ -0,0 +1,200 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "numa_placement.h"
+#include "op_profile.h"
+#include "tensor.h"
+
+typedef struct {
+    pthread_mutex_t submit_lock; //< Held by the thread that currently owns the pool
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+
+    pthread_t* threads;
+    int num_threads;
+    int requested_threads;
+    bool running;
+    bool shutdown;
+
+    unsigned long generation;
+    int remaining;
+
+    ParallelRangeFn fn;
+    void* ctx;
+    int length;
+    int chunks;
+} ThreadPool;
+
+static ThreadPool pool = {
+    .submit_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .finish = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local bool in_parallel_region = false;
+
+static int default_thread_count(void) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+void parallel_chunk_range(const int length, const int chunk, const int chunks, int* begin, int* end) {
+    *begin = (int) ((long long) length * chunk / chunks);
+    *end = (int) ((long long) length * (chunk + 1) / chunks);
+}
+
+static void* pool_worker(void* arg) {
+    const int index = (int) (intptr_t) arg;
+    in_parallel_region = true;
+
+    if (numa_placement_node_count() > 1) {
+        numa_placement_pin_current_thread(numa_placement_node_of_worker(index, pool.num_threads));
+    }
+
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.shutdown) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        if (pool.shutdown) break;
+        seen = pool.generation;
+
+        if (index >= pool.chunks) continue;
+
+        const ParallelRangeFn fn = pool.fn;
+        void* ctx = pool.ctx;
+        int begin, end;
+        parallel_chunk_range(pool.length, index, pool.chunks, &begin, &end);
+        pthread_mutex_unlock(&pool.lock);
+
+        profile_attach_thread();
+        fn(ctx, begin, end);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.remaining == 0) pthread_cond_signal(&pool.finish);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+// Caller must hold submit_lock
+static void pool_stop(void) {
+    if (!pool.running) return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.num_threads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+
+    free(pool.threads);
+    pool.threads = NULL;
+    pool.running = false;
+    pool.shutdown = false;
+}
+
+// Caller must hold submit_lock
+static int pool_start(void) {
+    if (pool.running) return 0;
+
+    const int num_threads = pool.requested_threads > 0 ? pool.requested_threads : default_thread_count();
+    pool.threads = malloc(num_threads * sizeof *pool.threads);
+    if (pool.threads == NULL) return -1;
+
+    pool.num_threads = num_threads;
+    pool.generation = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool.threads[i], NULL, pool_worker, (void*) (intptr_t) i) != 0) {
+            pool.num_threads = i;
+            pool.running = true;
+            pool_stop();
+            return -1;
+        }
+    }
+
+    pool.running = true;
+    return 0;
+}
+
+void parallel_start(void) {
+    pthread_mutex_lock(&pool.submit_lock);
+    pool_start();
+    pthread_mutex_unlock(&pool.submit_lock);
+}
+
+int parallel_num_threads(void) {
+    pthread_mutex_lock(&pool.submit_lock);
+    const int num_threads = pool.running ? pool.num_threads
+                          : pool.requested_threads > 0 ? pool.requested_threads
+                          : default_thread_count();
+    pthread_mutex_unlock(&pool.submit_lock);
+
+    return num_threads;
+}
+
+int parallel_chunk_count(const int length, const int grain) {
+    const int g = grain < 1 ? 1 : grain;
+    if (length < 2 * g) return 1;
+
+    const int max_chunks = (length + g - 1) / g;
+    const int num_threads = parallel_num_threads();
+    return max_chunks < num_threads ? max_chunks : num_threads;
+}
+
+void parallel_for(const int length, int grain, const ParallelRangeFn fn, void* ctx) {
+    if (length <= 0) return;
+    if (grain < 1) grain = 1;
+
+    if (length < 2 * grain || in_parallel_region || pthread_mutex_trylock(&pool.submit_lock) != 0) {
+        fn(ctx, 0, length);
+        return;
+    }
+
+    if (pool_start() < 0 || pool.num_threads < 2) {
+        pthread_mutex_unlock(&pool.submit_lock);
+        fn(ctx, 0, length);
+        return;
+    }
+
+    const int max_chunks = (length + grain - 1) / grain;
+    const int chunks = max_chunks < pool.num_threads ? max_chunks : pool.num_threads;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.length = length;
+    pool.chunks = chunks;
+    pool.remaining = chunks;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+
+    while (pool.remaining > 0) {
+        pthread_cond_wait(&pool.finish, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.submit_lock);
+}
+
+void tensor_set_num_threads(const int num_threads) {
+    pthread_mutex_lock(&pool.submit_lock);
+    pool_stop();
+    pool.requested_threads = num_threads;
+    pthread_mutex_unlock(&pool.submit_lock);
+}
+
+int tensor_get_num_threads(void) {
+    return parallel_num_threads();
+}
@@ -0,0 +1,169 @@
+#include <stdatomic.h>
+
+#include "tensor_async.h"
+#include "test_harness.h"
+
+typedef struct {
+    atomic_int* clock;
+    int started_at;
+    TensorError result;
+} OrderedTask;
+
+static TensorError record_order(void* arg) {
+    OrderedTask* task = arg;
+    task->started_at = atomic_fetch_add(task->clock, 1);
+    return task->result;
+}
+
+static void test_dependency_order(TensorQueue* queue) {
+    atomic_int clock = 0;
+    Tensor a = {0}, b = {0}, c = {0};
+    OrderedTask write_a = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask write_b = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask read_ab = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask rewrite_a = {&clock, -1, TENSOR_ERROR_NONE};
+
+    Tensor* writes_a[] = {&a};
+    Tensor* writes_b[] = {&b};
+    Tensor* writes_c[] = {&c};
+    const Tensor* reads_ab[] = {&a, &b};
+
+    TensorFuture* last;
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &write_a, NULL, 0, writes_a, 1));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &write_b, NULL, 0, writes_b, 1));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &read_ab, reads_ab, 2, writes_c, 1));
+    CHECK_OK(tensor_submit(&last, queue, record_order, &rewrite_a, NULL, 0, writes_a, 1));
+
+    CHECK_OK(tensor_future_wait(last));
+    CHECK_OK(tensor_queue_wait_all(queue));
+    tensor_future_release(last);
+
+    CHECK(read_ab.started_at > write_a.started_at, "reader ran before writer of a");
+    CHECK(read_ab.started_at > write_b.started_at, "reader ran before writer of b");
+    CHECK(rewrite_a.started_at > read_ab.started_at, "writer overtook a pending reader");
+}
+
+static void test_error_propagation(TensorQueue* queue) {
+    atomic_int clock = 0;
+    Tensor a = {0}, b = {0};
+    OrderedTask failing = {&clock, -1, TENSOR_ERROR_INVALID_ARGUMENT};
+    OrderedTask dependent = {&clock, -1, TENSOR_ERROR_NONE};
+
+    Tensor* writes_a[] = {&a};
+    Tensor* writes_b[] = {&b};
+    const Tensor* reads_a[] = {&a};
+
+    TensorFuture* first;
+    TensorFuture* second;
+    CHECK_OK(tensor_submit(&first, queue, record_order, &failing, NULL, 0, writes_a, 1));
+    CHECK_OK(tensor_submit(&second, queue, record_order, &dependent, reads_a, 1, writes_b, 1));
+
+    CHECK(tensor_future_wait(second) == TENSOR_ERROR_INVALID_ARGUMENT, "dependent did not inherit the error");
+    CHECK(dependent.started_at == -1, "dependent of a failed op was run");
+    CHECK(tensor_future_is_ready(first), "failed op not marked ready");
+    CHECK(tensor_queue_wait_all(queue) == TENSOR_ERROR_INVALID_ARGUMENT, "wait_all lost the error");
+
+    // The queue remembers the failed writes by handle; clear them before these stack slots hold other tensors
+    OrderedTask rewrite = {&clock, -1, TENSOR_ERROR_NONE};
+    Tensor* writes_ab[] = {&a, &b};
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &rewrite, NULL, 0, writes_ab, 2));
+    CHECK_OK(tensor_queue_wait_all(queue));
+
+    tensor_future_release(first);
+    tensor_future_release(second);
+}
+
+static TensorError slow_order(void* arg) {
+    nanosleep(&(struct timespec) {0, 20 * 1000 * 1000}, NULL);
+    return record_order(arg);
+}
+
+// Handles that share a buffer are ordered by the elements they span, not by the handle
+static void test_aliasing_handles(TensorQueue* queue) {
+    atomic_int clock = 0;
+    Tensor t, view, copy, gate = {0}, rows = {0};
+    test_random_tensor(&t, (int[]){1, 8}, 2);
+    CHECK_OK(tensor_expand(&view, &t, (int[]){4, 8}, 2));
+    copy = t;
+    Tensor other;
+    test_random_tensor(&other, (int[]){1, 8}, 2);
+
+    OrderedTask slow = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask write_t = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask read_view = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask read_copy = {&clock, -1, TENSOR_ERROR_NONE};
+    OrderedTask read_other = {&clock, -1, TENSOR_ERROR_NONE};
+
+    // The write waits on a slow task, so unordered readers would start first
+    Tensor* writes_gate[] = {&gate};
+    const Tensor* reads_gate[] = {&gate};
+    Tensor* writes_t[] = {&t};
+    const Tensor* reads_view[] = {&view};
+    const Tensor* reads_copy[] = {&copy};
+    const Tensor* reads_other[] = {&other};
+    Tensor* writes_rows[] = {&rows};
+    CHECK_OK(tensor_submit(NULL, queue, slow_order, &slow, NULL, 0, writes_gate, 1));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &write_t, reads_gate, 1, writes_t, 1));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &read_view, reads_view, 1, writes_rows, 1));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &read_copy, reads_copy, 1, NULL, 0));
+    CHECK_OK(tensor_submit(NULL, queue, record_order, &read_other, reads_other, 1, NULL, 0));
+    CHECK_OK(tensor_queue_wait_all(queue));
+
+    CHECK(read_view.started_at > write_t.started_at, "reader of an expanded view overtook the writer");
+    CHECK(read_copy.started_at > write_t.started_at, "reader of a copied handle overtook the writer");
+    CHECK(read_other.started_at < write_t.started_at, "a disjoint buffer waited for the writer");
+
+    tensor_view_free(&view);
+    tensor_free(&t);
+    tensor_free(&other);
+}
+
+static void test_binary_ops_match_sync(TensorQueue* queue) {
+    const int shape[] = {64, 96};
+    Tensor x, y, w;
+    test_random_tensor(&x, shape, 2);
+    test_random_tensor(&y, shape, 2);
+    test_random_tensor(&w, (int[]){96, 32}, 2);
+
+    // Two independent branches joined at the end: (x + y) @ w and (x * y) @ w
+    Tensor sum, prod, left, right, joined;
+    TensorFuture* done;
+    CHECK_OK(tensor_submit_binary(NULL, queue, tensor_add, &sum, &x, &y));
+    CHECK_OK(tensor_submit_binary(NULL, queue, tensor_mul, &prod, &x, &y));
+    CHECK_OK(tensor_submit_binary(NULL, queue, tensor_mat_mul, &left, &sum, &w));
+    CHECK_OK(tensor_submit_binary(NULL, queue, tensor_mat_mul, &right, &prod, &w));
+    CHECK_OK(tensor_submit_binary(&done, queue, tensor_sub, &joined, &left, &right));
+    CHECK_OK(tensor_future_wait(done));
+    tensor_future_release(done);
+
+    Tensor s_sum, s_prod, s_left, s_right, s_joined;
+    CHECK_OK(tensor_add(&s_sum, &x, &y));
+    CHECK_OK(tensor_mul(&s_prod, &x, &y));
+    CHECK_OK(tensor_mat_mul(&s_left, &s_sum, &w));
+    CHECK_OK(tensor_mat_mul(&s_right, &s_prod, &w));
+    CHECK_OK(tensor_sub(&s_joined, &s_left, &s_right));
+
+    int mismatches = 0;
+    for (int i = 0; i < joined.length; i++) mismatches += joined.data[i] != s_joined.data[i];
+    CHECK(mismatches == 0, "async result differs from synchronous result");
+
+    Tensor* all[] = {&x, &y, &w, &sum, &prod, &left, &right, &joined, &s_sum, &s_prod, &s_left, &s_right, &s_joined};
+    for (int i = 0; i < 13; i++) tensor_free(all[i]);
+}
+
+int main(void) {
+    test_begin("async", 27);
+
+    TensorQueue* queue;
+    CHECK_OK(tensor_queue_create(&queue, 4));
+
+    for (int repeat = 0; repeat < 50; repeat++) {
+        test_dependency_order(queue);
+        test_error_propagation(queue);
+    }
+    test_aliasing_handles(queue);
+    test_binary_ops_match_sync(queue);
+
+    tensor_queue_destroy(queue);
+    return test_finish();
+}
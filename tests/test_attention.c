@@ -0,0 +1,235 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 5
+
+/**
+ * Random [..., rows, cols] operand, optionally stored with its last two dimensions transposed
+ */
+typedef struct {
+    Tensor base;
+    Tensor view;
+    int shape[MAX_DIMS];
+    int strides[MAX_DIMS];
+} Operand;
+
+static void operand_make(Operand* op, const int* shape, const int ndim, const float scale) {
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    const int transposed = test_rand_int(0, 1);
+    if (transposed) {
+        op->shape[ndim - 2] = shape[ndim - 1];
+        op->shape[ndim - 1] = shape[ndim - 2];
+    }
+    test_random_tensor(&op->base, op->shape, ndim);
+    for (int i = 0; i < op->base.length; i++) op->base.data[i] *= scale;
+
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+    if (transposed) {
+        op->strides[ndim - 2] = op->base.strides[ndim - 1];
+        op->strides[ndim - 1] = op->base.strides[ndim - 2];
+    }
+    op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+}
+
+// Batch dimensions of one operand: each output batch dimension is kept, broadcast as 1, or dropped from the front
+static int operand_shape(int* shape, const int* batch, const int batch_ndim, const int rows, const int cols) {
+    const int dropped = test_rand_int(0, batch_ndim);
+    const int ndim = batch_ndim - dropped + 2;
+    for (int i = dropped; i < batch_ndim; i++) shape[i - dropped] = test_rand_int(0, 2) == 0 ? 1 : batch[i];
+    shape[ndim - 2] = rows;
+    shape[ndim - 1] = cols;
+    return ndim;
+}
+
+// softmax(q k^T / sqrt(D) + mask) v in double precision, with the score matrix materialized
+static int count_mismatches(const Tensor* out, const Tensor* q, const Tensor* k, const Tensor* v, const Tensor* mask,
+                            const int* batch, const int batch_ndim, const int lq, const int lk, const int d, const int dv) {
+    const int ndim = batch_ndim + 2;
+    int batches = 1;
+    for (int i = 0; i < batch_ndim; i++) batches *= batch[i];
+
+    double* scores = malloc((size_t) (lk ? lk : 1) * sizeof *scores);
+    int mismatches = 0;
+    int idx[MAX_DIMS + 2];
+    for (int b = 0; b < batches; b++) {
+        test_unravel(b, batch, batch_ndim, idx);
+        for (int i = 0; i < lq; i++) {
+            double max = -INFINITY;
+            for (int j = 0; j < lk; j++) {
+                double dot = 0.0;
+                for (int c = 0; c < d; c++) {
+                    idx[ndim - 2] = i;
+                    idx[ndim - 1] = c;
+                    const double x = test_broadcast_get(q, idx, ndim);
+                    idx[ndim - 2] = j;
+                    dot += x * test_broadcast_get(k, idx, ndim);
+                }
+                scores[j] = dot / sqrt((double) d);
+                if (mask) {
+                    idx[ndim - 2] = i;
+                    idx[ndim - 1] = j;
+                    scores[j] += test_broadcast_get(mask, idx, ndim);
+                }
+                if (scores[j] > max) max = scores[j];
+            }
+
+            double sum = 0.0;
+            for (int j = 0; j < lk; j++) {
+                scores[j] = max == -INFINITY ? 0.0 : exp(scores[j] - max);
+                sum += scores[j];
+            }
+
+            for (int e = 0; e < dv; e++) {
+                double expected = 0.0;
+                idx[ndim - 1] = e;
+                for (int j = 0; j < lk; j++) {
+                    idx[ndim - 2] = j;
+                    expected += scores[j] * test_broadcast_get(v, idx, ndim);
+                }
+                expected = sum > 0.0 ? expected / sum : 0.0;
+                mismatches += fabs(out->data[((size_t) b * lq + i) * dv + e] - expected) > 2e-5 * (1.0 + fabs(expected));
+            }
+        }
+    }
+
+    free(scores);
+    return mismatches;
+}
+
+static void test_matches_reference(void) {
+    for (int trial = 0; trial < 120; trial++) {
+        const int batch_ndim = test_rand_int(0, 2);
+        int batch[MAX_DIMS];
+        for (int i = 0; i < batch_ndim; i++) batch[i] = test_rand_int(1, 4);
+        const int lq = test_rand_int(1, 80);
+        const int lk = trial % 5 == 0 ? test_rand_int(130, 300) : test_rand_int(1, 90);
+        const int d = test_rand_int(1, 70);
+        const int dv = test_rand_int(1, 40);
+        const float scale = trial % 2 ? 4.0f : 1.0f;
+
+        // At least one operand spans the whole batch shape so the result has it
+        int q_shape[MAX_DIMS], k_shape[MAX_DIMS], v_shape[MAX_DIMS];
+        const int q_ndim = batch_ndim + 2;
+        memcpy(q_shape, batch, batch_ndim * sizeof *batch);
+        q_shape[batch_ndim] = lq;
+        q_shape[batch_ndim + 1] = d;
+        const int k_ndim = operand_shape(k_shape, batch, batch_ndim, lk, d);
+        const int v_ndim = operand_shape(v_shape, batch, batch_ndim, lk, dv);
+
+        Operand q, k, v;
+        operand_make(&q, q_shape, q_ndim, scale);
+        operand_make(&k, k_shape, k_ndim, scale);
+        operand_make(&v, v_shape, v_ndim, 1.0f);
+
+        // Causal, random additive broadcast along the batch, or no mask. Causal masks with more queries
+        // than keys leave the leading rows fully masked
+        Tensor mask;
+        const int mask_kind = trial % 3;
+        if (mask_kind == 1) {
+            CHECK_OK(tensor_empty(&mask, (int[]){lq, lk}, 2));
+            for (int i = 0; i < lq; i++) {
+                for (int j = 0; j < lk; j++) mask.data[i * lk + j] = j <= i + lk - lq ? 0.0f : -INFINITY;
+            }
+        }else if (mask_kind == 2) {
+            test_random_tensor(&mask, (int[]){1, test_rand_int(0, 1) ? lk : 1}, 2);
+        }
+
+        Tensor out;
+        CHECK_OK(tensor_attention(&out, &q.view, &k.view, &v.view, mask_kind ? &mask : NULL));
+        CHECK(out.ndim == batch_ndim + 2 && out.shape[batch_ndim] == lq && out.shape[batch_ndim + 1] == dv,
+              "trial %d: result shape", trial);
+
+        const int mismatches = count_mismatches(&out, &q.view, &k.view, &v.view, mask_kind ? &mask : NULL,
+                                                batch, batch_ndim, lq, lk, d, dv);
+        CHECK(mismatches == 0, "trial %d (Lq %d, Lk %d, D %d, Dv %d): %d values differ", trial, lq, lk, d, dv, mismatches);
+
+        tensor_free(&out);
+        if (mask_kind) tensor_free(&mask);
+        tensor_free(&q.base);
+        tensor_free(&k.base);
+        tensor_free(&v.base);
+    }
+}
+
+static void test_invalid_arguments(void) {
+    Tensor q, k, v, wrong, out;
+    test_random_tensor(&q, (int[]){2, 4, 8}, 3);
+    test_random_tensor(&k, (int[]){2, 6, 8}, 3);
+    test_random_tensor(&v, (int[]){2, 6, 3}, 3);
+    test_random_tensor(&wrong, (int[]){3, 6, 8}, 3);
+
+    CHECK(tensor_attention(&out, &q, &k, &q, NULL) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted values with too few keys");
+    CHECK(tensor_attention(&out, &q, &v, &v, NULL) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted keys of the wrong depth");
+    CHECK(tensor_attention(&out, &q, &wrong, &v, NULL) == TENSOR_ERROR_CANNOT_BROADCAST, "broadcast batches 2 and 3");
+    CHECK(tensor_attention(&out, &q, &k, &v, &wrong) == TENSOR_ERROR_CANNOT_BROADCAST, "accepted a mask of the wrong shape");
+
+    Tensor* all[] = {&q, &k, &v, &wrong};
+    for (int i = 0; i < 4; i++) tensor_free(all[i]);
+}
+
+// 8 heads over 1024 tokens: the fused kernel against tensor_mat_mul with a materialized softmax in between
+static void test_timings(void) {
+    const int heads = 8, seq = 1024, d = 64;
+    Tensor q, k, v;
+    test_random_tensor(&q, (int[]){heads, seq, d}, 3);
+    test_random_tensor(&k, (int[]){heads, seq, d}, 3);
+    test_random_tensor(&v, (int[]){heads, seq, d}, 3);
+
+    Tensor results[2];
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        char case_name[32];
+        snprintf(case_name, sizeof case_name, "8x1024x64_t%d", thread_counts[t]);
+
+        const double start = test_timing_start();
+        CHECK_OK(tensor_attention(&results[t], &q, &k, &v, NULL));
+        test_report_timing("tensor_attention", case_name, test_now_ms() - start);
+    }
+    tensor_set_num_threads(0);
+    CHECK(memcmp(results[0].data, results[1].data, results[0].length * sizeof(float)) == 0,
+          "result depends on the thread count");
+
+    // The [8, 1024, 1024] score matrix alone is 32 MiB here
+    int kt_shape[] = {heads, d, seq};
+    int kt_strides[] = {seq * d, 1, d};
+    const Tensor kt = {3, k.length, kt_shape, kt_strides, k.data};
+    Tensor scores, unfused;
+    const double start = test_timing_start();
+    CHECK_OK(tensor_mat_mul(&scores, &q, &kt));
+    for (int row = 0; row < heads * seq; row++) {
+        float* s = &scores.data[(size_t) row * seq];
+        float max = -INFINITY, sum = 0.0f;
+        for (int j = 0; j < seq; j++) {
+            s[j] *= 0.125f;
+            max = s[j] > max ? s[j] : max;
+        }
+        for (int j = 0; j < seq; j++) sum += s[j] = expf(s[j] - max);
+        for (int j = 0; j < seq; j++) s[j] /= sum;
+    }
+    CHECK_OK(tensor_mat_mul(&unfused, &scores, &v));
+    test_report_timing("mat_mul_softmax_mat_mul", "8x1024x64", test_now_ms() - start);
+
+    int mismatches = 0;
+    for (int i = 0; i < unfused.length; i++) mismatches += fabsf(results[0].data[i] - unfused.data[i]) > 1e-5f;
+    CHECK(mismatches == 0, "%d values differ from the unfused composition", mismatches);
+
+    Tensor* all[] = {&q, &k, &v, &results[0], &results[1], &scores, &unfused};
+    for (int i = 0; i < 7; i++) tensor_free(all[i]);
+}
+
+int main(void) {
+    test_begin("attention", 39);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_matches_reference();
+    }
+
+    tensor_set_num_threads(0);
+    test_invalid_arguments();
+    test_timings();
+
+    return test_finish();
+}
@@ -0,0 +1,167 @@
+#include "test_harness.h"
+
+static int image_index(const Tensor* t, const TensorLayout layout, const int n, const int c, const int h, const int w) {
+    if (layout == TENSOR_LAYOUT_NHWC) {
+        return n * t->strides[0] + h * t->strides[1] + w * t->strides[2] + c * t->strides[3];
+    }
+    return n * t->strides[0] + c * t->strides[1] + h * t->strides[2] + w * t->strides[3];
+}
+
+static int check_against_reference(const Tensor* out, const Tensor* input, const Tensor* weight,
+                                   const Tensor* bias, const TensorConv2dParams* p) {
+    const int nhwc = p->layout == TENSOR_LAYOUT_NHWC;
+    const int batch = input->shape[0];
+    const int h_in = nhwc ? input->shape[1] : input->shape[2];
+    const int w_in = nhwc ? input->shape[2] : input->shape[3];
+    const int c_out = weight->shape[0];
+    const int cin_g = weight->shape[1];
+    const int k_h = weight->shape[2];
+    const int k_w = weight->shape[3];
+    const int cout_g = c_out / p->groups;
+    const int h_out = nhwc ? out->shape[1] : out->shape[2];
+    const int w_out = nhwc ? out->shape[2] : out->shape[3];
+
+    int mismatches = 0;
+    for (int n = 0; n < batch; n++) {
+        for (int oc = 0; oc < c_out; oc++) {
+            for (int oh = 0; oh < h_out; oh++) {
+                for (int ow = 0; ow < w_out; ow++) {
+                    double expected = bias ? bias->data[oc] : 0.0;
+                    double magnitude = fabs(expected);
+
+                    for (int ic = 0; ic < cin_g; ic++) {
+                        for (int y = 0; y < k_h; y++) {
+                            for (int x = 0; x < k_w; x++) {
+                                const int ih = oh * p->stride_h - p->pad_h + y * p->dilation_h;
+                                const int iw = ow * p->stride_w - p->pad_w + x * p->dilation_w;
+                                if (ih < 0 || ih >= h_in || iw < 0 || iw >= w_in) continue;
+
+                                const int c = oc / cout_g * cin_g + ic;
+                                const double term = (double) input->data[image_index(input, p->layout, n, c, ih, iw)]
+                                                  * weight->data[((oc * cin_g + ic) * k_h + y) * k_w + x];
+                                expected += term;
+                                magnitude += fabs(term);
+                            }
+                        }
+                    }
+
+                    const float actual = out->data[image_index(out, p->layout, n, oc, oh, ow)];
+                    mismatches += !test_close(actual, expected, magnitude, 4 * cin_g * k_h * k_w);
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+static void test_random_configs(void) {
+    for (int trial = 0; trial < 150; trial++) {
+        TensorConv2dParams p = {
+            .stride_h = test_rand_int(1, 2),
+            .stride_w = test_rand_int(1, 3),
+            .pad_h = test_rand_int(0, 2),
+            .pad_w = test_rand_int(0, 2),
+            .dilation_h = test_rand_int(1, 2),
+            .dilation_w = test_rand_int(1, 2),
+            .groups = test_rand_int(1, 3),
+            .layout = test_rand_int(0, 1) ? TENSOR_LAYOUT_NHWC : TENSOR_LAYOUT_NCHW,
+        };
+
+        const int batch = test_rand_int(1, 2);
+        const int cin_g = test_rand_int(1, 4);
+        const int cout_g = test_rand_int(1, 11);
+        const int k_h = test_rand_int(1, 3);
+        const int k_w = test_rand_int(1, 3);
+        const int h = test_rand_int(k_h * p.dilation_h, 12);
+        const int w = test_rand_int(k_w * p.dilation_w, 20);
+        const int c_in = cin_g * p.groups;
+        const int c_out = cout_g * p.groups;
+
+        const int nhwc = p.layout == TENSOR_LAYOUT_NHWC;
+        const int input_shape[4] = {batch, nhwc ? h : c_in, nhwc ? w : h, nhwc ? c_in : w};
+
+        Tensor input, weight, bias, out;
+        test_random_tensor(&input, input_shape, 4);
+        test_random_tensor(&weight, (int[]){c_out, cin_g, k_h, k_w}, 4);
+        test_random_tensor(&bias, &c_out, 1);
+        const int use_bias = test_rand_int(0, 1);
+
+        const TensorError err = tensor_conv2d(&out, &input, &weight, use_bias ? &bias : NULL, &p);
+        CHECK(err == TENSOR_ERROR_NONE, "trial %d: %s", trial, tensor_error_to_string(err));
+
+        if (err == TENSOR_ERROR_NONE) {
+            const int mismatches = check_against_reference(&out, &input, &weight, use_bias ? &bias : NULL, &p);
+            CHECK(mismatches == 0, "trial %d: %d outputs outside tolerance", trial, mismatches);
+            tensor_free(&out);
+        }
+
+        tensor_free(&input);
+        tensor_free(&weight);
+        tensor_free(&bias);
+    }
+}
+
+static void test_invalid_arguments(void) {
+    Tensor input, weight, out;
+    test_random_tensor(&input, (int[]){1, 4, 8, 8}, 4);
+    test_random_tensor(&weight, (int[]){6, 3, 3, 3}, 4);
+
+    TensorConv2dParams p = {1, 1, 0, 0, 1, 1, 1, TENSOR_LAYOUT_NCHW};
+    CHECK(tensor_conv2d(&out, &input, &weight, NULL, &p) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "channel mismatch accepted");
+
+    p.groups = 3;
+    CHECK(tensor_conv2d(&out, &input, &weight, NULL, &p) == TENSOR_ERROR_INVALID_ARGUMENT, "groups not dividing channels accepted");
+
+    p.groups = 1;
+    p.stride_h = 0;
+    CHECK(tensor_conv2d(&out, &input, &weight, NULL, &p) == TENSOR_ERROR_INVALID_ARGUMENT, "zero stride accepted");
+
+    // A kernel larger than the padded input, where a truncating division would still give one output
+    Tensor small, large;
+    test_random_tensor(&small, (int[]){1, 1, 3, 3}, 4);
+    test_random_tensor(&large, (int[]){1, 1, 4, 4}, 4);
+    p = (TensorConv2dParams) {2, 2, 0, 0, 1, 1, 1, TENSOR_LAYOUT_NCHW};
+    CHECK(tensor_conv2d(&out, &small, &large, NULL, &p) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "kernel larger than the input accepted");
+    p.pad_h = 1;
+    p.pad_w = 1;
+    CHECK_OK(tensor_conv2d(&out, &small, &large, NULL, &p));
+    CHECK(out.shape[2] == 1 && out.shape[3] == 1, "padded output is %dx%d", out.shape[2], out.shape[3]);
+    tensor_free(&out);
+
+    tensor_free(&small);
+    tensor_free(&large);
+    tensor_free(&input);
+    tensor_free(&weight);
+}
+
+static void test_timings(void) {
+    const TensorLayout layouts[] = {TENSOR_LAYOUT_NCHW, TENSOR_LAYOUT_NHWC};
+    const char* names[] = {"nchw_64x56x56_k3", "nhwc_64x56x56_k3"};
+
+    for (int l = 0; l < 2; l++) {
+        const int nhwc = layouts[l] == TENSOR_LAYOUT_NHWC;
+        Tensor input, weight, out;
+        test_random_tensor(&input, nhwc ? (int[]){1, 56, 56, 64} : (int[]){1, 64, 56, 56}, 4);
+        test_random_tensor(&weight, (int[]){64, 64, 3, 3}, 4);
+
+        const TensorConv2dParams p = {1, 1, 1, 1, 1, 1, 1, layouts[l]};
+        const double start = test_timing_start();
+        CHECK_OK(tensor_conv2d(&out, &input, &weight, NULL, &p));
+        test_report_timing("tensor_conv2d", names[l], test_now_ms() - start);
+
+        tensor_free(&input);
+        tensor_free(&weight);
+        tensor_free(&out);
+    }
+}
+
+int main(void) {
+    test_begin("conv2d", 26);
+
+    test_random_configs();
+    test_invalid_arguments();
+    test_timings();
+
+    return test_finish();
+}
@@ -0,0 +1,244 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+typedef enum {
+    OPERAND_CONTIGUOUS,
+    OPERAND_SCALAR,
+    OPERAND_ROW,
+    OPERAND_COLUMN,
+    OPERAND_RANDOM_BROADCAST,
+    OPERAND_TRANSPOSED,
+    OPERAND_STEPPED,
+    OPERAND_EXPANDED,
+    OPERAND_PATTERN_COUNT,
+} OperandPattern;
+
+/**
+ * One input operand: `base` owns the data, `view` is what the op sees
+ */
+typedef struct {
+    Tensor base;
+    Tensor view;
+    int shape[MAX_DIMS];
+    int strides[MAX_DIMS];
+    int owns_view_metadata;
+} Operand;
+
+static void operand_make(Operand* op, const OperandPattern pattern, const int* shape, const int ndim) {
+    op->owns_view_metadata = 0;
+
+    switch (pattern) {
+        case OPERAND_SCALAR:
+            test_random_tensor(&op->base, (int[]){1}, 1);
+            op->view = op->base;
+            return;
+        case OPERAND_ROW:
+            test_random_tensor(&op->base, &shape[ndim - 1], 1);
+            op->view = op->base;
+            return;
+        case OPERAND_COLUMN:
+            memcpy(op->shape, shape, ndim * sizeof *shape);
+            op->shape[ndim - 1] = 1;
+            test_random_tensor(&op->base, op->shape, ndim);
+            op->view = op->base;
+            return;
+        case OPERAND_RANDOM_BROADCAST: {
+            const int drop = test_rand_int(0, ndim - 1);
+            for (int i = drop; i < ndim; i++) {
+                op->shape[i - drop] = test_rand_int(0, 2) == 0 ? 1 : shape[i];
+            }
+            test_random_tensor(&op->base, op->shape, ndim - drop);
+            op->view = op->base;
+            return;
+        }
+        case OPERAND_TRANSPOSED:
+            if (ndim >= 2) {
+                memcpy(op->shape, shape, ndim * sizeof *shape);
+                op->shape[ndim - 2] = shape[ndim - 1];
+                op->shape[ndim - 1] = shape[ndim - 2];
+                test_random_tensor(&op->base, op->shape, ndim);
+
+                memcpy(op->shape, shape, ndim * sizeof *shape);
+                memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+                op->strides[ndim - 2] = op->base.strides[ndim - 1];
+                op->strides[ndim - 1] = op->base.strides[ndim - 2];
+                op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+                return;
+            }
+            break;
+        case OPERAND_STEPPED:
+            memcpy(op->shape, shape, ndim * sizeof *shape);
+            op->shape[ndim - 1] *= 2;
+            test_random_tensor(&op->base, op->shape, ndim);
+
+            op->shape[ndim - 1] = shape[ndim - 1];
+            memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+            op->strides[ndim - 1] = 2;
+            op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+            return;
+        case OPERAND_EXPANDED:
+            test_random_tensor(&op->base, &shape[ndim - 1], 1);
+            CHECK_OK(tensor_expand(&op->view, &op->base, shape, ndim));
+            op->owns_view_metadata = 1;
+            return;
+        default:
+            break;
+    }
+
+    test_random_tensor(&op->base, shape, ndim);
+    op->view = op->base;
+}
+
+static void operand_free(Operand* op) {
+    if (op->owns_view_metadata) tensor_view_free(&op->view);
+    tensor_free(&op->base);
+}
+
+static float reference_op(const int op, const float x, const float y) {
+    switch (op) {
+        case 0: return x + y;
+        case 1: return x - y;
+        case 2: return x * y;
+        default: return x / y;
+    }
+}
+
+static TensorError run_op(const int op, Tensor* out, const Tensor* a, const Tensor* b) {
+    switch (op) {
+        case 0: return tensor_add(out, a, b);
+        case 1: return tensor_sub(out, a, b);
+        case 2: return tensor_mul(out, a, b);
+        default: return tensor_div(out, a, b);
+    }
+}
+
+static void test_random_patterns(void) {
+    for (int trial = 0; trial < 400; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int i = 0; i < ndim; i++) {
+            shape[i] = test_rand_int(1, 7);
+        }
+        if (trial % 4 == 0) shape[ndim - 1] = test_rand_int(64, 300);
+
+        Operand a, b;
+        operand_make(&a, (OperandPattern) test_rand_int(0, OPERAND_PATTERN_COUNT - 1), shape, ndim);
+        operand_make(&b, (OperandPattern) test_rand_int(0, OPERAND_PATTERN_COUNT - 1), shape, ndim);
+
+        const int op = test_rand_int(0, 3);
+        Tensor out;
+        const TensorError err = run_op(op, &out, &a.view, &b.view);
+        CHECK(err == TENSOR_ERROR_NONE, "trial %d: %s", trial, tensor_error_to_string(err));
+
+        if (err == TENSOR_ERROR_NONE) {
+            int idx[MAX_DIMS];
+            int mismatches = 0;
+            for (int f = 0; f < out.length && mismatches == 0; f++) {
+                test_unravel(f, out.shape, out.ndim, idx);
+                const float expected = reference_op(op, test_broadcast_get(&a.view, idx, out.ndim),
+                                                        test_broadcast_get(&b.view, idx, out.ndim));
+                mismatches += test_ulp_distance(out.data[f], expected) > 0;
+            }
+            CHECK(mismatches == 0, "trial %d op %d: result differs from reference", trial, op);
+            tensor_free(&out);
+        }
+
+        operand_free(&a);
+        operand_free(&b);
+    }
+}
+
+static void test_incompatible_shapes(void) {
+    Tensor a, b, out;
+    test_random_tensor(&a, (int[]){3, 4}, 2);
+    test_random_tensor(&b, (int[]){3, 5}, 2);
+
+    CHECK(tensor_add(&out, &a, &b) == TENSOR_ERROR_CANNOT_BROADCAST, "expected broadcast failure");
+
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+// An empty result that still broadcasts has a zero-length last dimension after coalescing
+static void test_empty_broadcast(void) {
+    Tensor a, b, out;
+    test_random_tensor(&a, (int[]){2, 3, 0}, 3);
+    test_random_tensor(&b, (int[]){1, 3, 1}, 3);
+
+    CHECK_OK(tensor_add(&out, &a, &b));
+    CHECK(out.ndim == 3 && out.length == 0 && out.shape[0] == 2 && out.shape[1] == 3 && out.shape[2] == 0,
+          "empty broadcast shape");
+
+    tensor_free(&out);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void reference_add(float* out, const Tensor* a, const Tensor* b, const int* shape, const int ndim, const int total) {
+    int idx[MAX_DIMS];
+    for (int f = 0; f < total; f++) {
+        test_unravel(f, shape, ndim, idx);
+        out[f] = test_broadcast_get(a, idx, ndim) + test_broadcast_get(b, idx, ndim);
+    }
+}
+
+static void time_case(const char* case_name, const Tensor* a, const Tensor* b, const int* shape, const int ndim) {
+    const int total = shape[0] * shape[1];
+    float* expected = malloc(total * sizeof *expected);
+
+    double start = test_timing_start();
+    reference_add(expected, a, b, shape, ndim, total);
+    test_report_timing("reference_add", case_name, test_now_ms() - start);
+
+    Tensor out;
+    start = test_timing_start();
+    CHECK_OK(tensor_add(&out, a, b));
+    test_report_timing("tensor_add", case_name, test_now_ms() - start);
+
+    int mismatches = 0;
+    for (int i = 0; i < total; i++) mismatches += out.data[i] != expected[i];
+    CHECK(mismatches == 0, "%s: %d mismatches", case_name, mismatches);
+
+    tensor_free(&out);
+    free(expected);
+}
+
+static void test_timings(void) {
+    const int shape[] = {1024, 2048};
+    Tensor a, b, scalar, row, col;
+
+    test_random_tensor(&a, shape, 2);
+    test_random_tensor(&b, shape, 2);
+    test_random_tensor(&scalar, (int[]){1}, 1);
+    test_random_tensor(&row, &shape[1], 1);
+    test_random_tensor(&col, (int[]){shape[0], 1}, 2);
+
+    time_case("contiguous", &a, &b, shape, 2);
+    time_case("scalar", &a, &scalar, shape, 2);
+    time_case("row_broadcast", &a, &row, shape, 2);
+    time_case("col_broadcast", &a, &col, shape, 2);
+
+    tensor_free(&a);
+    tensor_free(&b);
+    tensor_free(&scalar);
+    tensor_free(&row);
+    tensor_free(&col);
+}
+
+int main(void) {
+    test_begin("elementwise", 29);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_random_patterns();
+    }
+
+    tensor_set_num_threads(0);
+    test_incompatible_shapes();
+    test_empty_broadcast();
+    test_timings();
+
+    return test_finish();
+}
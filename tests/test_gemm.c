@@ -0,0 +1,288 @@
+#include <unistd.h>
+
+#include "tensor_gemm.h"
+#include "test_harness.h"
+
+// Random [rows, cols] matrix, stored transposed half of the time
+static void random_matrix(Tensor* base, Tensor* view, int* shape, int* strides, const int rows, const int cols) {
+    const int transposed = test_rand_int(0, 1);
+    test_random_tensor(base, transposed ? (int[]){cols, rows} : (int[]){rows, cols}, 2);
+    shape[0] = rows;
+    shape[1] = cols;
+    strides[0] = transposed ? 1 : cols;
+    strides[1] = transposed ? rows : 1;
+    *view = (Tensor) {2, base->length, shape, strides, base->data};
+}
+
+static void test_matches_reference(void) {
+    for (int trial = 0; trial < 120; trial++) {
+        const int m = test_rand_int(1, 70);
+        const int k = trial % 4 == 0 ? test_rand_int(257, 700) : test_rand_int(1, 80);
+        const int n = test_rand_int(1, 150);
+        const int batch = trial % 3 == 0 ? test_rand_int(2, 3) : 0;
+
+        Tensor w_base, w, a_base, a;
+        int w_shape[2], w_strides[2], a_shape[3], a_strides[3];
+        random_matrix(&w_base, &w, w_shape, w_strides, k, n);
+
+        if (batch) {
+            test_random_tensor(&a_base, (int[]){batch, m, k}, 3);
+            memcpy(a_shape, a_base.shape, sizeof a_shape);
+            memcpy(a_strides, a_base.strides, sizeof a_strides);
+            a = (Tensor) {3, a_base.length, a_shape, a_strides, a_base.data};
+        }else {
+            random_matrix(&a_base, &a, a_shape, a_strides, m, k);
+        }
+
+        TensorPackedWeights* packed;
+        Tensor out;
+        CHECK_OK(tensor_pack_weights(&packed, &w));
+        CHECK_OK(tensor_mat_mul_packed(&out, &a, packed));
+        CHECK(out.ndim == a.ndim && out.shape[out.ndim - 2] == m && out.shape[out.ndim - 1] == n, "trial %d: shape", trial);
+
+        int mismatches = 0;
+        for (int b = 0; b < (batch ? batch : 1); b++) {
+            for (int i = 0; i < m; i++) {
+                for (int j = 0; j < n; j++) {
+                    double sum = 0.0, magnitude = 0.0;
+                    for (int p = 0; p < k; p++) {
+                        const double x = a.data[(batch ? b * a.strides[0] : 0) + i * a.strides[a.ndim - 2] + p * a.strides[a.ndim - 1]];
+                        const double y = w.data[p * w.strides[0] + j * w.strides[1]];
+                        sum += x * y;
+                        magnitude += fabs(x * y);
+                    }
+                    mismatches += !test_close(out.data[(b * m + i) * n + j], sum, magnitude, 2 * k);
+                }
+            }
+        }
+        CHECK(mismatches == 0, "trial %d (%dx%dx%d): %d products differ", trial, m, k, n, mismatches);
+
+        tensor_free(&out);
+        tensor_packed_weights_destroy(packed);
+        tensor_free(&w_base);
+        tensor_free(&a_base);
+    }
+}
+
+static void test_vector_and_invalid(void) {
+    Tensor w, x, out;
+    test_random_tensor(&w, (int[]){5, 3}, 2);
+    CHECK_OK(tensor_from_data(&x, (float[]){1, 0, 0, 0, 2}, (int[]){5}, 1));
+
+    TensorPackedWeights* packed;
+    CHECK_OK(tensor_pack_weights(&packed, &w));
+    CHECK(tensor_packed_weights_bytes(packed) == 5 * 16 * sizeof(float), "padded to %zu bytes", tensor_packed_weights_bytes(packed));
+
+    CHECK_OK(tensor_mat_mul_packed(&out, &x, packed));
+    CHECK(out.ndim == 2 && out.shape[0] == 1 && out.shape[1] == 3, "vector result shape");
+    int mismatches = 0;
+    for (int j = 0; j < 3; j++) mismatches += out.data[j] != w.data[j] + 2.0f * w.data[12 + j];
+    CHECK(mismatches == 0, "vector product differs");
+    tensor_free(&out);
+
+    Tensor wrong;
+    test_random_tensor(&wrong, (int[]){2, 4}, 2);
+    CHECK(tensor_mat_mul_packed(&out, &wrong, packed) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted mismatched K");
+    TensorPackedWeights* rejected;
+    CHECK(tensor_pack_weights(&rejected, &x) == TENSOR_ERROR_INVALID_ARGUMENT, "packed a 1D tensor");
+
+    tensor_packed_weights_destroy(packed);
+    tensor_free(&wrong);
+    tensor_free(&w);
+    tensor_free(&x);
+}
+
+static int same_config(const TensorGemmConfig* a, const TensorGemmConfig* b) {
+    return a->kc == b->kc && a->unit_rows == b->unit_rows && a->unit_panels == b->unit_panels
+        && a->kernel == b->kernel && a->threads == b->threads;
+}
+
+// Tunes one shape, checks that the winner is used and computes the right product, and round-trips it through a file
+static void test_tuning(void) {
+    const int m = 40, n = 200, k = 300, batch = 2;
+    tensor_gemm_tuning_clear();
+    TensorGemmConfig config, tuned, found;
+    CHECK(!tensor_gemm_find_config(&config, m, n, k, batch), "found a config before tuning");
+    CHECK(config.kc > 0 && config.unit_rows > 0 && config.unit_panels > 0, "default config");
+    CHECK(tensor_gemm_tune(&tuned, 0, n, k, batch) == TENSOR_ERROR_INVALID_ARGUMENT, "tuned an empty shape");
+
+    tensor_set_num_threads(3);
+    const double start = test_timing_start();
+    CHECK_OK(tensor_gemm_tune(&tuned, m, n, k, batch));
+    test_report_timing("tensor_gemm_tune", "2x40x300x200", test_now_ms() - start);
+    CHECK(tensor_gemm_find_config(&found, m, n, k, batch) && same_config(&found, &tuned), "tuned config not found");
+    CHECK(!tensor_gemm_find_config(&found, m + 1, n, k, batch), "found a config for another shape");
+    CHECK(tuned.unit_rows <= TENSOR_GEMM_MAX_UNIT_ROWS && tuned.kernel != TENSOR_GEMM_KERNEL_AUTO, "tuned config out of range");
+
+    Tensor w, a, out;
+    test_random_tensor(&w, (int[]){k, n}, 2);
+    test_random_tensor(&a, (int[]){batch, m, k}, 3);
+    TensorPackedWeights* packed;
+    CHECK_OK(tensor_pack_weights(&packed, &w));
+    CHECK_OK(tensor_mat_mul_packed(&out, &a, packed));
+
+    int mismatches = 0;
+    for (int row = 0; row < batch * m; row++) {
+        for (int j = 0; j < n; j++) {
+            double sum = 0.0, magnitude = 0.0;
+            for (int p = 0; p < k; p++) {
+                sum += (double) a.data[row * k + p] * w.data[p * n + j];
+                magnitude += fabs((double) a.data[row * k + p] * w.data[p * n + j]);
+            }
+            mismatches += !test_close(out.data[row * n + j], sum, magnitude, 2 * k);
+        }
+    }
+    CHECK(mismatches == 0, "%d products differ with the tuned config", mismatches);
+    tensor_set_num_threads(0);
+
+    // Entries of other CPU models survive a load and save
+    char path[] = "/tmp/tensor_gemm_tuning_XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd >= 0, "cannot create a temporary file");
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "# comment\nOther CPU @ 1.00GHz\t8\t16\t32\t1\t128\t24\t4\tgeneric\t2\t0.5000\n");
+    fclose(file);
+
+    CHECK_OK(tensor_gemm_tuning_load(path));
+    CHECK_OK(tensor_gemm_tuning_save(path));
+    tensor_gemm_tuning_clear();
+    CHECK(!tensor_gemm_find_config(&found, m, n, k, batch), "clear kept a config");
+    CHECK_OK(tensor_gemm_tuning_load(path));
+    CHECK(tensor_gemm_find_config(&found, m, n, k, batch) && same_config(&found, &tuned), "config lost in the file");
+    CHECK(!tensor_gemm_find_config(&found, 8, 16, 32, 1), "used a config of another CPU model");
+
+    char contents[2048] = {0};
+    file = fopen(path, "r");
+    CHECK(fread(contents, 1, sizeof contents - 1, file) > 0, "empty tuning file");
+    fclose(file);
+    CHECK(strstr(contents, "Other CPU @ 1.00GHz\t8\t16\t32\t1\t128\t24\t4\tgeneric\t2") != NULL, "dropped another CPU model:\n%s", contents);
+    CHECK(strstr(contents, tensor_gemm_cpu_model()) != NULL, "file not keyed by %s", tensor_gemm_cpu_model());
+
+    // A malformed file changes nothing
+    file = fopen(path, "w");
+    fprintf(file, "%s\t%d\t%d\t%d\t%d\t0\t24\t4\tgeneric\t2\t0.5\n", tensor_gemm_cpu_model(), m, n, k, batch);
+    fclose(file);
+    CHECK(tensor_gemm_tuning_load(path) == TENSOR_ERROR_IO, "loaded a zero K block");
+    CHECK(tensor_gemm_find_config(&found, m, n, k, batch) && same_config(&found, &tuned), "malformed file replaced a config");
+    unlink(path);
+    CHECK(tensor_gemm_tuning_load(path) == TENSOR_ERROR_IO, "loaded a missing file");
+
+    tensor_gemm_tuning_clear();
+    tensor_free(&out);
+    tensor_packed_weights_destroy(packed);
+    tensor_free(&w);
+    tensor_free(&a);
+}
+
+/**
+ * tensor_mat_mul packs a 2D right operand itself once there are enough rows, with the config tuned for the shape,
+ * so it must match tensor_mat_mul_packed bit for bit before and after a generic-kernel config is loaded
+ */
+static void test_mat_mul_uses_tuning(void) {
+    const int m = 24, n = 40, k = 300, batch = 2;
+    tensor_gemm_tuning_clear();
+
+    Tensor w_base, w, a;
+    int w_shape[2], w_strides[2];
+    random_matrix(&w_base, &w, w_shape, w_strides, k, n);
+    test_random_tensor(&a, (int[]){batch, m, k}, 3);
+
+    char path[] = "/tmp/tensor_gemm_tuning_XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd >= 0, "cannot create a temporary file");
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "%s\t%d\t%d\t%d\t%d\t64\t8\t1\tgeneric\t2\t0.5\n", tensor_gemm_cpu_model(), m, n, k, batch);
+    fclose(file);
+
+    for (int tuned = 0; tuned < 2; tuned++) {
+        if (tuned) CHECK_OK(tensor_gemm_tuning_load(path));
+
+        Tensor product, packed_product;
+        TensorPackedWeights* packed;
+        CHECK_OK(tensor_mat_mul(&product, &a, &w));
+        CHECK_OK(tensor_pack_weights(&packed, &w));
+        CHECK_OK(tensor_mat_mul_packed(&packed_product, &a, packed));
+
+        CHECK(product.ndim == 3 && product.shape[0] == batch && product.shape[1] == m && product.shape[2] == n,
+              "tuned %d: shape", tuned);
+        CHECK(memcmp(product.data, packed_product.data, product.length * sizeof(float)) == 0,
+              "tuned %d: tensor_mat_mul differs from tensor_mat_mul_packed", tuned);
+
+        tensor_free(&product);
+        tensor_free(&packed_product);
+        tensor_packed_weights_destroy(packed);
+    }
+
+    unlink(path);
+    tensor_gemm_tuning_clear();
+    tensor_free(&w_base);
+    tensor_free(&a);
+}
+
+// Results must not depend on the thread count, and the packed product is timed against tensor_mat_mul
+static void test_timings(void) {
+    const int rows[] = {1, 16, 128};
+    Tensor w;
+    test_random_tensor(&w, (int[]){1024, 1024}, 2);
+
+    for (int r = 0; r < 3; r++) {
+        Tensor a;
+        test_random_tensor(&a, (int[]){rows[r], 1024}, 2);
+        char case_name[32];
+        snprintf(case_name, sizeof case_name, "%dx1024x1024", rows[r]);
+
+        Tensor reference;
+        double start = test_timing_start();
+        CHECK_OK(tensor_mat_mul(&reference, &a, &w));
+        test_report_timing("tensor_mat_mul", case_name, test_now_ms() - start);
+
+        TensorPackedWeights* packed;
+        start = test_timing_start();
+        CHECK_OK(tensor_pack_weights(&packed, &w));
+        test_report_timing("tensor_pack_weights", case_name, test_now_ms() - start);
+
+        Tensor results[2];
+        const int thread_counts[] = {1, 3};
+        for (int t = 0; t < 2; t++) {
+            tensor_set_num_threads(thread_counts[t]);
+            char threaded_case[48];
+            snprintf(threaded_case, sizeof threaded_case, "%s_t%d", case_name, thread_counts[t]);
+
+            start = test_timing_start();
+            CHECK_OK(tensor_mat_mul_packed(&results[t], &a, packed));
+            test_report_timing("tensor_mat_mul_packed", threaded_case, test_now_ms() - start);
+        }
+        tensor_set_num_threads(0);
+
+        CHECK(memcmp(results[0].data, results[1].data, results[0].length * sizeof(float)) == 0,
+              "%s: result depends on the thread count", case_name);
+        int mismatches = 0;
+        for (int i = 0; i < reference.length; i++) mismatches += !test_close(results[0].data[i], reference.data[i], 32.0, 1024);
+        CHECK(mismatches == 0, "%s: %d products differ from tensor_mat_mul", case_name, mismatches);
+
+        tensor_free(&results[0]);
+        tensor_free(&results[1]);
+        tensor_free(&reference);
+        tensor_packed_weights_destroy(packed);
+        tensor_free(&a);
+    }
+    tensor_free(&w);
+}
+
+int main(void) {
+    test_begin("gemm", 37);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_matches_reference();
+    }
+
+    tensor_set_num_threads(0);
+    test_vector_and_invalid();
+    test_tuning();
+    test_mat_mul_uses_tuning();
+    test_timings();
+
+    return test_finish();
+}
@@ -0,0 +1,173 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "tensor_profile.h"
+
+/**
+ * Minimal test harness shared by every test executable.
+ * Each test compares a library kernel against a simple reference written directly in the test,
+ * on randomized shapes, strides and broadcast patterns, and reports per-kernel timings.
+ *
+ * Timings are printed as "[timing] <suite> <kernel> <case> <ms>" lines and, when the
+ * TENSOR_BENCH_OUTPUT environment variable names a file, appended to it in the same format.
+ * When TENSOR_BENCH_COUNTERS is set, ops are profiled per timed case: test_timing_start clears the
+ * profiler and test_report_timing prints the ops called since, with hardware counters where available,
+ * as "[counters] <suite> <kernel> <case> <op> ..." lines right after the case's timing line.
+ */
+
+static int test_failures = 0;
+static int test_checks = 0;
+static int test_counters = 0;
+static const char* test_suite = "";
+
+#define CHECK(cond, ...)                                                         \
+    do {                                                                         \
+        test_checks++;                                                           \
+        if (!(cond)) {                                                           \
+            test_failures++;                                                     \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                                        \
+            fputc('\n', stderr);                                                 \
+        }                                                                        \
+    } while (0)
+
+#define CHECK_OK(expr)                                                           \
+    do {                                                                         \
+        const TensorError check_err_ = (expr);                                   \
+        CHECK(check_err_ == TENSOR_ERROR_NONE, "%s returned %s", #expr,          \
+              tensor_error_to_string(check_err_));                               \
+    } while (0)
+
+static uint64_t test_rng_state = 0x9E3779B97F4A7C15ull;
+
+static inline void test_seed(const uint64_t seed) {
+    test_rng_state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint32_t test_rand_u32(void) {
+    test_rng_state ^= test_rng_state << 13;
+    test_rng_state ^= test_rng_state >> 7;
+    test_rng_state ^= test_rng_state << 17;
+    return (uint32_t) (test_rng_state >> 32);
+}
+
+// Uniform integer in [lo, hi]
+static inline int test_rand_int(const int lo, const int hi) {
+    return lo + (int) (test_rand_u32() % (uint32_t) (hi - lo + 1));
+}
+
+// Uniform float in [-1, 1)
+static inline float test_rand_float(void) {
+    return (float) (test_rand_u32() >> 8) / (float) (1u << 23) - 1.0f;
+}
+
+static inline int64_t test_ulp_distance(const float a, const float b) {
+    if (a == b || (isnan(a) && isnan(b))) return 0;
+    if (isnan(a) || isnan(b)) return INT64_MAX;
+
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof ia);
+    memcpy(&ib, &b, sizeof ib);
+
+    // Map the sign-magnitude float encoding onto a monotonic integer line
+    const int64_t la = ia < 0 ? (int64_t) INT32_MIN - ia : ia;
+    const int64_t lb = ib < 0 ? (int64_t) INT32_MIN - ib : ib;
+    return la > lb ? la - lb : lb - la;
+}
+
+/**
+ * Accept `actual` if it is within max_ulps of the reference, or within max_ulps epsilons
+ * of `magnitude` (the sum of absolute terms that produced the reference), which keeps
+ * the tolerance meaningful for reductions where cancellation makes the result tiny
+ */
+static inline int test_close(const float actual, const double expected, const double magnitude, const int max_ulps) {
+    if (test_ulp_distance(actual, (float) expected) <= max_ulps) return 1;
+    return fabs(actual - expected) <= max_ulps * (double) FLT_EPSILON * magnitude;
+}
+
+static inline double test_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Start of a timed case, which also clears the counters reported with it
+static inline double test_timing_start(void) {
+    if (test_counters) tensor_profile_reset();
+    return test_now_ms();
+}
+
+static inline void test_report_timing(const char* kernel, const char* case_name, const double ms) {
+    printf("[timing] %s %s %s %.3f\n", test_suite, kernel, case_name, ms);
+
+    if (test_counters) {
+        static char report[16384];
+        tensor_profile_report(report, sizeof report);
+        // The first line is the column header, printed once by test_begin
+        char* line = strtok(report, "\n");
+        while ((line = strtok(NULL, "\n")) != NULL) printf("[counters] %s %s %s %s\n", test_suite, kernel, case_name, line);
+    }
+
+    const char* path = getenv("TENSOR_BENCH_OUTPUT");
+    if (path == NULL) return;
+
+    FILE* file = fopen(path, "a");
+    if (file == NULL) return;
+    fprintf(file, "%s %s %s %.3f\n", test_suite, kernel, case_name, ms);
+    fclose(file);
+}
+
+static inline void test_random_fill(const Tensor* tensor) {
+    for (int i = 0; i < tensor->length; i++) {
+        tensor->data[i] = test_rand_float();
+    }
+}
+
+static inline void test_random_tensor(Tensor* out, const int* shape, const int ndim) {
+    CHECK_OK(tensor_empty(out, shape, ndim));
+    test_random_fill(out);
+}
+
+static inline void test_unravel(int flat, const int* shape, const int ndim, int* idx) {
+    for (int d = ndim - 1; d >= 0; d--) {
+        idx[d] = flat % shape[d];
+        flat /= shape[d];
+    }
+}
+
+// Element of `tensor` read at the right-aligned broadcast index idx of an ndim-dimensional result
+static inline float test_broadcast_get(const Tensor* tensor, const int* idx, const int ndim) {
+    int offset = 0;
+    for (int i = 0; i < tensor->ndim; i++) {
+        const int j = i + ndim - tensor->ndim;
+        offset += (tensor->shape[i] == 1 ? 0 : idx[j]) * tensor->strides[i];
+    }
+    return tensor->data[offset];
+}
+
+static inline void test_begin(const char* suite, const uint64_t seed) {
+    test_suite = suite;
+    test_seed(seed);
+    test_counters = getenv("TENSOR_BENCH_COUNTERS") != NULL;
+    if (test_counters) {
+        tensor_profile_enable(true);
+        char header[128];
+        tensor_profile_report(header, sizeof header);
+        printf("[counters] %s kernel case %s\n", test_suite, strtok(header, "\n"));
+    }
+}
+
+static inline int test_finish(void) {
+    printf("%s: %d checks, %d failures\n", test_suite, test_checks, test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif //TEST_HARNESS_H
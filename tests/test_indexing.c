@@ -0,0 +1,279 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+/**
+ * Random tensor seen through a view: contiguous, with the last two dimensions transposed,
+ * or with every other element of the last dimension
+ */
+typedef struct {
+    Tensor base;
+    Tensor view;
+    int shape[MAX_DIMS];
+    int strides[MAX_DIMS];
+} Operand;
+
+static void operand_make(Operand* op, const int* shape, const int ndim) {
+    const int pattern = test_rand_int(0, 2);
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+
+    if (pattern == 1 && ndim >= 2) {
+        op->shape[ndim - 2] = shape[ndim - 1];
+        op->shape[ndim - 1] = shape[ndim - 2];
+        test_random_tensor(&op->base, op->shape, ndim);
+
+        memcpy(op->shape, shape, ndim * sizeof *shape);
+        memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+        op->strides[ndim - 2] = op->base.strides[ndim - 1];
+        op->strides[ndim - 1] = op->base.strides[ndim - 2];
+    }else if (pattern == 2) {
+        op->shape[ndim - 1] *= 2;
+        test_random_tensor(&op->base, op->shape, ndim);
+
+        op->shape[ndim - 1] = shape[ndim - 1];
+        memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+        op->strides[ndim - 1] = 2;
+    }else {
+        test_random_tensor(&op->base, shape, ndim);
+        memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+    }
+
+    op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+}
+
+static void random_index(Tensor* index, const int* shape, const int ndim, const int limit) {
+    CHECK_OK(tensor_empty(index, shape, ndim));
+    for (int i = 0; i < index->length; i++) index->data[i] = (float) test_rand_int(0, limit - 1);
+}
+
+static float* element(const Tensor* t, const int* idx) {
+    int offset = 0;
+    for (int d = 0; d < t->ndim; d++) offset += idx[d] * t->strides[d];
+    return &t->data[offset];
+}
+
+static void test_gather(void) {
+    for (int trial = 0; trial < 200; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS], index_shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        if (trial % 4 == 0) shape[ndim - 1] = test_rand_int(20, 90);
+
+        const int axis = test_rand_int(0, ndim - 1);
+        for (int d = 0; d < ndim; d++) index_shape[d] = d == axis ? test_rand_int(1, 40) : test_rand_int(1, shape[d]);
+
+        Operand in;
+        Tensor index, out;
+        operand_make(&in, shape, ndim);
+        random_index(&index, index_shape, ndim, shape[axis]);
+
+        CHECK_OK(tensor_gather(&out, &in.view, axis, &index));
+
+        int idx[MAX_DIMS];
+        int mismatches = 0;
+        for (int f = 0; f < out.length; f++) {
+            test_unravel(f, index_shape, ndim, idx);
+            const float expected_position = *element(&index, idx);
+            int src_idx[MAX_DIMS];
+            memcpy(src_idx, idx, sizeof idx);
+            src_idx[axis] = (int) expected_position;
+            mismatches += out.data[f] != *element(&in.view, src_idx);
+        }
+        CHECK(mismatches == 0, "trial %d: %d gathered values differ", trial, mismatches);
+
+        tensor_free(&out);
+        tensor_free(&index);
+        tensor_free(&in.base);
+    }
+}
+
+static void test_index_select(void) {
+    for (int trial = 0; trial < 200; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 7);
+        if (trial % 4 == 0) shape[ndim - 1] = test_rand_int(20, 90);
+
+        const int axis = test_rand_int(0, ndim - 1);
+        const int count = test_rand_int(1, 30);
+
+        Operand in;
+        Tensor index, out;
+        operand_make(&in, shape, ndim);
+        random_index(&index, &count, 1, shape[axis]);
+
+        CHECK_OK(tensor_index_select(&out, &in.view, axis, &index));
+
+        int out_shape[MAX_DIMS];
+        memcpy(out_shape, shape, sizeof shape);
+        out_shape[axis] = count;
+
+        int idx[MAX_DIMS];
+        int mismatches = 0;
+        for (int f = 0; f < out.length; f++) {
+            test_unravel(f, out_shape, ndim, idx);
+            idx[axis] = (int) index.data[idx[axis]];
+            mismatches += out.data[f] != *element(&in.view, idx);
+        }
+        CHECK(out.shape[axis] == count, "trial %d: wrong output shape", trial);
+        CHECK(mismatches == 0, "trial %d: %d selected values differ", trial, mismatches);
+
+        tensor_free(&out);
+        tensor_free(&index);
+        tensor_free(&in.base);
+    }
+}
+
+// Scatter into a copy of target at the current thread count and compare with a sequential reference
+static void check_scatter(const Tensor* target_init, const int axis, const Tensor* index, const Tensor* src,
+                          const char* label) {
+    Tensor target, expected;
+    CHECK_OK(tensor_from_data(&target, target_init->data, target_init->shape, target_init->ndim));
+    CHECK_OK(tensor_from_data(&expected, target_init->data, target_init->shape, target_init->ndim));
+
+    int idx[MAX_DIMS];
+    for (int f = 0; f < index->length; f++) {
+        test_unravel(f, index->shape, index->ndim, idx);
+        const float value = *element(src, idx);
+        idx[axis] = (int) *element(index, idx);
+        *element(&expected, idx) += value;
+    }
+
+    CHECK_OK(tensor_scatter_add(&target, axis, index, src));
+
+    // Updates to one position are added in index order, so the result is exact
+    int mismatches = 0;
+    for (int i = 0; i < target.length; i++) mismatches += target.data[i] != expected.data[i];
+    CHECK(mismatches == 0, "%s: %d scattered values differ", label, mismatches);
+
+    tensor_free(&target);
+    tensor_free(&expected);
+}
+
+static void test_scatter_add(void) {
+    for (int trial = 0; trial < 200; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS], index_shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        if (trial % 4 == 0) shape[ndim - 1] = test_rand_int(20, 300);
+
+        const int axis = test_rand_int(0, ndim - 1);
+        for (int d = 0; d < ndim; d++) index_shape[d] = d == axis ? test_rand_int(1, 40) : test_rand_int(1, shape[d]);
+
+        Operand src;
+        Tensor target, index;
+        operand_make(&src, index_shape, ndim);
+        test_random_tensor(&target, shape, ndim);
+        random_index(&index, index_shape, ndim, shape[axis]);
+
+        char label[32];
+        snprintf(label, sizeof label, "trial %d", trial);
+        check_scatter(&target, axis, &index, &src.view, label);
+
+        tensor_free(&target);
+        tensor_free(&index);
+        tensor_free(&src.base);
+    }
+
+    // A single long fiber into many bins takes the position-partitioned path
+    Tensor bins, index, src;
+    CHECK_OK(tensor_zeros(&bins, (int[]){4096}, 1));
+    random_index(&index, (int[]){200000}, 1, 4096);
+    test_random_tensor(&src, (int[]){200000}, 1);
+    check_scatter(&bins, 0, &index, &src, "histogram");
+
+    // Embedding gradient: rows of a [vocab, dim] table, one index row per token
+    Tensor table, token_grads, token_index;
+    CHECK_OK(tensor_zeros(&table, (int[]){500, 64}, 2));
+    test_random_tensor(&token_grads, (int[]){3000, 64}, 2);
+    CHECK_OK(tensor_empty(&token_index, (int[]){3000, 64}, 2));
+    for (int t = 0; t < 3000; t++) {
+        const float token = (float) test_rand_int(0, 499);
+        for (int j = 0; j < 64; j++) token_index.data[t * 64 + j] = token;
+    }
+    check_scatter(&table, 0, &token_index, &token_grads, "embedding_grad");
+
+    Tensor* all[] = {&bins, &index, &src, &table, &token_grads, &token_index};
+    for (int i = 0; i < 6; i++) tensor_free(all[i]);
+}
+
+static void test_invalid_indices(void) {
+    Tensor in, index, out;
+    test_random_tensor(&in, (int[]){4, 5}, 2);
+    CHECK_OK(tensor_from_data(&index, (float[]){0, 4, 1}, (int[]){3}, 1));
+
+    CHECK(tensor_index_select(&out, &in, 0, &index) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted index past the end");
+    CHECK(tensor_index_select(&out, &in, 2, &index) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted axis past the end");
+    index.data[1] = -1.0f;
+    CHECK(tensor_index_select(&out, &in, 1, &index) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted negative index");
+    CHECK(tensor_gather(&out, &in, 0, &index) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted index of wrong rank");
+
+    Tensor expanded;
+    CHECK_OK(tensor_expand(&expanded, &in, (int[]){2, 4, 5}, 3));
+    Tensor scatter_index, src;
+    CHECK_OK(tensor_zeros(&scatter_index, (int[]){2, 4, 5}, 3));
+    test_random_tensor(&src, (int[]){2, 4, 5}, 3);
+    CHECK(tensor_scatter_add(&expanded, 1, &scatter_index, &src) == TENSOR_ERROR_INVALID_ARGUMENT,
+          "scattered into a broadcast view");
+
+    tensor_view_free(&expanded);
+    Tensor* all[] = {&in, &index, &scatter_index, &src};
+    for (int i = 0; i < 4; i++) tensor_free(all[i]);
+}
+
+static void test_timings(void) {
+    const int vocab = 50000;
+    const int dim = 256;
+    const int tokens = 8192;
+
+    Tensor table, ids, out;
+    test_random_tensor(&table, (int[]){vocab, dim}, 2);
+    random_index(&ids, &tokens, 1, vocab);
+
+    float* expected = malloc((size_t) tokens * dim * sizeof *expected);
+    double start = test_timing_start();
+    for (int t = 0; t < tokens; t++) {
+        for (int j = 0; j < dim; j++) expected[t * dim + j] = tensor_get(&table, (int[]){(int) ids.data[t], j});
+    }
+    test_report_timing("tensor_get_loop", "embedding_8192x256", test_now_ms() - start);
+
+    start = test_timing_start();
+    CHECK_OK(tensor_index_select(&out, &table, 0, &ids));
+    test_report_timing("tensor_index_select", "embedding_8192x256", test_now_ms() - start);
+    CHECK(memcmp(out.data, expected, (size_t) tokens * dim * sizeof *expected) == 0, "embedding lookup differs");
+    tensor_free(&out);
+
+    // Gather along the last axis exercises the vector gather kernels
+    Tensor positions;
+    random_index(&positions, (int[]){64, 65536}, 2, dim);
+    Tensor rows;
+    CHECK_OK(tensor_index_select(&rows, &table, 0, &(Tensor) {1, 64, (int[]){64}, (int[]){1}, ids.data}));
+    start = test_timing_start();
+    CHECK_OK(tensor_gather(&out, &rows, 1, &positions));
+    test_report_timing("tensor_gather", "last_axis_64x65536", test_now_ms() - start);
+
+    tensor_free(&out);
+    tensor_free(&rows);
+    tensor_free(&positions);
+    tensor_free(&table);
+    tensor_free(&ids);
+    free(expected);
+}
+
+int main(void) {
+    test_begin("indexing", 33);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_gather();
+        test_index_select();
+        test_scatter_add();
+    }
+
+    tensor_set_num_threads(0);
+    test_invalid_indices();
+    test_timings();
+
+    return test_finish();
+}
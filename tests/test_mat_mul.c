@@ -0,0 +1,175 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+/**
+ * Reference product of the broadcast matrices at output batch index idx, accumulated in double
+ */
+static void reference_entry(const Tensor* a, const Tensor* b, const int* idx, const int out_ndim,
+                            const int i, const int j, const int k, double* value, double* magnitude) {
+    const int batch_ndim = out_ndim - 2;
+    int offset_a = 0;
+    int offset_b = 0;
+
+    for (int d = 0; d < a->ndim - 2; d++) {
+        const int od = d + batch_ndim - (a->ndim - 2);
+        offset_a += (a->shape[d] == 1 ? 0 : idx[od]) * a->strides[d];
+    }
+    for (int d = 0; d < b->ndim - 2; d++) {
+        const int od = d + batch_ndim - (b->ndim - 2);
+        offset_b += (b->shape[d] == 1 ? 0 : idx[od]) * b->strides[d];
+    }
+
+    if (a->ndim >= 2) offset_a += i * a->strides[a->ndim - 2];
+    if (b->ndim >= 2) offset_b += j * b->strides[b->ndim - 1];
+    const int a_k_stride = a->strides[a->ndim - 1];
+    const int b_k_stride = b->ndim >= 2 ? b->strides[b->ndim - 2] : b->strides[0];
+
+    *value = 0.0;
+    *magnitude = 0.0;
+    for (int p = 0; p < k; p++) {
+        const double term = (double) a->data[offset_a + p * a_k_stride] * b->data[offset_b + p * b_k_stride];
+        *value += term;
+        *magnitude += fabs(term);
+    }
+}
+
+static int check_against_reference(const Tensor* out, const Tensor* a, const Tensor* b, const int k) {
+    int idx[MAX_DIMS];
+    int mismatches = 0;
+
+    for (int f = 0; f < out->length; f++) {
+        test_unravel(f, out->shape, out->ndim, idx);
+        double expected, magnitude;
+        reference_entry(a, b, idx, out->ndim, idx[out->ndim - 2], idx[out->ndim - 1], k, &expected, &magnitude);
+        mismatches += !test_close(out->data[f], expected, magnitude, 4 * k);
+    }
+
+    return mismatches;
+}
+
+// Swap the last two strides so the tensor reads as the transpose of its buffer
+static Tensor transposed_view(const Tensor* base, int* shape, int* strides) {
+    memcpy(shape, base->shape, base->ndim * sizeof *shape);
+    memcpy(strides, base->strides, base->ndim * sizeof *strides);
+
+    shape[base->ndim - 2] = base->shape[base->ndim - 1];
+    shape[base->ndim - 1] = base->shape[base->ndim - 2];
+    strides[base->ndim - 2] = base->strides[base->ndim - 1];
+    strides[base->ndim - 1] = base->strides[base->ndim - 2];
+
+    return (Tensor) {base->ndim, base->length, shape, strides, base->data};
+}
+
+static void test_random_shapes(void) {
+    for (int trial = 0; trial < 300; trial++) {
+        const int m = test_rand_int(1, 40);
+        const int n = test_rand_int(1, 40);
+        const int k = test_rand_int(1, 70);
+        const int batch = test_rand_int(1, 3);
+
+        const int a_ndim = test_rand_int(1, 4);
+        const int b_ndim = test_rand_int(1, 4);
+        int a_shape[MAX_DIMS], b_shape[MAX_DIMS];
+
+        // Batch dims are right aligned, each operand independently broadcasts some of them
+        for (int d = 0; d < a_ndim - 2; d++) a_shape[d] = test_rand_int(0, 1) ? batch : 1;
+        for (int d = 0; d < b_ndim - 2; d++) b_shape[d] = test_rand_int(0, 1) ? batch : 1;
+
+        const int transpose_a = a_ndim >= 2 && test_rand_int(0, 3) == 0;
+        const int transpose_b = b_ndim >= 2 && test_rand_int(0, 3) == 0;
+
+        if (a_ndim == 1) a_shape[0] = k;
+        else if (transpose_a) {a_shape[a_ndim - 2] = k; a_shape[a_ndim - 1] = m;}
+        else {a_shape[a_ndim - 2] = m; a_shape[a_ndim - 1] = k;}
+
+        if (b_ndim == 1) b_shape[0] = k;
+        else if (transpose_b) {b_shape[b_ndim - 2] = n; b_shape[b_ndim - 1] = k;}
+        else {b_shape[b_ndim - 2] = k; b_shape[b_ndim - 1] = n;}
+
+        Tensor a_base, b_base;
+        test_random_tensor(&a_base, a_shape, a_ndim);
+        test_random_tensor(&b_base, b_shape, b_ndim);
+
+        int a_view_shape[MAX_DIMS], a_view_strides[MAX_DIMS];
+        int b_view_shape[MAX_DIMS], b_view_strides[MAX_DIMS];
+        const Tensor a = transpose_a ? transposed_view(&a_base, a_view_shape, a_view_strides) : a_base;
+        const Tensor b = transpose_b ? transposed_view(&b_base, b_view_shape, b_view_strides) : b_base;
+
+        Tensor out;
+        const TensorError err = tensor_mat_mul(&out, &a, &b);
+        CHECK(err == TENSOR_ERROR_NONE, "trial %d: %s", trial, tensor_error_to_string(err));
+
+        if (err == TENSOR_ERROR_NONE) {
+            CHECK(out.shape[out.ndim - 2] == (a_ndim == 1 ? 1 : m), "trial %d: wrong row count", trial);
+            CHECK(out.shape[out.ndim - 1] == (b_ndim == 1 ? 1 : n), "trial %d: wrong column count", trial);
+
+            const int mismatches = check_against_reference(&out, &a, &b, k);
+            CHECK(mismatches == 0, "trial %d: %d entries outside tolerance", trial, mismatches);
+            tensor_free(&out);
+        }
+
+        tensor_free(&a_base);
+        tensor_free(&b_base);
+    }
+}
+
+static void test_dimension_mismatch(void) {
+    Tensor a, b, out;
+    test_random_tensor(&a, (int[]){3, 4}, 2);
+    test_random_tensor(&b, (int[]){5, 2}, 2);
+
+    CHECK(tensor_mat_mul(&out, &a, &b) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "expected dim mismatch");
+
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void test_timings(void) {
+    const int sizes[] = {64, 256, 512};
+
+    for (int s = 0; s < 3; s++) {
+        const int size = sizes[s];
+        Tensor a, b, out;
+        test_random_tensor(&a, (int[]){size, size}, 2);
+        test_random_tensor(&b, (int[]){size, size}, 2);
+
+        const double start = test_timing_start();
+        CHECK_OK(tensor_mat_mul(&out, &a, &b));
+        const double elapsed = test_now_ms() - start;
+
+        char case_name[32];
+        snprintf(case_name, sizeof(case_name), "%dx%dx%d", size, size, size);
+        test_report_timing("tensor_mat_mul", case_name, elapsed);
+
+        // Spot check a few entries rather than paying for a full reference product
+        for (int t = 0; t < 16; t++) {
+            const int i = test_rand_int(0, size - 1);
+            const int j = test_rand_int(0, size - 1);
+            const int idx[2] = {i, j};
+            double expected, magnitude;
+            reference_entry(&a, &b, idx, 2, i, j, size, &expected, &magnitude);
+            CHECK(test_close(out.data[i * size + j], expected, magnitude, 4 * size), "%s: entry (%d,%d)", case_name, i, j);
+        }
+
+        tensor_free(&a);
+        tensor_free(&b);
+        tensor_free(&out);
+    }
+}
+
+int main(void) {
+    test_begin("mat_mul", 30);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_random_shapes();
+    }
+
+    tensor_set_num_threads(0);
+    test_dimension_mismatch();
+    test_timings();
+
+    return test_finish();
+}
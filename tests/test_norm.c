@@ -0,0 +1,231 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+/**
+ * Random tensor, optionally viewed with its last two dimensions transposed so that rows are strided
+ */
+typedef struct {
+    Tensor base;
+    Tensor view;
+    int shape[MAX_DIMS];
+    int strides[MAX_DIMS];
+} Operand;
+
+static void operand_make(Operand* op, const int* shape, const int ndim) {
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    const int transposed = ndim >= 2 && test_rand_int(0, 1);
+    if (transposed) {
+        op->shape[ndim - 2] = shape[ndim - 1];
+        op->shape[ndim - 1] = shape[ndim - 2];
+    }
+
+    // Offset values so the mean is far from zero, which is where single-pass variances lose precision
+    test_random_tensor(&op->base, op->shape, ndim);
+    for (int i = 0; i < op->base.length; i++) op->base.data[i] += 4.0f;
+
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+    if (transposed) {
+        op->strides[ndim - 2] = op->base.strides[ndim - 1];
+        op->strides[ndim - 1] = op->base.strides[ndim - 2];
+    }
+    op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+}
+
+static float element(const Tensor* t, const int* idx) {
+    int offset = 0;
+    for (int d = 0; d < t->ndim; d++) offset += idx[d] * t->strides[d];
+    return t->data[offset];
+}
+
+static void random_vector(Tensor* out, const int length, const float offset) {
+    test_random_tensor(out, &length, 1);
+    for (int i = 0; i < length; i++) out->data[i] += offset;
+}
+
+static void test_layer_and_rms_norm(void) {
+    for (int trial = 0; trial < 150; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        shape[ndim - 1] = trial % 3 == 0 ? test_rand_int(100, 700) : test_rand_int(1, 40);
+        const int d_model = shape[ndim - 1];
+
+        Operand in;
+        operand_make(&in, shape, ndim);
+        Tensor weight, bias, layer, rms;
+        random_vector(&weight, d_model, 1.0f);
+        random_vector(&bias, d_model, 0.0f);
+        const int affine = trial % 2;
+
+        CHECK_OK(tensor_layer_norm(&layer, &in.view, affine ? &weight : NULL, affine ? &bias : NULL, 1e-5f));
+        CHECK_OK(tensor_rms_norm(&rms, &in.view, affine ? &weight : NULL, 1e-6f));
+
+        int mismatches = 0;
+        int idx[MAX_DIMS];
+        for (int row = 0; row < layer.length / d_model; row++) {
+            test_unravel(row * d_model, shape, ndim, idx);
+            double sum = 0.0, squares = 0.0;
+            for (int i = 0; i < d_model; i++) {
+                idx[ndim - 1] = i;
+                const double x = element(&in.view, idx);
+                sum += x;
+                squares += x * x;
+            }
+            const double mean = sum / d_model;
+            double var = 0.0;
+            for (int i = 0; i < d_model; i++) {
+                idx[ndim - 1] = i;
+                var += (element(&in.view, idx) - mean) * (element(&in.view, idx) - mean);
+            }
+            const double rstd = 1.0 / sqrt(var / d_model + 1e-5);
+            const double rms_rstd = 1.0 / sqrt(squares / d_model + 1e-6);
+
+            for (int i = 0; i < d_model; i++) {
+                idx[ndim - 1] = i;
+                const double x = element(&in.view, idx);
+                const double w = affine ? weight.data[i] : 1.0;
+                const double expected_layer = (x - mean) * rstd * w + (affine ? bias.data[i] : 0.0);
+                const double expected_rms = x * rms_rstd * w;
+                mismatches += fabs(layer.data[row * d_model + i] - expected_layer) > 1e-4 * (1.0 + fabs(w));
+                mismatches += fabs(rms.data[row * d_model + i] - expected_rms) > 1e-5 * (1.0 + fabs(w));
+            }
+        }
+        CHECK(mismatches == 0, "trial %d: %d normalized values differ", trial, mismatches);
+
+        Tensor* all[] = {&in.base, &weight, &bias, &layer, &rms};
+        for (int i = 0; i < 5; i++) tensor_free(all[i]);
+    }
+}
+
+static void test_batch_norm(void) {
+    for (int trial = 0; trial < 100; trial++) {
+        const int ndim = test_rand_int(2, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 7);
+        const TensorLayout layout = trial % 2 ? TENSOR_LAYOUT_NHWC : TENSOR_LAYOUT_NCHW;
+        const int axis = layout == TENSOR_LAYOUT_NCHW ? 1 : ndim - 1;
+        const int channels = shape[axis];
+
+        Operand in;
+        operand_make(&in, shape, ndim);
+        Tensor mean, var, weight, bias, out;
+        random_vector(&mean, channels, 4.0f);
+        random_vector(&var, channels, 2.0f);
+        random_vector(&weight, channels, 1.0f);
+        random_vector(&bias, channels, 0.0f);
+        const int affine = trial % 3 != 0;
+
+        CHECK_OK(tensor_batch_norm(&out, &in.view, &mean, &var, affine ? &weight : NULL, affine ? &bias : NULL, 1e-3f, layout));
+
+        int mismatches = 0;
+        int idx[MAX_DIMS];
+        for (int f = 0; f < out.length; f++) {
+            test_unravel(f, shape, ndim, idx);
+            const int c = idx[axis];
+            const double w = affine ? weight.data[c] : 1.0;
+            const double expected = (element(&in.view, idx) - mean.data[c]) / sqrt(var.data[c] + 1e-3) * w
+                                  + (affine ? bias.data[c] : 0.0);
+            mismatches += fabs(out.data[f] - expected) > 1e-5 * (1.0 + fabs(w) * 8);
+        }
+        CHECK(mismatches == 0, "trial %d: %d normalized values differ", trial, mismatches);
+
+        Tensor* all[] = {&in.base, &mean, &var, &weight, &bias, &out};
+        for (int i = 0; i < 6; i++) tensor_free(all[i]);
+    }
+}
+
+static void test_invalid_arguments(void) {
+    Tensor in, short_weight, out;
+    test_random_tensor(&in, (int[]){3, 8}, 2);
+    random_vector(&short_weight, 7, 0.0f);
+
+    CHECK(tensor_layer_norm(&out, &in, &short_weight, NULL, 1e-5f) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted weight of wrong length");
+    CHECK(tensor_rms_norm(&out, &in, &short_weight, 1e-5f) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted weight of wrong length");
+    CHECK(tensor_batch_norm(&out, &in, &short_weight, &short_weight, NULL, NULL, 1e-5f, TENSOR_LAYOUT_NCHW)
+          == TENSOR_ERROR_INPUT_DIM_MISMATCH, "accepted statistics of wrong length");
+    CHECK(tensor_batch_norm(&out, &in, NULL, NULL, NULL, NULL, 1e-5f, TENSOR_LAYOUT_NHWC) == TENSOR_ERROR_INVALID_ARGUMENT,
+          "accepted missing statistics");
+
+    tensor_free(&in);
+    tensor_free(&short_weight);
+}
+
+// Transformer-sized activations: the fused kernels against the separate passes they replace
+static void test_timings(void) {
+    const int rows = 2048, d_model = 1024;
+    Tensor in, weight, bias;
+    test_random_tensor(&in, (int[]){rows, d_model}, 2);
+    random_vector(&weight, d_model, 1.0f);
+    random_vector(&bias, d_model, 0.0f);
+
+    Tensor results[2][2];
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        char case_name[32];
+        snprintf(case_name, sizeof case_name, "2048x1024_t%d", thread_counts[t]);
+
+        double start = test_timing_start();
+        CHECK_OK(tensor_layer_norm(&results[t][0], &in, &weight, &bias, 1e-5f));
+        test_report_timing("tensor_layer_norm", case_name, test_now_ms() - start);
+
+        start = test_timing_start();
+        CHECK_OK(tensor_rms_norm(&results[t][1], &in, &weight, 1e-5f));
+        test_report_timing("tensor_rms_norm", case_name, test_now_ms() - start);
+    }
+    tensor_set_num_threads(0);
+
+    for (int r = 0; r < 2; r++) {
+        CHECK(memcmp(results[0][r].data, results[1][r].data, results[0][r].length * sizeof(float)) == 0,
+              "result %d depends on the thread count", r);
+    }
+
+    // Mean, variance, normalize and affine as separate sweeps over the whole tensor
+    float* means = malloc(rows * sizeof *means);
+    float* rstds = malloc(rows * sizeof *rstds);
+    float* unfused = malloc((size_t) rows * d_model * sizeof *unfused);
+    const double start = test_timing_start();
+    for (int r = 0; r < rows; r++) {
+        float sum = 0.0f;
+        for (int i = 0; i < d_model; i++) sum += in.data[r * d_model + i];
+        means[r] = sum / d_model;
+    }
+    for (int r = 0; r < rows; r++) {
+        float sum = 0.0f;
+        for (int i = 0; i < d_model; i++) sum += (in.data[r * d_model + i] - means[r]) * (in.data[r * d_model + i] - means[r]);
+        rstds[r] = 1.0f / sqrtf(sum / d_model + 1e-5f);
+    }
+    for (int f = 0; f < rows * d_model; f++) unfused[f] = (in.data[f] - means[f / d_model]) * rstds[f / d_model];
+    for (int f = 0; f < rows * d_model; f++) unfused[f] = unfused[f] * weight.data[f % d_model] + bias.data[f % d_model];
+    test_report_timing("separate_passes", "2048x1024", test_now_ms() - start);
+
+    free(means);
+    free(rstds);
+    free(unfused);
+    for (int t = 0; t < 2; t++) {
+        tensor_free(&results[t][0]);
+        tensor_free(&results[t][1]);
+    }
+    tensor_free(&in);
+    tensor_free(&weight);
+    tensor_free(&bias);
+}
+
+int main(void) {
+    test_begin("norm", 38);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_layer_and_rms_norm();
+        test_batch_norm();
+    }
+
+    tensor_set_num_threads(0);
+    test_invalid_arguments();
+    test_timings();
+
+    return test_finish();
+}
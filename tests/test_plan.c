@@ -0,0 +1,187 @@
+#include "tensor_plan.h"
+#include "test_harness.h"
+
+#define CHAIN_LENGTH 12
+
+static int count_mismatches(const Tensor* actual, const Tensor* expected) {
+    if (actual->length != expected->length) return actual->length + expected->length;
+    int mismatches = 0;
+    for (int i = 0; i < actual->length; i++) mismatches += actual->data[i] != expected->data[i];
+    return mismatches;
+}
+
+typedef struct {
+    Tensor x;       //< [8,16]
+    Tensor w1;      //< [16,32]
+    Tensor b1;      //< [32]
+    Tensor w2;      //< [32,16]
+    Tensor image;   //< [2,3,12,12]
+    Tensor kernel;  //< [4,3,3,3]
+    Tensor bias;    //< [4]
+} Inputs;
+
+/**
+ * mlp = ((x @ w1 + expand(b1))^2) @ w2 - x
+ * conv = conv2d(image) * conv2d(image) + conv2d(image)
+ */
+static void run_direct(Tensor* mlp, Tensor* conv, const Inputs* in, const TensorConv2dParams* params) {
+    Tensor h, b_expanded, hb, sq, h2, c;
+    CHECK_OK(tensor_mat_mul(&h, &in->x, &in->w1));
+    CHECK_OK(tensor_expand(&b_expanded, &in->b1, (int[]){8, 32}, 2));
+    CHECK_OK(tensor_add(&hb, &h, &b_expanded));
+    CHECK_OK(tensor_mul(&sq, &hb, &hb));
+    CHECK_OK(tensor_mat_mul(&h2, &sq, &in->w2));
+    CHECK_OK(tensor_sub(mlp, &h2, &in->x));
+
+    Tensor c2;
+    CHECK_OK(tensor_conv2d(&c, &in->image, &in->kernel, &in->bias, params));
+    CHECK_OK(tensor_mul(&c2, &c, &c));
+    CHECK_OK(tensor_add(conv, &c2, &c));
+
+    Tensor* temps[] = {&h, &hb, &sq, &h2, &c, &c2};
+    for (int i = 0; i < 6; i++) tensor_free(temps[i]);
+    tensor_view_free(&b_expanded);
+}
+
+static void test_matches_direct_ops(void) {
+    Inputs in;
+    test_random_tensor(&in.x, (int[]){8, 16}, 2);
+    test_random_tensor(&in.w1, (int[]){16, 32}, 2);
+    test_random_tensor(&in.b1, (int[]){32}, 1);
+    test_random_tensor(&in.w2, (int[]){32, 16}, 2);
+    test_random_tensor(&in.image, (int[]){2, 3, 12, 12}, 4);
+    test_random_tensor(&in.kernel, (int[]){4, 3, 3, 3}, 4);
+    test_random_tensor(&in.bias, (int[]){4}, 1);
+    const TensorConv2dParams params = {1, 1, 1, 1, 1, 1, 1, TENSOR_LAYOUT_NCHW};
+
+    TensorPlan* plan;
+    CHECK_OK(tensor_plan_create(&plan));
+
+    Tensor h, b_expanded, hb, sq, h2, mlp, c, c2, conv;
+    CHECK_OK(tensor_plan_mat_mul(plan, &h, &in.x, &in.w1));
+    CHECK_OK(tensor_plan_expand(plan, &b_expanded, &in.b1, (int[]){8, 32}, 2));
+    CHECK_OK(tensor_plan_add(plan, &hb, &h, &b_expanded));
+    CHECK_OK(tensor_plan_mul(plan, &sq, &hb, &hb));
+    CHECK_OK(tensor_plan_mat_mul(plan, &h2, &sq, &in.w2));
+    CHECK_OK(tensor_plan_sub(plan, &mlp, &h2, &in.x));
+    CHECK_OK(tensor_plan_conv2d(plan, &c, &in.image, &in.kernel, &in.bias, &params));
+    CHECK_OK(tensor_plan_mul(plan, &c2, &c, &c));
+    CHECK_OK(tensor_plan_add(plan, &conv, &c2, &c));
+    CHECK_OK(tensor_plan_mark_output(plan, &mlp));
+    CHECK_OK(tensor_plan_mark_output(plan, &conv));
+
+    CHECK(tensor_plan_execute(plan) == TENSOR_ERROR_INVALID_ARGUMENT, "executed before compiling");
+    CHECK_OK(tensor_plan_compile(plan));
+
+    Tensor late;
+    CHECK(tensor_plan_add(plan, &late, &in.x, &in.x) == TENSOR_ERROR_INVALID_ARGUMENT, "recorded after compiling");
+
+    // Inputs are read in place, so refilling them between executes must be picked up
+    for (int step = 0; step < 3; step++) {
+        CHECK_OK(tensor_plan_execute(plan));
+
+        Tensor expected_mlp, expected_conv;
+        run_direct(&expected_mlp, &expected_conv, &in, &params);
+        CHECK(count_mismatches(&mlp, &expected_mlp) == 0, "step %d: mlp output differs", step);
+        CHECK(count_mismatches(&conv, &expected_conv) == 0, "step %d: conv output differs", step);
+        tensor_free(&expected_mlp);
+        tensor_free(&expected_conv);
+
+        test_random_fill(&in.x);
+        test_random_fill(&in.image);
+    }
+
+    size_t unplanned = 0;
+    const Tensor* results[] = {&h, &hb, &sq, &h2, &mlp, &c, &c2, &conv};
+    for (int i = 0; i < 8; i++) unplanned += results[i]->length * sizeof(float);
+    CHECK(tensor_plan_slab_bytes(plan) < unplanned, "slab %zu bytes, unplanned %zu", tensor_plan_slab_bytes(plan), unplanned);
+
+    tensor_plan_destroy(plan);
+    CHECK(mlp.data == NULL && mlp.shape == NULL, "destroy left a result behind");
+
+    Tensor* all[] = {&in.x, &in.w1, &in.b1, &in.w2, &in.image, &in.kernel, &in.bias};
+    for (int i = 0; i < 7; i++) tensor_free(all[i]);
+}
+
+static void test_chain_reuses_memory(void) {
+    const int shape[] = {256, 256};
+    Tensor a, b;
+    test_random_tensor(&a, shape, 2);
+    test_random_tensor(&b, shape, 2);
+
+    TensorPlan* plan;
+    CHECK_OK(tensor_plan_create(&plan));
+
+    Tensor steps[CHAIN_LENGTH];
+    CHECK_OK(tensor_plan_add(plan, &steps[0], &a, &b));
+    for (int i = 1; i < CHAIN_LENGTH; i++) {
+        CHECK_OK(i % 2 ? tensor_plan_mul(plan, &steps[i], &steps[i - 1], &b)
+                       : tensor_plan_sub(plan, &steps[i], &steps[i - 1], &a));
+    }
+    CHECK_OK(tensor_plan_mark_output(plan, &steps[CHAIN_LENGTH - 1]));
+    CHECK_OK(tensor_plan_compile(plan));
+
+    // Only a step and its predecessor are ever live at once
+    const size_t step_bytes = a.length * sizeof(float);
+    CHECK(tensor_plan_slab_bytes(plan) == 2 * step_bytes, "slab is %zu bytes", tensor_plan_slab_bytes(plan));
+    int misaligned = 0;
+    for (int i = 0; i < CHAIN_LENGTH; i++) misaligned += (uintptr_t) steps[i].data % 64 != 0;
+    CHECK(misaligned == 0, "%d planned buffers do not start on a cache line", misaligned);
+
+    double start = test_timing_start();
+    CHECK_OK(tensor_plan_execute(plan));
+    test_report_timing("tensor_plan_execute", "chain_256x256", test_now_ms() - start);
+
+    Tensor expected, next;
+    start = test_timing_start();
+    CHECK_OK(tensor_add(&expected, &a, &b));
+    for (int i = 1; i < CHAIN_LENGTH; i++) {
+        CHECK_OK(i % 2 ? tensor_mul(&next, &expected, &b) : tensor_sub(&next, &expected, &a));
+        tensor_free(&expected);
+        expected = next;
+    }
+    test_report_timing("direct_ops", "chain_256x256", test_now_ms() - start);
+
+    CHECK(count_mismatches(&steps[CHAIN_LENGTH - 1], &expected) == 0, "chain output differs");
+
+    tensor_free(&expected);
+    tensor_plan_destroy(plan);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void test_invalid_recordings(void) {
+    Tensor a, b, out, again;
+    test_random_tensor(&a, (int[]){3, 4}, 2);
+    test_random_tensor(&b, (int[]){3, 5}, 2);
+
+    TensorPlan* plan;
+    CHECK_OK(tensor_plan_create(&plan));
+    CHECK(tensor_plan_add(plan, &out, &a, &b) == TENSOR_ERROR_CANNOT_BROADCAST, "expected broadcast failure");
+    CHECK(tensor_plan_mat_mul(plan, &out, &a, &b) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "expected mismatch");
+
+    CHECK_OK(tensor_plan_add(plan, &out, &a, &a));
+    CHECK(tensor_plan_add(plan, &out, &a, &a) == TENSOR_ERROR_INVALID_ARGUMENT, "recorded the same handle twice");
+    CHECK(tensor_plan_mark_output(plan, &a) == TENSOR_ERROR_INVALID_ARGUMENT, "marked an input as output");
+    CHECK_OK(tensor_plan_add(plan, &again, &out, &out));
+
+    tensor_plan_destroy(plan);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+int main(void) {
+    test_begin("plan", 32);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_matches_direct_ops();
+    }
+
+    tensor_set_num_threads(0);
+    test_chain_reuses_memory();
+    test_invalid_recordings();
+
+    return test_finish();
+}
@@ -0,0 +1,172 @@
+#include "test_harness.h"
+#include "tensor_plan.h"
+#include "tensor_profile.h"
+#include "tensor_tape.h"
+
+static const TensorProfileEntry* find_entry(const TensorProfileEntry* entries, const int count, const char* op) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].op, op) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+static void test_disabled_records_nothing(void) {
+    Tensor a, b, out;
+    test_random_tensor(&a, (int[]){16, 16}, 2);
+    test_random_tensor(&b, (int[]){16, 16}, 2);
+    CHECK_OK(tensor_add(&out, &a, &b));
+    tensor_free(&out);
+
+    TensorProfileEntry entries[8];
+    CHECK(tensor_profile_snapshot(entries, 8) == 0, "recorded an op before profiling was enabled");
+
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void test_counts_calls(const int threads) {
+    tensor_set_num_threads(threads);
+    tensor_profile_reset();
+    tensor_profile_enable(true);
+
+    Tensor a, b, sum, product;
+    test_random_tensor(&a, (int[]){256, 256}, 2);
+    test_random_tensor(&b, (int[]){256, 256}, 2);
+    for (int i = 0; i < 3; i++) {
+        CHECK_OK(tensor_add(&sum, &a, &b));
+        tensor_free(&sum);
+    }
+    CHECK_OK(tensor_mat_mul(&product, &a, &b));
+    tensor_free(&product);
+
+    // Failed calls are recorded too
+    Tensor wrong;
+    test_random_tensor(&wrong, (int[]){3, 5}, 2);
+    CHECK(tensor_mat_mul(&product, &a, &wrong) != TENSOR_ERROR_NONE, "multiplied mismatched shapes");
+
+    tensor_profile_enable(false);
+    CHECK_OK(tensor_add(&sum, &a, &b));
+    tensor_free(&sum);
+
+    TensorProfileEntry entries[8];
+    const int count = tensor_profile_snapshot(entries, 8);
+    CHECK(count == 2, "threads %d: %d ops recorded", threads, count);
+
+    const TensorProfileEntry* add = find_entry(entries, count, "tensor_add");
+    const TensorProfileEntry* mat_mul = find_entry(entries, count, "tensor_mat_mul");
+    CHECK(add && add->calls == 3, "threads %d: tensor_add calls", threads);
+    CHECK(mat_mul && mat_mul->calls == 2, "threads %d: tensor_mat_mul calls", threads);
+    CHECK(mat_mul && mat_mul->ms > 0.0, "threads %d: tensor_mat_mul time", threads);
+
+    // Only the counters that could be opened are non-zero, and those that were count every call
+    const unsigned available = tensor_profile_counters_available();
+    for (int c = 0; c < TENSOR_COUNTER_COUNT; c++) {
+        const int has = (available >> c & 1u) != 0;
+        if (mat_mul && (c == TENSOR_COUNTER_CYCLES || c == TENSOR_COUNTER_INSTRUCTIONS || !has)) {
+            CHECK((mat_mul->counters[c] != 0) == has, "threads %d: counter %d is %llu with availability %d",
+                  threads, c, (unsigned long long) mat_mul->counters[c], has);
+        }
+    }
+
+    tensor_free(&a);
+    tensor_free(&b);
+    tensor_free(&wrong);
+}
+
+// The tape records through the public ops, and its backward pass calls tensor_mat_mul and accumulates once per input
+static void test_tape_ops(void) {
+    tensor_profile_reset();
+    tensor_profile_enable(true);
+
+    Tensor a, b, product;
+    test_random_tensor(&a, (int[]){8, 4}, 2);
+    test_random_tensor(&b, (int[]){4, 6}, 2);
+
+    TensorTape* tape;
+    CHECK_OK(tensor_tape_create(&tape));
+    CHECK_OK(tensor_tape_mat_mul(tape, &product, &a, &b));
+    CHECK_OK(tensor_tape_backward(tape, &product, NULL));
+    tensor_tape_destroy(tape);
+    tensor_profile_enable(false);
+
+    TensorProfileEntry entries[8];
+    const int count = tensor_profile_snapshot(entries, 8);
+    const TensorProfileEntry* mat_mul = find_entry(entries, count, "tensor_mat_mul");
+    CHECK(mat_mul && mat_mul->calls == 3, "tape mat_mul calls: %llu", mat_mul ? (unsigned long long) mat_mul->calls : 0ull);
+    const TensorProfileEntry* accumulate = find_entry(entries, count, "tensor_tape_accumulate_grad");
+    CHECK(accumulate && accumulate->calls == 2, "tape accumulate calls: %llu",
+          accumulate ? (unsigned long long) accumulate->calls : 0ull);
+
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+// Planned runs never reach the public ops, so each planned op is recorded under its own name
+static void test_plan_ops(void) {
+    Tensor a, b, sum, product;
+    test_random_tensor(&a, (int[]){8, 8}, 2);
+    test_random_tensor(&b, (int[]){8, 8}, 2);
+
+    TensorPlan* plan;
+    CHECK_OK(tensor_plan_create(&plan));
+    CHECK_OK(tensor_plan_add(plan, &sum, &a, &b));
+    CHECK_OK(tensor_plan_mat_mul(plan, &product, &sum, &b));
+    CHECK_OK(tensor_plan_mark_output(plan, &product));
+    CHECK_OK(tensor_plan_compile(plan));
+
+    tensor_profile_reset();
+    tensor_profile_enable(true);
+    for (int i = 0; i < 2; i++) CHECK_OK(tensor_plan_execute(plan));
+    tensor_profile_enable(false);
+
+    TensorProfileEntry entries[8];
+    const int count = tensor_profile_snapshot(entries, 8);
+    const TensorProfileEntry* add = find_entry(entries, count, "tensor_plan_add");
+    const TensorProfileEntry* mat_mul = find_entry(entries, count, "tensor_plan_mat_mul");
+    CHECK(count == 2 && add && add->calls == 2 && mat_mul && mat_mul->calls == 2, "planned ops not recorded");
+
+    tensor_plan_destroy(plan);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void test_report(void) {
+    tensor_profile_reset();
+    char buffer[512];
+    CHECK(tensor_profile_report(buffer, sizeof buffer) == strlen(buffer), "empty report length");
+    CHECK(strncmp(buffer, "op calls ms", 11) == 0, "report header: %s", buffer);
+
+    tensor_profile_enable(true);
+    Tensor in, sorted;
+    test_random_tensor(&in, (int[]){64}, 1);
+    CHECK_OK(tensor_sort(&sorted, &in, 0, false));
+    tensor_free(&sorted);
+    tensor_profile_enable(false);
+
+    const size_t length = tensor_profile_report(buffer, sizeof buffer);
+    CHECK(length == strlen(buffer), "report length %zu", length);
+    CHECK(strstr(buffer, "\ntensor_sort 1 ") != NULL, "report lacks the sort line: %s", buffer);
+
+    // Truncation still reports the full length
+    char small[8];
+    CHECK(tensor_profile_report(small, sizeof small) == length && strlen(small) == sizeof small - 1,
+          "truncated report");
+
+    tensor_free(&in);
+}
+
+int main(void) {
+    test_begin("profile", 41);
+    if (getenv("TENSOR_BENCH_COUNTERS") == NULL) test_disabled_records_nothing();
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) test_counts_calls(thread_counts[t]);
+
+    tensor_set_num_threads(0);
+    test_tape_ops();
+    test_plan_ops();
+    test_report();
+
+    tensor_profile_reset();
+    return test_finish();
+}
@@ -0,0 +1,169 @@
+#include "test_harness.h"
+
+#define LARGE_LENGTH 1000037
+
+/**
+ * Reference Philox4x32-10 block. Element e of a tensor comes from block (e / 256) * 64 + e % 64,
+ * word (e % 256) / 64
+ */
+static void philox_reference(uint32_t out[4], const uint32_t block, const uint64_t seed) {
+    uint32_t c[4] = {block, 0, 0, 0};
+    uint32_t k0 = (uint32_t) seed, k1 = (uint32_t) (seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        const uint64_t p0 = (uint64_t) 0xD2511F53u * c[0];
+        const uint64_t p1 = (uint64_t) 0xCD9E8D57u * c[2];
+        const uint32_t next[4] = {(uint32_t) (p1 >> 32) ^ c[1] ^ k0, (uint32_t) p1, (uint32_t) (p0 >> 32) ^ c[3] ^ k1, (uint32_t) p0};
+        memcpy(c, next, sizeof c);
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    memcpy(out, c, sizeof c);
+}
+
+static uint32_t reference_word(const int element, const uint64_t seed) {
+    uint32_t words[4];
+    philox_reference(words, (uint32_t) (element / 256 * 64 + element % 64), seed);
+    return words[element % 256 / 64];
+}
+
+static void test_known_answer(void) {
+    // Published Philox4x32-10 vector for a zero counter and key
+    uint32_t words[4];
+    philox_reference(words, 0, 0);
+    CHECK(words[0] == 0x6627E8D5u && words[1] == 0xE169C58Du && words[2] == 0xBC57AC4Cu && words[3] == 0x9B00DBD8u,
+          "reference generator disagrees with the published vector");
+
+    Tensor u;
+    CHECK_OK(tensor_rand_uniform(&u, 0.0f, 1.0f, 0, (int[]){3, 333}, 2));
+    int mismatches = 0;
+    for (int e = 0; e < u.length; e++) {
+        mismatches += u.data[e] != (float) (reference_word(e, 0) >> 8) * 0x1p-24f;
+    }
+    CHECK(mismatches == 0, "%d uniform values differ from the reference generator", mismatches);
+    tensor_free(&u);
+}
+
+static void test_normal_matches_box_muller(void) {
+    const uint64_t seed = 0x0123456789ABCDEFull;
+    Tensor z;
+    CHECK_OK(tensor_rand_normal(&z, 0.5f, 2.0f, seed, (int[]){4001}, 1));
+
+    int mismatches = 0;
+    for (int e = 0; e < z.length; e++) {
+        const int pair = e % 256 / 128 * 128 + e % 64;
+        const int batch = e / 256 * 256;
+        const uint32_t radius_word = reference_word(batch + pair, seed);
+        const uint32_t angle_word = reference_word(batch + pair + 64, seed);
+
+        const double u = ((radius_word >> 9) + 0.5) / 8388608.0;
+        const double phi = ((angle_word >> 8 & 0x3FFFFF) / 4194304.0 - 0.5) * 1.5707963267948966;
+        const double theta = (angle_word >> 30) * 1.5707963267948966 + phi;
+        const double radius = sqrt(-2.0 * log(u));
+        const double expected = 0.5 + 2.0 * radius * (e % 128 < 64 ? cos(theta) : sin(theta));
+        mismatches += fabs(z.data[e] - expected) > 1e-5 * (1.0 + 2.0 * radius);
+    }
+    CHECK(mismatches == 0, "%d normal values differ from the double precision transform", mismatches);
+    tensor_free(&z);
+}
+
+static void test_distributions(void) {
+    Tensor u, z;
+    CHECK_OK(tensor_rand_uniform(&u, -2.0f, 3.0f, 7, (int[]){LARGE_LENGTH}, 1));
+    CHECK_OK(tensor_rand_normal(&z, 1.0f, 0.25f, 7, (int[]){LARGE_LENGTH}, 1));
+
+    double u_sum = 0.0, u_sq = 0.0, z_sum = 0.0, z_sq = 0.0;
+    int out_of_range = 0, beyond_six_sigma = 0;
+    for (int i = 0; i < LARGE_LENGTH; i++) {
+        out_of_range += !(u.data[i] >= -2.0f && u.data[i] < 3.0f);
+        u_sum += u.data[i];
+        u_sq += (double) u.data[i] * u.data[i];
+
+        const double d = z.data[i] - 1.0;
+        beyond_six_sigma += fabs(d) > 6 * 0.25;
+        z_sum += d;
+        z_sq += d * d;
+    }
+
+    const double n = LARGE_LENGTH;
+    const double u_mean = u_sum / n, u_var = u_sq / n - u_mean * u_mean;
+    const double z_mean = z_sum / n, z_var = z_sq / n - z_mean * z_mean;
+    CHECK(out_of_range == 0, "%d uniform values outside [low, high)", out_of_range);
+    CHECK(fabs(u_mean - 0.5) < 0.01 && fabs(u_var - 25.0 / 12.0) < 0.01, "uniform mean %f variance %f", u_mean, u_var);
+    CHECK(fabs(z_mean) < 0.001 && fabs(z_var - 0.0625) < 0.001, "normal mean %f variance %f", z_mean + 1.0, z_var);
+    CHECK(beyond_six_sigma < 5, "%d normal values beyond six sigma", beyond_six_sigma);
+
+    tensor_free(&u);
+    tensor_free(&z);
+}
+
+static void test_reproducible(void) {
+    Tensor results[2][3];
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        char case_name[32];
+        snprintf(case_name, sizeof case_name, "1000037_t%d", thread_counts[t]);
+
+        double start = test_timing_start();
+        CHECK_OK(tensor_rand_uniform(&results[t][0], 0.0f, 1.0f, 42, (int[]){LARGE_LENGTH}, 1));
+        test_report_timing("tensor_rand_uniform", case_name, test_now_ms() - start);
+
+        start = test_timing_start();
+        CHECK_OK(tensor_rand_normal(&results[t][1], 0.0f, 1.0f, 42, (int[]){LARGE_LENGTH}, 1));
+        test_report_timing("tensor_rand_normal", case_name, test_now_ms() - start);
+
+        CHECK_OK(tensor_rand_normal(&results[t][2], 0.0f, 1.0f, 43, (int[]){LARGE_LENGTH}, 1));
+    }
+
+    for (int r = 0; r < 3; r++) {
+        CHECK(memcmp(results[0][r].data, results[1][r].data, LARGE_LENGTH * sizeof(float)) == 0,
+              "result %d depends on the thread count", r);
+    }
+    int equal = 0;
+    for (int i = 0; i < LARGE_LENGTH; i++) equal += results[0][1].data[i] == results[0][2].data[i];
+    CHECK(equal < 100, "seeds 42 and 43 share %d values", equal);
+
+    // A shorter tensor is a prefix of a longer one from the same seed
+    Tensor prefix;
+    CHECK_OK(tensor_rand_normal(&prefix, 0.0f, 1.0f, 42, (int[]){7, 11, 13}, 3));
+    CHECK(memcmp(prefix.data, results[0][1].data, prefix.length * sizeof(float)) == 0, "prefix differs");
+    tensor_free(&prefix);
+
+    // Baseline: the C library generator, one element at a time
+    float* baseline = malloc(LARGE_LENGTH * sizeof *baseline);
+    srand(42);
+    const double start = test_timing_start();
+    for (int i = 0; i < LARGE_LENGTH; i++) baseline[i] = (float) rand() / ((float) RAND_MAX + 1.0f);
+    test_report_timing("rand_loop", "1000037", test_now_ms() - start);
+    free(baseline);
+
+    for (int t = 0; t < 2; t++) {
+        for (int r = 0; r < 3; r++) tensor_free(&results[t][r]);
+    }
+    tensor_set_num_threads(0);
+}
+
+static void test_invalid_arguments(void) {
+    Tensor out;
+    CHECK(tensor_rand_uniform(&out, 1.0f, 1.0f, 0, (int[]){4}, 1) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted low == high");
+    CHECK(tensor_rand_uniform(&out, -FLT_MAX, FLT_MAX, 0, (int[]){4}, 1) == TENSOR_ERROR_INVALID_ARGUMENT,
+          "accepted an infinite range");
+    CHECK(tensor_rand_normal(&out, 0.0f, -1.0f, 0, (int[]){4}, 1) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted negative std");
+    CHECK(tensor_rand_normal(&out, NAN, 1.0f, 0, (int[]){4}, 1) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted NaN mean");
+
+    CHECK_OK(tensor_rand_normal(&out, 3.0f, 0.0f, 0, (int[]){4}, 1));
+    CHECK(out.data[0] == 3.0f && out.data[3] == 3.0f, "zero std did not return the mean");
+    tensor_free(&out);
+}
+
+int main(void) {
+    test_begin("random", 35);
+
+    test_known_answer();
+    test_normal_matches_box_muller();
+    test_distributions();
+    test_reproducible();
+    test_invalid_arguments();
+
+    return test_finish();
+}
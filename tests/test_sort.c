@@ -0,0 +1,261 @@
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+/**
+ * Random tensor, optionally viewed with its last two dimensions transposed. Values are drawn from
+ * a small set now and then so that ties are common
+ */
+typedef struct {
+    Tensor base;
+    Tensor view;
+    int shape[MAX_DIMS];
+    int strides[MAX_DIMS];
+} Operand;
+
+static void operand_make(Operand* op, const int* shape, const int ndim, const int with_ties) {
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    const int transposed = ndim >= 2 && test_rand_int(0, 1);
+    if (transposed) {
+        op->shape[ndim - 2] = shape[ndim - 1];
+        op->shape[ndim - 1] = shape[ndim - 2];
+    }
+
+    test_random_tensor(&op->base, op->shape, ndim);
+    if (with_ties) {
+        for (int i = 0; i < op->base.length; i++) op->base.data[i] = (float) test_rand_int(-3, 3);
+    }
+
+    memcpy(op->shape, shape, ndim * sizeof *shape);
+    memcpy(op->strides, op->base.strides, ndim * sizeof *shape);
+    if (transposed) {
+        op->strides[ndim - 2] = op->base.strides[ndim - 1];
+        op->strides[ndim - 1] = op->base.strides[ndim - 2];
+    }
+    op->view = (Tensor) {ndim, op->base.length, op->shape, op->strides, op->base.data};
+}
+
+// Offsets of lane `lane` (every position except the axis) in a tensor with the given strides
+static int lane_base(int lane, const int* shape, const int* strides, const int ndim, const int axis) {
+    int offset = 0;
+    for (int d = ndim - 1; d >= 0; d--) {
+        if (d == axis) continue;
+        offset += lane % shape[d] * strides[d];
+        lane /= shape[d];
+    }
+    return offset;
+}
+
+// Strict ordering used by the library: ascending value, then ascending position
+static int ranks_before(const float x, const int i, const float y, const int j, const int descending) {
+    if (x != y) return descending ? x > y : x < y;
+    return i < j;
+}
+
+static void test_cumsum(void) {
+    for (int trial = 0; trial < 150; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        const int axis = test_rand_int(0, ndim - 1);
+        if (trial % 3 == 0) shape[axis] = test_rand_int(50, 400);
+
+        Operand in;
+        Tensor out;
+        operand_make(&in, shape, ndim, 0);
+        CHECK_OK(tensor_cumsum(&out, &in.view, axis));
+
+        const int n = shape[axis];
+        const int lanes = in.view.length / n;
+        int mismatches = 0;
+        for (int lane = 0; lane < lanes; lane++) {
+            const int in_offset = lane_base(lane, shape, in.strides, ndim, axis);
+            const int out_offset = lane_base(lane, shape, out.strides, ndim, axis);
+            double sum = 0.0, magnitude = 0.0;
+            for (int i = 0; i < n; i++) {
+                const float x = in.base.data[in_offset + i * in.strides[axis]];
+                sum += x;
+                magnitude += fabs(x);
+                mismatches += !test_close(out.data[out_offset + i * out.strides[axis]], sum, magnitude, 2 * n);
+            }
+        }
+        CHECK(mismatches == 0, "trial %d: %d prefix sums differ", trial, mismatches);
+
+        tensor_free(&out);
+        tensor_free(&in.base);
+    }
+}
+
+static void test_sort_and_argsort(void) {
+    for (int trial = 0; trial < 200; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        const int axis = test_rand_int(0, ndim - 1);
+        if (trial % 3 == 0) shape[axis] = test_rand_int(20, 300);
+        const int descending = test_rand_int(0, 1);
+
+        Operand in;
+        Tensor sorted, order;
+        operand_make(&in, shape, ndim, trial % 2);
+        CHECK_OK(tensor_sort(&sorted, &in.view, axis, descending));
+        CHECK_OK(tensor_argsort(&order, &in.view, axis, descending));
+
+        const int n = shape[axis];
+        const int lanes = in.view.length / n;
+        int mismatches = 0;
+        for (int lane = 0; lane < lanes; lane++) {
+            const int in_offset = lane_base(lane, shape, in.strides, ndim, axis);
+            const int out_offset = lane_base(lane, shape, sorted.strides, ndim, axis);
+            const float* src = &in.base.data[in_offset];
+            const int stride = in.strides[axis];
+            const int out_stride = sorted.strides[axis];
+
+            for (int i = 0; i < n; i++) {
+                const int position = (int) order.data[out_offset + i * out_stride];
+                mismatches += sorted.data[out_offset + i * out_stride] != src[position * stride];
+                if (i == 0) continue;
+                const int previous = (int) order.data[out_offset + (i - 1) * out_stride];
+                mismatches += !ranks_before(src[previous * stride], previous, src[position * stride], position, descending);
+            }
+        }
+        CHECK(mismatches == 0, "trial %d: %d entries out of order", trial, mismatches);
+
+        tensor_free(&sorted);
+        tensor_free(&order);
+        tensor_free(&in.base);
+    }
+}
+
+static void test_topk(void) {
+    for (int trial = 0; trial < 200; trial++) {
+        const int ndim = test_rand_int(1, MAX_DIMS);
+        int shape[MAX_DIMS];
+        for (int d = 0; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+        const int axis = test_rand_int(0, ndim - 1);
+        if (trial % 3 == 0) shape[axis] = test_rand_int(50, 500);
+        const int k = test_rand_int(0, shape[axis]);
+        const int largest = test_rand_int(0, 1);
+
+        Operand in;
+        Tensor values, indices, order;
+        operand_make(&in, shape, ndim, trial % 2);
+        CHECK_OK(tensor_topk(&values, &indices, &in.view, axis, k, largest));
+        CHECK_OK(tensor_argsort(&order, &in.view, axis, largest));
+
+        // The selection must equal the first k entries of the full (stable) sort
+        const int n = shape[axis];
+        const int lanes = in.view.length / n;
+        int mismatches = 0;
+        for (int lane = 0; lane < lanes && k > 0; lane++) {
+            const int in_offset = lane_base(lane, shape, in.strides, ndim, axis);
+            const int out_offset = lane_base(lane, values.shape, values.strides, ndim, axis);
+            const int order_offset = lane_base(lane, shape, order.strides, ndim, axis);
+            for (int i = 0; i < k; i++) {
+                const int position = (int) indices.data[out_offset + i * values.strides[axis]];
+                mismatches += position != (int) order.data[order_offset + i * order.strides[axis]];
+                mismatches += values.data[out_offset + i * values.strides[axis]]
+                            != in.base.data[in_offset + position * in.strides[axis]];
+            }
+        }
+        CHECK(values.shape[axis] == k, "trial %d: wrong output shape", trial);
+        CHECK(mismatches == 0, "trial %d: %d selected entries differ", trial, mismatches);
+
+        tensor_free(&values);
+        tensor_free(&indices);
+        tensor_free(&order);
+        tensor_free(&in.base);
+    }
+}
+
+static void test_special_values(void) {
+    const float data[] = {1.0f, NAN, -0.0f, -INFINITY, 0.0f, INFINITY, -2.0f, NAN};
+    Tensor in, sorted, top;
+    CHECK_OK(tensor_from_data(&in, data, (int[]){8}, 1));
+
+    CHECK_OK(tensor_sort(&sorted, &in, 0, false));
+    const float expected[] = {-INFINITY, -2.0f, -0.0f, 0.0f, 1.0f, INFINITY};
+    int mismatches = 0;
+    for (int i = 0; i < 6; i++) mismatches += memcmp(&sorted.data[i], &expected[i], sizeof(float)) != 0;
+    CHECK(mismatches == 0 && isnan(sorted.data[6]) && isnan(sorted.data[7]), "NaN and signed zeros misplaced");
+
+    CHECK_OK(tensor_topk(&top, NULL, &in, 0, 2, true));
+    CHECK(isnan(top.data[0]) && isnan(top.data[1]), "NaN is not the largest value");
+
+    CHECK(tensor_topk(&top, NULL, &in, 0, 9, true) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted k past the axis");
+    CHECK(tensor_cumsum(&top, &in, 1) == TENSOR_ERROR_INVALID_ARGUMENT, "accepted axis past the end");
+
+    tensor_free(&in);
+    tensor_free(&sorted);
+    tensor_free(&top);
+}
+
+// Long lanes take the block-parallel paths; their results must match across thread counts exactly
+static void test_long_lanes(void) {
+    Tensor in;
+    test_random_tensor(&in, (int[]){2, 300000}, 2);
+
+    Tensor results[2][4];
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        char case_name[32];
+        snprintf(case_name, sizeof case_name, "2x300000_t%d", thread_counts[t]);
+
+        double start = test_timing_start();
+        CHECK_OK(tensor_cumsum(&results[t][0], &in, 1));
+        test_report_timing("tensor_cumsum", case_name, test_now_ms() - start);
+
+        start = test_timing_start();
+        CHECK_OK(tensor_sort(&results[t][1], &in, 1, false));
+        test_report_timing("tensor_sort", case_name, test_now_ms() - start);
+
+        start = test_timing_start();
+        CHECK_OK(tensor_topk(&results[t][2], &results[t][3], &in, 1, 50, true));
+        test_report_timing("tensor_topk_50", case_name, test_now_ms() - start);
+    }
+
+    for (int r = 0; r < 4; r++) {
+        CHECK(memcmp(results[0][r].data, results[1][r].data, results[0][r].length * sizeof(float)) == 0,
+              "result %d depends on the thread count", r);
+    }
+
+    int unsorted = 0;
+    for (int lane = 0; lane < 2; lane++) {
+        const float* row = &results[0][1].data[lane * 300000];
+        for (int i = 1; i < 300000; i++) unsorted += row[i - 1] > row[i];
+        for (int i = 0; i < 50; i++) unsorted += results[0][2].data[lane * 50 + i] != row[299999 - i];
+    }
+    CHECK(unsorted == 0, "long lanes: %d entries out of order", unsorted);
+
+    // Full sort as a baseline for top-k over a vocabulary sized axis
+    Tensor order;
+    const double start = test_timing_start();
+    CHECK_OK(tensor_argsort(&order, &in, 1, true));
+    test_report_timing("tensor_argsort", "2x300000", test_now_ms() - start);
+    tensor_free(&order);
+
+    for (int t = 0; t < 2; t++) {
+        for (int r = 0; r < 4; r++) tensor_free(&results[t][r]);
+    }
+    tensor_free(&in);
+    tensor_set_num_threads(0);
+}
+
+int main(void) {
+    test_begin("sort", 34);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_cumsum();
+        test_sort_and_argsort();
+        test_topk();
+    }
+
+    tensor_set_num_threads(0);
+    test_special_values();
+    test_long_lanes();
+
+    return test_finish();
+}
@@ -0,0 +1,326 @@
+#include <unistd.h>
+
+#include "tensor_stream.h"
+#include "test_harness.h"
+
+#define MAX_DIMS 4
+
+static char test_dir[] = "/tmp/tensor_stream_XXXXXX";
+static int test_file_count = 0;
+
+static void temp_path(char* path, const size_t size) {
+    snprintf(path, size, "%s/%d.bin", test_dir, test_file_count++);
+}
+
+// Writes a random tensor to a new file, returning the file and, in `data`, the same values in memory
+static TensorFile* random_file(Tensor* data, const int* shape, const int ndim) {
+    char path[64];
+    temp_path(path, sizeof path);
+    test_random_tensor(data, shape, ndim);
+
+    TensorFile* file;
+    CHECK_OK(tensor_file_create(&file, path, shape, ndim));
+    CHECK_OK(tensor_file_write_rows(file, 0, data));
+    return file;
+}
+
+static TensorFile* empty_file(const int* shape, const int ndim) {
+    char path[64];
+    temp_path(path, sizeof path);
+    TensorFile* file;
+    CHECK_OK(tensor_file_create(&file, path, shape, ndim));
+    return file;
+}
+
+// Chunks from below one row up to a few hundred rows, with 2 to 4 buffers in flight
+static TensorStreamParams random_params(const int row_length) {
+    const int rows = test_rand_int(0, 3) == 0 ? 0 : test_rand_int(1, 40);
+    return (TensorStreamParams) {(size_t) rows * row_length * sizeof(float), test_rand_int(2, 4)};
+}
+
+static int row_length_of(const int* shape, const int ndim) {
+    int length = 1;
+    for (int d = 1; d < ndim; d++) length *= shape[d];
+    return length;
+}
+
+static int random_shape(int* shape) {
+    const int ndim = test_rand_int(1, MAX_DIMS);
+    shape[0] = test_rand_int(0, 9) == 0 ? test_rand_int(0, 1) : test_rand_int(1, 300);
+    for (int d = 1; d < ndim; d++) shape[d] = test_rand_int(1, 6);
+    return ndim;
+}
+
+static int count_differences(const TensorFile* file, const Tensor* expected) {
+    Tensor actual;
+    CHECK_OK(tensor_file_read_rows(&actual, file, 0, expected->shape[0]));
+    int differences = 0;
+    for (int i = 0; i < expected->length; i++) differences += actual.data[i] != expected->data[i];
+    tensor_free(&actual);
+    return differences;
+}
+
+static TensorError memory_op(Tensor* out, const Tensor* a, const Tensor* b, const TensorStreamOp op) {
+    switch (op) {
+        case TENSOR_STREAM_ADD: return tensor_add(out, a, b);
+        case TENSOR_STREAM_SUB: return tensor_sub(out, a, b);
+        case TENSOR_STREAM_MUL: return tensor_mul(out, a, b);
+        default: return tensor_div(out, a, b);
+    }
+}
+
+static void test_files(void) {
+    Tensor data, rows;
+    TensorFile* file = random_file(&data, (int[]){7, 3, 5}, 3);
+
+    CHECK_OK(tensor_file_read_rows(&rows, file, 2, 4));
+    CHECK(rows.ndim == 3 && rows.shape[0] == 4 && rows.shape[2] == 5, "read rows shape");
+    CHECK(memcmp(rows.data, &data.data[2 * 15], 4 * 15 * sizeof(float)) == 0, "read rows differ");
+    tensor_free(&rows);
+    CHECK(tensor_file_read_rows(&rows, file, 5, 3) == TENSOR_ERROR_INVALID_ARGUMENT, "read past the last row");
+
+    // A transposed view is written in logical order
+    Tensor square;
+    test_random_tensor(&square, (int[]){3, 5}, 2);
+    int shape[] = {1, 3, 5};
+    int strides[] = {15, 1, 3};
+    const Tensor transposed = {3, 15, shape, strides, square.data};
+    CHECK_OK(tensor_file_write_rows(file, 6, &transposed));
+    CHECK_OK(tensor_file_read_rows(&rows, file, 6, 1));
+    int differences = 0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 5; j++) differences += rows.data[i * 5 + j] != square.data[j * 3 + i];
+    }
+    CHECK(differences == 0, "strided write differs in %d values", differences);
+    tensor_free(&rows);
+    CHECK(tensor_file_write_rows(file, 0, &square) == TENSOR_ERROR_INPUT_DIM_MISMATCH, "wrote rows of the wrong shape");
+
+    // The same data opened read-only past a one-row header
+    char path[64];
+    snprintf(path, sizeof path, "%s/0.bin", test_dir);
+    TensorFile* offset;
+    CHECK_OK(tensor_file_open(&offset, path, (int[]){5, 15}, 2, 15 * sizeof(float)));
+    CHECK_OK(tensor_file_read_rows(&rows, offset, 0, 5));
+    CHECK(memcmp(rows.data, &data.data[15], 5 * 15 * sizeof(float)) == 0, "offset rows differ");
+    CHECK(tensor_file_write_rows(offset, 0, &rows) == TENSOR_ERROR_INVALID_ARGUMENT, "wrote to a read-only file");
+    tensor_free(&rows);
+
+    TensorFile* rejected;
+    CHECK(tensor_file_open(&rejected, path, (int[]){8, 15}, 2, 0) == TENSOR_ERROR_IO, "opened a file too short for its shape");
+    CHECK(tensor_file_open(&rejected, "/nonexistent/tensor.bin", (int[]){1}, 1, 0) == TENSOR_ERROR_IO, "opened a missing file");
+    CHECK(tensor_file_create(&rejected, path, (int[]){2, -1}, 2) == TENSOR_ERROR_NEGATIVE_DIM, "created a negative shape");
+
+    tensor_file_close(offset);
+    tensor_file_close(file);
+    tensor_free(&data);
+    tensor_free(&square);
+}
+
+static void test_binary(void) {
+    for (int trial = 0; trial < 60; trial++) {
+        int shape[MAX_DIMS];
+        const int ndim = random_shape(shape);
+        const TensorStreamOp op = (TensorStreamOp) test_rand_int(TENSOR_STREAM_ADD, TENSOR_STREAM_DIV);
+
+        Tensor a, b, expected;
+        TensorFile* a_file = random_file(&a, shape, ndim);
+        TensorFile* b_file = random_file(&b, shape, ndim);
+        CHECK_OK(memory_op(&expected, &a, &b, op));
+
+        // Half of the trials write the result over a
+        const int in_place = trial % 2;
+        TensorFile* out = in_place ? a_file : empty_file(shape, ndim);
+        const TensorStreamParams params = random_params(row_length_of(shape, ndim));
+        CHECK_OK(tensor_stream_binary(out, a_file, b_file, op, &params));
+        CHECK(count_differences(out, &expected) == 0, "trial %d: streamed op %d differs", trial, op);
+
+        if (!in_place) tensor_file_close(out);
+        tensor_file_close(a_file);
+        tensor_file_close(b_file);
+        tensor_free(&a);
+        tensor_free(&b);
+        tensor_free(&expected);
+    }
+}
+
+static void test_binary_tensor(void) {
+    for (int trial = 0; trial < 60; trial++) {
+        int shape[MAX_DIMS];
+        const int ndim = random_shape(shape);
+        const TensorStreamOp op = (TensorStreamOp) test_rand_int(TENSOR_STREAM_ADD, TENSOR_STREAM_DIV);
+
+        // b is one row, a row broadcast along the outer axis, or as large as a and transposed
+        int b_shape[MAX_DIMS];
+        const int kind = ndim == 1 && trial % 3 == 0 ? 1 : trial % 3;
+        const int b_ndim = kind == 0 ? ndim - 1 : ndim;
+        for (int d = 0; d < b_ndim; d++) b_shape[d] = shape[d + ndim - b_ndim];
+        if (kind == 1) b_shape[0] = 1;
+        for (int d = 1; d < b_ndim; d++) b_shape[d] = test_rand_int(0, 2) == 0 ? 1 : b_shape[d];
+
+        Tensor a, b_base, expected;
+        TensorFile* a_file = random_file(&a, shape, ndim);
+        Tensor b = {0};
+        int b_view_shape[MAX_DIMS], b_strides[MAX_DIMS];
+        if (kind == 2 && ndim >= 2) {
+            memcpy(b_view_shape, b_shape, ndim * sizeof *b_shape);
+            b_view_shape[0] = b_shape[ndim - 1];
+            b_view_shape[ndim - 1] = b_shape[0];
+            test_random_tensor(&b_base, b_view_shape, ndim);
+            memcpy(b_strides, b_base.strides, ndim * sizeof *b_strides);
+            b_strides[0] = b_base.strides[ndim - 1];
+            b_strides[ndim - 1] = b_base.strides[0];
+            b = (Tensor) {ndim, b_base.length, b_shape, b_strides, b_base.data};
+        }else {
+            test_random_tensor(&b_base, b_shape, b_ndim);
+            b = b_base;
+        }
+
+        CHECK_OK(memory_op(&expected, &a, &b, op));
+        TensorFile* out = empty_file(shape, ndim);
+        const TensorStreamParams params = random_params(row_length_of(shape, ndim));
+        CHECK_OK(tensor_stream_binary_tensor(out, a_file, &b, op, &params));
+        CHECK(count_differences(out, &expected) == 0, "trial %d: streamed op %d with kind %d differs", trial, op, kind);
+
+        tensor_file_close(out);
+        tensor_file_close(a_file);
+        tensor_free(&a);
+        tensor_free(&b_base);
+        tensor_free(&expected);
+    }
+
+    // b may not grow a
+    Tensor a, b;
+    TensorFile* a_file = random_file(&a, (int[]){4, 1}, 2);
+    TensorFile* out = empty_file((int[]){4, 1}, 2);
+    test_random_tensor(&b, (int[]){4, 3}, 2);
+    CHECK(tensor_stream_binary_tensor(out, a_file, &b, TENSOR_STREAM_ADD, NULL) == TENSOR_ERROR_CANNOT_BROADCAST,
+          "streamed an op that broadcasts a");
+    const TensorStreamParams shallow = {1024, 1};
+    CHECK(tensor_stream_binary(out, a_file, a_file, TENSOR_STREAM_ADD, &shallow) == TENSOR_ERROR_INVALID_ARGUMENT,
+          "streamed with one buffer");
+    char path[64];
+    snprintf(path, sizeof path, "%s/%d.bin", test_dir, test_file_count - 1);
+    TensorFile* read_only;
+    CHECK_OK(tensor_file_open(&read_only, path, (int[]){4, 1}, 2, 0));
+    CHECK(tensor_stream_binary(read_only, a_file, a_file, TENSOR_STREAM_ADD, NULL) == TENSOR_ERROR_INVALID_ARGUMENT,
+          "wrote to a read-only file");
+    tensor_file_close(read_only);
+
+    tensor_file_close(out);
+    tensor_file_close(a_file);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+static void test_reduce(void) {
+    for (int trial = 0; trial < 60; trial++) {
+        int shape[MAX_DIMS];
+        const int ndim = random_shape(shape);
+        const TensorStreamReduction reduction = (TensorStreamReduction) (trial % 4);
+
+        Tensor in, out;
+        TensorFile* file = random_file(&in, shape, ndim);
+        const int row_length = row_length_of(shape, ndim);
+        const TensorStreamParams params = random_params(row_length);
+
+        if (shape[0] == 0 && reduction != TENSOR_STREAM_SUM) {
+            CHECK(tensor_stream_reduce(&out, file, reduction, &params) == TENSOR_ERROR_INVALID_ARGUMENT,
+                  "trial %d: reduced no rows", trial);
+        }else {
+            CHECK_OK(tensor_stream_reduce(&out, file, reduction, &params));
+            CHECK(out.length == (ndim > 1 ? row_length : 1), "trial %d: result length %d", trial, out.length);
+
+            int mismatches = 0;
+            for (int j = 0; j < row_length; j++) {
+                double expected = reduction == TENSOR_STREAM_MIN ? INFINITY : reduction == TENSOR_STREAM_MAX ? -INFINITY : 0.0;
+                for (int r = 0; r < shape[0]; r++) {
+                    const double x = in.data[r * row_length + j];
+                    if (reduction == TENSOR_STREAM_MIN) expected = fmin(expected, x);
+                    else if (reduction == TENSOR_STREAM_MAX) expected = fmax(expected, x);
+                    else expected += x;
+                }
+                if (reduction == TENSOR_STREAM_MEAN) expected /= shape[0];
+                mismatches += fabs(out.data[j] - expected) > 1e-6 * (1.0 + fabs(expected));
+            }
+            CHECK(mismatches == 0, "trial %d: reduction %d differs in %d columns", trial, reduction, mismatches);
+            tensor_free(&out);
+        }
+
+        tensor_file_close(file);
+        tensor_free(&in);
+    }
+}
+
+// A 64 MiB product of two files streamed against reading, computing and writing one chunk at a time
+static void test_timings(void) {
+    const int rows = 4096, cols = 4096;
+    Tensor a, b;
+    TensorFile* a_file = random_file(&a, (int[]){rows, cols}, 2);
+    TensorFile* b_file = random_file(&b, (int[]){rows, cols}, 2);
+    TensorFile* streamed = empty_file((int[]){rows, cols}, 2);
+    TensorFile* sequential = empty_file((int[]){rows, cols}, 2);
+
+    const TensorStreamParams params = {1u << 20, 2};
+    const int chunk_rows = (int) (params.chunk_bytes / (cols * sizeof(float)));
+
+    double start = test_timing_start();
+    CHECK_OK(tensor_stream_binary(streamed, a_file, b_file, TENSOR_STREAM_MUL, &params));
+    test_report_timing("tensor_stream_binary", "4096x4096", test_now_ms() - start);
+
+    start = test_timing_start();
+    for (int row0 = 0; row0 < rows; row0 += chunk_rows) {
+        Tensor a_chunk, b_chunk, product;
+        CHECK_OK(tensor_file_read_rows(&a_chunk, a_file, row0, chunk_rows));
+        CHECK_OK(tensor_file_read_rows(&b_chunk, b_file, row0, chunk_rows));
+        CHECK_OK(tensor_mul(&product, &a_chunk, &b_chunk));
+        CHECK_OK(tensor_file_write_rows(sequential, row0, &product));
+        tensor_free(&a_chunk);
+        tensor_free(&b_chunk);
+        tensor_free(&product);
+    }
+    test_report_timing("read_compute_write", "4096x4096", test_now_ms() - start);
+
+    Tensor expected;
+    CHECK_OK(tensor_file_read_rows(&expected, sequential, 0, rows));
+    CHECK(count_differences(streamed, &expected) == 0, "streamed product differs");
+
+    Tensor sums;
+    start = test_timing_start();
+    CHECK_OK(tensor_stream_reduce(&sums, a_file, TENSOR_STREAM_SUM, &params));
+    test_report_timing("tensor_stream_reduce", "4096x4096", test_now_ms() - start);
+
+    TensorFile* files[] = {a_file, b_file, streamed, sequential};
+    for (int i = 0; i < 4; i++) tensor_file_close(files[i]);
+    tensor_free(&a);
+    tensor_free(&b);
+    tensor_free(&expected);
+    tensor_free(&sums);
+}
+
+int main(void) {
+    test_begin("stream", 43);
+    if (mkdtemp(test_dir) == NULL) {
+        fprintf(stderr, "cannot create %s\n", test_dir);
+        return 1;
+    }
+
+    test_files();
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_binary();
+        test_binary_tensor();
+        test_reduce();
+    }
+
+    tensor_set_num_threads(0);
+    test_timings();
+
+    char path[64];
+    for (int i = 0; i < test_file_count; i++) {
+        snprintf(path, sizeof path, "%s/%d.bin", test_dir, i);
+        unlink(path);
+    }
+    rmdir(test_dir);
+    return test_finish();
+}
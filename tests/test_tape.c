@@ -0,0 +1,253 @@
+#include "tensor_tape.h"
+#include "test_harness.h"
+
+typedef enum {OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MAT_MUL} OpKind;
+
+typedef struct {
+    Tensor x;       //< [4,5]
+    Tensor w;       //< [5,3]
+    Tensor bias;    //< [3], expanded to [4,3] on the tape
+    Tensor d;       //< [4,1], column broadcast divisor
+    Tensor v;       //< [5], 1D left operand of a mat_mul
+    Tensor s;       //< [1], scalar
+    Tensor row;     //< [3], read through a caller-made tensor_expand view
+    Tensor row_view;
+} Params;
+
+static TensorError apply(TensorTape* tape, const OpKind kind, Tensor* out, const Tensor* a, const Tensor* b) {
+    switch (kind) {
+        case OP_ADD: return tape ? tensor_tape_add(tape, out, a, b) : tensor_add(out, a, b);
+        case OP_SUB: return tape ? tensor_tape_sub(tape, out, a, b) : tensor_sub(out, a, b);
+        case OP_MUL: return tape ? tensor_tape_mul(tape, out, a, b) : tensor_mul(out, a, b);
+        case OP_DIV: return tape ? tensor_tape_div(tape, out, a, b) : tensor_div(out, a, b);
+        default: return tape ? tensor_tape_mat_mul(tape, out, a, b) : tensor_mat_mul(out, a, b);
+    }
+}
+
+/**
+ * r = (((x @ w + expand(bias)) / d) * (x @ w + expand(bias)) - v @ w + row_view) * s
+ * Intermediates live in `t`; without a tape they are freed here, with one the tape owns them
+ */
+typedef struct {
+    Tensor y, b_expanded, z, q, p, u, diff, shifted, r;
+} Intermediates;
+
+static void forward(TensorTape* tape, const Params* params, Intermediates* t) {
+    CHECK_OK(apply(tape, OP_MAT_MUL, &t->y, &params->x, &params->w));
+    if (tape) CHECK_OK(tensor_tape_expand(tape, &t->b_expanded, &params->bias, (int[]){4, 3}, 2));
+    else CHECK_OK(tensor_expand(&t->b_expanded, &params->bias, (int[]){4, 3}, 2));
+    CHECK_OK(apply(tape, OP_ADD, &t->z, &t->y, &t->b_expanded));
+    CHECK_OK(apply(tape, OP_DIV, &t->q, &t->z, &params->d));
+    CHECK_OK(apply(tape, OP_MUL, &t->p, &t->q, &t->z));
+    CHECK_OK(apply(tape, OP_MAT_MUL, &t->u, &params->v, &params->w));
+    CHECK_OK(apply(tape, OP_SUB, &t->diff, &t->p, &t->u));
+    CHECK_OK(apply(tape, OP_ADD, &t->shifted, &t->diff, &params->row_view));
+    CHECK_OK(apply(tape, OP_MUL, &t->r, &t->shifted, &params->s));
+}
+
+static double loss_without_tape(const Params* params) {
+    Intermediates t;
+    forward(NULL, params, &t);
+
+    double sum = 0.0;
+    for (int i = 0; i < t.r.length; i++) sum += t.r.data[i];
+
+    Tensor* owned[] = {&t.y, &t.z, &t.q, &t.p, &t.u, &t.diff, &t.shifted, &t.r};
+    for (int i = 0; i < 8; i++) tensor_free(owned[i]);
+    tensor_view_free(&t.b_expanded);
+    return sum;
+}
+
+static void check_gradient(const char* name, Tensor* param, const Tensor* grad, const Params* params) {
+    CHECK(grad != NULL, "%s: no gradient", name);
+    if (grad == NULL) return;
+
+    const float h = 1e-2f;
+    int mismatches = 0;
+    for (int i = 0; i < grad->length; i++) {
+        const float saved = param->data[i];
+        param->data[i] = saved + h;
+        const double up = loss_without_tape(params);
+        param->data[i] = saved - h;
+        const double down = loss_without_tape(params);
+        param->data[i] = saved;
+
+        const double numeric = (up - down) / (2.0 * h);
+        mismatches += fabs(numeric - grad->data[i]) > 2e-2 * fmax(1.0, fabs(numeric));
+    }
+    CHECK(mismatches == 0, "%s: %d entries differ from finite differences", name, mismatches);
+}
+
+static void make_params(Params* p) {
+    test_random_tensor(&p->x, (int[]){4, 5}, 2);
+    test_random_tensor(&p->w, (int[]){5, 3}, 2);
+    test_random_tensor(&p->bias, (int[]){3}, 1);
+    test_random_tensor(&p->d, (int[]){4, 1}, 2);
+    for (int i = 0; i < p->d.length; i++) p->d.data[i] = 1.5f + 0.5f * p->d.data[i];
+    test_random_tensor(&p->v, (int[]){5}, 1);
+    test_random_tensor(&p->s, (int[]){1}, 1);
+    test_random_tensor(&p->row, (int[]){3}, 1);
+    CHECK_OK(tensor_expand(&p->row_view, &p->row, (int[]){4, 3}, 2));
+}
+
+static void free_params(Params* p) {
+    tensor_view_free(&p->row_view);
+    Tensor* all[] = {&p->x, &p->w, &p->bias, &p->d, &p->v, &p->s, &p->row};
+    for (int i = 0; i < 7; i++) tensor_free(all[i]);
+}
+
+static void test_gradients_and_lifetimes(void) {
+    Params params;
+    make_params(&params);
+
+    TensorTape* tape;
+    CHECK_OK(tensor_tape_create(&tape));
+
+    for (int step = 0; step < 2; step++) {
+        Intermediates t;
+        forward(tape, &params, &t);
+        CHECK_OK(tensor_tape_retain(tape, &t.z));
+        CHECK_OK(tensor_tape_backward(tape, &t.r, NULL));
+
+        check_gradient("x", &params.x, tensor_tape_grad(tape, &params.x), &params);
+        check_gradient("w", &params.w, tensor_tape_grad(tape, &params.w), &params);
+        check_gradient("bias", &params.bias, tensor_tape_grad(tape, &params.bias), &params);
+        check_gradient("d", &params.d, tensor_tape_grad(tape, &params.d), &params);
+        check_gradient("v", &params.v, tensor_tape_grad(tape, &params.v), &params);
+        check_gradient("s", &params.s, tensor_tape_grad(tape, &params.s), &params);
+
+        // A caller-made broadcast view gets a gradient sized like its storage
+        const Tensor* row_grad = tensor_tape_grad(tape, &params.row_view);
+        CHECK(row_grad && row_grad->ndim == 2 && row_grad->shape[0] == 1 && row_grad->shape[1] == 3,
+              "broadcast view gradient is not compact");
+        check_gradient("row", &params.row, row_grad, &params);
+
+        // Intermediates are freed during backward, retained ones survive with their gradient
+        CHECK(t.y.data == NULL && t.p.data == NULL && t.r.data == NULL, "intermediates still allocated");
+        CHECK(t.z.data != NULL, "retained intermediate was freed");
+        CHECK(tensor_tape_grad(tape, &t.z) != NULL, "retained intermediate lost its gradient");
+        CHECK(tensor_tape_grad(tape, &t.y) == NULL, "intermediate gradient was kept");
+
+        tensor_tape_reset(tape);
+        CHECK(t.z.data == NULL, "reset did not free the retained intermediate");
+    }
+
+    tensor_tape_destroy(tape);
+    free_params(&params);
+}
+
+static void test_batched_mat_mul(void) {
+    Tensor a, b, out;
+    test_random_tensor(&a, (int[]){2, 3, 4}, 3);
+    test_random_tensor(&b, (int[]){4, 5}, 2);
+
+    TensorTape* tape;
+    CHECK_OK(tensor_tape_create(&tape));
+    CHECK_OK(tensor_tape_mat_mul(tape, &out, &a, &b));
+    CHECK_OK(tensor_tape_backward(tape, &out, NULL));
+
+    // d(sum(A @ B))/dB[k][n] = sum over batch and rows of A[.., m, k]
+    const Tensor* grad_b = tensor_tape_grad(tape, &b);
+    CHECK(grad_b && grad_b->ndim == 2 && grad_b->shape[0] == 4 && grad_b->shape[1] == 5, "batch not reduced");
+    int mismatches = 0;
+    for (int k = 0; k < 4 && grad_b; k++) {
+        double expected = 0.0;
+        for (int i = 0; i < 6; i++) expected += a.data[i * 4 + k];
+        for (int n = 0; n < 5; n++) mismatches += !test_close(grad_b->data[k * 5 + n], expected, 6.0, 8);
+    }
+    CHECK(mismatches == 0, "batched gradient of b wrong");
+
+    tensor_tape_destroy(tape);
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+// Backward step of q = 2 * a that checks the tensor in ctx, if any, was already freed when it ran
+static TensorError double_backward(TensorTape* tape, const Tensor* out, const Tensor* grad_out,
+                                   const Tensor* const* inputs, const int num_inputs, void* ctx) {
+    (void) out;
+    (void) num_inputs;
+    const Tensor* watched = ctx;
+    CHECK(watched == NULL || watched->data == NULL, "intermediate outlived its last backward use");
+    return tensor_tape_accumulate_grad(tape, inputs[0], grad_out, 2.0f);
+}
+
+/**
+ * y = a * b is read last, in backward order, by z = y * c, which runs before the node recorded between them,
+ * so y must be gone by then and not only once its own node runs. e views y and keeps it alive until e is freed
+ */
+static void test_early_release(void) {
+    Tensor a, b, c, y, e, q, z, ze, zq, r;
+    test_random_tensor(&a, (int[]){3, 4}, 2);
+    test_random_tensor(&b, (int[]){3, 4}, 2);
+    test_random_tensor(&c, (int[]){3, 4}, 2);
+
+    TensorTape* tape;
+    CHECK_OK(tensor_tape_create(&tape));
+    CHECK_OK(tensor_tape_mul(tape, &y, &a, &b));
+    CHECK_OK(tensor_tape_expand(tape, &e, &y, (int[]){2, 3, 4}, 3));
+
+    CHECK_OK(tensor_mul(&q, &a, &(Tensor) {1, 1, (int[]){1}, (int[]){1}, (float[]){2.0f}}));
+    const Tensor* inputs[] = {&a};
+    CHECK_OK(tensor_tape_record(tape, &q, false, inputs, 1, NULL, 0, double_backward, &y));
+
+    CHECK_OK(tensor_tape_mul(tape, &ze, &e, &c));
+    CHECK_OK(tensor_tape_mul(tape, &z, &y, &c));
+    CHECK_OK(tensor_tape_add(tape, &zq, &z, &q));
+    CHECK_OK(tensor_tape_add(tape, &r, &zq, &ze));
+    CHECK_OK(tensor_tape_backward(tape, &r, NULL));
+
+    // r holds two copies of z + q and of y * c, so dr/da = 4 * b * c + 4
+    const Tensor* grad_a = tensor_tape_grad(tape, &a);
+    int mismatches = 0;
+    for (int i = 0; grad_a && i < a.length; i++) {
+        const double expected = 4.0 * b.data[i] * c.data[i] + 4.0;
+        mismatches += !test_close(grad_a->data[i], expected, fabs(4.0 * b.data[i] * c.data[i]) + 4.0, 8);
+    }
+    CHECK(grad_a && mismatches == 0, "gradient of a wrong");
+    CHECK(y.data == NULL && e.shape == NULL && q.data == NULL, "intermediates still allocated");
+
+    tensor_tape_destroy(tape);
+    tensor_free(&a);
+    tensor_free(&b);
+    tensor_free(&c);
+}
+
+// A record that fails partway leaves no trace: its result can be recorded again and its saved tensors are still freed
+static void test_failed_record(void) {
+    Tensor a, b, y, q, r, deep;
+    test_random_tensor(&a, (int[]){2, 2}, 2);
+    test_random_tensor(&b, (int[]){2, 2}, 2);
+    int deep_shape[33];
+    for (int d = 0; d < 33; d++) deep_shape[d] = 1;
+    test_random_tensor(&deep, deep_shape, 33);
+
+    TensorTape* tape;
+    CHECK_OK(tensor_tape_create(&tape));
+    CHECK_OK(tensor_tape_mul(tape, &y, &a, &b));
+    CHECK_OK(tensor_mul(&q, &y, &a));
+
+    const Tensor* inputs[] = {&y};
+    const Tensor* saved[] = {&y, &deep};
+    CHECK(tensor_tape_record(tape, &q, false, inputs, 1, saved, 2, double_backward, NULL) == TENSOR_ERROR_NO_MEMORY,
+          "recorded a tensor with too many dimensions");
+    CHECK_OK(tensor_tape_record(tape, &q, false, inputs, 1, NULL, 0, double_backward, NULL));
+    CHECK_OK(tensor_tape_add(tape, &r, &q, &y));
+    CHECK_OK(tensor_tape_backward(tape, &r, NULL));
+    CHECK(y.data == NULL && q.data == NULL, "a failed record kept an intermediate alive");
+
+    tensor_tape_destroy(tape);
+    Tensor* all[] = {&a, &b, &deep};
+    for (int i = 0; i < 3; i++) tensor_free(all[i]);
+}
+
+int main(void) {
+    test_begin("tape", 31);
+
+    test_gradients_and_lifetimes();
+    test_batched_mat_mul();
+    test_early_release();
+    test_failed_record();
+
+    return test_finish();
+}
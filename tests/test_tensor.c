@@ -0,0 +1,243 @@
+#include <pthread.h>
+
+#include "test_harness.h"
+
+static void test_fills(void) {
+    // Large enough to be split across the worker pool. Odd sizes and a misaligned source leave
+    // unaligned heads and tails around the streaming stores
+    const int shape[] = {517, 1031};
+    float* source = malloc((517 * 1031 + 1) * sizeof *source);
+    for (int i = 0; i < 517 * 1031 + 1; i++) source[i] = (float) i;
+
+    // Default threshold, then streaming everything
+    const size_t thresholds[] = {0, 1};
+    for (int s = 0; s < 2; s++) {
+        tensor_set_streaming_threshold(thresholds[s]);
+        Tensor zeros, ones, filled, copied;
+
+        CHECK_OK(tensor_zeros(&zeros, shape, 2));
+        CHECK_OK(tensor_ones(&ones, shape, 2));
+        CHECK_OK(tensor_fill(&filled, -2.5f, shape, 2));
+        CHECK_OK(tensor_from_data(&copied, &source[1], shape, 2));
+
+        int mismatches = 0;
+        for (int i = 0; i < zeros.length; i++) {
+            mismatches += zeros.data[i] != 0.0f;
+            mismatches += ones.data[i] != 1.0f;
+            mismatches += filled.data[i] != -2.5f;
+            mismatches += copied.data[i] != source[i + 1];
+        }
+        CHECK(mismatches == 0, "threshold %zu: %d filled values differ", thresholds[s], mismatches);
+        CHECK(zeros.strides[0] == 1031 && zeros.strides[1] == 1, "unexpected strides");
+
+        tensor_free(&zeros);
+        tensor_free(&ones);
+        tensor_free(&filled);
+        tensor_free(&copied);
+    }
+
+    tensor_set_streaming_threshold(0);
+    free(source);
+}
+
+static void test_from_data_and_get(void) {
+    Tensor t;
+    CHECK_OK(tensor_from_data(&t, (float[]){1, 2, 3, 4, 5, 6}, (int[]){2, 3}, 2));
+
+    CHECK(tensor_get(&t, (int[]){0, 0}) == 1.0f, "wrong element");
+    CHECK(tensor_get(&t, (int[]){1, 2}) == 6.0f, "wrong element");
+    CHECK(tensor_get(&t, (int[]){1, 0}) == 4.0f, "wrong element");
+
+    tensor_free(&t);
+}
+
+static void test_views(void) {
+    Tensor row, expanded, col;
+    CHECK_OK(tensor_from_data(&row, (float[]){1, 2, 3}, (int[]){3}, 1));
+
+    CHECK_OK(tensor_expand(&expanded, &row, (int[]){4, 3}, 2));
+    CHECK(expanded.strides[0] == 0 && expanded.strides[1] == 1, "expand strides");
+    CHECK(tensor_get(&expanded, (int[]){3, 2}) == 3.0f, "expanded element");
+    CHECK(expanded.data == row.data, "expand copied the data");
+    tensor_view_free(&expanded);
+
+    CHECK(tensor_expand(&expanded, &row, (int[]){4, 5}, 2) == TENSOR_ERROR_CANNOT_EXPAND, "bad expand accepted");
+
+    CHECK_OK(tensor_promote_to_col(&col, &row));
+    CHECK(col.shape[0] == 3 && col.shape[1] == 1, "column shape");
+    CHECK(tensor_get(&col, (int[]){2, 0}) == 3.0f, "column element");
+    tensor_view_free(&col);
+
+    tensor_free(&row);
+}
+
+static void test_numa_policies(void) {
+    const TensorNumaPolicy policies[] = {
+        TENSOR_NUMA_INTERLEAVE, TENSOR_NUMA_BIND, TENSOR_NUMA_PARTITIONED, TENSOR_NUMA_DEFAULT
+    };
+
+    for (int p = 0; p < 4; p++) {
+        const TensorError err = tensor_set_numa_policy(policies[p], 0);
+        CHECK(err == TENSOR_ERROR_NONE || err == TENSOR_ERROR_UNSUPPORTED, "policy %d: %s", p, tensor_error_to_string(err));
+
+        Tensor t;
+        CHECK_OK(tensor_fill(&t, 3.0f, (int[]){1 << 20}, 1));
+        CHECK(t.data[0] == 3.0f && t.data[t.length - 1] == 3.0f, "policy %d: fill", p);
+        tensor_free(&t);
+    }
+
+    CHECK(tensor_set_numa_policy(TENSOR_NUMA_BIND, tensor_numa_node_count()) != TENSOR_ERROR_NONE, "bound to a missing node");
+}
+
+static void test_strings(void) {
+    Tensor t;
+    CHECK_OK(tensor_from_data(&t, (float[]){1, 2.5f, -3, 4}, (int[]){2, 2}, 2));
+
+    char* heap = tensor_to_string(&t);
+    char* metadata = tensor_metadata_to_string(&t);
+    CHECK(heap && strcmp(heap, "[\n  [1, 2.5], \n  [-3, 4]\n]") == 0, "tensor string: %s", heap);
+    CHECK(metadata && strstr(metadata, "Shape: [2, 2]\nStrides: [2, 1]") != NULL, "metadata string: %s", metadata);
+
+    // Caller buffers hold the same strings, and report the full length when they truncate
+    char buffer[256];
+    CHECK(tensor_to_string_buffer(buffer, sizeof buffer, &t) == strlen(heap), "full length");
+    CHECK(strcmp(buffer, heap) == 0, "buffer string: %s", buffer);
+    CHECK(tensor_metadata_to_string_buffer(buffer, sizeof buffer, &t) == strlen(metadata), "full length");
+    CHECK(strcmp(buffer, metadata) == 0, "buffer metadata: %s", buffer);
+
+    char small[8];
+    CHECK(tensor_to_string_buffer(small, sizeof small, &t) == strlen(heap), "truncated length");
+    CHECK(strncmp(small, heap, 7) == 0 && small[7] == '\0', "truncated string: %s", small);
+    CHECK(tensor_to_string_buffer(NULL, 0, &t) == strlen(heap), "length query");
+
+    // A string longer than the builder's initial heap buffer
+    Tensor big;
+    CHECK_OK(tensor_fill(&big, 0.125f, (int[]){40, 40}, 2));
+    char* big_string = tensor_to_string(&big);
+    CHECK(big_string && strlen(big_string) == tensor_to_string_buffer(NULL, 0, &big), "long string");
+
+    free(heap);
+    free(metadata);
+    free(big_string);
+    tensor_free(&big);
+    tensor_free(&t);
+}
+
+static void test_error_context(void) {
+    Tensor a, b, out;
+    CHECK_OK(tensor_zeros(&a, (int[]){2, 3}, 2));
+    CHECK_OK(tensor_zeros(&b, (int[]){4, 5}, 2));
+
+    TensorErrorContext ctx = {0};
+    CHECK(tensor_error_record(&ctx, tensor_mat_mul(&out, &a, &b), "tensor_mat_mul", &a, &b) == TENSOR_ERROR_INPUT_DIM_MISMATCH,
+          "error passed through");
+
+    // A later successful call keeps the recorded failure
+    Tensor c;
+    CHECK_OK(tensor_zeros(&c, (int[]){3, 4}, 2));
+    CHECK_OK(tensor_error_record(&ctx, tensor_mat_mul(&out, &a, &c), "tensor_mat_mul", &a, &c));
+    tensor_free(&out);
+    tensor_free(&c);
+
+    char buffer[128];
+    const char* expected = "tensor_mat_mul: TENSOR_ERROR_INPUT_DIM_MISMATCH, operand shapes [2, 3] and [4, 5]";
+    CHECK(tensor_error_context_to_string(buffer, sizeof buffer, &ctx) == strlen(expected), "full length");
+    CHECK(strcmp(buffer, expected) == 0, "error string: %s", buffer);
+    CHECK(strcmp(tensor_error_to_string(TENSOR_ERROR_COUNT), "TENSOR_ERROR_UNKNOWN") == 0, "out of range error");
+
+    // A NULL first operand does not hide the second
+    tensor_error_record(&ctx, TENSOR_ERROR_INVALID_ARGUMENT, "tensor_expand", NULL, &b);
+    expected = "tensor_expand: TENSOR_ERROR_INVALID_ARGUMENT, operand shapes [4, 5]";
+    tensor_error_context_to_string(buffer, sizeof buffer, &ctx);
+    CHECK(ctx.operands == 1 && strcmp(buffer, expected) == 0, "error string: %s", buffer);
+
+    tensor_free(&a);
+    tensor_free(&b);
+}
+
+typedef struct {
+    const Tensor* tensor;
+    const char* expected;
+    int mismatches;
+} FormatThread;
+
+static void* format_repeatedly(void* arg) {
+    FormatThread* job = arg;
+    char buffer[256];
+    for (int i = 0; i < 2000; i++) {
+        tensor_to_string_buffer(buffer, sizeof buffer, job->tensor);
+        job->mismatches += strcmp(buffer, job->expected) != 0;
+    }
+    return NULL;
+}
+
+// Formatting into caller buffers from many threads at once
+static void test_concurrent_strings(void) {
+    Tensor tensors[4];
+    char* expected[4];
+    FormatThread jobs[4];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        test_random_tensor(&tensors[i], (int[]){2, i + 1}, 2);
+        expected[i] = tensor_to_string(&tensors[i]);
+        jobs[i] = (FormatThread) {&tensors[i], expected[i], 0};
+        pthread_create(&threads[i], NULL, format_repeatedly, &jobs[i]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(jobs[i].mismatches == 0, "thread %d: %d strings differ", i, jobs[i].mismatches);
+        free(expected[i]);
+        tensor_free(&tensors[i]);
+    }
+}
+
+static void test_timings(void) {
+    const int shape[] = {1 << 24};
+    float* source = malloc((1 << 24) * sizeof *source);
+    for (int i = 0; i < 1 << 24; i++) source[i] = (float) i;
+
+    // Cached stores, then streaming stores regardless of the cache size
+    const size_t thresholds[] = {SIZE_MAX, 1};
+    const char* cases[] = {"16M_cached", "16M_streaming"};
+    for (int s = 0; s < 2; s++) {
+        tensor_set_streaming_threshold(thresholds[s]);
+        Tensor filled, copied;
+
+        double start = test_timing_start();
+        CHECK_OK(tensor_fill(&filled, 1.5f, shape, 1));
+        test_report_timing("tensor_fill", cases[s], test_now_ms() - start);
+
+        start = test_timing_start();
+        CHECK_OK(tensor_from_data(&copied, source, shape, 1));
+        test_report_timing("tensor_from_data", cases[s], test_now_ms() - start);
+
+        CHECK(filled.data[(1 << 24) - 1] == 1.5f && copied.data[(1 << 24) - 1] == source[(1 << 24) - 1], "%s", cases[s]);
+        tensor_free(&filled);
+        tensor_free(&copied);
+    }
+
+    tensor_set_streaming_threshold(0);
+    free(source);
+}
+
+int main(void) {
+    test_begin("tensor", 1);
+
+    const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        tensor_set_num_threads(thread_counts[t]);
+        test_fills();
+        test_numa_policies();
+    }
+
+    tensor_set_num_threads(0);
+    test_from_data_and_get();
+    test_views();
+    test_strings();
+    test_error_context();
+    test_concurrent_strings();
+    test_timings();
+
+    return test_finish();
+}